@@ -26,7 +26,15 @@
 
 #include "compositor.h"
 
+enum binding_type {
+	BINDING_KEY,
+	BINDING_BUTTON,
+	BINDING_AXIS,
+	BINDING_DEBUG
+};
+
 struct weston_binding {
+	enum binding_type type;
 	uint32_t key;
 	uint32_t button;
 	uint32_t axis;
@@ -34,11 +42,27 @@ struct weston_binding {
 	void *handler;
 	void *data;
 	struct wl_list link;
+	struct wl_list hash_link;	/* weston_compositor::binding_table */
 };
 
+/* All bindings of one type, code and modifier end up in the same
+ * bucket, appended as they are added, so walking the bucket runs them
+ * in registration order just like walking the binding list did. */
+static struct wl_list *
+binding_bucket(struct weston_compositor *compositor, enum binding_type type,
+	       uint32_t code, uint32_t modifier)
+{
+	uint32_t hash;
+
+	hash = code * 2654435761u ^ modifier * 40503u ^ type * 97u;
+	hash ^= hash >> 16;
+
+	return &compositor->binding_table[hash & (WESTON_BINDING_BUCKETS - 1)];
+}
+
 static struct weston_binding *
 weston_compositor_add_binding(struct weston_compositor *compositor,
-			      uint32_t key, uint32_t button, uint32_t axis,
+			      enum binding_type type, uint32_t code,
 			      uint32_t modifier, void *handler, void *data)
 {
 	struct weston_binding *binding;
@@ -47,13 +71,21 @@ weston_compositor_add_binding(struct weston_compositor *compositor,
 	if (binding == NULL)
 		return NULL;
 
-	binding->key = key;
-	binding->button = button;
-	binding->axis = axis;
+	binding->type = type;
+	binding->key = type == BINDING_KEY || type == BINDING_DEBUG ? code : 0;
+	binding->button = type == BINDING_BUTTON ? code : 0;
+	binding->axis = type == BINDING_AXIS ? code : 0;
 	binding->modifier = modifier;
 	binding->handler = handler;
 	binding->data = data;
 
+	if (type == BINDING_DEBUG)
+		wl_list_init(&binding->hash_link);
+	else
+		wl_list_insert(binding_bucket(compositor, type,
+					      code, modifier)->prev,
+			       &binding->hash_link);
+
 	return binding;
 }
 
@@ -65,7 +97,7 @@ weston_compositor_add_key_binding(struct weston_compositor *compositor,
 {
 	struct weston_binding *binding;
 
-	binding = weston_compositor_add_binding(compositor, key, 0, 0,
+	binding = weston_compositor_add_binding(compositor, BINDING_KEY, key,
 						modifier, handler, data);
 	if (binding == NULL)
 		return NULL;
@@ -83,8 +115,9 @@ weston_compositor_add_button_binding(struct weston_compositor *compositor,
 {
 	struct weston_binding *binding;
 
-	binding = weston_compositor_add_binding(compositor, 0, button, 0,
-						modifier, handler, data);
+	binding = weston_compositor_add_binding(compositor, BINDING_BUTTON,
+						button, modifier,
+						handler, data);
 	if (binding == NULL)
 		return NULL;
 
@@ -101,7 +134,7 @@ weston_compositor_add_axis_binding(struct weston_compositor *compositor,
 {
 	struct weston_binding *binding;
 
-	binding = weston_compositor_add_binding(compositor, 0, 0, axis,
+	binding = weston_compositor_add_binding(compositor, BINDING_AXIS, axis,
 						modifier, handler, data);
 	if (binding == NULL)
 		return NULL;
@@ -119,8 +152,8 @@ weston_compositor_add_debug_binding(struct weston_compositor *compositor,
 {
 	struct weston_binding *binding;
 
-	binding = weston_compositor_add_binding(compositor, key, 0, 0, 0,
-						handler, data);
+	binding = weston_compositor_add_binding(compositor, BINDING_DEBUG, key,
+						0, handler, data);
 
 	wl_list_insert(compositor->debug_binding_list.prev, &binding->link);
 
@@ -131,6 +164,7 @@ WL_EXPORT void
 weston_binding_destroy(struct weston_binding *binding)
 {
 	wl_list_remove(&binding->link);
+	wl_list_remove(&binding->hash_link);
 	free(binding);
 }
 
@@ -211,13 +245,17 @@ weston_compositor_run_key_binding(struct weston_compositor *compositor,
 				  uint32_t time, uint32_t key,
 				  enum wl_keyboard_key_state state)
 {
+	uint32_t modifier = seat->modifier_state;
 	struct weston_binding *b;
+	struct wl_list *bucket;
 
 	if (state == WL_KEYBOARD_KEY_STATE_RELEASED)
 		return;
 
-	wl_list_for_each(b, &compositor->key_binding_list, link) {
-		if (b->key == key && b->modifier == seat->modifier_state) {
+	bucket = binding_bucket(compositor, BINDING_KEY, key, modifier);
+	wl_list_for_each(b, bucket, hash_link) {
+		if (b->type == BINDING_KEY &&
+		    b->key == key && b->modifier == modifier) {
 			weston_key_binding_handler_t handler = b->handler;
 			handler(seat, time, key, b->data);
 
@@ -237,13 +275,17 @@ weston_compositor_run_button_binding(struct weston_compositor *compositor,
 				     uint32_t time, uint32_t button,
 				     enum wl_pointer_button_state state)
 {
+	uint32_t modifier = seat->modifier_state;
 	struct weston_binding *b;
+	struct wl_list *bucket;
 
 	if (state == WL_POINTER_BUTTON_STATE_RELEASED)
 		return;
 
-	wl_list_for_each(b, &compositor->button_binding_list, link) {
-		if (b->button == button && b->modifier == seat->modifier_state) {
+	bucket = binding_bucket(compositor, BINDING_BUTTON, button, modifier);
+	wl_list_for_each(b, bucket, hash_link) {
+		if (b->type == BINDING_BUTTON &&
+		    b->button == button && b->modifier == modifier) {
 			weston_button_binding_handler_t handler = b->handler;
 			handler(seat, time, button, b->data);
 		}
@@ -256,10 +298,14 @@ weston_compositor_run_axis_binding(struct weston_compositor *compositor,
 				   uint32_t time, uint32_t axis,
 				   wl_fixed_t value)
 {
+	uint32_t modifier = seat->modifier_state;
 	struct weston_binding *b;
+	struct wl_list *bucket;
 
-	wl_list_for_each(b, &compositor->axis_binding_list, link) {
-		if (b->axis == axis && b->modifier == seat->modifier_state) {
+	bucket = binding_bucket(compositor, BINDING_AXIS, axis, modifier);
+	wl_list_for_each(b, bucket, hash_link) {
+		if (b->type == BINDING_AXIS &&
+		    b->axis == axis && b->modifier == modifier) {
 			weston_axis_binding_handler_t handler = b->handler;
 			handler(seat, time, axis, value, b->data);
 			return 1;
@@ -47,6 +47,7 @@
 #include "pixman-renderer.h"
 #include "udev-seat.h"
 #include "launcher-util.h"
+#include "plane-assign.h"
 
 #ifndef DRM_CAP_TIMESTAMP_MONOTONIC
 #define DRM_CAP_TIMESTAMP_MONOTONIC 0x6
@@ -159,6 +160,10 @@ struct drm_output {
 	pixman_image_t *image[2];
 	int current_image;
 	pixman_region32_t previous_damage;
+
+	/* struct plane_assign_surface, one per visible surface, kept
+	 * around between frames. */
+	struct wl_array plane_candidates;
 };
 
 /*
@@ -430,6 +435,23 @@ drm_output_check_scanout_format(struct drm_output *output,
 	}
 }
 
+static int
+drm_surface_can_scanout(struct drm_output *output, struct weston_surface *es)
+{
+	struct drm_compositor *c =
+		(struct drm_compositor *) output->base.compositor;
+	struct weston_buffer *buffer = es->buffer_ref.buffer;
+
+	return es->geometry.x == output->base.x &&
+		es->geometry.y == output->base.y &&
+		buffer != NULL && c->gbm != NULL &&
+		!wl_shm_buffer_get(buffer->resource) &&
+		buffer->width == output->base.current->width &&
+		buffer->height == output->base.current->height &&
+		output->base.transform == es->buffer_transform &&
+		!es->transform.enabled;
+}
+
 static struct weston_plane *
 drm_output_prepare_scanout_surface(struct weston_output *_output,
 				   struct weston_surface *es)
@@ -441,13 +463,7 @@ drm_output_prepare_scanout_surface(struct weston_output *_output,
 	struct gbm_bo *bo;
 	uint32_t format;
 
-	if (es->geometry.x != output->base.x ||
-	    es->geometry.y != output->base.y ||
-	    buffer == NULL || c->gbm == NULL ||
-	    buffer->width != output->base.current->width ||
-	    buffer->height != output->base.current->height ||
-	    output->base.transform != es->buffer_transform ||
-	    es->transform.enabled)
+	if (!drm_surface_can_scanout(output, es))
 		return NULL;
 
 	bo = gbm_bo_import(c->gbm, GBM_BO_IMPORT_WL_BUFFER,
@@ -756,6 +772,24 @@ drm_surface_transform_supported(struct weston_surface *es)
 		(es->transform.matrix.type < WESTON_MATRIX_TRANSFORM_ROTATE);
 }
 
+static int
+drm_surface_can_overlay(struct weston_output *output_base,
+			struct weston_surface *es)
+{
+	struct drm_compositor *c =
+		(struct drm_compositor *) output_base->compositor;
+
+	return c->gbm != NULL &&
+		es->buffer_transform == output_base->transform &&
+		es->buffer_scale == output_base->scale &&
+		!c->sprites_are_broken &&
+		es->output_mask == (1u << output_base->id) &&
+		es->buffer_ref.buffer != NULL &&
+		es->alpha == 1.0f &&
+		!wl_shm_buffer_get(es->buffer_ref.buffer->resource) &&
+		drm_surface_transform_supported(es);
+}
+
 static struct weston_plane *
 drm_output_prepare_overlay_surface(struct weston_output *output_base,
 				   struct weston_surface *es)
@@ -770,31 +804,7 @@ drm_output_prepare_overlay_surface(struct weston_output *output_base,
 	uint32_t format;
 	wl_fixed_t sx1, sy1, sx2, sy2;
 
-	if (c->gbm == NULL)
-		return NULL;
-
-	if (es->buffer_transform != output_base->transform)
-		return NULL;
-
-	if (es->buffer_scale != output_base->scale)
-		return NULL;
-
-	if (c->sprites_are_broken)
-		return NULL;
-
-	if (es->output_mask != (1u << output_base->id))
-		return NULL;
-
-	if (es->buffer_ref.buffer == NULL)
-		return NULL;
-
-	if (es->alpha != 1.0f)
-		return NULL;
-
-	if (wl_shm_buffer_get(es->buffer_ref.buffer->resource))
-		return NULL;
-
-	if (!drm_surface_transform_supported(es))
+	if (!drm_surface_can_overlay(output_base, es))
 		return NULL;
 
 	wl_list_for_each(s, &c->sprite_list, link) {
@@ -896,27 +906,31 @@ drm_output_prepare_overlay_surface(struct weston_output *output_base,
 	return &s->plane;
 }
 
+static int
+drm_surface_can_cursor(struct weston_output *output_base,
+		       struct weston_surface *es)
+{
+	struct drm_compositor *c =
+		(struct drm_compositor *) output_base->compositor;
+
+	return c->gbm != NULL &&
+		output_base->transform == WL_OUTPUT_TRANSFORM_NORMAL &&
+		es->output_mask == (1u << output_base->id) &&
+		!c->cursors_are_broken &&
+		es->buffer_ref.buffer != NULL &&
+		wl_shm_buffer_get(es->buffer_ref.buffer->resource) &&
+		es->geometry.width <= 64 && es->geometry.height <= 64;
+}
+
 static struct weston_plane *
 drm_output_prepare_cursor_surface(struct weston_output *output_base,
 				  struct weston_surface *es)
 {
-	struct drm_compositor *c =
-		(struct drm_compositor *) output_base->compositor;
 	struct drm_output *output = (struct drm_output *) output_base;
 
-	if (c->gbm == NULL)
-		return NULL;
-	if (output->base.transform != WL_OUTPUT_TRANSFORM_NORMAL)
-		return NULL;
 	if (output->cursor_surface)
 		return NULL;
-	if (es->output_mask != (1u << output_base->id))
-		return NULL;
-	if (c->cursors_are_broken)
-		return NULL;
-	if (es->buffer_ref.buffer == NULL ||
-	    !wl_shm_buffer_get(es->buffer_ref.buffer->resource) ||
-	    es->geometry.width > 64 || es->geometry.height > 64)
+	if (!drm_surface_can_cursor(output_base, es))
 		return NULL;
 
 	output->cursor_surface = es;
@@ -979,21 +993,61 @@ drm_output_set_cursor(struct drm_output *output)
 	}
 }
 
+/* Builds the plane model of the output: the cursor plane on top, the
+ * sprites for its crtc and the scanout plane. */
+static void
+drm_output_get_planes(struct drm_output *output, struct plane_assign *pa,
+		      int *cursor, int *scanout, uint32_t *overlays)
+{
+	struct drm_compositor *c =
+		(struct drm_compositor *) output->base.compositor;
+	struct drm_sprite *s;
+	int p;
+
+	plane_assign_init(pa);
+	*cursor = -1;
+	*scanout = -1;
+	*overlays = 0;
+
+	if (c->gbm == NULL)
+		return;
+
+	if (!c->cursors_are_broken)
+		*cursor = plane_assign_add_plane(pa, PLANE_ASSIGN_CURSOR, 2);
+	*scanout = plane_assign_add_plane(pa, PLANE_ASSIGN_SCANOUT, 0);
+
+	if (c->sprites_are_broken)
+		return;
+
+	wl_list_for_each(s, &c->sprite_list, link) {
+		if (!drm_sprite_crtc_supported(&output->base,
+					       s->possible_crtcs))
+			continue;
+		p = plane_assign_add_plane(pa, PLANE_ASSIGN_OVERLAY, 1);
+		if (p < 0)
+			break;
+		*overlays |= 1u << p;
+	}
+}
+
 static void
 drm_assign_planes(struct weston_output *output)
 {
 	struct drm_compositor *c =
 		(struct drm_compositor *) output->compositor;
-	struct weston_surface *es, *next;
+	struct drm_output *drm_output = (struct drm_output *) output;
+	struct weston_surface *es, **ptr;
 	pixman_region32_t overlap, surface_overlap;
 	struct weston_plane *primary, *next_plane;
+	struct plane_assign pa;
+	struct plane_assign_surface *candidate;
+	uint32_t overlays;
+	int cursor, scanout, n;
 
 	/*
-	 * Find a surface for each sprite in the output using some heuristics:
-	 * 1) size
-	 * 2) frequency of update
-	 * 3) opacity (though some hw might support alpha blending)
-	 * 4) clipping (this can be fixed with color keys)
+	 * Pick the surfaces for the cursor, scanout and sprite planes that
+	 * leave the least for the primary plane to compose, going by how
+	 * often and how much of each surface changes, see plane-assign.c.
 	 *
 	 * The idea is to save on blitting since this should save power.
 	 * If we can get a large video surface on the sprite for example,
@@ -1001,9 +1055,18 @@ drm_assign_planes(struct weston_output *output)
 	 * the client buffer can be used directly for the sprite surface
 	 * as we do for flipping full screen surfaces.
 	 */
-	pixman_region32_init(&overlap);
-	primary = &c->base.primary_plane;
-	wl_list_for_each_safe(es, next, &c->base.surface_list, link) {
+	drm_output_get_planes(drm_output, &pa, &cursor, &scanout, &overlays);
+
+	n = output->visible_list.size / sizeof *ptr;
+	drm_output->plane_candidates.size = 0;
+	candidate = wl_array_add(&drm_output->plane_candidates,
+				 n * sizeof *candidate);
+	if (candidate == NULL)
+		n = 0;
+
+	wl_array_for_each(ptr, &output->visible_list) {
+		es = *ptr;
+
 		/* test whether this buffer can ever go into a plane:
 		 * non-shm, or small enough to be a cursor
 		 */
@@ -1014,18 +1077,48 @@ drm_assign_planes(struct weston_output *output)
 		else
 			es->keep_buffer = 0;
 
+		if (candidate == NULL)
+			continue;
+
+		candidate->box =
+			*pixman_region32_extents(&es->transform.boundingbox);
+		candidate->planes = 0;
+		if (cursor >= 0 && drm_surface_can_cursor(output, es))
+			candidate->planes |= 1u << cursor;
+		if (scanout >= 0 && drm_surface_can_scanout(drm_output, es))
+			candidate->planes |= 1u << scanout;
+		if (overlays && drm_surface_can_overlay(output, es))
+			candidate->planes |= overlays;
+		candidate->commit_rate = weston_surface_get_commit_rate(es);
+		candidate->damage_area = es->damage_area;
+		candidate++;
+	}
+
+	candidate = drm_output->plane_candidates.data;
+	plane_assign_run(&pa, candidate, n);
+
+	/* Preparing a plane can still fail, and then anything below
+	 * that overlaps the surface has to stay on the primary plane
+	 * too, as the first fit loop always did. */
+	pixman_region32_init(&overlap);
+	primary = &c->base.primary_plane;
+	wl_array_for_each(ptr, &output->visible_list) {
+		es = *ptr;
+
 		pixman_region32_init(&surface_overlap);
 		pixman_region32_intersect(&surface_overlap, &overlap,
 					  &es->transform.boundingbox);
 
 		next_plane = NULL;
-		if (pixman_region32_not_empty(&surface_overlap))
+		if (n == 0 || pixman_region32_not_empty(&surface_overlap))
 			next_plane = primary;
-		if (next_plane == NULL)
+		else if (candidate->plane < 0)
+			next_plane = primary;
+		else if (candidate->plane == cursor)
 			next_plane = drm_output_prepare_cursor_surface(output, es);
-		if (next_plane == NULL)
+		else if (candidate->plane == scanout)
 			next_plane = drm_output_prepare_scanout_surface(output, es);
-		if (next_plane == NULL)
+		else
 			next_plane = drm_output_prepare_overlay_surface(output, es);
 		if (next_plane == NULL)
 			next_plane = primary;
@@ -1035,6 +1128,8 @@ drm_assign_planes(struct weston_output *output)
 					      &es->transform.boundingbox);
 
 		pixman_region32_fini(&surface_overlap);
+		if (n > 0)
+			candidate++;
 	}
 	pixman_region32_fini(&overlap);
 }
@@ -1076,6 +1171,7 @@ drm_output_destroy(struct weston_output *output_base)
 
 	weston_plane_release(&output->fb_plane);
 	weston_plane_release(&output->cursor_plane);
+	wl_array_release(&output->plane_candidates);
 
 	weston_output_destroy(&output->base);
 	wl_list_remove(&output->base.link);
@@ -1483,7 +1579,10 @@ drm_output_init_pixman(struct drm_output *output, struct drm_compositor *c)
 			goto err;
 	}
 
-	if (pixman_renderer_output_create(&output->base) < 0)
+	/* Dumb buffers are usually mapped uncached, so blend in a
+	 * shadow image instead of reading them back. */
+	if (pixman_renderer_output_create(&output->base,
+					  PIXMAN_RENDERER_OUTPUT_USE_SHADOW) < 0)
 		goto err;
 
 	pixman_region32_init_rect(&output->previous_damage,
@@ -1781,6 +1880,7 @@ create_output_for_connector(struct drm_compositor *ec,
 	output->base.model = "unknown";
 	output->base.serial_number = "unknown";
 	wl_list_init(&output->base.mode_list);
+	wl_array_init(&output->plane_candidates);
 
 	if (connector->connector_type < ARRAY_LENGTH(connector_type_names))
 		type_name = connector_type_names[connector->connector_type];
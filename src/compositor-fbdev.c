@@ -472,6 +472,7 @@ fbdev_output_create(struct fbdev_compositor *compositor,
 	int shadow_width, shadow_height;
 	int width, height;
 	unsigned int bytes_per_pixel;
+	uint32_t flags;
 	struct wl_event_loop *loop;
 
 	weston_log("Creating fbdev output.\n");
@@ -586,7 +587,15 @@ fbdev_output_create(struct fbdev_compositor *compositor,
 	if (output->base.transform != WL_OUTPUT_TRANSFORM_NORMAL)
 		pixman_image_set_transform(output->shadow_surface, &transform);
 
-	if (pixman_renderer_output_create(&output->base) < 0)
+	/* shadow_surface is ordinary memory, so the renderer can composite
+	 * straight into it, unless the format is less precise than the
+	 * renderer's own shadow. */
+	if (PIXMAN_FORMAT_BPP(output->fb_info.pixel_format) == 32)
+		flags = 0;
+	else
+		flags = PIXMAN_RENDERER_OUTPUT_USE_SHADOW;
+
+	if (pixman_renderer_output_create(&output->base, flags) < 0)
 		goto out_shadow_surface;
 
 	loop = wl_display_get_event_loop(compositor->base.wl_display);
@@ -24,22 +24,101 @@
 #include "config.h"
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <math.h>
 #include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
 
 #include "compositor.h"
+#include "pixman-renderer.h"
+
+/* In benchmark mode, the backend drives a built-in workload of
+ * surfaces for a number of frames, repainting as fast as it can or at
+ * a given rate, and then logs the frame rate and how long each stage
+ * of the repaint took on average, see weston_output::timings. */
+
+enum benchmark_damage {
+	BENCHMARK_DAMAGE_NONE,
+	BENCHMARK_DAMAGE_PARTIAL,
+	BENCHMARK_DAMAGE_FULL,
+	BENCHMARK_DAMAGE_MOVE
+};
+
+struct benchmark_options {
+	int frames;
+	int rate;
+	int surfaces;
+	int depth;
+	int transform;
+	char *damage;
+};
+
+struct benchmark_surface {
+	struct weston_surface *surface;
+	struct wl_shm_buffer *buffer;
+	struct weston_transform rotation;
+	int width, height;
+	int dx, dy;
+	int opaque;
+};
+
+struct headless_benchmark {
+	struct headless_compositor *c;
+	struct benchmark_options options;
+	enum benchmark_damage damage;
+
+	/* The surfaces belong to a client of our own, so that their
+	 * buffers are regular wl_shm buffers. */
+	struct wl_client *client;
+	struct wl_listener client_destroy_listener;
+	int client_fd;
+	struct wl_event_source *client_source;
+	uint32_t next_id;
+
+	struct weston_layer layer;
+	struct wl_array surfaces;
+
+	uint32_t frame;
+	uint64_t start;
+	int done;
+};
 
 struct headless_compositor {
 	struct weston_compositor base;
 	struct weston_seat fake_seat;
+	int use_pixman;
+
+	/* Frames finish on a timer, every 'frame_interval' ms, or right
+	 * away through frame_fd when it is 0. */
+	int frame_interval;
+	int frame_fd;
+	struct wl_event_source *frame_source;
+
+	struct headless_benchmark *benchmark;
 };
 
 struct headless_output {
 	struct weston_output base;
 	struct weston_mode mode;
 	struct wl_event_source *finish_frame_timer;
+	pixman_image_t *image;
+
+	int frame_pending;
+	uint32_t timing_seq;
+	uint32_t frames;
+	uint32_t frames_skipped;
+	uint64_t stage_total[WESTON_REPAINT_STAGES];
+	uint32_t repaint_max;
 };
 
+static void
+benchmark_frame(struct headless_benchmark *b, struct headless_output *output);
+
 
 static void
 headless_output_start_repaint_loop(struct weston_output *output)
@@ -52,10 +131,69 @@ headless_output_start_repaint_loop(struct weston_output *output)
 	weston_output_finish_frame(output, msec);
 }
 
+static void
+headless_output_schedule_frame(struct headless_output *output)
+{
+	struct headless_compositor *c =
+		(struct headless_compositor *) output->base.compositor;
+	uint64_t one = 1;
+
+	/* Go through the event loop even when running flat out, so that
+	 * clients and input are still serviced between frames. */
+	if (c->frame_interval == 0) {
+		output->frame_pending = 1;
+		if (write(c->frame_fd, &one, sizeof one) < 0)
+			weston_log("headless: failed to finish frame: %m\n");
+	} else {
+		wl_event_source_timer_update(output->finish_frame_timer,
+					     c->frame_interval);
+	}
+}
+
+static void
+headless_output_finish_frame(struct headless_output *output)
+{
+	struct headless_compositor *c =
+		(struct headless_compositor *) output->base.compositor;
+
+	if (c->benchmark)
+		benchmark_frame(c->benchmark, output);
+
+	headless_output_start_repaint_loop(&output->base);
+
+	/* Frames with nothing to draw are skipped without a repaint,
+	 * which stops the loop. Keep the benchmark going regardless. */
+	if (c->benchmark && !c->benchmark->done &&
+	    !output->base.repaint_scheduled) {
+		output->frames_skipped++;
+		headless_output_schedule_frame(output);
+	}
+}
+
 static int
 finish_frame_handler(void *data)
 {
-	headless_output_start_repaint_loop(data);
+	headless_output_finish_frame(data);
+
+	return 1;
+}
+
+static int
+frame_fd_handler(int fd, uint32_t mask, void *data)
+{
+	struct headless_compositor *c = data;
+	struct headless_output *output, *next;
+	uint64_t count;
+
+	if (read(fd, &count, sizeof count) != sizeof count)
+		return 1;
+
+	wl_list_for_each_safe(output, next, &c->base.output_list, base.link) {
+		if (!output->frame_pending)
+			continue;
+		output->frame_pending = 0;
+		headless_output_finish_frame(output);
+	}
 
 	return 1;
 }
@@ -72,7 +210,7 @@ headless_output_repaint(struct weston_output *output_base,
 	pixman_region32_subtract(&ec->primary_plane.damage,
 				 &ec->primary_plane.damage, damage);
 
-	wl_event_source_timer_update(output->finish_frame_timer, 16);
+	headless_output_schedule_frame(output);
 
 	return;
 }
@@ -83,6 +221,12 @@ headless_output_destroy(struct weston_output *output_base)
 	struct headless_output *output = (struct headless_output *) output_base;
 
 	wl_event_source_remove(output->finish_frame_timer);
+
+	if (output->image) {
+		pixman_renderer_output_destroy(&output->base);
+		pixman_image_unref(output->image);
+	}
+
 	free(output);
 
 	return;
@@ -90,7 +234,7 @@ headless_output_destroy(struct weston_output *output_base)
 
 static int
 headless_compositor_create_output(struct headless_compositor *c,
-				 int width, int height)
+				 int x, int width, int height)
 {
 	struct headless_output *output;
 	struct wl_event_loop *loop;
@@ -108,13 +252,29 @@ headless_compositor_create_output(struct headless_compositor *c,
 	wl_list_insert(&output->base.mode_list, &output->mode.link);
 
 	output->base.current = &output->mode;
-	weston_output_init(&output->base, &c->base, 0, 0, width, height,
+	weston_output_init(&output->base, &c->base, x, 0, width, height,
 			   WL_OUTPUT_TRANSFORM_NORMAL, 1);
 
 	output->base.make = "weston";
 	output->base.model = "headless";
 
-	weston_output_move(&output->base, 0, 0);
+	if (c->use_pixman) {
+		output->image = pixman_image_create_bits(PIXMAN_x8r8g8b8,
+							 width, height, NULL,
+							 width * 4);
+		if (!output->image)
+			goto err_output;
+
+		if (pixman_renderer_output_create(&output->base, 0) < 0) {
+			pixman_image_unref(output->image);
+			goto err_output;
+		}
+
+		pixman_renderer_output_set_buffer(&output->base,
+						  output->image);
+	}
+
+	weston_output_move(&output->base, x, 0);
 
 	loop = wl_display_get_event_loop(c->base.wl_display);
 	output->finish_frame_timer =
@@ -132,6 +292,464 @@ headless_compositor_create_output(struct headless_compositor *c,
 	wl_list_insert(c->base.output_list.prev, &output->base.link);
 
 	return 0;
+
+err_output:
+	weston_output_destroy(&output->base);
+	free(output);
+	return -1;
+}
+
+static int
+benchmark_client_data(int fd, uint32_t mask, void *data)
+{
+	struct headless_benchmark *b = data;
+	char buf[4096];
+	ssize_t len;
+
+	/* Nobody listens to the events sent to the benchmark client,
+	 * only make sure they never fill up the socket. */
+	do {
+		len = read(fd, buf, sizeof buf);
+	} while (len > 0 || (len < 0 && errno == EINTR));
+
+	if (len == 0 || (mask & (WL_EVENT_HANGUP | WL_EVENT_ERROR))) {
+		wl_event_source_remove(b->client_source);
+		b->client_source = NULL;
+	}
+
+	return 1;
+}
+
+static void
+benchmark_client_destroyed(struct wl_listener *listener, void *data)
+{
+	struct headless_benchmark *b =
+		container_of(listener, struct headless_benchmark,
+			     client_destroy_listener);
+
+	b->client = NULL;
+}
+
+/* The extents of all the outputs together. */
+static void
+benchmark_get_area(struct headless_benchmark *b, pixman_box32_t *area)
+{
+	struct weston_output *output;
+	pixman_region32_t region;
+
+	pixman_region32_init(&region);
+	wl_list_for_each(output, &b->c->base.output_list, link)
+		pixman_region32_union(&region, &region, &output->region);
+	*area = *pixman_region32_extents(&region);
+	pixman_region32_fini(&region);
+}
+
+static void
+benchmark_fill(struct benchmark_surface *bs, int x, int y,
+	       int width, int height, uint32_t color)
+{
+	uint32_t *data;
+	int stride;
+
+	if (bs->buffer == NULL) {
+		weston_surface_set_color(bs->surface,
+					 ((color >> 16) & 0xff) / 255.0f,
+					 ((color >> 8) & 0xff) / 255.0f,
+					 (color & 0xff) / 255.0f,
+					 bs->opaque ? 1.0f : 0.5f);
+		return;
+	}
+
+	data = wl_shm_buffer_get_data(bs->buffer);
+	stride = wl_shm_buffer_get_stride(bs->buffer);
+
+	if (!bs->opaque)
+		color = (color & 0x00ffffff) | 0x80000000;
+
+	pixman_fill(data, stride / 4, 32, x, y, width, height, color);
+}
+
+static struct benchmark_surface *
+benchmark_create_surface(struct headless_benchmark *b,
+			 struct weston_surface *parent,
+			 int x, int y, int width, int height, int opaque)
+{
+	struct weston_compositor *ec = &b->c->base;
+	struct benchmark_surface *bs;
+	struct weston_buffer *buffer;
+	struct wl_resource *resource;
+	uint32_t id = 0;
+
+	bs = wl_array_add(&b->surfaces, sizeof *bs);
+	if (bs == NULL)
+		return NULL;
+	memset(bs, 0, sizeof *bs);
+
+	bs->surface = weston_surface_create(ec);
+	if (bs->surface == NULL) {
+		b->surfaces.size -= sizeof *bs;
+		return NULL;
+	}
+
+	bs->width = width;
+	bs->height = height;
+	bs->opaque = opaque;
+	bs->dx = 1 + (b->surfaces.size / sizeof *bs) % 3;
+	bs->dy = 1 + (b->surfaces.size / sizeof *bs) % 2;
+
+	/* Fall back to solid color surfaces if this libwayland can't
+	 * make shm buffers on our behalf. */
+	if (b->client) {
+		id = b->next_id;
+		bs->buffer = wl_shm_buffer_create(b->client, id, width, height,
+						  width * 4, opaque ?
+						  WL_SHM_FORMAT_XRGB8888 :
+						  WL_SHM_FORMAT_ARGB8888);
+	}
+	if (bs->buffer) {
+		b->next_id++;
+		resource = wl_client_get_object(b->client, id);
+		buffer = weston_buffer_from_resource(resource);
+		weston_buffer_reference(&bs->surface->buffer_ref, buffer);
+		ec->renderer->attach(bs->surface, buffer);
+	}
+
+	benchmark_fill(bs, 0, 0, width, height, 0xff204060 + id * 0x1f3d5b);
+
+	if (parent)
+		weston_surface_set_transform_parent(bs->surface, parent);
+	weston_surface_configure(bs->surface, x, y, width, height);
+	if (opaque) {
+		pixman_region32_fini(&bs->surface->opaque);
+		pixman_region32_init_rect(&bs->surface->opaque,
+					  0, 0, width, height);
+	}
+	weston_layer_entry_insert(&b->layer.surface_list, bs->surface);
+
+	return bs;
+}
+
+/* Each surface gets two children, half its size, down to 'depth'
+ * levels, like a tree of subsurfaces. Returns the index of the
+ * surface in b->surfaces, as adding more may move the array. */
+static int
+benchmark_create_tree(struct headless_benchmark *b, int parent,
+		      int x, int y, int width, int height, int depth,
+		      int opaque)
+{
+	struct benchmark_surface *bs;
+	struct weston_surface *p = NULL;
+	int index;
+
+	if (parent >= 0)
+		p = ((struct benchmark_surface *)
+		     b->surfaces.data)[parent].surface;
+
+	bs = benchmark_create_surface(b, p, x, y, width, height, opaque);
+	if (bs == NULL)
+		return -1;
+
+	index = bs - (struct benchmark_surface *) b->surfaces.data;
+
+	if (depth > 0 && width >= 8 && height >= 8) {
+		benchmark_create_tree(b, index, width / 8, height / 8,
+				      width / 2, height / 2, depth - 1, !opaque);
+		benchmark_create_tree(b, index, width * 3 / 8,
+				      height * 3 / 8, width / 2, height / 2,
+				      depth - 1, opaque);
+	}
+
+	return index;
+}
+
+static void
+benchmark_rotate(struct benchmark_surface *bs, uint32_t frame)
+{
+	struct weston_matrix *matrix = &bs->rotation.matrix;
+	float angle = frame * 0.02f;
+	float cx = bs->width / 2.0f, cy = bs->height / 2.0f;
+
+	wl_list_remove(&bs->rotation.link);
+
+	weston_matrix_init(matrix);
+	weston_matrix_translate(matrix, -cx, -cy, 0.0f);
+	weston_matrix_rotate_xy(matrix, cosf(angle), sinf(angle));
+	weston_matrix_translate(matrix, cx, cy, 0.0f);
+
+	wl_list_insert(bs->surface->geometry.transformation_list.prev,
+		       &bs->rotation.link);
+	weston_surface_geometry_dirty(bs->surface);
+}
+
+static void
+benchmark_move(struct benchmark_surface *bs, pixman_box32_t *area)
+{
+	struct weston_surface *surface = bs->surface;
+	float x = surface->geometry.x + bs->dx;
+	float y = surface->geometry.y + bs->dy;
+
+	if (x < area->x1 || x + bs->width > area->x2)
+		bs->dx = -bs->dx;
+	if (y < area->y1 || y + bs->height > area->y2)
+		bs->dy = -bs->dy;
+
+	weston_surface_set_position(surface, x, y);
+}
+
+static void
+benchmark_tick(struct headless_benchmark *b)
+{
+	struct weston_compositor *ec = &b->c->base;
+	struct benchmark_surface *bs;
+	pixman_box32_t area;
+	uint32_t color = 0xff000000 | (b->frame * 0x010305);
+	int x, y, w, h;
+
+	benchmark_get_area(b, &area);
+
+	wl_array_for_each(bs, &b->surfaces) {
+		switch (b->damage) {
+		case BENCHMARK_DAMAGE_NONE:
+			break;
+		case BENCHMARK_DAMAGE_PARTIAL:
+			w = bs->width < 32 ? bs->width : 32;
+			h = bs->height < 32 ? bs->height : 32;
+			x = (b->frame * 4) % (bs->width - w + 1);
+			y = (b->frame * 2) % (bs->height - h + 1);
+			benchmark_fill(bs, x, y, w, h, color);
+			weston_surface_damage_rect(bs->surface, x, y, w, h);
+			break;
+		case BENCHMARK_DAMAGE_FULL:
+			benchmark_fill(bs, 0, 0, bs->width, bs->height, color);
+			weston_surface_damage(bs->surface);
+			break;
+		case BENCHMARK_DAMAGE_MOVE:
+			if (!bs->surface->geometry.parent)
+				benchmark_move(bs, &area);
+			break;
+		}
+
+		if (b->options.transform && !bs->surface->geometry.parent)
+			benchmark_rotate(bs, b->frame);
+	}
+
+	/* Ask for a frame every time, with nothing changed the core
+	 * skips it, see weston_output_repaint(). */
+	weston_compositor_schedule_repaint(ec);
+}
+
+static void
+benchmark_report(struct headless_benchmark *b)
+{
+	struct headless_compositor *c = b->c;
+	struct headless_output *output;
+	uint64_t elapsed;
+	int i;
+
+	elapsed = weston_compositor_get_monotonic_time() - b->start;
+	if (elapsed == 0)
+		elapsed = 1;
+
+	weston_log("benchmark: %u frames in %.3f s, %.1f frames/s, "
+		   "%d surfaces, %s damage%s\n",
+		   b->frame, elapsed / 1000000.0,
+		   b->frame * 1000000.0 / elapsed,
+		   (int) (b->surfaces.size / sizeof(struct benchmark_surface)),
+		   b->options.damage, b->options.transform ? ", rotated" : "");
+
+	wl_list_for_each(output, &c->base.output_list, base.link) {
+		weston_log_continue("  output %s: %u frames, %u skipped "
+				    "with nothing to draw, slowest repaint "
+				    "%u us\n", output->base.name,
+				    output->frames, output->frames_skipped,
+				    output->repaint_max);
+		if (output->frames == 0)
+			continue;
+		for (i = 0; i < WESTON_REPAINT_STAGES; i++)
+			weston_log_continue("    %-10s %8.1f us avg\n",
+					    weston_repaint_stage_name(i),
+					    (double) output->stage_total[i] /
+					    output->frames);
+	}
+}
+
+static void
+benchmark_frame(struct headless_benchmark *b, struct headless_output *output)
+{
+	struct weston_frame_timing *timing;
+	uint32_t sum;
+	int i;
+
+	if (b->done)
+		return;
+
+	/* Account for the repaints done since the last frame. */
+	for (; output->timing_seq != output->base.timing_seq;
+	     output->timing_seq++) {
+		timing = &output->base.timings[output->timing_seq %
+					       WESTON_FRAME_TIMINGS];
+		if (timing->seq != output->timing_seq)
+			continue;
+
+		sum = 0;
+		for (i = 0; i < WESTON_REPAINT_STAGES; i++) {
+			output->stage_total[i] += timing->stage[i];
+			sum += timing->stage[i];
+		}
+		if (sum > output->repaint_max)
+			output->repaint_max = sum;
+		output->frames++;
+	}
+
+	/* The first output paces the workload. */
+	if (&output->base.link != b->c->base.output_list.next)
+		return;
+
+	if (b->start == 0) {
+		/* Leave out the first frames, that map everything. */
+		b->start = weston_compositor_get_monotonic_time();
+		wl_list_for_each(output, &b->c->base.output_list, base.link) {
+			output->frames = 0;
+			output->frames_skipped = 0;
+			output->repaint_max = 0;
+			memset(output->stage_total, 0,
+			       sizeof output->stage_total);
+		}
+	} else if (++b->frame >= (uint32_t) b->options.frames) {
+		benchmark_report(b);
+		b->done = 1;
+		wl_display_terminate(b->c->base.wl_display);
+		return;
+	}
+
+	benchmark_tick(b);
+}
+
+static void
+benchmark_destroy(struct headless_benchmark *b)
+{
+	struct benchmark_surface *bs;
+	int i;
+
+	/* Children first, then their parents. */
+	bs = b->surfaces.data;
+	for (i = b->surfaces.size / sizeof *bs - 1; i >= 0; i--) {
+		wl_list_remove(&bs[i].rotation.link);
+		weston_surface_destroy(bs[i].surface);
+	}
+	wl_array_release(&b->surfaces);
+	wl_list_remove(&b->layer.link);
+	weston_compositor_surface_list_dirty(&b->c->base);
+
+	if (b->client_source)
+		wl_event_source_remove(b->client_source);
+	if (b->client) {
+		wl_list_remove(&b->client_destroy_listener.link);
+		wl_client_destroy(b->client);
+	}
+	close(b->client_fd);
+
+	free(b->options.damage);
+	free(b);
+}
+
+static struct headless_benchmark *
+benchmark_create(struct headless_compositor *c,
+		 struct benchmark_options *options)
+{
+	static const char *damage_names[] = {
+		[BENCHMARK_DAMAGE_NONE] = "none",
+		[BENCHMARK_DAMAGE_PARTIAL] = "partial",
+		[BENCHMARK_DAMAGE_FULL] = "full",
+		[BENCHMARK_DAMAGE_MOVE] = "move",
+	};
+	struct headless_benchmark *b;
+	struct wl_event_loop *loop;
+	pixman_box32_t area;
+	struct benchmark_surface *bs;
+	int fds[2], i, x, y, w, h, size = 256;
+	uint32_t seed = 1;
+
+	b = zalloc(sizeof *b);
+	if (b == NULL)
+		return NULL;
+
+	b->c = c;
+	b->options = *options;
+	if (b->options.damage == NULL)
+		b->options.damage = strdup("partial");
+
+	b->damage = ARRAY_LENGTH(damage_names);
+	for (i = 0; i < (int) ARRAY_LENGTH(damage_names); i++)
+		if (strcmp(b->options.damage, damage_names[i]) == 0)
+			b->damage = i;
+	if (b->damage == ARRAY_LENGTH(damage_names)) {
+		weston_log("headless: unknown benchmark damage '%s', "
+			   "expected none, partial, full or move\n",
+			   b->options.damage);
+		free(b->options.damage);
+		free(b);
+		return NULL;
+	}
+
+	if (b->options.depth > 4)
+		b->options.depth = 4;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+		free(b->options.damage);
+		free(b);
+		return NULL;
+	}
+
+	b->client_fd = fds[1];
+	fcntl(b->client_fd, F_SETFL, O_NONBLOCK);
+	b->client = wl_client_create(c->base.wl_display, fds[0]);
+	if (b->client == NULL) {
+		close(fds[0]);
+		close(fds[1]);
+		free(b->options.damage);
+		free(b);
+		return NULL;
+	}
+	b->client_destroy_listener.notify = benchmark_client_destroyed;
+	wl_client_add_destroy_listener(b->client, &b->client_destroy_listener);
+
+	loop = wl_display_get_event_loop(c->base.wl_display);
+	b->client_source = wl_event_loop_add_fd(loop, b->client_fd,
+						WL_EVENT_READABLE,
+						benchmark_client_data, b);
+
+	/* Object 1 is the client's wl_display. */
+	b->next_id = 2;
+	wl_array_init(&b->surfaces);
+	weston_layer_init(&b->layer, &c->base.layer_list);
+
+	/* Scatter the surfaces over the outputs, the same way each run. */
+	benchmark_get_area(b, &area);
+	if (area.x2 - area.x1 < size || area.y2 - area.y1 < size)
+		size = 64;
+	w = MAX(area.x2 - area.x1 - size + 1, 1);
+	h = MAX(area.y2 - area.y1 - size + 1, 1);
+	for (i = 0; i < b->options.surfaces; i++) {
+		seed = seed * 1103515245 + 12345;
+		x = area.x1 + (seed >> 8) % w;
+		seed = seed * 1103515245 + 12345;
+		y = area.y1 + (seed >> 8) % h;
+
+		benchmark_create_tree(b, -1, x, y, size, size,
+				      b->options.depth, i % 2 == 0);
+	}
+
+	/* Only now that the array no longer moves. */
+	wl_array_for_each(bs, &b->surfaces)
+		wl_list_init(&bs->rotation.link);
+
+	weston_log("headless: running a benchmark of %d frames, %s, "
+		   "%s shm buffers\n", b->options.frames,
+		   c->use_pixman ? "pixman renderer" : "no renderer",
+		   b->next_id > 2 ? "with" : "without");
+
+	return b;
 }
 
 static void
@@ -144,6 +762,14 @@ headless_destroy(struct weston_compositor *ec)
 {
 	struct headless_compositor *c = (struct headless_compositor *) ec;
 
+	if (c->benchmark)
+		benchmark_destroy(c->benchmark);
+
+	if (c->frame_source)
+		wl_event_source_remove(c->frame_source);
+	if (c->frame_fd >= 0)
+		close(c->frame_fd);
+
 	ec->renderer->destroy(ec);
 
 	weston_seat_release(&c->fake_seat);
@@ -154,16 +780,27 @@ headless_destroy(struct weston_compositor *ec)
 
 static struct weston_compositor *
 headless_compositor_create(struct wl_display *display,
-			   int width, int height, const char *display_name,
-			   int *argc, char *argv[],
+			   int width, int height, int count, int use_pixman,
+			   struct benchmark_options *benchmark,
+			   const char *display_name, int *argc, char *argv[],
 			   struct weston_config *config)
 {
 	struct headless_compositor *c;
+	struct wl_event_loop *loop;
+	int i;
 
 	c = zalloc(sizeof *c);
 	if (c == NULL)
 		return NULL;
 
+	c->frame_fd = -1;
+	c->frame_interval = 16;
+	if (benchmark->frames > 0)
+		c->frame_interval = benchmark->rate > 0 ?
+			1000 / benchmark->rate : 0;
+	if (benchmark->rate > 1000)
+		c->frame_interval = 1;
+
 	if (weston_compositor_init(&c->base, display, argc, argv, config) < 0)
 		goto err_free;
 
@@ -172,14 +809,50 @@ headless_compositor_create(struct wl_display *display,
 	c->base.destroy = headless_destroy;
 	c->base.restore = headless_restore;
 
-	if (headless_compositor_create_output(c, width, height) < 0)
-		goto err_compositor;
-
-	if (noop_renderer_init(&c->base) < 0)
-		goto err_compositor;
+	c->use_pixman = use_pixman;
+	if (c->use_pixman) {
+		if (pixman_renderer_init(&c->base) < 0)
+			goto err_compositor;
+	} else {
+		if (noop_renderer_init(&c->base) < 0)
+			goto err_compositor;
+	}
+
+	/* Outputs are laid out side by side, left to right. */
+	for (i = 0; i < count; i++)
+		if (headless_compositor_create_output(c, i * width,
+						      width, height) < 0)
+			goto err_renderer;
+
+	if (c->frame_interval == 0) {
+		c->frame_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		if (c->frame_fd < 0)
+			goto err_renderer;
+
+		loop = wl_display_get_event_loop(c->base.wl_display);
+		c->frame_source = wl_event_loop_add_fd(loop, c->frame_fd,
+						       WL_EVENT_READABLE,
+						       frame_fd_handler, c);
+		if (c->frame_source == NULL)
+			goto err_frame_fd;
+	}
+
+	if (benchmark->frames > 0) {
+		c->benchmark = benchmark_create(c, benchmark);
+		if (c->benchmark == NULL)
+			goto err_frame_source;
+	}
 
 	return &c->base;
 
+err_frame_source:
+	if (c->frame_source)
+		wl_event_source_remove(c->frame_source);
+err_frame_fd:
+	if (c->frame_fd >= 0)
+		close(c->frame_fd);
+err_renderer:
+	c->base.renderer->destroy(&c->base);
 err_compositor:
 	weston_compositor_shutdown(&c->base);
 err_free:
@@ -191,17 +864,36 @@ WL_EXPORT struct weston_compositor *
 backend_init(struct wl_display *display, int *argc, char *argv[],
 	     struct weston_config *config)
 {
-	int width = 1024, height = 640;
+	int width = 1024, height = 640, count = 1;
+	int use_pixman = 0;
 	char *display_name = NULL;
+	struct benchmark_options benchmark = { .surfaces = 16 };
 
 	const struct weston_option headless_options[] = {
 		{ WESTON_OPTION_INTEGER, "width", 0, &width },
 		{ WESTON_OPTION_INTEGER, "height", 0, &height },
+		{ WESTON_OPTION_INTEGER, "output-count", 0, &count },
+		{ WESTON_OPTION_BOOLEAN, "use-pixman", 0, &use_pixman },
+		{ WESTON_OPTION_INTEGER, "benchmark", 0, &benchmark.frames },
+		{ WESTON_OPTION_INTEGER, "benchmark-rate", 0,
+		  &benchmark.rate },
+		{ WESTON_OPTION_INTEGER, "benchmark-surfaces", 0,
+		  &benchmark.surfaces },
+		{ WESTON_OPTION_INTEGER, "benchmark-depth", 0,
+		  &benchmark.depth },
+		{ WESTON_OPTION_BOOLEAN, "benchmark-transform", 0,
+		  &benchmark.transform },
+		{ WESTON_OPTION_STRING, "benchmark-damage", 0,
+		  &benchmark.damage },
 	};
 
 	parse_options(headless_options,
 		      ARRAY_LENGTH(headless_options), argc, argv);
 
-	return headless_compositor_create(display, width, height, display_name,
+	if (count < 1)
+		count = 1;
+
+	return headless_compositor_create(display, width, height, count,
+					  use_pixman, &benchmark, display_name,
 					  argc, argv, config);
 }
@@ -785,6 +785,7 @@ x11_compositor_create_output(struct x11_compositor *c, int x, int y,
 	struct wm_normal_hints normal_hints;
 	struct wl_event_loop *loop;
 	int output_width, output_height;
+	uint32_t flags;
 	uint32_t mask = XCB_CW_EVENT_MASK | XCB_CW_CURSOR;
 	xcb_atom_t atom_list[1];
 	uint32_t values[2] = {
@@ -901,7 +902,13 @@ x11_compositor_create_output(struct x11_compositor *c, int x, int y,
 	if (c->use_pixman) {
 		if (x11_output_init_shm(c, output, output_width, output_height) < 0)
 			return NULL;
-		if (pixman_renderer_output_create(&output->base) < 0) {
+		/* The SHM image is ordinary memory, composite straight
+		 * into it unless it is less precise than the shadow. */
+		if (PIXMAN_FORMAT_BPP(pixman_image_get_format(output->hw_surface)) == 32)
+			flags = 0;
+		else
+			flags = PIXMAN_RENDERER_OUTPUT_USE_SHADOW;
+		if (pixman_renderer_output_create(&output->base, flags) < 0) {
 			x11_output_deinit_shm(c, output);
 			return NULL;
 		}
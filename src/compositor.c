@@ -93,7 +93,7 @@ weston_output_transform_scale_init(struct weston_output *output,
 				   uint32_t transform, uint32_t scale);
 
 static void
-weston_compositor_build_surface_list(struct weston_compositor *compositor);
+weston_compositor_update_surface_list(struct weston_compositor *compositor);
 
 WL_EXPORT int
 weston_output_switch_mode(struct weston_output *output, struct weston_mode *mode, int32_t scale)
@@ -316,6 +316,7 @@ weston_surface_create(struct weston_compositor *compositor)
 	wl_list_init(&surface->geometry.child_list);
 	pixman_region32_init(&surface->transform.boundingbox);
 	surface->transform.dirty = 1;
+	wl_list_insert(&compositor->pick.unindexed, &surface->pick.link);
 
 	surface->pending.buffer_destroy_listener.notify =
 		surface_handle_pending_buffer_destroy;
@@ -503,6 +504,19 @@ weston_surface_damage_below(struct weston_surface *surface)
 	pixman_region32_union(&surface->plane->damage,
 			      &surface->plane->damage, &damage);
 	pixman_region32_fini(&damage);
+
+	surface->compositor->damage_pass_needed = 1;
+}
+
+static void
+weston_compositor_dirty_visible_lists(struct weston_compositor *compositor,
+				      uint32_t mask)
+{
+	struct weston_output *output;
+
+	wl_list_for_each(output, &compositor->output_list, link)
+		if (mask & (1 << output->id))
+			output->visible_list_dirty = 1;
 }
 
 static void
@@ -516,11 +530,14 @@ weston_surface_update_output_mask(struct weston_surface *es, uint32_t mask)
 	struct wl_client *client;
 
 	es->output_mask = mask;
-	if (es->resource == NULL)
-		return;
 	if (different == 0)
 		return;
 
+	weston_compositor_dirty_visible_lists(es->compositor, different);
+
+	if (es->resource == NULL)
+		return;
+
 	client = wl_resource_get_client(es->resource);
 
 	wl_list_for_each(output, &es->compositor->output_list, link) {
@@ -567,6 +584,10 @@ weston_surface_assign_output(struct weston_surface *es)
 	}
 	pixman_region32_fini(&region);
 
+	/* Frame callbacks follow es->output, see weston_output_repaint(). */
+	if (es->output != new_output)
+		weston_compositor_dirty_visible_lists(ec, ~0);
+
 	es->output = new_output;
 	weston_surface_update_output_mask(es, mask);
 }
@@ -684,6 +705,146 @@ weston_surface_update_transform_enable(struct weston_surface *surface)
 	return 0;
 }
 
+static int32_t
+pick_cell(float v)
+{
+	return floorf(v / WESTON_PICK_CELL_SIZE);
+}
+
+static struct wl_array *
+pick_bucket(struct weston_compositor *compositor, int32_t cx, int32_t cy)
+{
+	uint32_t hash;
+
+	hash = (uint32_t) cx * 73856093u ^ (uint32_t) cy * 19349663u;
+
+	return &compositor->pick.cells[hash & (WESTON_PICK_BUCKETS - 1)];
+}
+
+/* Removes the entries of the surface for the cells up to and excluding
+ * (end_x, end_y) in row order. Cells hashing to the same bucket hold
+ * one entry each. */
+static void
+pick_index_remove_cells(struct weston_surface *surface,
+			int32_t end_x, int32_t end_y)
+{
+	struct weston_surface **es, **last;
+	struct wl_array *bucket;
+	int32_t cx, cy;
+
+	for (cy = surface->pick.y1; cy <= surface->pick.y2; cy++) {
+		for (cx = surface->pick.x1; cx <= surface->pick.x2; cx++) {
+			if (cx == end_x && cy == end_y)
+				return;
+
+			bucket = pick_bucket(surface->compositor, cx, cy);
+			wl_array_for_each(es, bucket) {
+				if (*es != surface)
+					continue;
+
+				bucket->size -= sizeof *es;
+				last = (struct weston_surface **)
+					((char *) bucket->data + bucket->size);
+				*es = *last;
+				break;
+			}
+		}
+	}
+}
+
+static void
+pick_index_remove(struct weston_surface *surface)
+{
+	if (surface->pick.indexed)
+		pick_index_remove_cells(surface, INT32_MAX, INT32_MAX);
+	else
+		wl_list_remove(&surface->pick.link);
+
+	wl_list_init(&surface->pick.link);
+	surface->pick.indexed = 0;
+}
+
+static void
+pick_index_unindex(struct weston_surface *surface)
+{
+	pick_index_remove(surface);
+	wl_list_insert(&surface->compositor->pick.unindexed,
+		       &surface->pick.link);
+}
+
+/* Hashes the surface into every cell a point picking it can fall in.
+ * Picking truncates surface coordinates towards zero, so that reaches
+ * up to a surface pixel out of the surface on the top and left side;
+ * the box is grown by one on all sides. A surface whose input region
+ * reaches out of the surface, like the default infinite one, can be
+ * picked anywhere and stays unindexed. */
+static void
+pick_index_insert(struct weston_surface *surface)
+{
+	struct weston_compositor *compositor = surface->compositor;
+	pixman_box32_t *input = pixman_region32_extents(&surface->input);
+	int32_t w = surface->geometry.width;
+	int32_t h = surface->geometry.height;
+	int32_t s[4][2] = {
+		{ -1,    -1 },
+		{ -1,    h + 1 },
+		{ w + 1, -1 },
+		{ w + 1, h + 1 }
+	};
+	float min_x = HUGE_VALF, min_y = HUGE_VALF;
+	float max_x = -HUGE_VALF, max_y = -HUGE_VALF;
+	struct weston_surface **es;
+	int32_t cx, cy;
+	int i;
+
+	pick_index_remove(surface);
+
+	if (input->x1 < 0 || input->y1 < 0 || input->x2 > w || input->y2 > h)
+		goto unindexed;
+
+	for (i = 0; i < 4; i++) {
+		float x, y;
+		weston_surface_to_global_float(surface,
+					       s[i][0], s[i][1], &x, &y);
+		min_x = fminf(min_x, x);
+		min_y = fminf(min_y, y);
+		max_x = fmaxf(max_x, x);
+		max_y = fmaxf(max_y, y);
+	}
+
+	if (!(max_x - min_x < WESTON_PICK_CELL_SIZE * WESTON_PICK_MAX_CELLS &&
+	      max_y - min_y < WESTON_PICK_CELL_SIZE * WESTON_PICK_MAX_CELLS &&
+	      fabsf(min_x) < (1 << 30) && fabsf(min_y) < (1 << 30)))
+		goto unindexed;
+
+	surface->pick.x1 = pick_cell(floorf(min_x) - 1);
+	surface->pick.y1 = pick_cell(floorf(min_y) - 1);
+	surface->pick.x2 = pick_cell(ceilf(max_x) + 1);
+	surface->pick.y2 = pick_cell(ceilf(max_y) + 1);
+
+	if ((surface->pick.x2 - surface->pick.x1 + 1) *
+	    (surface->pick.y2 - surface->pick.y1 + 1) > WESTON_PICK_MAX_CELLS)
+		goto unindexed;
+
+	for (cy = surface->pick.y1; cy <= surface->pick.y2; cy++) {
+		for (cx = surface->pick.x1; cx <= surface->pick.x2; cx++) {
+			es = wl_array_add(pick_bucket(compositor, cx, cy),
+					  sizeof *es);
+			if (!es) {
+				pick_index_remove_cells(surface, cx, cy);
+				goto unindexed;
+			}
+			*es = surface;
+		}
+	}
+
+	surface->pick.indexed = 1;
+	return;
+
+unindexed:
+	wl_list_insert(&compositor->pick.unindexed, &surface->pick.link);
+}
+
 WL_EXPORT void
 weston_surface_update_transform(struct weston_surface *surface)
 {
@@ -719,6 +880,8 @@ weston_surface_update_transform(struct weston_surface *surface)
 
 	weston_surface_assign_output(surface);
 
+	pick_index_insert(surface);
+
 	wl_signal_emit(&surface->compositor->transform_signal, surface);
 }
 
@@ -738,6 +901,8 @@ weston_surface_geometry_dirty(struct weston_surface *surface)
 		return;
 
 	surface->transform.dirty = 1;
+	surface->compositor->damage_pass_needed = 1;
+	pick_index_unindex(surface);
 
 	wl_list_for_each(child, &surface->geometry.child_list,
 			 geometry.parent_link)
@@ -827,6 +992,20 @@ weston_surface_damage(struct weston_surface *surface)
 	pixman_region32_union_rect(&surface->damage, &surface->damage,
 				   0, 0, surface->geometry.width,
 				   surface->geometry.height);
+	surface->compositor->damage_pass_needed = 1;
+
+	weston_surface_schedule_repaint(surface);
+}
+
+/* Damages a rectangle in surface coordinates, for when only part of the
+ * surface contents changed outside of a wl_surface commit. */
+WL_EXPORT void
+weston_surface_damage_rect(struct weston_surface *surface,
+			   int32_t x, int32_t y, int32_t width, int32_t height)
+{
+	pixman_region32_union_rect(&surface->damage, &surface->damage,
+				   x, y, width, height);
+	surface->compositor->damage_pass_needed = 1;
 
 	weston_surface_schedule_repaint(surface);
 }
@@ -940,23 +1119,54 @@ weston_compositor_get_time(void)
        return tv.tv_sec * 1000 + tv.tv_usec / 1000;
 }
 
+/* Returns whichever of the candidate and the best pick so far is
+ * topmost and has the point in its input region. Only surfaces in
+ * surface_list can be picked. */
+static struct weston_surface *
+pick_candidate(struct weston_compositor *compositor,
+	       struct weston_surface *surface, struct weston_surface *best,
+	       wl_fixed_t x, wl_fixed_t y)
+{
+	wl_fixed_t sx, sy;
+
+	if (wl_list_empty(&surface->link) ||
+	    (best && surface->pick.order >= best->pick.order))
+		return best;
+
+	compositor->pick.candidates++;
+
+	weston_surface_from_global_fixed(surface, x, y, &sx, &sy);
+	if (pixman_region32_contains_point(&surface->input,
+					   wl_fixed_to_int(sx),
+					   wl_fixed_to_int(sy),
+					   NULL))
+		return surface;
+
+	return best;
+}
+
 WL_EXPORT struct weston_surface *
 weston_compositor_pick_surface(struct weston_compositor *compositor,
 			       wl_fixed_t x, wl_fixed_t y,
 			       wl_fixed_t *sx, wl_fixed_t *sy)
 {
-	struct weston_surface *surface;
+	struct weston_surface *surface, *best = NULL, **es;
+	struct wl_array *bucket;
 
-	wl_list_for_each(surface, &compositor->surface_list, link) {
-		weston_surface_from_global_fixed(surface, x, y, sx, sy);
-		if (pixman_region32_contains_point(&surface->input,
-						   wl_fixed_to_int(*sx),
-						   wl_fixed_to_int(*sy),
-						   NULL))
-			return surface;
-	}
+	compositor->pick.picks++;
 
-	return NULL;
+	bucket = pick_bucket(compositor,
+			     pick_cell(wl_fixed_to_double(x)),
+			     pick_cell(wl_fixed_to_double(y)));
+	wl_array_for_each(es, bucket)
+		best = pick_candidate(compositor, *es, best, x, y);
+	wl_list_for_each(surface, &compositor->pick.unindexed, pick.link)
+		best = pick_candidate(compositor, surface, best, x, y);
+
+	if (best)
+		weston_surface_from_global_fixed(best, x, y, sx, sy);
+
+	return best;
 }
 
 static void
@@ -978,7 +1188,9 @@ weston_surface_unmap(struct weston_surface *surface)
 
 	weston_surface_damage_below(surface);
 	surface->output = NULL;
-	wl_list_remove(&surface->layer_link);
+	weston_layer_entry_remove(surface);
+	wl_list_remove(&surface->link);
+	wl_list_init(&surface->link);
 
 	wl_list_for_each(seat, &surface->compositor->seat_list, link) {
 		if (seat->keyboard && seat->keyboard->focus == surface)
@@ -1006,6 +1218,8 @@ weston_surface_destroy(struct weston_surface *surface)
 {
 	struct weston_compositor *compositor = surface->compositor;
 	struct weston_frame_callback *cb, *next;
+	struct weston_output *output;
+	struct weston_surface **es;
 
 	if (--surface->ref_count > 0)
 		return;
@@ -1016,10 +1230,20 @@ weston_surface_destroy(struct weston_surface *surface)
 	assert(wl_list_empty(&surface->subsurface_list_pending));
 	assert(wl_list_empty(&surface->subsurface_list));
 
-	if (weston_surface_is_mapped(surface)) {
+	if (weston_surface_is_mapped(surface))
 		weston_surface_unmap(surface);
-		weston_compositor_build_surface_list(compositor);
-	}
+
+	/* Never leave a dangling pointer in surface_list or the output
+	 * visible lists, even if the surface was taken out of its layer
+	 * without being unmapped. */
+	wl_list_remove(&surface->link);
+	weston_compositor_surface_list_dirty(compositor);
+	pick_index_remove(surface);
+
+	wl_list_for_each(output, &compositor->output_list, link)
+		wl_array_for_each(es, &output->presenting)
+			if (*es == surface)
+				*es = NULL;
 
 	wl_list_for_each_safe(cb, next,
 			      &surface->pending.frame_callback_list, link)
@@ -1068,7 +1292,7 @@ weston_buffer_destroy_handler(struct wl_listener *listener, void *data)
 	free(buffer);
 }
 
-struct weston_buffer *
+WL_EXPORT struct weston_buffer *
 weston_buffer_from_resource(struct wl_resource *resource)
 {
 	struct weston_buffer *buffer;
@@ -1146,8 +1370,8 @@ weston_surface_attach(struct weston_surface *surface,
 WL_EXPORT void
 weston_surface_restack(struct weston_surface *surface, struct wl_list *below)
 {
-	wl_list_remove(&surface->layer_link);
-	wl_list_insert(below, &surface->layer_link);
+	weston_layer_entry_remove(surface);
+	weston_layer_entry_insert(below, surface);
 	weston_surface_damage_below(surface);
 	weston_surface_damage(surface);
 }
@@ -1205,13 +1429,23 @@ surface_accumulate_damage(struct weston_surface *surface,
 	pixman_region32_union(opaque, opaque, &surface->transform.opaque);
 }
 
+/* The damage pass: fold surface damage into plane damage and compute
+ * each surface's clip, for the whole compositor at once. Its results live
+ * in the planes and surfaces, so outputs repainting in the same frame
+ * cycle only intersect them with their own region. It is skipped until
+ * something invalidates it again, see damage_pass_needed.
+ */
 static void
 compositor_accumulate_damage(struct weston_compositor *ec)
 {
+	struct weston_output *output;
 	struct weston_plane *plane;
 	struct weston_surface *es;
 	pixman_region32_t opaque, clip;
 
+	if (!ec->damage_pass_needed)
+		return;
+
 	pixman_region32_init(&clip);
 
 	wl_list_for_each(plane, &ec->plane_list, link) {
@@ -1230,6 +1464,15 @@ compositor_accumulate_damage(struct weston_compositor *ec)
 		pixman_region32_fini(&opaque);
 	}
 
+	/* Damage outside of all outputs, like that of the shell's fade
+	 * surface, is never repainted and so never taken off the plane by
+	 * a backend. Drop it here instead of letting it pile up. */
+	pixman_region32_clear(&clip);
+	wl_list_for_each(output, &ec->output_list, link)
+		pixman_region32_union(&clip, &clip, &output->region);
+	pixman_region32_intersect(&ec->primary_plane.damage,
+				  &ec->primary_plane.damage, &clip);
+
 	pixman_region32_fini(&clip);
 
 	wl_list_for_each(es, &ec->surface_list, link) {
@@ -1244,6 +1487,9 @@ compositor_accumulate_damage(struct weston_compositor *ec)
 		if (!es->keep_buffer)
 			weston_buffer_reference(&es->buffer_ref, NULL);
 	}
+
+	ec->damage_pass_needed = 0;
+	ec->damage_passes++;
 }
 
 static void
@@ -1255,6 +1501,7 @@ surface_list_add(struct weston_compositor *compositor,
 	if (wl_list_empty(&surface->subsurface_list)) {
 		weston_surface_update_transform(surface);
 		wl_list_insert(compositor->surface_list.prev, &surface->link);
+		surface->pick.order = compositor->pick.next_order++;
 		return;
 	}
 
@@ -1266,6 +1513,8 @@ surface_list_add(struct weston_compositor *compositor,
 			weston_surface_update_transform(sub->surface);
 			wl_list_insert(compositor->surface_list.prev,
 				       &sub->surface->link);
+			sub->surface->pick.order =
+				compositor->pick.next_order++;
 		} else {
 			surface_list_add(compositor, sub->surface);
 		}
@@ -1275,46 +1524,285 @@ surface_list_add(struct weston_compositor *compositor,
 static void
 weston_compositor_build_surface_list(struct weston_compositor *compositor)
 {
-	struct weston_surface *surface;
+	struct weston_surface *surface, *next;
 	struct weston_layer *layer;
 
+	/* Surfaces dropped from the list must not keep stale links, as
+	 * unmap and destroy unlink them from surface_list. */
+	wl_list_for_each_safe(surface, next, &compositor->surface_list, link)
+		wl_list_init(&surface->link);
+
 	wl_list_init(&compositor->surface_list);
+	compositor->pick.next_order = 0;
 	wl_list_for_each(layer, &compositor->layer_list, link) {
 		wl_list_for_each(surface, &layer->surface_list, layer_link) {
 			surface_list_add(compositor, surface);
 		}
 	}
+
+	compositor->surface_list_dirty = 0;
+	compositor->surface_list_rebuilds++;
+	compositor->damage_pass_needed = 1;
+
+	weston_compositor_dirty_visible_lists(compositor, ~0);
+}
+
+/* Bring surface_list and the surface transforms up to date. The list is
+ * only flattened again from the layers if the stacking changed since the
+ * last repaint; otherwise the existing list is walked in order, which
+ * updates the transforms exactly like a rebuild would.
+ */
+static void
+weston_compositor_update_surface_list(struct weston_compositor *compositor)
+{
+	struct weston_surface *surface;
+
+	if (compositor->surface_list_dirty) {
+		weston_compositor_build_surface_list(compositor);
+		return;
+	}
+
+	wl_list_for_each(surface, &compositor->surface_list, link)
+		weston_surface_update_transform(surface);
+}
+
+WL_EXPORT void
+weston_compositor_surface_list_dirty(struct weston_compositor *compositor)
+{
+	compositor->surface_list_dirty = 1;
+}
+
+static void
+weston_output_update_visible_list(struct weston_output *output)
+{
+	struct weston_compositor *ec = output->compositor;
+	struct weston_surface *es, **ptr;
+
+	if (!output->visible_list_dirty)
+		return;
+
+	output->visible_list.size = 0;
+	wl_list_for_each(es, &ec->surface_list, link) {
+		if (!(es->output_mask & (1 << output->id)) &&
+		    es->output != output)
+			continue;
+
+		ptr = wl_array_add(&output->visible_list, sizeof *ptr);
+		if (ptr == NULL)
+			return;
+		*ptr = es;
+	}
+
+	output->visible_list_dirty = 0;
+}
+
+/* Collect the primary plane surfaces the renderer has to draw on the
+ * output. A surface whose bounding box on the output lies entirely
+ * within its clip, the opaque region stacked above it, cannot show a
+ * single pixel, so it is culled here instead of the renderer finding an
+ * empty repaint region for it. Checking a box against the clip stays
+ * cheap even for complex clips, as pixman keeps regions sorted in
+ * y-x bands.
+ */
+static void
+weston_output_build_draw_list(struct weston_output *output)
+{
+	struct weston_compositor *ec = output->compositor;
+	struct weston_surface **es, **ptr;
+	pixman_box32_t *extents, *bbox, box;
+
+	output->draw_list.size = 0;
+	output->surfaces_drawn = 0;
+	output->surfaces_culled = 0;
+
+	extents = pixman_region32_extents(&output->region);
+	wl_array_for_each(es, &output->visible_list) {
+		if ((*es)->plane != &ec->primary_plane)
+			continue;
+
+		bbox = pixman_region32_extents(&(*es)->transform.boundingbox);
+		box.x1 = MAX(bbox->x1, extents->x1);
+		box.y1 = MAX(bbox->y1, extents->y1);
+		box.x2 = MIN(bbox->x2, extents->x2);
+		box.y2 = MIN(bbox->y2, extents->y2);
+
+		if (box.x1 >= box.x2 || box.y1 >= box.y2 ||
+		    pixman_region32_contains_rectangle(&(*es)->clip, &box) ==
+		    PIXMAN_REGION_IN) {
+			output->surfaces_culled++;
+			continue;
+		}
+
+		ptr = wl_array_add(&output->draw_list, sizeof *ptr);
+		if (ptr == NULL)
+			return;
+		*ptr = *es;
+		output->surfaces_drawn++;
+	}
+}
+
+WL_EXPORT uint64_t
+weston_compositor_get_monotonic_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+WL_EXPORT int
+weston_latency_bucket(uint64_t latency)
+{
+	int i;
+
+	for (i = 0; i < WESTON_LATENCY_BUCKETS - 1; i++)
+		if (latency < (1000u << i))
+			break;
+
+	return i;
+}
+
+static int
+weston_compositor_read_input(int fd, uint32_t mask, void *data)
+{
+	struct weston_compositor *compositor = data;
+
+	wl_event_loop_dispatch(compositor->input_loop, 0);
+
+	return 1;
+}
+
+/* Stops the repaint loop until the next repaint request, reading
+ * input directly in the meantime. */
+static void
+weston_output_idle(struct weston_output *output)
+{
+	struct weston_compositor *compositor = output->compositor;
+	struct wl_event_loop *loop =
+		wl_display_get_event_loop(compositor->wl_display);
+	int fd;
+
+	output->repaint_scheduled = 0;
+	if (compositor->input_loop_source)
+		return;
+
+	fd = wl_event_loop_get_fd(compositor->input_loop);
+	compositor->input_loop_source =
+		wl_event_loop_add_fd(loop, fd, WL_EVENT_READABLE,
+				     weston_compositor_read_input, compositor);
+}
+
+/* Nothing would change on screen: no damage on the output, in the
+ * stacking or transforms since its last repaint, nothing animating, no
+ * frame callbacks and no one waiting for a frame. */
+static int
+weston_output_is_clean(struct weston_output *output)
+{
+	struct weston_compositor *ec = output->compositor;
+	struct weston_surface **es;
+	pixman_region32_t damage;
+	int clean;
+
+	if (ec->damage_pass_needed || ec->surface_list_dirty ||
+	    output->visible_list_dirty || output->dirty ||
+	    output->damage_pass_seen != ec->damage_passes ||
+	    !wl_list_empty(&output->animation_list) ||
+	    !wl_list_empty(&output->frame_signal.listener_list))
+		return 0;
+
+	wl_array_for_each(es, &output->visible_list)
+		if ((*es)->output == output &&
+		    !wl_list_empty(&(*es)->frame_callback_list))
+			return 0;
+
+	pixman_region32_init(&damage);
+	pixman_region32_intersect(&damage, &ec->primary_plane.damage,
+				  &output->region);
+	clean = !pixman_region32_not_empty(&damage);
+	pixman_region32_fini(&damage);
+
+	return clean;
+}
+
+/* Ends the current stage of the frame and starts the next one. */
+static void
+timing_mark(struct weston_frame_timing *timing,
+	    enum weston_repaint_stage stage, uint64_t *t)
+{
+	uint64_t now = weston_compositor_get_monotonic_time();
+
+	timing->stage[stage] = now - *t;
+	*t = now;
 }
 
 static void
 weston_output_repaint(struct weston_output *output, uint32_t msecs)
 {
 	struct weston_compositor *ec = output->compositor;
-	struct weston_surface *es;
+	struct weston_surface **es;
 	struct weston_animation *animation, *next;
 	struct weston_frame_callback *cb, *cnext;
 	struct wl_list frame_callback_list;
+	struct weston_frame_timing *timing;
+	struct weston_surface **ptr;
 	pixman_region32_t output_damage;
+	uint64_t t;
+
+	/* Motion batched up since the last frame goes first, so that the
+	 * grabs it moves things with get their changes in. */
+	if (ec->motion_batching == WESTON_MOTION_BATCHING_FRAME)
+		weston_compositor_flush_motion(ec);
+
+	/* Don't even go through the motions if the frame would come out
+	 * the same. The loop stops until the next repaint request. */
+	if (weston_output_is_clean(output)) {
+		output->repaint_needed = 0;
+		output->frames_skipped++;
+		weston_output_idle(output);
+		return;
+	}
 
-	/* Rebuild the surface list and update surface transforms up front. */
-	weston_compositor_build_surface_list(ec);
+	timing = &output->timings[output->timing_seq % WESTON_FRAME_TIMINGS];
+	t = weston_compositor_get_monotonic_time();
+	timing->start = t;
+	timing->presented = 0;
+
+	/* Update the surface list and surface transforms up front. */
+	weston_compositor_update_surface_list(ec);
+	weston_output_update_visible_list(output);
+	timing_mark(timing, WESTON_REPAINT_SURFACE_LIST, &t);
 
 	if (output->assign_planes && !output->disable_planes)
 		output->assign_planes(output);
 	else
-		wl_list_for_each(es, &ec->surface_list, link)
-			weston_surface_move_to_plane(es, &ec->primary_plane);
+		wl_array_for_each(es, &output->visible_list)
+			weston_surface_move_to_plane(*es, &ec->primary_plane);
+	timing_mark(timing, WESTON_REPAINT_ASSIGN_PLANES, &t);
 
 	wl_list_init(&frame_callback_list);
-	wl_list_for_each(es, &ec->surface_list, link) {
-		if (es->output == output) {
-			wl_list_insert_list(&frame_callback_list,
-					    &es->frame_callback_list);
-			wl_list_init(&es->frame_callback_list);
-		}
+	output->presenting.size = 0;
+	wl_array_for_each(es, &output->visible_list) {
+		if ((*es)->output != output)
+			continue;
+
+		wl_list_insert_list(&frame_callback_list,
+				    &(*es)->frame_callback_list);
+		wl_list_init(&(*es)->frame_callback_list);
+
+		if ((*es)->commit_time == 0)
+			continue;
+		ptr = wl_array_add(&output->presenting, sizeof *ptr);
+		if (ptr == NULL)
+			continue;
+		*ptr = *es;
+		(*es)->drawn_commit_time = (*es)->commit_time;
+		(*es)->commit_time = 0;
 	}
 
 	compositor_accumulate_damage(ec);
+	weston_output_build_draw_list(output);
+	timing_mark(timing, WESTON_REPAINT_DAMAGE, &t);
 
 	pixman_region32_init(&output_damage);
 	pixman_region32_intersect(&output_damage,
@@ -1325,14 +1813,20 @@ weston_output_repaint(struct weston_output *output, uint32_t msecs)
 	if (output->dirty)
 		weston_output_update_matrix(output);
 
+	wl_signal_emit(&output->damage_signal, &output_damage);
 	output->repaint(output, &output_damage);
+	timing_mark(timing, WESTON_REPAINT_RENDER, &t);
+	output->frames_rendered++;
+	output->damage_pass_seen = ec->damage_passes;
 
 	pixman_region32_fini(&output_damage);
 
 	output->repaint_needed = 0;
+	output->repaint_drawn_time = output->repaint_request_time;
 
 	weston_compositor_repick(ec);
 	wl_event_loop_dispatch(ec->input_loop, 0);
+	timing_mark(timing, WESTON_REPAINT_INPUT, &t);
 
 	wl_list_for_each_safe(cb, cnext, &frame_callback_list, link) {
 		wl_callback_send_done(cb->resource, msecs);
@@ -1343,40 +1837,123 @@ weston_output_repaint(struct weston_output *output, uint32_t msecs)
 		animation->frame_counter++;
 		animation->frame(animation, output, msecs);
 	}
+	timing_mark(timing, WESTON_REPAINT_FRAME_CALLBACKS, &t);
+
+	/* Publish the entry only once it is complete. */
+	timing->seq = output->timing_seq++;
 }
 
 static int
-weston_compositor_read_input(int fd, uint32_t mask, void *data)
+output_repaint_timer_handler(void *data)
 {
-	struct weston_compositor *compositor = data;
+	struct weston_output *output = data;
+	struct weston_compositor *compositor = output->compositor;
 
-	wl_event_loop_dispatch(compositor->input_loop, 0);
+	/* Backends drop repaint_needed when they go offscreen. */
+	if (output->repaint_needed &&
+	    compositor->state != WESTON_COMPOSITOR_SLEEPING &&
+	    compositor->state != WESTON_COMPOSITOR_OFFSCREEN)
+		weston_output_repaint(output, output->frame_time);
+	else
+		weston_output_idle(output);
 
 	return 1;
 }
 
+static void
+weston_output_update_latency(struct weston_output *output)
+{
+	struct weston_frame_timing *timing;
+	struct weston_surface **es;
+	uint64_t now, latency;
+
+	now = weston_compositor_get_monotonic_time();
+
+	wl_array_for_each(es, &output->presenting) {
+		if (*es == NULL || (*es)->drawn_commit_time == 0)
+			continue;
+		latency = now - (*es)->drawn_commit_time;
+		(*es)->latency_histogram[weston_latency_bucket(latency)]++;
+		(*es)->drawn_commit_time = 0;
+	}
+	output->presenting.size = 0;
+
+	if (output->timing_seq > 0) {
+		timing = &output->timings[(output->timing_seq - 1) %
+					  WESTON_FRAME_TIMINGS];
+		if (timing->presented == 0)
+			timing->presented = now - timing->start;
+	}
+
+	if (output->repaint_drawn_time == 0)
+		return;
+
+	latency = now - output->repaint_drawn_time;
+	output->repaint_drawn_time = 0;
+	output->latency_frames++;
+	output->latency_total += latency;
+	if (latency > output->latency_max)
+		output->latency_max = latency;
+}
+
+/* How long after 'now' the repaint following the frame presented at
+ * 'frame_time' is due, in microseconds: repaint_window ms before the
+ * next vblank, one refresh after the frame. 'frame_time' is in ms on
+ * the monotonic clock, as 'now' is in us. A frame time that isn't
+ * within a refresh before 'now', from a backend using another clock,
+ * counts as presented now. Returns 0 or less to repaint right away. */
+WL_EXPORT int64_t
+weston_output_repaint_delay(struct weston_output *output,
+			    uint32_t frame_time, uint64_t now)
+{
+	struct weston_compositor *compositor = output->compositor;
+	int64_t refresh, elapsed;
+
+	if (compositor->repaint_window <= 0 || !output->current ||
+	    output->current->refresh <= 0)
+		return 0;
+
+	/* The mode refresh rate is in mHz. */
+	refresh = 1000000000LL / output->current->refresh;
+
+	/* The frame was presented somewhere in its millisecond, so this
+	 * errs on the early side by less than 1 ms. */
+	elapsed = (int64_t) (uint32_t) (now / 1000 - frame_time) * 1000 +
+		  now % 1000;
+	if (elapsed > refresh)
+		elapsed = 0;
+
+	return refresh - elapsed - compositor->repaint_window * 1000LL;
+}
+
+/* Called by the backends when a frame has been presented, with
+ * 'msecs' the frame time in ms on the monotonic clock. If a repaint is
+ * needed, it is done right away, or with a repaint window, that many ms
+ * before the vblank one refresh after the frame time, so that client
+ * updates and input coming in meanwhile still make it into the next
+ * frame. Input is only read while repainting until then. */
 WL_EXPORT void
 weston_output_finish_frame(struct weston_output *output, uint32_t msecs)
 {
-	struct weston_compositor *compositor = output->compositor;
-	struct wl_event_loop *loop =
-		wl_display_get_event_loop(compositor->wl_display);
-	int fd;
+	int64_t delay;
 
 	output->frame_time = msecs;
-	if (output->repaint_needed) {
-		weston_output_repaint(output, msecs);
-		return;
-	}
+	weston_output_update_latency(output);
 
-	output->repaint_scheduled = 0;
-	if (compositor->input_loop_source)
+	if (!output->repaint_needed) {
+		weston_output_idle(output);
 		return;
+	}
 
-	fd = wl_event_loop_get_fd(compositor->input_loop);
-	compositor->input_loop_source =
-		wl_event_loop_add_fd(loop, fd, WL_EVENT_READABLE,
-				     weston_compositor_read_input, compositor);
+	/* The timer counts whole milliseconds, round down so that the
+	 * repaint is never late. */
+	delay = weston_output_repaint_delay(output, msecs,
+					    weston_compositor_get_monotonic_time());
+	if (delay >= 1000)
+		wl_event_source_timer_update(output->repaint_timer,
+					     delay / 1000);
+	else
+		weston_output_repaint(output, msecs);
 }
 
 static void
@@ -1395,6 +1972,20 @@ weston_layer_init(struct weston_layer *layer, struct wl_list *below)
 		wl_list_insert(below, &layer->link);
 }
 
+WL_EXPORT void
+weston_layer_entry_insert(struct wl_list *list, struct weston_surface *surface)
+{
+	wl_list_insert(list, &surface->layer_link);
+	weston_compositor_surface_list_dirty(surface->compositor);
+}
+
+WL_EXPORT void
+weston_layer_entry_remove(struct weston_surface *surface)
+{
+	wl_list_remove(&surface->layer_link);
+	weston_compositor_surface_list_dirty(surface->compositor);
+}
+
 WL_EXPORT void
 weston_output_schedule_repaint(struct weston_output *output)
 {
@@ -1406,6 +1997,8 @@ weston_output_schedule_repaint(struct weston_output *output)
 		return;
 
 	loop = wl_display_get_event_loop(compositor->wl_display);
+	if (!output->repaint_needed)
+		output->repaint_request_time = weston_compositor_get_monotonic_time();
 	output->repaint_needed = 1;
 	if (output->repaint_scheduled)
 		return;
@@ -1548,21 +2141,94 @@ surface_set_input_region(struct wl_client *client,
 	}
 }
 
+static int
+weston_surface_subsurface_order_changed(struct weston_surface *surface)
+{
+	struct weston_subsurface *sub;
+	struct wl_list *pos = surface->subsurface_list.next;
+
+	wl_list_for_each(sub, &surface->subsurface_list_pending,
+			 parent_link_pending) {
+		if (pos != &sub->parent_link)
+			return 1;
+		pos = pos->next;
+	}
+
+	return 0;
+}
+
 static void
 weston_surface_commit_subsurface_order(struct weston_surface *surface)
 {
 	struct weston_subsurface *sub;
 
+	if (!weston_surface_subsurface_order_changed(surface))
+		return;
+
 	wl_list_for_each_reverse(sub, &surface->subsurface_list_pending,
 				 parent_link_pending) {
 		wl_list_remove(&sub->parent_link);
 		wl_list_insert(&surface->subsurface_list, &sub->parent_link);
 	}
+
+	weston_compositor_surface_list_dirty(surface->compositor);
+}
+
+static void
+weston_surface_update_commit_rate(struct weston_surface *surface,
+				  uint64_t now)
+{
+	pixman_region32_t damage;
+	pixman_box32_t *rects;
+	uint64_t interval;
+	float area = 0.0f;
+	int i, n;
+
+	pixman_region32_init(&damage);
+	pixman_region32_intersect_rect(&damage, &surface->pending.damage,
+				       0, 0,
+				       surface->geometry.width,
+				       surface->geometry.height);
+	rects = pixman_region32_rectangles(&damage, &n);
+	for (i = 0; i < n; i++)
+		area += (float) (rects[i].x2 - rects[i].x1) *
+			(rects[i].y2 - rects[i].y1);
+	pixman_region32_fini(&damage);
+
+	if (surface->last_commit_time) {
+		/* Anything faster than 1000 commits a second is as good. */
+		interval = now - surface->last_commit_time;
+		if (interval < 1000)
+			interval = 1000;
+		surface->commit_rate +=
+			(1000000.0f / interval - surface->commit_rate) / 4;
+	}
+	surface->damage_area += (area - surface->damage_area) / 4;
+	surface->last_commit_time = now;
+}
+
+/* The average lags behind a surface that stops committing, so the
+ * rate is also capped by the time since the last commit. */
+WL_EXPORT float
+weston_surface_get_commit_rate(struct weston_surface *surface)
+{
+	uint64_t idle;
+
+	if (surface->last_commit_time == 0)
+		return 0.0f;
+
+	idle = weston_compositor_get_monotonic_time() -
+		surface->last_commit_time;
+	if (idle > 1000 && 1000000.0f / idle < surface->commit_rate)
+		return 1000000.0f / idle;
+
+	return surface->commit_rate;
 }
 
 static void
 weston_surface_commit(struct weston_surface *surface)
 {
+	uint64_t now = weston_compositor_get_monotonic_time();
 	pixman_region32_t opaque;
 	int surface_width = 0;
 	int surface_height = 0;
@@ -1595,6 +2261,7 @@ weston_surface_commit(struct weston_surface *surface)
 	surface->pending.newly_attached = 0;
 
 	/* wl_surface.damage */
+	weston_surface_update_commit_rate(surface, now);
 	pixman_region32_union(&surface->damage, &surface->damage,
 			      &surface->pending.damage);
 	pixman_region32_intersect_rect(&surface->damage, &surface->damage,
@@ -1602,6 +2269,7 @@ weston_surface_commit(struct weston_surface *surface)
 				       surface->geometry.width,
 				       surface->geometry.height);
 	empty_region(&surface->pending.damage);
+	surface->compositor->damage_pass_needed = 1;
 
 	/* wl_surface.set_opaque_region */
 	pixman_region32_init_rect(&opaque, 0, 0,
@@ -1632,6 +2300,9 @@ weston_surface_commit(struct weston_surface *surface)
 
 	weston_surface_commit_subsurface_order(surface);
 
+	if (surface->commit_time == 0)
+		surface->commit_time = now;
+
 	weston_surface_schedule_repaint(surface);
 }
 
@@ -1829,6 +2500,7 @@ weston_subsurface_commit_from_cache(struct weston_subsurface *sub)
 				       surface->geometry.width,
 				       surface->geometry.height);
 	empty_region(&sub->cached.damage);
+	surface->compositor->damage_pass_needed = 1;
 
 	/* wl_surface.set_opaque_region */
 	pixman_region32_init_rect(&opaque, 0, 0,
@@ -2014,6 +2686,7 @@ subsurface_configure(struct weston_surface *surface, int32_t dx, int32_t dy,
 		assert(!wl_list_empty(&compositor->output_list));
 		surface->output = container_of(compositor->output_list.next,
 					       struct weston_output, link);
+		weston_compositor_surface_list_dirty(compositor);
 	}
 }
 
@@ -2294,6 +2967,7 @@ weston_subsurface_destroy(struct weston_subsurface *sub)
 	}
 
 	wl_list_remove(&sub->surface_destroy_listener.link);
+	weston_compositor_surface_list_dirty(sub->surface->compositor);
 	free(sub);
 }
 
@@ -2549,6 +3223,8 @@ weston_compositor_stack_plane(struct weston_compositor *ec,
 		wl_list_insert(above->link.prev, &plane->link);
 	else
 		wl_list_insert(&ec->plane_list, &plane->link);
+
+	ec->damage_pass_needed = 1;
 }
 
 static void unbind_resource(struct wl_resource *resource)
@@ -2603,7 +3279,12 @@ weston_output_destroy(struct weston_output *output)
 {
 	wl_signal_emit(&output->destroy_signal, output);
 
+	wl_event_source_remove(output->repaint_timer);
+	wl_array_release(&output->presenting);
+
 	free(output->name);
+	wl_array_release(&output->visible_list);
+	wl_array_release(&output->draw_list);
 	pixman_region32_fini(&output->region);
 	pixman_region32_fini(&output->previous_damage);
 	output->compositor->output_id_pool &= ~(1 << output->id);
@@ -2769,8 +3450,17 @@ weston_output_init(struct weston_output *output, struct weston_compositor *c,
 
 	wl_signal_init(&output->frame_signal);
 	wl_signal_init(&output->destroy_signal);
+	wl_signal_init(&output->damage_signal);
 	wl_list_init(&output->animation_list);
 	wl_list_init(&output->resource_list);
+	wl_array_init(&output->visible_list);
+	wl_array_init(&output->draw_list);
+	wl_array_init(&output->presenting);
+	output->visible_list_dirty = 1;
+
+	output->repaint_timer =
+		wl_event_loop_add_timer(wl_display_get_event_loop(c->wl_display),
+					output_repaint_timer_handler, output);
 
 	output->id = ffs(~output->compositor->output_id_pool) - 1;
 	output->compositor->output_id_pool |= 1 << output->id;
@@ -2884,6 +3574,49 @@ weston_environment_get_fd(const char *env)
 	return fd;
 }
 
+static void
+output_debug_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
+		     void *data)
+{
+	struct weston_compositor *ec = data;
+	struct weston_output *output;
+	struct weston_seat *ws;
+
+	wl_list_for_each(output, &ec->output_list, link) {
+		weston_log("output %u: last frame drew %u surfaces, "
+			   "culled %u as occluded\n", output->id,
+			   output->surfaces_drawn, output->surfaces_culled);
+		weston_log("output %u: %u frames rendered, %u skipped with "
+			   "nothing to draw\n", output->id,
+			   output->frames_rendered, output->frames_skipped);
+		if (output->latency_frames == 0)
+			continue;
+		weston_log("output %u: repaint request to frame latency "
+			   "%.2f ms average, %.2f ms max over %u frames, "
+			   "repaint window %d ms\n", output->id,
+			   output->latency_total / 1000.0 /
+			   output->latency_frames,
+			   output->latency_max / 1000.0,
+			   output->latency_frames, ec->repaint_window);
+	}
+
+	weston_log("surface list rebuilt %u times\n", ec->surface_list_rebuilds);
+
+	if (ec->pick.picks)
+		weston_log("%u surface picks tested %.1f surfaces each\n",
+			   ec->pick.picks,
+			   (float) ec->pick.candidates / ec->pick.picks);
+
+	wl_list_for_each(ws, &ec->seat_list, link) {
+		if (!ws->pointer)
+			continue;
+		weston_log("seat %s: %u motion events, delivered %u times\n",
+			   ws->seat_name ? ws->seat_name : "",
+			   ws->pointer->motion_events,
+			   ws->pointer->motion_deliveries);
+	}
+}
+
 WL_EXPORT int
 weston_compositor_init(struct weston_compositor *ec,
 		       struct wl_display *display,
@@ -2893,6 +3626,8 @@ weston_compositor_init(struct weston_compositor *ec,
 	struct wl_event_loop *loop;
 	struct xkb_rule_names xkb_names;
 	struct weston_config_section *s;
+	char *motion_batching;
+	int i;
 
 	ec->config = config;
 	ec->wl_display = display;
@@ -2927,6 +3662,13 @@ weston_compositor_init(struct weston_compositor *ec,
 	wl_list_init(&ec->button_binding_list);
 	wl_list_init(&ec->axis_binding_list);
 	wl_list_init(&ec->debug_binding_list);
+	for (i = 0; i < WESTON_BINDING_BUCKETS; i++)
+		wl_list_init(&ec->binding_table[i]);
+	for (i = 0; i < WESTON_PICK_BUCKETS; i++)
+		wl_array_init(&ec->pick.cells[i]);
+	wl_list_init(&ec->pick.unindexed);
+	ec->surface_list_dirty = 1;
+	ec->damage_pass_needed = 1;
 
 	weston_plane_init(&ec->primary_plane, 0, 0);
 	weston_compositor_stack_plane(ec, &ec->primary_plane, NULL);
@@ -2946,9 +3688,34 @@ weston_compositor_init(struct weston_compositor *ec,
 	if (weston_compositor_xkb_init(ec, &xkb_names) < 0)
 		return -1;
 
+	s = weston_config_get_section(ec->config, "core", NULL, NULL);
+	weston_config_section_get_int(s, "repaint-window",
+				      &ec->repaint_window, 0);
+
+	weston_config_section_get_string(s, "motion-batching",
+					 &motion_batching, "none");
+	if (strcmp(motion_batching, "frame") == 0)
+		ec->motion_batching = WESTON_MOTION_BATCHING_FRAME;
+	else if (strcmp(motion_batching, "rate") == 0)
+		ec->motion_batching = WESTON_MOTION_BATCHING_RATE;
+	else if (strcmp(motion_batching, "none") == 0)
+		ec->motion_batching = WESTON_MOTION_BATCHING_NONE;
+	else
+		weston_log("unknown motion-batching \"%s\", "
+			   "not batching motion\n", motion_batching);
+	free(motion_batching);
+
+	weston_config_section_get_int(s, "motion-rate", &ec->motion_rate, 125);
+	if (ec->motion_rate < 1 || ec->motion_rate > 1000) {
+		weston_log("motion-rate %d out of range, using 125\n",
+			   ec->motion_rate);
+		ec->motion_rate = 125;
+	}
+
 	ec->ping_handler = NULL;
 
 	screenshooter_create(ec);
+	frame_timing_create(ec);
 	text_cursor_position_notifier_create(ec);
 	text_backend_init(ec);
 
@@ -2956,6 +3723,9 @@ weston_compositor_init(struct weston_compositor *ec,
 
 	wl_display_init_shm(display);
 
+	weston_compositor_add_debug_binding(ec, KEY_D,
+					    output_debug_binding, ec);
+
 	loop = wl_display_get_event_loop(ec->wl_display);
 	ec->idle_source = wl_event_loop_add_timer(loop, idle_handler, ec);
 	wl_event_source_timer_update(ec->idle_source, ec->idle_time * 1000);
@@ -2974,6 +3744,7 @@ WL_EXPORT void
 weston_compositor_shutdown(struct weston_compositor *ec)
 {
 	struct weston_output *output, *next;
+	int i;
 
 	wl_event_source_remove(ec->idle_source);
 	if (ec->input_loop_source)
@@ -2990,6 +3761,9 @@ weston_compositor_shutdown(struct weston_compositor *ec)
 
 	weston_plane_release(&ec->primary_plane);
 
+	for (i = 0; i < WESTON_PICK_BUCKETS; i++)
+		wl_array_release(&ec->pick.cells[i]);
+
 	wl_event_loop_destroy(ec->input_loop);
 
 	weston_config_destroy(ec->config);
@@ -3284,6 +4058,20 @@ usage(int error_code)
 		"  --output-count=COUNT\tCreate multiple outputs\n"
 		"  --no-input\t\tDont create input devices\n\n");
 
+	fprintf(stderr,
+		"Options for headless-backend.so:\n\n"
+		"  --width=WIDTH\t\tWidth of the outputs\n"
+		"  --height=HEIGHT\tHeight of the outputs\n"
+		"  --output-count=COUNT\tCreate multiple outputs\n"
+		"  --use-pixman\t\tUse the pixman (CPU) renderer\n"
+		"  --benchmark=FRAMES\tRun a synthetic workload for FRAMES\n"
+		"\t\t\tframes, log the frame rate and exit\n"
+		"  --benchmark-rate=FPS\tFrame rate, or 0 for as fast as possible\n"
+		"  --benchmark-surfaces=N\tNumber of top level surfaces\n"
+		"  --benchmark-depth=N\tLevels of subsurfaces under each one\n"
+		"  --benchmark-damage=TYPE\tnone, partial, full or move\n"
+		"  --benchmark-transform\tRotate the top level surfaces\n\n");
+
 	fprintf(stderr,
 		"Options for wayland-backend.so:\n\n"
 		"  --width=WIDTH\t\tWidth of Wayland surface\n"
@@ -46,6 +46,10 @@ extern "C" {
 #define MIN(x,y) (((x) < (y)) ? (x) : (y))
 #endif
 
+#ifndef MAX
+#define MAX(x,y) (((x) > (y)) ? (x) : (y))
+#endif
+
 #define ARRAY_LENGTH(a) (sizeof (a) / sizeof (a)[0])
 
 #define container_of(ptr, type, member) ({				\
@@ -175,6 +179,52 @@ enum dpms_enum {
 	WESTON_DPMS_OFF
 };
 
+/* The stages of weston_output_repaint(), timed for each frame. */
+enum weston_repaint_stage {
+	WESTON_REPAINT_SURFACE_LIST,	/* surface and visible lists */
+	WESTON_REPAINT_ASSIGN_PLANES,
+	WESTON_REPAINT_DAMAGE,		/* damage pass and draw list */
+	WESTON_REPAINT_RENDER,		/* output->repaint() */
+	WESTON_REPAINT_INPUT,		/* repick and input dispatch */
+	WESTON_REPAINT_FRAME_CALLBACKS,	/* and animations */
+	WESTON_REPAINT_STAGES
+};
+
+/* Timestamps and durations are in microseconds of CLOCK_MONOTONIC. */
+struct weston_frame_timing {
+	uint32_t seq;
+	uint64_t start;
+	uint32_t stage[WESTON_REPAINT_STAGES];
+	uint32_t presented;	/* from start, 0 until presented */
+};
+
+/* Frame timings kept per output, a power of two. */
+#define WESTON_FRAME_TIMINGS 64
+
+/* Commit to present latency histogram buckets: under 1 ms, then
+ * doubling up to 64 ms and over. */
+#define WESTON_LATENCY_BUCKETS 8
+
+/* Pick grid cell size in pixels, number of hash buckets the cells go
+ * into (a power of two), and the most cells one surface may cover
+ * before it is left out of the grid. */
+#define WESTON_PICK_CELL_SIZE 128
+#define WESTON_PICK_BUCKETS 256
+#define WESTON_PICK_MAX_CELLS 256
+
+/* Number of hash buckets for key, button and axis bindings, a power of
+ * two. */
+#define WESTON_BINDING_BUCKETS 256
+
+/* When pointer motion reaches the grab, and so clients. Buttons, axis,
+ * keys and touch always flush pending motion first to keep the order
+ * of events. */
+enum weston_motion_batching {
+	WESTON_MOTION_BATCHING_NONE,	/* on every motion event */
+	WESTON_MOTION_BATCHING_FRAME,	/* once per output repaint */
+	WESTON_MOTION_BATCHING_RATE	/* at most motion_rate times a second */
+};
+
 struct weston_output {
 	uint32_t id;
 	char *name;
@@ -198,9 +248,56 @@ struct weston_output {
 	int dirty;
 	struct wl_signal frame_signal;
 	struct wl_signal destroy_signal;
+	/* Emitted with the damage about to be repainted, in global
+	 * coordinates. Unlike frame_signal, listening to it doesn't keep
+	 * the output repainting when nothing changed. */
+	struct wl_signal damage_signal;
 	uint32_t frame_time;
 	int disable_planes;
 
+	/* The surfaces of compositor->surface_list that intersect this
+	 * output or sync their frame callbacks to it, top to bottom.
+	 * Rebuilt before a repaint whenever visible_list_dirty is set. */
+	struct wl_array visible_list; /* struct weston_surface * */
+	int visible_list_dirty;
+
+	/* The primary plane surfaces of visible_list the renderer has to
+	 * draw in this frame, top to bottom, and how many of them were
+	 * drawn and culled as fully occluded. */
+	struct wl_array draw_list; /* struct weston_surface * */
+	uint32_t surfaces_drawn;
+	uint32_t surfaces_culled;
+
+	/* With a repaint window, the repaint after a frame is delayed by
+	 * this timer until shortly before the next vblank. The latency
+	 * is measured from the first repaint request after a repaint to
+	 * the frame that shows the result, in microseconds. */
+	struct wl_event_source *repaint_timer;
+	uint64_t repaint_request_time;
+	uint64_t repaint_drawn_time;	/* 0 if no frame is in flight */
+	uint32_t latency_frames;
+	uint64_t latency_total;
+	uint64_t latency_max;
+
+	/* Repaints that drew a frame, and the ones skipped as there was
+	 * nothing new to draw, see weston_output_repaint(). The damage
+	 * pass last seen by a repaint of this output, in
+	 * compositor->damage_passes. */
+	uint32_t frames_rendered;
+	uint32_t frames_skipped;
+	uint32_t damage_pass_seen;
+
+	/* The timings of the last WESTON_FRAME_TIMINGS repaints, written
+	 * at timing_seq % WESTON_FRAME_TIMINGS. Entries are only ever
+	 * written by the repaint of this output; a reader can tell an
+	 * entry was overwritten from its seq. */
+	struct weston_frame_timing timings[WESTON_FRAME_TIMINGS];
+	uint32_t timing_seq;
+
+	/* Surfaces whose commits went into the frame waiting to be
+	 * presented. Destroyed surfaces are set to NULL. */
+	struct wl_array presenting; /* struct weston_surface * */
+
 	char *make, *model, *serial_number;
 	uint32_t subpixel;
 	uint32_t transform;
@@ -322,6 +419,16 @@ struct weston_pointer {
 
 	wl_fixed_t x, y;
 	uint32_t button_count;
+
+	/* Motion held back from the grab while batching, see
+	 * enum weston_motion_batching, and how many motion events came
+	 * in and how many times motion was delivered. */
+	int motion_pending;
+	uint32_t motion_time;
+	uint32_t motion_flush_time;
+	struct wl_event_source *motion_timer;
+	uint32_t motion_events;
+	uint32_t motion_deliveries;
 };
 
 
@@ -489,6 +596,10 @@ enum {
                                          * to off */
 };
 
+/* Surfaces enter and leave a layer through weston_layer_entry_insert() and
+ * weston_layer_entry_remove(). Code that reorders compositor->layer_list
+ * directly must call weston_compositor_surface_list_dirty() afterwards.
+ */
 struct weston_layer {
 	struct wl_list surface_list;
 	struct wl_list link;
@@ -564,6 +675,10 @@ struct weston_compositor {
 	struct wl_list axis_binding_list;
 	struct wl_list debug_binding_list;
 
+	/* Key, button and axis bindings hashed by kind, code and modifier,
+	 * in registration order within each bucket. */
+	struct wl_list binding_table[WESTON_BINDING_BUCKETS];
+
 	uint32_t state;
 	struct wl_event_source *idle_source;
 	uint32_t idle_inhibit;
@@ -571,6 +686,40 @@ struct weston_compositor {
 
 	/* Repaint state. */
 	struct weston_plane primary_plane;
+
+	/* Set whenever the stacking of surface_list may have changed, see
+	 * weston_compositor_surface_list_dirty(). surface_list is only
+	 * rebuilt from the layers when this is set. */
+	int surface_list_dirty;
+	uint32_t surface_list_rebuilds;
+
+	/* Set whenever surface damage, stacking or plane assignment changed
+	 * since the last damage pass. The per-surface clip and the plane
+	 * damage it produces are shared by all outputs repainting in the
+	 * same frame cycle; only the first one to repaint redoes it. */
+	int damage_pass_needed;
+	uint32_t damage_passes;
+
+	/* How long before the predicted next vblank to repaint, in ms.
+	 * 0 repaints right after the previous one, as soon as needed. */
+	int32_t repaint_window;
+
+	enum weston_motion_batching motion_batching;
+	int32_t motion_rate;		/* Hz */
+
+	/* Surfaces hashed into a grid of WESTON_PICK_CELL_SIZE cells by
+	 * their transformed bounding box, for
+	 * weston_compositor_pick_surface(). Surfaces with a dirty
+	 * transform or too large for the grid are kept in 'unindexed'
+	 * and always considered. */
+	struct {
+		struct wl_array cells[WESTON_PICK_BUCKETS];
+		struct wl_list unindexed;	/* weston_surface::pick.link */
+		uint32_t next_order;
+		uint32_t picks;
+		uint32_t candidates;
+	} pick;
+
 	uint32_t capabilities; /* combination of enum weston_capability */
 
 	uint32_t focus;
@@ -815,6 +964,31 @@ struct weston_surface {
 	 */
 	struct wl_list subsurface_list; /* weston_subsurface::parent_link */
 	struct wl_list subsurface_list_pending; /* ...::parent_link_pending */
+
+	/* Time of the first commit not drawn yet, and of the one drawn in
+	 * the frame waiting to be presented, 0 if none. Commit to present
+	 * latencies are counted in latency_histogram, see
+	 * weston_latency_bucket(). */
+	uint64_t commit_time;
+	uint64_t drawn_commit_time;
+	uint32_t latency_histogram[WESTON_LATENCY_BUCKETS];
+
+	/* Decaying averages of how often the surface is committed and how
+	 * much of it changes each time, for plane assignment. Read the
+	 * rate with weston_surface_get_commit_rate(). */
+	uint64_t last_commit_time;
+	float commit_rate;		/* commits per second */
+	float damage_area;		/* damaged pixels per commit */
+
+	/* Where the surface is in the compositor pick grid: its range of
+	 * cells, or in the unindexed list when 'indexed' is 0. 'order' is
+	 * its position in surface_list as of the last rebuild. */
+	struct {
+		struct wl_list link;
+		int indexed;
+		int32_t x1, y1, x2, y2;
+		uint32_t order;
+	} pick;
 };
 
 enum weston_key_state_update {
@@ -883,6 +1057,8 @@ void
 notify_motion_absolute(struct weston_seat *seat, uint32_t time,
 		       wl_fixed_t x, wl_fixed_t y);
 void
+weston_compositor_flush_motion(struct weston_compositor *compositor);
+void
 notify_button(struct weston_seat *seat, uint32_t time, int32_t button,
 	      enum wl_pointer_button_state state);
 void
@@ -911,6 +1087,13 @@ notify_touch(struct weston_seat *seat, uint32_t time, int touch_id,
 
 void
 weston_layer_init(struct weston_layer *layer, struct wl_list *below);
+void
+weston_layer_entry_insert(struct wl_list *list, struct weston_surface *surface);
+void
+weston_layer_entry_remove(struct weston_surface *surface);
+
+void
+weston_compositor_surface_list_dirty(struct weston_compositor *compositor);
 
 void
 weston_plane_init(struct weston_plane *plane, int32_t x, int32_t y);
@@ -924,6 +1107,9 @@ weston_compositor_stack_plane(struct weston_compositor *ec,
 
 void
 weston_output_finish_frame(struct weston_output *output, uint32_t msecs);
+int64_t
+weston_output_repaint_delay(struct weston_output *output,
+			    uint32_t frame_time, uint64_t now);
 void
 weston_output_schedule_repaint(struct weston_output *output);
 void
@@ -1036,12 +1222,19 @@ weston_surface_set_transform_parent(struct weston_surface *surface,
 int
 weston_surface_is_mapped(struct weston_surface *surface);
 
+float
+weston_surface_get_commit_rate(struct weston_surface *surface);
+
 void
 weston_surface_schedule_repaint(struct weston_surface *surface);
 
 void
 weston_surface_damage(struct weston_surface *surface);
 
+void
+weston_surface_damage_rect(struct weston_surface *surface,
+			   int32_t x, int32_t y, int32_t width, int32_t height);
+
 void
 weston_surface_damage_below(struct weston_surface *surface);
 
@@ -1151,6 +1344,40 @@ tty_activate_vt(struct tty *tty, int vt);
 void
 screenshooter_create(struct weston_compositor *ec);
 
+struct weston_screenshooter_damage;
+
+struct weston_screenshooter_damage_interface {
+	/* A rectangle of the buffer, in output pixels, was updated. */
+	void (*damage)(void *data, int32_t x, int32_t y,
+		       int32_t width, int32_t height);
+	/* The shot is complete, or failed if 'status' is negative. */
+	void (*done)(void *data, int status);
+};
+
+struct weston_screenshooter_damage *
+weston_screenshooter_damage_create(struct weston_output *output,
+				   const struct weston_screenshooter_damage_interface *interface,
+				   void *data);
+
+int
+weston_screenshooter_damage_shoot(struct weston_screenshooter_damage *sd,
+				  struct weston_buffer *buffer);
+
+void
+weston_screenshooter_damage_destroy(struct weston_screenshooter_damage *sd);
+
+void
+frame_timing_create(struct weston_compositor *ec);
+
+const char *
+weston_repaint_stage_name(enum weston_repaint_stage stage);
+
+uint64_t
+weston_compositor_get_monotonic_time(void);
+
+int
+weston_latency_bucket(uint64_t latency);
+
 struct clipboard *
 clipboard_create(struct weston_seat *seat);
 
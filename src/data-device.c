@@ -184,7 +184,7 @@ drag_surface_configure(struct weston_surface *es, int32_t sx, int32_t sy, int32_
 		else
 			list = &es->compositor->cursor_layer.surface_list;
 
-		wl_list_insert(list, &es->layer_link);
+		weston_layer_entry_insert(list, es);
 		weston_surface_update_transform(es);
 		empty_region(&es->pending.input);
 	}
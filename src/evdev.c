@@ -386,27 +386,30 @@ fallback_dispatch_create(void)
 static void
 libevdev_process_events(struct libevdev_device *dev)
 {
-	struct input_event ev;
-	int rc;
-	uint32_t time;
+	struct evdev_dispatch *dispatch = dev->device->dispatch;
+	struct input_event *ev, *end, *events;
+	uint32_t time = 0;
 	int did_motion = 0;
-	do {
-		rc = libevdev_next_event(dev->dev, LIBEVDEV_READ_NORMAL, &ev);
+	int rc;
 
-		if (rc == 0) {
-			time = ev.time.tv_sec * 1000 + ev.time.tv_usec / 1000;
+	/* A frame at a time, up to the SYN_REPORT. libevdev only reads
+	 * the fd again once all queued frames are handled. */
+	while ((rc = libevdev_next_frame(dev->dev, &events)) >= 0) {
+		end = events + rc;
+		for (ev = events; ev < end; ev++) {
+			time = ev->time.tv_sec * 1000 + ev->time.tv_usec / 1000;
 			/* we try to minimize the amount of notifications to be
 			 * forwarded to the compositor, so we accumulate motion
 			 * events and send as a bunch */
-			if (!is_motion_event(&ev))
+			if (!is_motion_event(ev))
 				evdev_flush_motion(dev->device, time);
 			else
 				did_motion = 1;
 
-			dev->device->dispatch->interface->process(
-					dev->device->dispatch, dev->device, &ev, time);
+			dispatch->interface->process(dispatch, dev->device,
+						     ev, time);
 		}
-	} while (rc == 1 || rc == 0);
+	}
 
 	if (did_motion)
 		evdev_flush_motion(dev->device, time);
@@ -418,8 +421,14 @@ libevdev_device_data(int fd, uint32_t mask, void *data)
 	struct libevdev_device *device = data;
 	struct weston_compositor *ec = device->device->seat->compositor;
 
-	if (!ec->focus)
+	/* The input thread keeps reading without focus, and its queue
+	 * is only emptied here. Drop what it queued, or it stalls on a
+	 * full queue and the stale events replay once focus is back. */
+	if (!ec->focus) {
+		if (device->thread_source)
+			input_thread_source_flush(device->thread_source);
 		return 1;
+	}
 
 	libevdev_process_events(device);
 
@@ -651,7 +660,8 @@ evdev_device_destroy(struct evdev_device *device)
 }
 
 struct libevdev_device *
-libevdev_device_create(struct weston_seat *seat, const char *path, int device_fd)
+libevdev_device_create(struct weston_seat *seat, const char *path, int device_fd,
+		       struct input_thread *thread)
 {
 	struct libevdev_device *device = NULL;
 	struct libevdev *dev = NULL;
@@ -681,14 +691,32 @@ libevdev_device_create(struct weston_seat *seat, const char *path, int device_fd
 		return NULL;
 	}
 
-	device->device->source = wl_event_loop_add_fd(ec->input_loop, device_fd,
-					      WL_EVENT_READABLE,
-					      libevdev_device_data, device);
-	if (device->device->source == NULL) {
-		evdev_device_destroy(device->device);
-		libevdev_free(dev); 	
-		free(device);
-		return NULL;
+	/* With an input thread, the thread reads the fd and libevdev
+	 * reads from the queue it fills. */
+	if (thread) {
+		device->thread_source =
+			input_thread_add_fd(thread, device_fd,
+					    device->device->devname,
+					    libevdev_device_data, device);
+		if (device->thread_source == NULL) {
+			evdev_device_destroy(device->device);
+			libevdev_free(dev);
+			free(device);
+			return NULL;
+		}
+		libevdev_set_read_func(dev, input_thread_source_read,
+				       device->thread_source);
+	} else {
+		device->device->source =
+			wl_event_loop_add_fd(ec->input_loop, device_fd,
+					     WL_EVENT_READABLE,
+					     libevdev_device_data, device);
+		if (device->device->source == NULL) {
+			evdev_device_destroy(device->device);
+			libevdev_free(dev);
+			free(device);
+			return NULL;
+		}
 	}
 
 	device->dev = dev;
@@ -700,7 +728,19 @@ libevdev_device_create(struct weston_seat *seat, const char *path, int device_fd
 void
 libevdev_device_destroy(struct libevdev_device *device)
 {
+	struct libevdev_read_stats stats;
+
+	libevdev_get_read_stats(device->dev, &stats);
+	weston_log("input device %s: %u reads, %.1f events per read, "
+		   "%.2f reads per frame, %u SYN_DROPPED\n",
+		   device->device->devname, stats.reads,
+		   stats.reads ? (float) stats.events / stats.reads : 0.0f,
+		   stats.frames ? (float) stats.reads / stats.frames : 0.0f,
+		   stats.syn_dropped);
+
 	wl_list_remove(&device->link);
+	if (device->thread_source)
+		input_thread_source_remove(device->thread_source);
 	evdev_device_destroy(device->device);
 	libevdev_free(device->dev); 	
 	free(device);
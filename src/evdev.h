@@ -29,6 +29,8 @@
 #include <linux/input.h>
 #include <wayland-util.h>
 
+#include "input-thread.h"
+
 #define MAX_SLOTS 16
 
 enum evdev_event_type {
@@ -86,6 +88,7 @@ struct libevdev_device {
 	struct libevdev *dev;
 	struct wl_list link;
 	struct evdev_device *device; /*for backward compatibility?*/
+	struct input_thread_source *thread_source;
 };
 
 /* copied from udev/extras/input_id/input_id.c */
@@ -133,7 +136,8 @@ void
 evdev_device_destroy(struct evdev_device *device);
 
 struct libevdev_device *
-libevdev_device_create(struct weston_seat *seat, const char *path, int device_fd);
+libevdev_device_create(struct weston_seat *seat, const char *path, int device_fd,
+		       struct input_thread *thread);
 
 void
 libevdev_device_destroy(struct libevdev_device *device);
@@ -0,0 +1,250 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <linux/input.h>
+
+#include "compositor.h"
+#include "frame-timing-server-protocol.h"
+
+/* The repaint loop fills in output->timings as a ring, see
+ * weston_output_repaint(). Entries are only ever written by the
+ * repaint of their output and are complete once their seq matches,
+ * so reading them back here never takes a lock. */
+
+static const char *stage_names[WESTON_REPAINT_STAGES] = {
+	"list", "planes", "damage", "render", "input", "callbacks"
+};
+
+WL_EXPORT const char *
+weston_repaint_stage_name(enum weston_repaint_stage stage)
+{
+	return stage_names[stage];
+}
+
+static int
+frame_timing_first(struct weston_output *output, uint32_t *seq)
+{
+	if (output->timing_seq == 0)
+		return 0;
+
+	if (output->timing_seq > WESTON_FRAME_TIMINGS)
+		*seq = output->timing_seq - WESTON_FRAME_TIMINGS;
+	else
+		*seq = 0;
+
+	return 1;
+}
+
+static void
+frame_timing_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static void
+frame_timing_get_output_timings(struct wl_client *client,
+				struct wl_resource *resource,
+				struct wl_resource *output_resource)
+{
+	struct weston_output *output =
+		wl_resource_get_user_data(output_resource);
+	struct weston_frame_timing *timing;
+	struct wl_array stages;
+	uint32_t seq, *p;
+
+	wl_array_init(&stages);
+	p = wl_array_add(&stages, sizeof timing->stage);
+	if (p == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	if (frame_timing_first(output, &seq)) {
+		for (; seq != output->timing_seq; seq++) {
+			timing = &output->timings[seq % WESTON_FRAME_TIMINGS];
+			if (timing->seq != seq)
+				continue;
+
+			memcpy(p, timing->stage, sizeof timing->stage);
+			weston_frame_timing_send_frame(resource, seq,
+						       timing->start >> 32,
+						       timing->start,
+						       &stages,
+						       timing->presented);
+		}
+	}
+
+	weston_frame_timing_send_done(resource);
+	wl_array_release(&stages);
+}
+
+static void
+frame_timing_get_surface_latency(struct wl_client *client,
+				 struct wl_resource *resource,
+				 struct wl_resource *surface_resource)
+{
+	struct weston_surface *surface =
+		wl_resource_get_user_data(surface_resource);
+	struct wl_array histogram;
+	uint32_t *p;
+
+	wl_array_init(&histogram);
+	p = wl_array_add(&histogram, sizeof surface->latency_histogram);
+	if (p == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	memcpy(p, surface->latency_histogram,
+	       sizeof surface->latency_histogram);
+
+	weston_frame_timing_send_surface_latency(resource, &histogram);
+	weston_frame_timing_send_done(resource);
+	wl_array_release(&histogram);
+}
+
+static const struct weston_frame_timing_interface frame_timing_implementation = {
+	frame_timing_destroy,
+	frame_timing_get_output_timings,
+	frame_timing_get_surface_latency
+};
+
+static void
+bind_frame_timing(struct wl_client *client,
+		  void *data, uint32_t version, uint32_t id)
+{
+	struct wl_resource *resource;
+
+	resource = wl_resource_create(client, &weston_frame_timing_interface,
+				      1, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(resource, &frame_timing_implementation,
+				       data, NULL);
+}
+
+static void
+frame_timing_log_output(struct weston_output *output)
+{
+	struct weston_frame_timing *timing;
+	uint64_t total[WESTON_REPAINT_STAGES] = { 0 }, presented = 0;
+	uint32_t seq, max = 0, sum;
+	int i, n = 0, np = 0;
+
+	if (!frame_timing_first(output, &seq))
+		return;
+
+	for (; seq != output->timing_seq; seq++) {
+		timing = &output->timings[seq % WESTON_FRAME_TIMINGS];
+		if (timing->seq != seq)
+			continue;
+
+		sum = 0;
+		for (i = 0; i < WESTON_REPAINT_STAGES; i++) {
+			total[i] += timing->stage[i];
+			sum += timing->stage[i];
+		}
+		if (sum > max)
+			max = sum;
+		if (timing->presented) {
+			presented += timing->presented;
+			np++;
+		}
+		n++;
+	}
+
+	if (n == 0)
+		return;
+
+	weston_log("output %s: %d frames, slowest repaint %u us\n",
+		   output->name, n, max);
+	for (i = 0; i < WESTON_REPAINT_STAGES; i++)
+		weston_log_continue("  %-10s %6u us avg\n", stage_names[i],
+				    (uint32_t) (total[i] / n));
+	if (np)
+		weston_log_continue("  %-10s %6u us avg\n", "presented",
+				    (uint32_t) (presented / np));
+}
+
+static void
+frame_timing_log_surface(struct weston_surface *surface)
+{
+	static const char *bucket_names[WESTON_LATENCY_BUCKETS] = {
+		"<1", "<2", "<4", "<8", "<16", "<32", "<64", ">=64"
+	};
+	uint32_t count = 0;
+	int i;
+
+	for (i = 0; i < WESTON_LATENCY_BUCKETS; i++)
+		count += surface->latency_histogram[i];
+
+	if (count == 0)
+		return;
+
+	weston_log("surface %p, %u frames, commit to present (ms):\n",
+		   surface, count);
+	for (i = 0; i < WESTON_LATENCY_BUCKETS; i++)
+		if (surface->latency_histogram[i])
+			weston_log_continue("  %-5s %u\n", bucket_names[i],
+					    surface->latency_histogram[i]);
+}
+
+static void
+frame_timing_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
+		     void *data)
+{
+	struct weston_compositor *ec = data;
+	struct weston_output *output;
+	struct weston_surface *surface;
+
+	wl_list_for_each(output, &ec->output_list, link)
+		frame_timing_log_output(output);
+
+	wl_list_for_each(surface, &ec->surface_list, link)
+		frame_timing_log_surface(surface);
+}
+
+void
+frame_timing_create(struct weston_compositor *ec)
+{
+	struct weston_config_section *section;
+	int enabled;
+
+	weston_compositor_add_debug_binding(ec, KEY_T,
+					    frame_timing_binding, ec);
+
+	section = weston_config_get_section(ec->config, "core", NULL, NULL);
+	weston_config_section_get_bool(section, "frame-timing-protocol",
+				       &enabled, 0);
+	if (!enabled)
+		return;
+
+	if (!wl_global_create(ec->wl_display, &weston_frame_timing_interface,
+			      1, ec, bind_frame_timing))
+		weston_log("failed to create the frame timing global\n");
+}
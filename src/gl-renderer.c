@@ -26,6 +26,7 @@
 #include <GLES2/gl2ext.h>
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <ctype.h>
 #include <float.h>
@@ -33,6 +34,7 @@
 #include <linux/input.h>
 
 #include "gl-renderer.h"
+#include "vertex-clipping.h"
 
 #include <EGL/eglext.h>
 #include "weston-egl-ext.h"
@@ -45,6 +47,11 @@ struct gl_shader {
 	GLint alpha_uniform;
 	GLint color_uniform;
 	const char *vertex_source, *fragment_source;
+
+	/* Whose uniforms are loaded, see shader_uniforms(). */
+	struct weston_surface *uniform_surface;
+	struct weston_output *uniform_output;
+	uint32_t uniform_frame;
 };
 
 #define BUFFER_DAMAGE_COUNT 2
@@ -54,6 +61,20 @@ struct gl_output_state {
 	pixman_region32_t buffer_damage[BUFFER_DAMAGE_COUNT];
 };
 
+#if defined(GL_NV_pixel_buffer_object) && \
+    defined(GL_EXT_map_buffer_range) && defined(GL_OES_mapbuffer)
+#define HAVE_GL_PBO
+#endif
+
+/* Pixel buffer objects per surface state used for wl_shm uploads, in
+ * turns, so that filling one never waits for the texture upload from
+ * the previous one. */
+#define PBO_COUNT 2
+
+/* Defaults for the [renderer] damage coalescing keys of weston.ini. */
+#define DEFAULT_COALESCE_THRESHOLD 25
+#define DEFAULT_COALESCE_MAX_RECTS 32
+
 enum buffer_type {
 	BUFFER_TYPE_NULL,
 	BUFFER_TYPE_SHM,
@@ -69,6 +90,9 @@ struct gl_surface_state {
 	int needs_full_upload;
 	pixman_region32_t texture_damage;
 
+	GLuint pbos[PBO_COUNT];
+	int current_pbo;
+
 	EGLImageKHR images[3];
 	GLenum target;
 	int num_images;
@@ -79,6 +103,31 @@ struct gl_surface_state {
 	int height; /* in pixels */
 };
 
+struct coalesce_stats {
+	uint32_t rects_in, rects_out;
+};
+
+/* GL calls issued to repaint the surfaces of an output. */
+struct gl_call_stats {
+	uint32_t draws;
+	uint32_t programs;
+	uint32_t uniforms;
+	uint32_t textures;
+	uint32_t blend;
+};
+
+/* A draw recorded for the frame's batch, see batch_region(). */
+struct batch_draw {
+	struct weston_surface *surface;
+	struct gl_shader *shader;
+	int blend;
+	GLint filter;
+	int first, count; /* in gr->batch_indices */
+};
+
+/* Indices are GLushort, as GLES2 has no core 32-bit indices. */
+#define BATCH_MAX_VERTICES 65536
+
 struct gl_renderer {
 	struct weston_renderer base;
 	int fragment_shader_debug;
@@ -98,12 +147,36 @@ struct gl_renderer {
 	struct wl_array indices; /* only used in compositor-wayland */
 	struct wl_array vtxcnt;
 
+	/* Damage coalescing, see coalesce_region(). */
+	int32_t coalesce_threshold; /* in percent, 0 disables */
+	int32_t coalesce_max_rects;
+	struct wl_array coalesced; /* pixman_box32_t */
+	struct coalesce_stats coalesce_upload, coalesce_draw;
+
+	/* Draw batching: the surfaces of a frame are drawn from one
+	 * vertex array, with one glDrawElements() per surface part, and
+	 * GL state is only set when it changes. */
+	int batch_draws;
+	struct wl_array batch; /* struct batch_draw */
+	struct wl_array batch_indices; /* GLushort */
+	uint32_t frame;
+	struct weston_surface *texture_surface;
+	GLint texture_filter;
+	int blend;
+	struct gl_call_stats calls, last_calls;
+
 	PFNGLEGLIMAGETARGETTEXTURE2DOESPROC image_target_texture_2d;
 	PFNEGLCREATEIMAGEKHRPROC create_image;
 	PFNEGLDESTROYIMAGEKHRPROC destroy_image;
 
 	int has_unpack_subimage;
 
+#ifdef HAVE_GL_PBO
+	PFNGLMAPBUFFERRANGEEXTPROC map_buffer_range;
+	PFNGLUNMAPBUFFEROESPROC unmap_buffer;
+#endif
+	int has_pbo;
+
 	PFNEGLBINDWAYLANDDISPLAYWL bind_display;
 	PFNEGLUNBINDWAYLANDDISPLAYWL unbind_display;
 	PFNEGLQUERYWAYLANDBUFFERWL query_buffer;
@@ -178,366 +251,143 @@ gl_renderer_print_egl_error_state(void)
 		egl_error_string(code), (long)code);
 }
 
-struct polygon8 {
-	GLfloat x[8];
-	GLfloat y[8];
-	int n;
-};
-
-struct clip_context {
-	struct {
-		GLfloat x;
-		GLfloat y;
-	} prev;
-
-	struct {
-		GLfloat x1, y1;
-		GLfloat x2, y2;
-	} clip;
-
-	struct {
-		GLfloat *x;
-		GLfloat *y;
-	} vertices;
-};
-
-static GLfloat
-float_difference(GLfloat a, GLfloat b)
+static int
+box_overlaps(const pixman_box32_t *a, const pixman_box32_t *b)
 {
-	/* http://www.altdevblogaday.com/2012/02/22/comparing-floating-point-numbers-2012-edition/ */
-	static const GLfloat max_diff = 4.0f * FLT_MIN;
-	static const GLfloat max_rel_diff = 4.0e-5;
-	GLfloat diff = a - b;
-	GLfloat adiff = fabsf(diff);
-
-	if (adiff <= max_diff)
-		return 0.0f;
-
-	a = fabsf(a);
-	b = fabsf(b);
-	if (adiff <= (a > b ? a : b) * max_rel_diff)
-		return 0.0f;
-
-	return diff;
+	return a->x1 < b->x2 && b->x1 < a->x2 &&
+		a->y1 < b->y2 && b->y1 < a->y2;
 }
 
-/* A line segment (p1x, p1y)-(p2x, p2y) intersects the line x = x_arg.
- * Compute the y coordinate of the intersection.
- */
-static GLfloat
-clip_intersect_y(GLfloat p1x, GLfloat p1y, GLfloat p2x, GLfloat p2y,
-		 GLfloat x_arg)
+static int
+box_contains(const pixman_box32_t *a, const pixman_box32_t *b)
 {
-	GLfloat a;
-	GLfloat diff = float_difference(p1x, p2x);
-
-	/* Practically vertical line segment, yet the end points have already
-	 * been determined to be on different sides of the line. Therefore
-	 * the line segment is part of the line and intersects everywhere.
-	 * Return the end point, so we use the whole line segment.
-	 */
-	if (diff == 0.0f)
-		return p2y;
-
-	a = (x_arg - p2x) / diff;
-	return p2y + (p1y - p2y) * a;
+	return a->x1 <= b->x1 && b->x2 <= a->x2 &&
+		a->y1 <= b->y1 && b->y2 <= a->y2;
 }
 
-/* A line segment (p1x, p1y)-(p2x, p2y) intersects the line y = y_arg.
- * Compute the x coordinate of the intersection.
+/* Merge the rectangles of 'region' into fewer boxes, to cut down on the
+ * per rectangle cost of texture uploads and triangle fans. A rectangle is
+ * merged into a box when the bounding box of both wastes at most
+ * coalesce_threshold percent of its area on pixels outside of the
+ * region, does not overlap any other box, and does not cut through a
+ * rectangle still to come. A rectangle that a box has grown over
+ * entirely is counted towards it instead of being added. So the boxes
+ * are disjoint and cover the region, and each rectangle is counted in
+ * exactly one box. Regions with more than coalesce_max_rects rectangles
+ * are replaced by their extents outright.
+ *
+ * The boxes are stored in gr->coalesced, valid until the next call, and
+ * may be modified by the caller. Returns their number, or -1 on failure,
+ * and updates the rectangle counters in 'stats'.
  */
-static GLfloat
-clip_intersect_x(GLfloat p1x, GLfloat p1y, GLfloat p2x, GLfloat p2y,
-		 GLfloat y_arg)
-{
-	GLfloat a;
-	GLfloat diff = float_difference(p1y, p2y);
-
-	/* Practically horizontal line segment, yet the end points have already
-	 * been determined to be on different sides of the line. Therefore
-	 * the line segment is part of the line and intersects everywhere.
-	 * Return the end point, so we use the whole line segment.
-	 */
-	if (diff == 0.0f)
-		return p2x;
-
-	a = (y_arg - p2y) / diff;
-	return p2x + (p1x - p2x) * a;
-}
-
-enum path_transition {
-	PATH_TRANSITION_OUT_TO_OUT = 0,
-	PATH_TRANSITION_OUT_TO_IN = 1,
-	PATH_TRANSITION_IN_TO_OUT = 2,
-	PATH_TRANSITION_IN_TO_IN = 3,
-};
-
-static void
-clip_append_vertex(struct clip_context *ctx, GLfloat x, GLfloat y)
+static int
+coalesce_region(struct gl_renderer *gr, pixman_region32_t *region,
+		pixman_box32_t **boxes, struct coalesce_stats *stats)
 {
-	*ctx->vertices.x++ = x;
-	*ctx->vertices.y++ = y;
-}
+	pixman_box32_t *rects, *out, box;
+	int64_t *covered, area, merged;
+	int i, j, k, m, n, nout;
 
-static enum path_transition
-path_transition_left_edge(struct clip_context *ctx, GLfloat x, GLfloat y)
-{
-	return ((ctx->prev.x >= ctx->clip.x1) << 1) | (x >= ctx->clip.x1);
-}
+	rects = pixman_region32_rectangles(region, &n);
 
-static enum path_transition
-path_transition_right_edge(struct clip_context *ctx, GLfloat x, GLfloat y)
-{
-	return ((ctx->prev.x < ctx->clip.x2) << 1) | (x < ctx->clip.x2);
-}
+	gr->coalesced.size = 0;
+	out = wl_array_add(&gr->coalesced,
+			   n * (sizeof *out + sizeof *covered));
+	if (out == NULL)
+		return -1;
 
-static enum path_transition
-path_transition_top_edge(struct clip_context *ctx, GLfloat x, GLfloat y)
-{
-	return ((ctx->prev.y >= ctx->clip.y1) << 1) | (y >= ctx->clip.y1);
-}
+	*boxes = out;
+	covered = (int64_t *) (out + n);
 
-static enum path_transition
-path_transition_bottom_edge(struct clip_context *ctx, GLfloat x, GLfloat y)
-{
-	return ((ctx->prev.y < ctx->clip.y2) << 1) | (y < ctx->clip.y2);
-}
+	if (gr->coalesce_threshold <= 0 || n < 2) {
+		memcpy(out, rects, n * sizeof *out);
+		nout = n;
+	} else if (n > gr->coalesce_max_rects) {
+		out[0] = *pixman_region32_extents(region);
+		nout = 1;
+	} else {
+		nout = 0;
+		for (i = 0; i < n; i++) {
+			area = (int64_t) (rects[i].x2 - rects[i].x1) *
+				(rects[i].y2 - rects[i].y1);
+
+			for (k = 0; k < nout; k++)
+				if (box_contains(&out[k], &rects[i]))
+					break;
+			if (k < nout) {
+				covered[k] += area;
+				continue;
+			}
 
-static void
-clip_polygon_leftright(struct clip_context *ctx,
-		       enum path_transition transition,
-		       GLfloat x, GLfloat y, GLfloat clip_x)
-{
-	GLfloat yi;
+			for (j = nout - 1; j >= 0; j--) {
+				box.x1 = MIN(out[j].x1, rects[i].x1);
+				box.y1 = MIN(out[j].y1, rects[i].y1);
+				box.x2 = MAX(out[j].x2, rects[i].x2);
+				box.y2 = MAX(out[j].y2, rects[i].y2);
+				merged = (int64_t) (box.x2 - box.x1) *
+					(box.y2 - box.y1);
+
+				if ((merged - covered[j] - area) * 100 >
+				    merged * gr->coalesce_threshold)
+					continue;
+
+				for (k = 0; k < nout; k++)
+					if (k != j && box_overlaps(&box, &out[k]))
+						break;
+				if (k < nout)
+					continue;
+
+				for (m = i + 1; m < n; m++)
+					if (box_overlaps(&box, &rects[m]) &&
+					    !box_contains(&box, &rects[m]))
+						break;
+				if (m < n)
+					continue;
+
+				out[j] = box;
+				covered[j] += area;
+				break;
+			}
 
-	switch (transition) {
-	case PATH_TRANSITION_IN_TO_IN:
-		clip_append_vertex(ctx, x, y);
-		break;
-	case PATH_TRANSITION_IN_TO_OUT:
-		yi = clip_intersect_y(ctx->prev.x, ctx->prev.y, x, y, clip_x);
-		clip_append_vertex(ctx, clip_x, yi);
-		break;
-	case PATH_TRANSITION_OUT_TO_IN:
-		yi = clip_intersect_y(ctx->prev.x, ctx->prev.y, x, y, clip_x);
-		clip_append_vertex(ctx, clip_x, yi);
-		clip_append_vertex(ctx, x, y);
-		break;
-	case PATH_TRANSITION_OUT_TO_OUT:
-		/* nothing */
-		break;
-	default:
-		assert(0 && "bad enum path_transition");
+			if (j < 0) {
+				out[nout] = rects[i];
+				covered[nout] = area;
+				nout++;
+			}
+		}
 	}
 
-	ctx->prev.x = x;
-	ctx->prev.y = y;
-}
+	stats->rects_in += n;
+	stats->rects_out += nout;
 
-static void
-clip_polygon_topbottom(struct clip_context *ctx,
-		       enum path_transition transition,
-		       GLfloat x, GLfloat y, GLfloat clip_y)
-{
-	GLfloat xi;
-
-	switch (transition) {
-	case PATH_TRANSITION_IN_TO_IN:
-		clip_append_vertex(ctx, x, y);
-		break;
-	case PATH_TRANSITION_IN_TO_OUT:
-		xi = clip_intersect_x(ctx->prev.x, ctx->prev.y, x, y, clip_y);
-		clip_append_vertex(ctx, xi, clip_y);
-		break;
-	case PATH_TRANSITION_OUT_TO_IN:
-		xi = clip_intersect_x(ctx->prev.x, ctx->prev.y, x, y, clip_y);
-		clip_append_vertex(ctx, xi, clip_y);
-		clip_append_vertex(ctx, x, y);
-		break;
-	case PATH_TRANSITION_OUT_TO_OUT:
-		/* nothing */
-		break;
-	default:
-		assert(0 && "bad enum path_transition");
-	}
-
-	ctx->prev.x = x;
-	ctx->prev.y = y;
+	return nout;
 }
 
+/* Repainting more than the damage is always correct, so the output
+ * damage is coalesced before any surface is drawn, which bounds the
+ * rectangles repaint_region() turns into triangle fans for every surface.
+ * Coalescing the repaint region of each surface instead would draw over
+ * the surfaces stacked above it.
+ */
 static void
-clip_context_prepare(struct clip_context *ctx, const struct polygon8 *src,
-		      GLfloat *dst_x, GLfloat *dst_y)
-{
-	ctx->prev.x = src->x[src->n - 1];
-	ctx->prev.y = src->y[src->n - 1];
-	ctx->vertices.x = dst_x;
-	ctx->vertices.y = dst_y;
-}
-
-static int
-clip_polygon_left(struct clip_context *ctx, const struct polygon8 *src,
-		  GLfloat *dst_x, GLfloat *dst_y)
-{
-	enum path_transition trans;
-	int i;
-
-	clip_context_prepare(ctx, src, dst_x, dst_y);
-	for (i = 0; i < src->n; i++) {
-		trans = path_transition_left_edge(ctx, src->x[i], src->y[i]);
-		clip_polygon_leftright(ctx, trans, src->x[i], src->y[i],
-				       ctx->clip.x1);
-	}
-	return ctx->vertices.x - dst_x;
-}
-
-static int
-clip_polygon_right(struct clip_context *ctx, const struct polygon8 *src,
-		   GLfloat *dst_x, GLfloat *dst_y)
-{
-	enum path_transition trans;
-	int i;
-
-	clip_context_prepare(ctx, src, dst_x, dst_y);
-	for (i = 0; i < src->n; i++) {
-		trans = path_transition_right_edge(ctx, src->x[i], src->y[i]);
-		clip_polygon_leftright(ctx, trans, src->x[i], src->y[i],
-				       ctx->clip.x2);
-	}
-	return ctx->vertices.x - dst_x;
-}
-
-static int
-clip_polygon_top(struct clip_context *ctx, const struct polygon8 *src,
-		 GLfloat *dst_x, GLfloat *dst_y)
+coalesce_damage(struct gl_renderer *gr, pixman_region32_t *damage)
 {
-	enum path_transition trans;
-	int i;
+	pixman_box32_t *boxes;
+	int n;
 
-	clip_context_prepare(ctx, src, dst_x, dst_y);
-	for (i = 0; i < src->n; i++) {
-		trans = path_transition_top_edge(ctx, src->x[i], src->y[i]);
-		clip_polygon_topbottom(ctx, trans, src->x[i], src->y[i],
-				       ctx->clip.y1);
-	}
-	return ctx->vertices.x - dst_x;
-}
+	n = coalesce_region(gr, damage, &boxes, &gr->coalesce_draw);
+	if (n < 0)
+		return;
 
-static int
-clip_polygon_bottom(struct clip_context *ctx, const struct polygon8 *src,
-		    GLfloat *dst_x, GLfloat *dst_y)
-{
-	enum path_transition trans;
-	int i;
+	pixman_region32_fini(damage);
+	pixman_region32_init_rects(damage, boxes, n);
 
-	clip_context_prepare(ctx, src, dst_x, dst_y);
-	for (i = 0; i < src->n; i++) {
-		trans = path_transition_bottom_edge(ctx, src->x[i], src->y[i]);
-		clip_polygon_topbottom(ctx, trans, src->x[i], src->y[i],
-				       ctx->clip.y2);
-	}
-	return ctx->vertices.x - dst_x;
+	/* Count what repaint_region() gets to see. */
+	gr->coalesce_draw.rects_out += pixman_region32_n_rects(damage) - n;
 }
 
-#define max(a, b) (((a) > (b)) ? (a) : (b))
-#define min(a, b) (((a) > (b)) ? (b) : (a))
-#define clip(x, a, b)  min(max(x, a), b)
-
-/*
- * Compute the boundary vertices of the intersection of the global coordinate
- * aligned rectangle 'rect', and an arbitrary quadrilateral produced from
- * 'surf_rect' when transformed from surface coordinates into global coordinates.
- * The vertices are written to 'ex' and 'ey', and the return value is the
- * number of vertices. Vertices are produced in clockwise winding order.
- * Guarantees to produce either zero vertices, or 3-8 vertices with non-zero
- * polygon area.
- */
-static int
-calculate_edges(struct weston_surface *es, pixman_box32_t *rect,
-		pixman_box32_t *surf_rect, GLfloat *ex, GLfloat *ey)
-{
-	struct polygon8 polygon;
-	struct clip_context ctx;
-	int i, n;
-	GLfloat min_x, max_x, min_y, max_y;
-	struct polygon8 surf = {
-		{ surf_rect->x1, surf_rect->x2, surf_rect->x2, surf_rect->x1 },
-		{ surf_rect->y1, surf_rect->y1, surf_rect->y2, surf_rect->y2 },
-		4
-	};
-
-	ctx.clip.x1 = rect->x1;
-	ctx.clip.y1 = rect->y1;
-	ctx.clip.x2 = rect->x2;
-	ctx.clip.y2 = rect->y2;
-
-	/* transform surface to screen space: */
-	for (i = 0; i < surf.n; i++)
-		weston_surface_to_global_float(es, surf.x[i], surf.y[i],
-					       &surf.x[i], &surf.y[i]);
-
-	/* find bounding box: */
-	min_x = max_x = surf.x[0];
-	min_y = max_y = surf.y[0];
-
-	for (i = 1; i < surf.n; i++) {
-		min_x = min(min_x, surf.x[i]);
-		max_x = max(max_x, surf.x[i]);
-		min_y = min(min_y, surf.y[i]);
-		max_y = max(max_y, surf.y[i]);
-	}
-
-	/* First, simple bounding box check to discard early transformed
-	 * surface rects that do not intersect with the clip region:
-	 */
-	if ((min_x >= ctx.clip.x2) || (max_x <= ctx.clip.x1) ||
-	    (min_y >= ctx.clip.y2) || (max_y <= ctx.clip.y1))
-		return 0;
-
-	/* Simple case, bounding box edges are parallel to surface edges,
-	 * there will be only four edges.  We just need to clip the surface
-	 * vertices to the clip rect bounds:
-	 */
-	if (!es->transform.enabled) {
-		for (i = 0; i < surf.n; i++) {
-			ex[i] = clip(surf.x[i], ctx.clip.x1, ctx.clip.x2);
-			ey[i] = clip(surf.y[i], ctx.clip.y1, ctx.clip.y2);
-		}
-		return surf.n;
-	}
-
-	/* Transformed case: use a general polygon clipping algorithm to
-	 * clip the surface rectangle with each side of 'rect'.
-	 * The algorithm is Sutherland-Hodgman, as explained in
-	 * http://www.codeguru.com/cpp/misc/misc/graphics/article.php/c8965/Polygon-Clipping.htm
-	 * but without looking at any of that code.
-	 */
-	polygon.n = clip_polygon_left(&ctx, &surf, polygon.x, polygon.y);
-	surf.n = clip_polygon_right(&ctx, &polygon, surf.x, surf.y);
-	polygon.n = clip_polygon_top(&ctx, &surf, polygon.x, polygon.y);
-	surf.n = clip_polygon_bottom(&ctx, &polygon, surf.x, surf.y);
-
-	/* Get rid of duplicate vertices */
-	ex[0] = surf.x[0];
-	ey[0] = surf.y[0];
-	n = 1;
-	for (i = 1; i < surf.n; i++) {
-		if (float_difference(ex[n - 1], surf.x[i]) == 0.0f &&
-		    float_difference(ey[n - 1], surf.y[i]) == 0.0f)
-			continue;
-		ex[n] = surf.x[i];
-		ey[n] = surf.y[i];
-		n++;
-	}
-	if (float_difference(ex[n - 1], surf.x[0]) == 0.0f &&
-	    float_difference(ey[n - 1], surf.y[0]) == 0.0f)
-		n--;
-
-	if (n < 3)
-		return 0;
-
-	return n;
-}
+/* Clip rects handed to clip_quad_rects() per call. */
+#define CLIP_BATCH 16
 
 static int
 texture_region(struct weston_surface *es, pixman_region32_t *region,
@@ -563,46 +413,68 @@ texture_region(struct weston_surface *es, pixman_region32_t *region,
 	inv_width = 1.0 / gs->pitch;
         inv_height = 1.0 / gs->height;
 
-	for (i = 0; i < nrects; i++) {
-		pixman_box32_t *rect = &rects[i];
-		for (j = 0; j < nsurf; j++) {
-			pixman_box32_t *surf_rect = &surf_rects[j];
-			GLfloat sx, sy, bx, by;
-			GLfloat ex[8], ey[8];          /* edge points in screen space */
-			int n;
-
-			/* The transformed surface, after clipping to the clip region,
-			 * can have as many as eight sides, emitted as a triangle-fan.
-			 * The first vertex in the triangle fan can be chosen arbitrarily,
-			 * since the area is guaranteed to be convex.
-			 *
-			 * If a corner of the transformed surface falls outside of the
-			 * clip region, instead of emitting one vertex for the corner
-			 * of the surface, up to two are emitted for two corresponding
-			 * intersection point(s) between the surface and the clip region.
-			 *
-			 * To do this, we first calculate the (up to eight) points that
-			 * form the intersection of the clip rect and the transformed
-			 * surface.
-			 */
-			n = calculate_edges(es, rect, surf_rect, ex, ey);
-			if (n < 3)
-				continue;
-
-			/* emit edge points: */
-			for (k = 0; k < n; k++) {
-				weston_surface_from_global_float(es, ex[k], ey[k], &sx, &sy);
-				/* position: */
-				*(v++) = ex[k];
-				*(v++) = ey[k];
-				/* texcoord: */
-				weston_surface_to_buffer_float(es, sx, sy,
-							       &bx, &by);
-				*(v++) = bx * inv_width;
-				*(v++) = by * inv_height;
+	/* The transformed surface, after clipping to the clip region,
+	 * can have as many as eight sides, emitted as a triangle-fan.
+	 * The first vertex in the triangle fan can be chosen arbitrarily,
+	 * since the area is guaranteed to be convex.
+	 *
+	 * If a corner of the transformed surface falls outside of the
+	 * clip region, instead of emitting one vertex for the corner
+	 * of the surface, up to two are emitted for two corresponding
+	 * intersection point(s) between the surface and the clip region.
+	 *
+	 * To do this, we first calculate the (up to eight) points that
+	 * form the intersection of the clip rects and the transformed
+	 * surface rect, a batch of clip rects at a time.
+	 */
+	for (j = 0; j < nsurf; j++) {
+		struct polygon8 quad = {
+			{ surf_rects[j].x1, surf_rects[j].x2,
+			  surf_rects[j].x2, surf_rects[j].x1 },
+			{ surf_rects[j].y1, surf_rects[j].y1,
+			  surf_rects[j].y2, surf_rects[j].y2 },
+			4
+		};
+
+		/* transform surface to screen space: */
+		for (k = 0; k < quad.n; k++)
+			weston_surface_to_global_float(es,
+						       quad.x[k], quad.y[k],
+						       &quad.x[k], &quad.y[k]);
+
+		for (i = 0; i < nrects; i += CLIP_BATCH) {
+			int count = MIN(nrects - i, CLIP_BATCH);
+			struct polygon8 clipped[CLIP_BATCH];
+			int r;
+
+			clip_quad_rects(&quad, es->transform.enabled,
+					&rects[i], count, clipped);
+
+			for (r = 0; r < count; r++) {
+				/* edge points in screen space */
+				GLfloat *ex = clipped[r].x, *ey = clipped[r].y;
+				GLfloat sx, sy, bx, by;
+				int n = clipped[r].n;
+
+				if (n < 3)
+					continue;
+
+				/* emit edge points: */
+				for (k = 0; k < n; k++) {
+					weston_surface_from_global_float(es, ex[k], ey[k],
+									 &sx, &sy);
+					/* position: */
+					*(v++) = ex[k];
+					*(v++) = ey[k];
+					/* texcoord: */
+					weston_surface_to_buffer_float(es, sx, sy,
+								       &bx, &by);
+					*(v++) = bx * inv_width;
+					*(v++) = by * inv_height;
+				}
+
+				vtxcnt[nvtx++] = n;
 			}
-
-			vtxcnt[nvtx++] = n;
 		}
 	}
 
@@ -646,6 +518,7 @@ triangle_fan_debug(struct weston_surface *surface, int first, int count)
 			color[color_idx++ % ARRAY_LENGTH(color)]);
 	glDrawElements(GL_LINES, nelems, GL_UNSIGNED_SHORT, buffer);
 	glUseProgram(gr->current_shader->program);
+	gr->solid_shader.uniform_surface = NULL;
 	free(buffer);
 }
 
@@ -682,6 +555,7 @@ repaint_region(struct weston_surface *es, pixman_region32_t *region,
 
 	for (i = 0, first = 0; i < nfans; i++) {
 		glDrawArrays(GL_TRIANGLE_FAN, first, vtxcnt[i]);
+		gr->calls.draws++;
 		if (gr->fan_debug)
 			triangle_fan_debug(es, first, vtxcnt[i]);
 		first += vtxcnt[i];
@@ -733,14 +607,20 @@ use_shader(struct gl_renderer *gr, struct gl_shader *shader)
 
 		if (ret < 0)
 			weston_log("warning: failed to compile shader\n");
+		shader->uniform_surface = NULL;
 	}
 
 	if (gr->current_shader == shader)
 		return;
 	glUseProgram(shader->program);
 	gr->current_shader = shader;
+	gr->calls.programs++;
 }
 
+/* Load the uniforms of 'surface' into 'shader', unless they already are.
+ * Surface state does not change while a frame is drawn, so what was
+ * loaded earlier in the same frame can be trusted.
+ */
 static void
 shader_uniforms(struct gl_shader *shader,
 		       struct weston_surface *surface,
@@ -748,6 +628,12 @@ shader_uniforms(struct gl_shader *shader,
 {
 	int i;
 	struct gl_surface_state *gs = get_surface_state(surface);
+	struct gl_renderer *gr = get_renderer(surface->compositor);
+
+	if (shader->uniform_surface == surface &&
+	    shader->uniform_output == output &&
+	    shader->uniform_frame == gr->frame)
+		return;
 
 	glUniformMatrix4fv(shader->proj_uniform,
 			   1, GL_FALSE, output->matrix.d);
@@ -756,6 +642,191 @@ shader_uniforms(struct gl_shader *shader,
 
 	for (i = 0; i < gs->num_textures; i++)
 		glUniform1i(shader->tex_uniforms[i], i);
+
+	shader->uniform_surface = surface;
+	shader->uniform_output = output;
+	shader->uniform_frame = gr->frame;
+	gr->calls.uniforms += 3 + gs->num_textures;
+}
+
+static void
+set_blend(struct gl_renderer *gr, int blend)
+{
+	if (gr->blend == blend)
+		return;
+
+	if (blend)
+		glEnable(GL_BLEND);
+	else
+		glDisable(GL_BLEND);
+	gr->blend = blend;
+	gr->calls.blend++;
+}
+
+/* Make 'shader' current with the uniforms and textures of 'surface'. */
+static void
+draw_state(struct gl_renderer *gr, struct weston_output *output,
+	   struct weston_surface *surface, struct gl_shader *shader,
+	   int blend, GLint filter)
+{
+	struct gl_surface_state *gs = get_surface_state(surface);
+	int i;
+
+	use_shader(gr, shader);
+	shader_uniforms(shader, surface, output);
+	set_blend(gr, blend);
+
+	if (gr->texture_surface == surface && gr->texture_filter == filter)
+		return;
+
+	for (i = 0; i < gs->num_textures; i++) {
+		glActiveTexture(GL_TEXTURE0 + i);
+		glBindTexture(gs->target, gs->textures[i]);
+		glTexParameteri(gs->target, GL_TEXTURE_MIN_FILTER, filter);
+		glTexParameteri(gs->target, GL_TEXTURE_MAG_FILTER, filter);
+	}
+	gr->texture_surface = surface;
+	gr->texture_filter = filter;
+	gr->calls.textures += gs->num_textures;
+}
+
+/* Draw the recorded batch, in order, from a single vertex array. */
+static void
+batch_flush(struct gl_renderer *gr, struct weston_output *output)
+{
+	struct batch_draw *draw;
+	GLushort *indices = gr->batch_indices.data;
+	GLfloat *v = gr->vertices.data;
+
+	if (gr->batch.size == 0)
+		goto out;
+
+	/* position: */
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof *v, &v[0]);
+	glEnableVertexAttribArray(0);
+
+	/* texcoord: */
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof *v, &v[2]);
+	glEnableVertexAttribArray(1);
+
+	wl_array_for_each(draw, &gr->batch) {
+		draw_state(gr, output, draw->surface, draw->shader,
+			   draw->blend, draw->filter);
+		glDrawElements(GL_TRIANGLES, draw->count, GL_UNSIGNED_SHORT,
+			       &indices[draw->first]);
+		gr->calls.draws++;
+	}
+
+	glDisableVertexAttribArray(1);
+	glDisableVertexAttribArray(0);
+
+out:
+	gr->batch.size = 0;
+	gr->batch_indices.size = 0;
+	gr->vertices.size = 0;
+	gr->vtxcnt.size = 0;
+}
+
+/* Record the drawing of 'region' intersected with 'surf_region', like
+ * repaint_region() does, for batch_flush(). The triangle fans from
+ * texture_region() are appended to the frame's vertex array and turned
+ * into indexed triangles, merged with the previous draw when the GL
+ * state is the same. Returns -1 if the batch cannot take the region.
+ */
+static int
+batch_region(struct gl_renderer *gr, struct weston_output *output,
+	     struct weston_surface *es, struct gl_shader *shader,
+	     int blend, GLint filter,
+	     pixman_region32_t *region, pixman_region32_t *surf_region)
+{
+	struct batch_draw *draw;
+	unsigned int *vtxcnt;
+	GLushort *index;
+	int base, first, i, k, max, nfans, nvtx, ntri;
+
+	/* Worst case of texture_region(), see there. */
+	max = pixman_region32_n_rects(region) *
+		pixman_region32_n_rects(surf_region) * 8;
+	if (max > BATCH_MAX_VERTICES)
+		return -1;
+
+	base = gr->vertices.size / (4 * sizeof(GLfloat));
+	if (base + max > BATCH_MAX_VERTICES) {
+		batch_flush(gr, output);
+		base = 0;
+	}
+
+	gr->vtxcnt.size = 0;
+	nfans = texture_region(es, region, surf_region);
+	vtxcnt = gr->vtxcnt.data;
+
+	for (i = 0, nvtx = 0, ntri = 0; i < nfans; i++) {
+		nvtx += vtxcnt[i];
+		ntri += vtxcnt[i] - 2;
+	}
+
+	/* Drop the unused worst case space again. */
+	gr->vertices.size = (base + nvtx) * 4 * sizeof(GLfloat);
+	if (ntri == 0)
+		return 0;
+
+	first = gr->batch_indices.size / sizeof *index;
+	index = wl_array_add(&gr->batch_indices, ntri * 3 * sizeof *index);
+	if (index == NULL)
+		return -1;
+
+	for (i = 0; i < nfans; i++) {
+		for (k = 1; k < (int) vtxcnt[i] - 1; k++) {
+			*index++ = base;
+			*index++ = base + k;
+			*index++ = base + k + 1;
+		}
+		base += vtxcnt[i];
+	}
+
+	if (gr->batch.size > 0) {
+		draw = (struct batch_draw *)
+			((char *) gr->batch.data + gr->batch.size) - 1;
+		if (draw->surface == es && draw->shader == shader &&
+		    draw->blend == blend && draw->filter == filter &&
+		    draw->first + draw->count == first) {
+			draw->count += ntri * 3;
+			return 0;
+		}
+	}
+
+	draw = wl_array_add(&gr->batch, sizeof *draw);
+	if (draw == NULL) {
+		gr->batch_indices.size = first * sizeof *index;
+		return -1;
+	}
+
+	draw->surface = es;
+	draw->shader = shader;
+	draw->blend = blend;
+	draw->filter = filter;
+	draw->first = first;
+	draw->count = ntri * 3;
+
+	return 0;
+}
+
+static void
+draw_region(struct gl_renderer *gr, struct weston_output *output,
+	    struct weston_surface *es, struct gl_shader *shader,
+	    int blend, GLint filter,
+	    pixman_region32_t *region, pixman_region32_t *surf_region)
+{
+	if (gr->batch_draws && !gr->fan_debug &&
+	    batch_region(gr, output, es, shader, blend, filter,
+			 region, surf_region) == 0)
+		return;
+
+	/* Keep the order of the draws. */
+	batch_flush(gr, output);
+
+	draw_state(gr, output, es, shader, blend, filter);
+	repaint_region(es, region, surf_region);
 }
 
 static void
@@ -769,8 +840,8 @@ draw_surface(struct weston_surface *es, struct weston_output *output,
 	pixman_region32_t repaint;
 	/* non-opaque region in surface coordinates: */
 	pixman_region32_t surface_blend;
+	struct gl_shader *shader;
 	GLint filter;
-	int i;
 
 	pixman_region32_init(&repaint);
 	pixman_region32_intersect(&repaint,
@@ -780,57 +851,39 @@ draw_surface(struct weston_surface *es, struct weston_output *output,
 	if (!pixman_region32_not_empty(&repaint))
 		goto out;
 
-	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
-
 	if (gr->fan_debug) {
 		use_shader(gr, &gr->solid_shader);
 		shader_uniforms(&gr->solid_shader, es, output);
 	}
 
-	use_shader(gr, gs->shader);
-	shader_uniforms(gs->shader, es, output);
-
 	if (es->transform.enabled || output->zoom.active || output->scale != es->buffer_scale)
 		filter = GL_LINEAR;
 	else
 		filter = GL_NEAREST;
 
-	for (i = 0; i < gs->num_textures; i++) {
-		glActiveTexture(GL_TEXTURE0 + i);
-		glBindTexture(gs->target, gs->textures[i]);
-		glTexParameteri(gs->target, GL_TEXTURE_MIN_FILTER, filter);
-		glTexParameteri(gs->target, GL_TEXTURE_MAG_FILTER, filter);
-	}
-
 	/* blended region is whole surface minus opaque region: */
 	pixman_region32_init_rect(&surface_blend, 0, 0,
 				  es->geometry.width, es->geometry.height);
 	pixman_region32_subtract(&surface_blend, &surface_blend, &es->opaque);
 
 	if (pixman_region32_not_empty(&es->opaque)) {
+		shader = gs->shader;
 		if (gs->shader == &gr->texture_shader_rgba) {
 			/* Special case for RGBA textures with possibly
 			 * bad data in alpha channel: use the shader
 			 * that forces texture alpha = 1.0.
 			 * Xwayland surfaces need this.
 			 */
-			use_shader(gr, &gr->texture_shader_rgbx);
-			shader_uniforms(&gr->texture_shader_rgbx, es, output);
+			shader = &gr->texture_shader_rgbx;
 		}
 
-		if (es->alpha < 1.0)
-			glEnable(GL_BLEND);
-		else
-			glDisable(GL_BLEND);
-
-		repaint_region(es, &repaint, &es->opaque);
+		draw_region(gr, output, es, shader, es->alpha < 1.0, filter,
+			    &repaint, &es->opaque);
 	}
 
-	if (pixman_region32_not_empty(&surface_blend)) {
-		use_shader(gr, gs->shader);
-		glEnable(GL_BLEND);
-		repaint_region(es, &repaint, &surface_blend);
-	}
+	if (pixman_region32_not_empty(&surface_blend))
+		draw_region(gr, output, es, gs->shader, 1, filter,
+			    &repaint, &surface_blend);
 
 	pixman_region32_fini(&surface_blend);
 
@@ -841,12 +894,14 @@ out:
 static void
 repaint_surfaces(struct weston_output *output, pixman_region32_t *damage)
 {
-	struct weston_compositor *compositor = output->compositor;
-	struct weston_surface *surface;
+	struct weston_surface **surfaces = output->draw_list.data;
+	int i;
+
+	/* The unoccluded primary plane surfaces, bottom to top. */
+	for (i = output->draw_list.size / sizeof *surfaces; i-- > 0; )
+		draw_surface(surfaces[i], output, damage);
 
-	wl_list_for_each_reverse(surface, &compositor->surface_list, link)
-		if (surface->plane == &compositor->primary_plane)
-			draw_surface(surface, output, damage);
+	batch_flush(get_renderer(output->compositor), output);
 }
 
 
@@ -943,6 +998,7 @@ draw_border(struct weston_output *output)
 
 	glUniform1i(shader->tex_uniforms[0], 0);
 	glUniform1f(shader->alpha_uniform, 1);
+	shader->uniform_surface = NULL;
 
 	n = texture_border(output);
 
@@ -1032,6 +1088,15 @@ gl_renderer_repaint_output(struct weston_output *output,
 	if (use_output(output) < 0)
 		return;
 
+	/* Nothing of the GL state cached while drawing the last frame
+	 * can be trusted anymore. */
+	gr->frame++;
+	gr->blend = -1;
+	gr->texture_surface = NULL;
+	memset(&gr->calls, 0, sizeof gr->calls);
+
+	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
 	/* if debugging, redraw everything outside the damage to clean up
 	 * debug lines from the previous draw on this buffer:
 	 */
@@ -1053,8 +1118,10 @@ gl_renderer_repaint_output(struct weston_output *output,
 	output_rotate_damage(output, output_damage);
 
 	pixman_region32_union(&total_damage, &buffer_damage, output_damage);
+	coalesce_damage(gr, &total_damage);
 
 	repaint_surfaces(output, &total_damage);
+	gr->last_calls = gr->calls;
 
 	pixman_region32_fini(&total_damage);
 	pixman_region32_fini(&buffer_damage);
@@ -1103,20 +1170,160 @@ gl_renderer_read_pixels(struct weston_output *output,
 	return 0;
 }
 
+/* Compute the boxes of the shm buffer to upload, in buffer coordinates.
+ * The damage goes through coalesce_region(), as each upload has a fixed
+ * cost. Without GL_EXT_unpack_subimage only whole rows can be read out
+ * of the buffer, so the damaged row span is uploaded.
+ */
+static int
+texture_upload_boxes(struct weston_surface *surface, int width, int height,
+		     pixman_box32_t *full, pixman_box32_t **boxes)
+{
+	struct gl_renderer *gr = get_renderer(surface->compositor);
+	struct gl_surface_state *gs = get_surface_state(surface);
+	pixman_box32_t *b;
+	int i, n;
+
+	full->x1 = 0;
+	full->y1 = 0;
+	full->x2 = width;
+	full->y2 = height;
+
+	*boxes = full;
+
+	if (gs->needs_full_upload)
+		return 1;
+
+	if (!gr->has_unpack_subimage) {
+		b = pixman_region32_extents(&gs->texture_damage);
+		*full = weston_surface_to_buffer_rect(surface, *b);
+		full->x1 = 0;
+		full->x2 = width;
+		full->y1 = MAX(full->y1, 0);
+		full->y2 = MIN(full->y2, height);
+		return 1;
+	}
+
+	n = coalesce_region(gr, &gs->texture_damage, boxes,
+			    &gr->coalesce_upload);
+	if (n < 0) {
+		*boxes = full;
+		return 1;
+	}
+
+	for (i = 0, b = *boxes; i < n; i++, b++) {
+		*b = weston_surface_to_buffer_rect(surface, *b);
+		b->x1 = MAX(b->x1, 0);
+		b->y1 = MAX(b->y1, 0);
+		b->x2 = MIN(b->x2, width);
+		b->y2 = MIN(b->y2, height);
+	}
+
+	return n;
+}
+
+/* Copy the boxes to be uploaded from the shm buffer into the next pixel
+ * buffer object of the surface, with the layout of the shm buffer, and
+ * leave it bound. The texture uploads then source from the PBO and are
+ * queued by the driver, instead of the driver copying from client memory
+ * while the compositor waits. Returns the pointer the uploads have to
+ * use as the start of the buffer, which is 0 for a bound PBO.
+ *
+ * The PBO is orphaned and mapped unsynchronized, so mapping never waits
+ * for the GPU to finish with the previous contents. The copy into the
+ * mapping itself still runs on the compositor thread: wl_shm memory
+ * belongs to the client and can't be handed to GL without it. Only the
+ * transfer into the texture overlaps with rendering.
+ */
+static const void *
+texture_upload_stage(struct gl_renderer *gr, struct gl_surface_state *gs,
+		     const pixman_box32_t *boxes, int n,
+		     const uint8_t *data, int stride, int bpp)
+{
+#ifdef HAVE_GL_PBO
+	size_t size = (size_t) stride * gs->height;
+	uint8_t *map;
+	int i, y;
+
+	if (!gr->has_pbo)
+		return data;
+
+	if (gs->pbos[0] == 0)
+		glGenBuffers(PBO_COUNT, gs->pbos);
+
+	gs->current_pbo = (gs->current_pbo + 1) % PBO_COUNT;
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, gs->pbos[gs->current_pbo]);
+
+	/* Orphan the old storage, the driver keeps it around for as long
+	 * as a pending upload reads from it. */
+	glBufferData(GL_PIXEL_UNPACK_BUFFER_NV, size, NULL, GL_STREAM_DRAW);
+
+	map = gr->map_buffer_range(GL_PIXEL_UNPACK_BUFFER_NV, 0, size,
+				   GL_MAP_WRITE_BIT_EXT |
+				   GL_MAP_INVALIDATE_BUFFER_BIT_EXT |
+				   GL_MAP_UNSYNCHRONIZED_BIT_EXT);
+	if (!map) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, 0);
+		return data;
+	}
+
+	for (i = 0; i < n; i++) {
+		size_t offset, len;
+
+		offset = (size_t) boxes[i].x1 * bpp;
+		len = (size_t) (boxes[i].x2 - boxes[i].x1) * bpp;
+		for (y = boxes[i].y1; y < boxes[i].y2; y++)
+			memcpy(map + (size_t) y * stride + offset,
+			       data + (size_t) y * stride + offset, len);
+	}
+
+	if (!gr->unmap_buffer(GL_PIXEL_UNPACK_BUFFER_NV)) {
+		/* The contents got lost, upload from the buffer instead. */
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, 0);
+		return data;
+	}
+
+	return NULL;
+#else
+	return data;
+#endif
+}
+
+static void
+texture_upload_done(struct gl_renderer *gr)
+{
+#ifdef HAVE_GL_PBO
+	/* A bound PBO would turn the pointer of any other texture
+	 * upload into an offset in it. */
+	if (gr->has_pbo)
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, 0);
+#endif
+}
+
+static void
+release_pbos(struct gl_surface_state *gs)
+{
+	int i;
+
+	if (gs->pbos[0] == 0)
+		return;
+
+	glDeleteBuffers(PBO_COUNT, gs->pbos);
+	for (i = 0; i < PBO_COUNT; i++)
+		gs->pbos[i] = 0;
+}
+
 static void
 gl_renderer_flush_damage(struct weston_surface *surface)
 {
 	struct gl_renderer *gr = get_renderer(surface->compositor);
 	struct gl_surface_state *gs = get_surface_state(surface);
 	struct weston_buffer *buffer = gs->buffer_ref.buffer;
+	pixman_box32_t full, *boxes;
+	const uint8_t *data;
 	GLenum format;
 	int pixel_type;
-
-#ifdef GL_EXT_unpack_subimage
-	pixman_box32_t *rectangles;
-	void *data;
-	int i, n;
-#endif
+	int stride, bpp, i, n;
 
 	pixman_region32_union(&gs->texture_damage,
 			      &gs->texture_damage, &surface->damage);
@@ -1132,7 +1339,8 @@ gl_renderer_flush_damage(struct weston_surface *surface)
 	if (surface->plane != &surface->compositor->primary_plane)
 		return;
 
-	if (!pixman_region32_not_empty(&gs->texture_damage))
+	if (!pixman_region32_not_empty(&gs->texture_damage) &&
+	    !gs->needs_full_upload)
 		goto done;
 
 	switch (wl_shm_buffer_get_format(buffer->shm_buffer)) {
@@ -1151,44 +1359,56 @@ gl_renderer_flush_damage(struct weston_surface *surface)
 		pixel_type = GL_UNSIGNED_BYTE;
 	}
 
+	stride = wl_shm_buffer_get_stride(buffer->shm_buffer);
+	bpp = stride / gs->pitch;
+
+	n = texture_upload_boxes(surface, gs->pitch, buffer->height,
+				 &full, &boxes);
+	data = texture_upload_stage(gr, gs, boxes, n,
+				    wl_shm_buffer_get_data(buffer->shm_buffer),
+				    stride, bpp);
+
 	glBindTexture(GL_TEXTURE_2D, gs->textures[0]);
 
 	if (!gr->has_unpack_subimage) {
-		glTexImage2D(GL_TEXTURE_2D, 0, format,
-			     gs->pitch, buffer->height, 0,
-			     format, pixel_type,
-			     wl_shm_buffer_get_data(buffer->shm_buffer));
-
-		goto done;
+		/* The texture may have been allocated with another format
+		 * than the buffer's, so respecify it on a full upload.
+		 * Otherwise only the damaged rows are uploaded, as they
+		 * are contiguous in the buffer. */
+		if (gs->needs_full_upload)
+			glTexImage2D(GL_TEXTURE_2D, 0, format,
+				     gs->pitch, buffer->height, 0,
+				     format, pixel_type, data);
+		else if (boxes[0].y1 < boxes[0].y2)
+			glTexSubImage2D(GL_TEXTURE_2D, 0,
+					0, boxes[0].y1,
+					gs->pitch, boxes[0].y2 - boxes[0].y1,
+					format, pixel_type,
+					(const void *) ((uintptr_t) data +
+					(uintptr_t) boxes[0].y1 * stride));
+
+		goto upload_done;
 	}
 
 #ifdef GL_EXT_unpack_subimage
 	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, gs->pitch);
-	data = wl_shm_buffer_get_data(buffer->shm_buffer);
-
-	if (gs->needs_full_upload) {
-		glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
-		glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
-		glTexSubImage2D(GL_TEXTURE_2D, 0,
-				0, 0, gs->pitch, buffer->height,
-				format, pixel_type, data);
-		goto done;
-	}
 
-	rectangles = pixman_region32_rectangles(&gs->texture_damage, &n);
 	for (i = 0; i < n; i++) {
-		pixman_box32_t r;
-
-		r = weston_surface_to_buffer_rect(surface, rectangles[i]);
+		if (boxes[i].x1 >= boxes[i].x2 || boxes[i].y1 >= boxes[i].y2)
+			continue;
 
-		glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, r.x1);
-		glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, r.y1);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, r.x1, r.y1,
-				r.x2 - r.x1, r.y2 - r.y1,
+		glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, boxes[i].x1);
+		glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, boxes[i].y1);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, boxes[i].x1, boxes[i].y1,
+				boxes[i].x2 - boxes[i].x1,
+				boxes[i].y2 - boxes[i].y1,
 				format, pixel_type, data);
 	}
 #endif
 
+upload_done:
+	texture_upload_done(gr);
+
 done:
 	pixman_region32_fini(&gs->texture_damage);
 	pixman_region32_init(&gs->texture_damage);
@@ -1279,6 +1499,8 @@ gl_renderer_attach_egl(struct weston_surface *es, struct weston_buffer *buffer,
 	EGLint attribs[3];
 	int i, num_planes;
 
+	release_pbos(gs);
+
 	buffer->legacy_buffer = (struct wl_buffer *)buffer->resource;
 	gr->query_buffer(gr->egl_display, buffer->legacy_buffer,
 			 EGL_WIDTH, &buffer->width);
@@ -1362,6 +1584,7 @@ gl_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 		gs->num_images = 0;
 		glDeleteTextures(gs->num_textures, gs->textures);
 		gs->num_textures = 0;
+		release_pbos(gs);
 		gs->buffer_type = BUFFER_TYPE_NULL;
 		return;
 	}
@@ -1424,6 +1647,7 @@ gl_renderer_destroy_surface(struct weston_surface *surface)
 	int i;
 
 	glDeleteTextures(gs->num_textures, gs->textures);
+	release_pbos(gs);
 
 	for (i = 0; i < gs->num_images; i++)
 		gr->destroy_image(gr->egl_display, gs->images[i]);
@@ -1826,6 +2050,9 @@ gl_renderer_destroy(struct weston_compositor *ec)
 	wl_array_release(&gr->vertices);
 	wl_array_release(&gr->indices);
 	wl_array_release(&gr->vtxcnt);
+	wl_array_release(&gr->coalesced);
+	wl_array_release(&gr->batch);
+	wl_array_release(&gr->batch_indices);
 
 	free(gr);
 }
@@ -2020,10 +2247,62 @@ fan_debug_repaint_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
 	weston_compositor_damage_all(compositor);
 }
 
+static void
+coalesce_debug_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
+		       void *data)
+{
+	struct weston_compositor *ec = data;
+	struct gl_renderer *gr = get_renderer(ec);
+
+	weston_log("damage coalescing since last report:\n");
+	weston_log_continue(STAMP_SPACE "texture uploads: %u rectangles "
+			    "merged into %u\n",
+			    gr->coalesce_upload.rects_in,
+			    gr->coalesce_upload.rects_out);
+	weston_log_continue(STAMP_SPACE "repaint: %u rectangles "
+			    "merged into %u\n",
+			    gr->coalesce_draw.rects_in,
+			    gr->coalesce_draw.rects_out);
+
+	memset(&gr->coalesce_upload, 0, sizeof gr->coalesce_upload);
+	memset(&gr->coalesce_draw, 0, sizeof gr->coalesce_draw);
+}
+
+static void
+batch_debug_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
+		    void *data)
+{
+	struct weston_compositor *ec = data;
+	struct gl_renderer *gr = get_renderer(ec);
+
+	gr->batch_draws ^= 1;
+	weston_log("draw batching %s\n", gr->batch_draws ? "on" : "off");
+
+	weston_compositor_damage_all(ec);
+}
+
+static void
+gl_calls_debug_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
+		       void *data)
+{
+	struct weston_compositor *ec = data;
+	struct gl_renderer *gr = get_renderer(ec);
+
+	weston_log("GL calls in the last frame, draw batching %s:\n",
+		   gr->batch_draws ? "on" : "off");
+	weston_log_continue(STAMP_SPACE "%u draws, %u program switches, "
+			    "%u uniform updates, %u texture binds, "
+			    "%u blend state changes\n",
+			    gr->last_calls.draws, gr->last_calls.programs,
+			    gr->last_calls.uniforms, gr->last_calls.textures,
+			    gr->last_calls.blend);
+}
+
 static int
 gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 {
 	struct gl_renderer *gr = get_renderer(ec);
+	struct weston_config_section *section;
 	const char *extensions;
 	EGLBoolean ret;
 
@@ -2093,6 +2372,19 @@ gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 	if (strstr(extensions, "GL_OES_EGL_image_external"))
 		gr->has_egl_image_external = 1;
 
+#ifdef HAVE_GL_PBO
+	if (strstr(extensions, "GL_NV_pixel_buffer_object") &&
+	    strstr(extensions, "GL_EXT_map_buffer_range") &&
+	    strstr(extensions, "GL_OES_mapbuffer")) {
+		gr->map_buffer_range =
+			(void *) eglGetProcAddress("glMapBufferRangeEXT");
+		gr->unmap_buffer =
+			(void *) eglGetProcAddress("glUnmapBufferOES");
+		if (gr->map_buffer_range && gr->unmap_buffer)
+			gr->has_pbo = 1;
+	}
+#endif
+
 	extensions =
 		(const char *) eglQueryString(gr->egl_display, EGL_EXTENSIONS);
 	if (!extensions) {
@@ -2123,12 +2415,31 @@ gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 					    fragment_debug_binding, ec);
 	weston_compositor_add_debug_binding(ec, KEY_F,
 					    fan_debug_repaint_binding, ec);
+	weston_compositor_add_debug_binding(ec, KEY_M,
+					    coalesce_debug_binding, ec);
+	weston_compositor_add_debug_binding(ec, KEY_B,
+					    batch_debug_binding, ec);
+	weston_compositor_add_debug_binding(ec, KEY_G,
+					    gl_calls_debug_binding, ec);
+
+	section = weston_config_get_section(ec->config,
+					    "renderer", NULL, NULL);
+	weston_config_section_get_int(section, "coalesce-threshold",
+				      &gr->coalesce_threshold,
+				      DEFAULT_COALESCE_THRESHOLD);
+	weston_config_section_get_int(section, "coalesce-max-rects",
+				      &gr->coalesce_max_rects,
+				      DEFAULT_COALESCE_MAX_RECTS);
+	weston_config_section_get_bool(section, "batch-draws",
+				       &gr->batch_draws, 1);
 
 	weston_log("GL ES 2 renderer features:\n");
 	weston_log_continue(STAMP_SPACE "read-back format: %s\n",
 		ec->read_format == PIXMAN_a8r8g8b8 ? "BGRA" : "RGBA");
 	weston_log_continue(STAMP_SPACE "wl_shm sub-image to texture: %s\n",
 			    gr->has_unpack_subimage ? "yes" : "no");
+	weston_log_continue(STAMP_SPACE "wl_shm upload through PBOs: %s\n",
+			    gr->has_pbo ? "yes" : "no");
 	weston_log_continue(STAMP_SPACE "EGL Wayland extension: %s\n",
 			    gr->has_bind_display ? "yes" : "no");
 
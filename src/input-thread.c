@@ -0,0 +1,372 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "compositor.h"
+#include "input-thread.h"
+
+/*
+ * The input thread only drains the device fds into per device queues,
+ * so that the kernel buffers don't overflow while the main thread is
+ * busy repainting. Decoding stays on the main thread: libevdev keeps
+ * its key state in the seat keyboard, and the evdev dispatchers call
+ * straight into notify_*().
+ *
+ * When a queue fills up, its fd is taken out of the epoll set until
+ * the main thread has read from the queue again, and the kernel queues
+ * events as it would without the thread.
+ */
+
+#define QUEUE_MASK (INPUT_THREAD_QUEUE_SIZE - 1)
+
+static void
+source_poll(struct input_thread_source *source, uint32_t events)
+{
+	struct epoll_event ep;
+
+	memset(&ep, 0, sizeof ep);
+	ep.events = events;
+	ep.data.ptr = source;
+	epoll_ctl(source->thread->epoll_fd, EPOLL_CTL_MOD, source->fd, &ep);
+}
+
+static uint32_t
+source_queued(struct input_thread_source *source)
+{
+	return __atomic_load_n(&source->head, __ATOMIC_ACQUIRE) -
+		__atomic_load_n(&source->tail, __ATOMIC_SEQ_CST);
+}
+
+/* Input thread: reads from the fd until it would block or the queue is
+ * full. Returns the number of events queued. */
+static int
+source_fill(struct input_thread_source *source)
+{
+	uint32_t head = source->head;
+	uint32_t tail, space, count;
+	int total = 0;
+	ssize_t len;
+
+	for (;;) {
+		tail = __atomic_load_n(&source->tail, __ATOMIC_SEQ_CST);
+		space = INPUT_THREAD_QUEUE_SIZE - (head - tail);
+		if (space == 0)
+			break;
+
+		count = INPUT_THREAD_QUEUE_SIZE - (head & QUEUE_MASK);
+		if (count > space)
+			count = space;
+
+		len = read(source->fd, &source->queue[head & QUEUE_MASK],
+			   count * sizeof source->queue[0]);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len <= 0) {
+			/* Gone, the main thread removes it on the udev
+			 * event. Stop polling it until then. */
+			if (len == 0 || errno != EAGAIN)
+				epoll_ctl(source->thread->epoll_fd,
+					  EPOLL_CTL_DEL, source->fd, NULL);
+			return total;
+		}
+
+		count = len / sizeof source->queue[0];
+		head += count;
+		total += count;
+		__atomic_store_n(&source->head, head, __ATOMIC_RELEASE);
+		source->events += count;
+		if (head - tail > source->max_queued)
+			source->max_queued = head - tail;
+	}
+
+	/* Full: stop polling the fd, and poll it again right away if the
+	 * main thread freed up space before it could see the flag. */
+	source->stalls++;
+	__atomic_store_n(&source->stalled, 1, __ATOMIC_SEQ_CST);
+	source_poll(source, 0);
+	if (source_queued(source) < INPUT_THREAD_QUEUE_SIZE) {
+		__atomic_store_n(&source->stalled, 0, __ATOMIC_SEQ_CST);
+		source_poll(source, EPOLLIN);
+	}
+
+	return total;
+}
+
+static void *
+input_thread_func(void *data)
+{
+	struct input_thread *thread = data;
+	struct input_thread_source *source;
+	struct epoll_event ep[16];
+	uint64_t one = 1;
+	int i, n, queued;
+
+	for (;;) {
+		n = epoll_wait(thread->epoll_fd, ep, ARRAY_LENGTH(ep), -1);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			break;
+
+		queued = 0;
+		pthread_mutex_lock(&thread->mutex);
+		for (i = 0; i < n; i++) {
+			if (ep[i].data.ptr == thread) {
+				pthread_mutex_unlock(&thread->mutex);
+				return NULL;
+			}
+
+			/* Skip sources removed since epoll_wait(). */
+			wl_list_for_each(source, &thread->source_list, link)
+				if (source == ep[i].data.ptr)
+					break;
+			if (&source->link == &thread->source_list)
+				continue;
+
+			if (ep[i].events & (EPOLLHUP | EPOLLERR))
+				epoll_ctl(thread->epoll_fd, EPOLL_CTL_DEL,
+					  source->fd, NULL);
+			else
+				queued += source_fill(source);
+		}
+		pthread_mutex_unlock(&thread->mutex);
+
+		if (queued && write(thread->wake_fd, &one, sizeof one) < 0)
+			weston_log("input thread: failed to wake compositor: "
+				   "%m\n");
+	}
+
+	weston_log("input thread: epoll_wait failed: %m\n");
+
+	return NULL;
+}
+
+/* Main thread: copies out up to count queued events. Used as the read
+ * function of libevdev. */
+int
+input_thread_source_read(void *data, struct input_event *ev, int count)
+{
+	struct input_thread_source *source = data;
+	uint32_t tail = source->tail;
+	uint32_t head = __atomic_load_n(&source->head, __ATOMIC_ACQUIRE);
+	uint32_t n, first;
+
+	n = head - tail;
+	if (n > (uint32_t) count)
+		n = count;
+	if (n == 0)
+		return -EAGAIN;
+
+	first = INPUT_THREAD_QUEUE_SIZE - (tail & QUEUE_MASK);
+	if (first > n)
+		first = n;
+	memcpy(ev, &source->queue[tail & QUEUE_MASK], first * sizeof *ev);
+	memcpy(ev + first, source->queue, (n - first) * sizeof *ev);
+
+	__atomic_store_n(&source->tail, tail + n, __ATOMIC_SEQ_CST);
+
+	if (__atomic_exchange_n(&source->stalled, 0, __ATOMIC_SEQ_CST))
+		source_poll(source, EPOLLIN);
+
+	return n;
+}
+
+/* Main thread: drops everything queued, for when there is nobody to
+ * deliver it to. The thread goes back to polling a full queue's fd. */
+void
+input_thread_source_flush(struct input_thread_source *source)
+{
+	__atomic_store_n(&source->tail,
+			 __atomic_load_n(&source->head, __ATOMIC_ACQUIRE),
+			 __ATOMIC_SEQ_CST);
+
+	if (__atomic_exchange_n(&source->stalled, 0, __ATOMIC_SEQ_CST))
+		source_poll(source, EPOLLIN);
+}
+
+static int
+input_thread_wake(int fd, uint32_t mask, void *data)
+{
+	struct input_thread *thread = data;
+	struct input_thread_source *source, *next;
+	uint64_t count;
+
+	if (read(fd, &count, sizeof count) < 0 && errno != EAGAIN)
+		weston_log("input thread: failed to read wake count: %m\n");
+
+	/* Only the main thread changes the list. */
+	wl_list_for_each_safe(source, next, &thread->source_list, link)
+		if (source_queued(source))
+			source->dispatch(source->fd, WL_EVENT_READABLE,
+					 source->data);
+
+	return 1;
+}
+
+struct input_thread_source *
+input_thread_add_fd(struct input_thread *thread, int fd, const char *name,
+		    wl_event_loop_fd_func_t dispatch, void *data)
+{
+	struct input_thread_source *source;
+	struct epoll_event ep;
+
+	source = zalloc(sizeof *source);
+	if (source == NULL)
+		return NULL;
+
+	source->name = strdup(name);
+	if (source->name == NULL) {
+		free(source);
+		return NULL;
+	}
+
+	source->thread = thread;
+	source->fd = fd;
+	source->dispatch = dispatch;
+	source->data = data;
+
+	memset(&ep, 0, sizeof ep);
+	ep.events = EPOLLIN;
+	ep.data.ptr = source;
+
+	pthread_mutex_lock(&thread->mutex);
+	if (epoll_ctl(thread->epoll_fd, EPOLL_CTL_ADD, fd, &ep) < 0) {
+		pthread_mutex_unlock(&thread->mutex);
+		free(source->name);
+		free(source);
+		return NULL;
+	}
+	wl_list_insert(&thread->source_list, &source->link);
+	pthread_mutex_unlock(&thread->mutex);
+
+	return source;
+}
+
+void
+input_thread_source_remove(struct input_thread_source *source)
+{
+	struct input_thread *thread = source->thread;
+
+	pthread_mutex_lock(&thread->mutex);
+	epoll_ctl(thread->epoll_fd, EPOLL_CTL_DEL, source->fd, NULL);
+	wl_list_remove(&source->link);
+	pthread_mutex_unlock(&thread->mutex);
+
+	/* The input thread is done with it now. */
+	weston_log("input thread: %s: %u events, at most %u queued, "
+		   "queue full %u times\n", source->name, source->events,
+		   source->max_queued, source->stalls);
+
+	free(source->name);
+	free(source);
+}
+
+struct input_thread *
+input_thread_create(struct wl_event_loop *loop)
+{
+	struct input_thread *thread;
+	struct epoll_event ep;
+	sigset_t all, saved;
+	int ret;
+
+	thread = zalloc(sizeof *thread);
+	if (thread == NULL)
+		return NULL;
+
+	wl_list_init(&thread->source_list);
+	pthread_mutex_init(&thread->mutex, NULL);
+	thread->wake_fd = -1;
+	thread->quit_fd = -1;
+
+	thread->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (thread->epoll_fd < 0)
+		goto err;
+
+	thread->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	thread->quit_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (thread->wake_fd < 0 || thread->quit_fd < 0)
+		goto err;
+
+	memset(&ep, 0, sizeof ep);
+	ep.events = EPOLLIN;
+	ep.data.ptr = thread;
+	if (epoll_ctl(thread->epoll_fd, EPOLL_CTL_ADD,
+		      thread->quit_fd, &ep) < 0)
+		goto err;
+
+	thread->wake_source =
+		wl_event_loop_add_fd(loop, thread->wake_fd, WL_EVENT_READABLE,
+				     input_thread_wake, thread);
+	if (thread->wake_source == NULL)
+		goto err;
+
+	/* Signals are handled through signalfd on the main thread. */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &saved);
+	ret = pthread_create(&thread->thread, NULL, input_thread_func, thread);
+	pthread_sigmask(SIG_SETMASK, &saved, NULL);
+	if (ret != 0) {
+		wl_event_source_remove(thread->wake_source);
+		goto err;
+	}
+
+	return thread;
+
+err:
+	weston_log("input thread: failed to start: %m\n");
+	if (thread->quit_fd >= 0)
+		close(thread->quit_fd);
+	if (thread->wake_fd >= 0)
+		close(thread->wake_fd);
+	if (thread->epoll_fd >= 0)
+		close(thread->epoll_fd);
+	pthread_mutex_destroy(&thread->mutex);
+	free(thread);
+
+	return NULL;
+}
+
+void
+input_thread_destroy(struct input_thread *thread)
+{
+	uint64_t one = 1;
+
+	if (write(thread->quit_fd, &one, sizeof one) < 0)
+		weston_log("input thread: failed to stop: %m\n");
+	pthread_join(thread->thread, NULL);
+
+	wl_event_source_remove(thread->wake_source);
+	close(thread->quit_fd);
+	close(thread->wake_fd);
+	close(thread->epoll_fd);
+	pthread_mutex_destroy(&thread->mutex);
+	free(thread);
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _WESTON_INPUT_THREAD_H_
+#define _WESTON_INPUT_THREAD_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <linux/input.h>
+#include <wayland-server.h>
+
+/* Events queued per device, a power of two. */
+#define INPUT_THREAD_QUEUE_SIZE 1024
+
+/* An input device fd read by the input thread. The thread is the only
+ * writer of 'head' and the main thread the only writer of 'tail', so
+ * the queue between them needs no lock. */
+struct input_thread_source {
+	struct input_thread *thread;
+	struct wl_list link;		/* input_thread::source_list */
+	int fd;
+	char *name;
+
+	wl_event_loop_fd_func_t dispatch;
+	void *data;
+
+	struct input_event queue[INPUT_THREAD_QUEUE_SIZE];
+	uint32_t head;
+	uint32_t tail;
+	int stalled;			/* queue full, fd not polled */
+
+	/* Written by the input thread, logged on removal. */
+	uint32_t events;
+	uint32_t stalls;
+	uint32_t max_queued;
+};
+
+struct input_thread {
+	pthread_t thread;
+	pthread_mutex_t mutex;		/* source_list and the epoll set */
+	struct wl_list source_list;
+	int epoll_fd;
+	int wake_fd;			/* input thread to main thread */
+	int quit_fd;			/* main thread to input thread */
+	struct wl_event_source *wake_source;
+};
+
+struct input_thread *
+input_thread_create(struct wl_event_loop *loop);
+
+void
+input_thread_destroy(struct input_thread *thread);
+
+struct input_thread_source *
+input_thread_add_fd(struct input_thread *thread, int fd, const char *name,
+		    wl_event_loop_fd_func_t dispatch, void *data);
+
+void
+input_thread_source_remove(struct input_thread_source *source);
+
+int
+input_thread_source_read(void *data, struct input_event *ev, int count);
+
+void
+input_thread_source_flush(struct input_thread_source *source);
+
+#endif
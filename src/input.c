@@ -335,6 +335,8 @@ weston_pointer_destroy(struct weston_pointer *pointer)
 	/* XXX: What about pointer->resource_list? */
 	if (pointer->focus_resource)
 		wl_list_remove(&pointer->focus_listener.link);
+	if (pointer->motion_timer)
+		wl_event_source_remove(pointer->motion_timer);
 	free(pointer);
 }
 
@@ -626,6 +628,89 @@ move_pointer(struct weston_seat *seat, wl_fixed_t x, wl_fixed_t y)
 	}
 }
 
+static void
+pointer_flush_motion(struct weston_pointer *pointer)
+{
+	struct weston_compositor *compositor;
+
+	if (pointer == NULL || !pointer->motion_pending)
+		return;
+
+	compositor = pointer->seat->compositor;
+	if (compositor->motion_batching == WESTON_MOTION_BATCHING_RATE)
+		pointer->motion_flush_time = weston_compositor_get_time();
+
+	pointer->motion_pending = 0;
+	pointer->motion_deliveries++;
+
+	pointer->grab->interface->focus(pointer->grab);
+	pointer->grab->interface->motion(pointer->grab, pointer->motion_time);
+}
+
+static int
+pointer_motion_timer_handler(void *data)
+{
+	pointer_flush_motion(data);
+
+	return 1;
+}
+
+/* The pointer itself, and so the cursor, always moves right away; only
+ * the pick and the grab motion, which sends wl_pointer.motion, are held
+ * back while batching. */
+static void
+pointer_queue_motion(struct weston_pointer *pointer, uint32_t time)
+{
+	struct weston_compositor *compositor = pointer->seat->compositor;
+	struct wl_event_loop *loop;
+	int32_t delay;
+
+	pointer->motion_events++;
+	pointer->motion_time = time;
+
+	if (pointer->motion_pending)
+		return;
+	pointer->motion_pending = 1;
+
+	switch (compositor->motion_batching) {
+	case WESTON_MOTION_BATCHING_FRAME:
+		if (wl_list_empty(&compositor->output_list))
+			break;
+		weston_compositor_schedule_repaint(compositor);
+		return;
+	case WESTON_MOTION_BATCHING_RATE:
+		delay = 1000 / compositor->motion_rate -
+			(int32_t) (weston_compositor_get_time() -
+				   pointer->motion_flush_time);
+		if (delay <= 0)
+			break;
+		if (pointer->motion_timer == NULL) {
+			loop = wl_display_get_event_loop(compositor->wl_display);
+			pointer->motion_timer =
+				wl_event_loop_add_timer(loop,
+							pointer_motion_timer_handler,
+							pointer);
+			if (pointer->motion_timer == NULL)
+				break;
+		}
+		wl_event_source_timer_update(pointer->motion_timer, delay);
+		return;
+	case WESTON_MOTION_BATCHING_NONE:
+		break;
+	}
+
+	pointer_flush_motion(pointer);
+}
+
+WL_EXPORT void
+weston_compositor_flush_motion(struct weston_compositor *compositor)
+{
+	struct weston_seat *seat;
+
+	wl_list_for_each(seat, &compositor->seat_list, link)
+		pointer_flush_motion(seat->pointer);
+}
+
 WL_EXPORT void
 notify_motion(struct weston_seat *seat,
 	      uint32_t time, wl_fixed_t dx, wl_fixed_t dy)
@@ -637,8 +722,7 @@ notify_motion(struct weston_seat *seat,
 
 	move_pointer(seat, pointer->x + dx, pointer->y + dy);
 
-	pointer->grab->interface->focus(pointer->grab);
-	pointer->grab->interface->motion(pointer->grab, time);
+	pointer_queue_motion(pointer, time);
 }
 
 WL_EXPORT void
@@ -652,8 +736,7 @@ notify_motion_absolute(struct weston_seat *seat,
 
 	move_pointer(seat, x, y);
 
-	pointer->grab->interface->focus(pointer->grab);
-	pointer->grab->interface->motion(pointer->grab, time);
+	pointer_queue_motion(pointer, time);
 }
 
 WL_EXPORT void
@@ -676,10 +759,12 @@ notify_button(struct weston_seat *seat, uint32_t time, int32_t button,
 {
 	struct weston_compositor *compositor = seat->compositor;
 	struct weston_pointer *pointer = seat->pointer;
-	struct weston_surface *focus =
-		(struct weston_surface *) pointer->focus;
+	struct weston_surface *focus;
 	uint32_t serial = wl_display_next_serial(compositor->wl_display);
 
+	pointer_flush_motion(pointer);
+	focus = pointer->focus;
+
 	if (state == WL_POINTER_BUTTON_STATE_PRESSED) {
 		if (compositor->ping_handler && focus)
 			compositor->ping_handler(focus, serial);
@@ -712,10 +797,12 @@ notify_axis(struct weston_seat *seat, uint32_t time, uint32_t axis,
 {
 	struct weston_compositor *compositor = seat->compositor;
 	struct weston_pointer *pointer = seat->pointer;
-	struct weston_surface *focus =
-		(struct weston_surface *) pointer->focus;
+	struct weston_surface *focus;
 	uint32_t serial = wl_display_next_serial(compositor->wl_display);
 
+	pointer_flush_motion(pointer);
+	focus = pointer->focus;
+
 	if (compositor->ping_handler && focus)
 		compositor->ping_handler(focus, serial);
 
@@ -861,6 +948,8 @@ notify_key(struct weston_seat *seat, uint32_t time, uint32_t key,
 	struct weston_keyboard_grab *grab = keyboard->grab;
 	uint32_t serial = wl_display_next_serial(compositor->wl_display);
 
+	pointer_flush_motion(seat->pointer);
+
 	if (state == WL_KEYBOARD_KEY_STATE_PRESSED) {
 		if (compositor->ping_handler && focus)
 			compositor->ping_handler(focus, serial);
@@ -900,6 +989,7 @@ notify_pointer_focus(struct weston_seat *seat, struct weston_output *output,
 
 	if (output) {
 		move_pointer(seat, x, y);
+		pointer_flush_motion(seat->pointer);
 		compositor->focus = 1;
 	} else {
 		compositor->focus = 0;
@@ -1045,6 +1135,8 @@ notify_touch(struct weston_seat *seat, uint32_t time, int touch_id,
 	struct weston_surface *es;
 	wl_fixed_t sx, sy;
 
+	pointer_flush_motion(seat->pointer);
+
 	/* Update grab's global coordinates. */
 	touch->grab_x = x;
 	touch->grab_y = y;
@@ -1125,8 +1217,8 @@ pointer_cursor_surface_configure(struct weston_surface *es,
 	empty_region(&es->pending.input);
 
 	if (!weston_surface_is_mapped(es)) {
-		wl_list_insert(&es->compositor->cursor_layer.surface_list,
-			       &es->layer_link);
+		weston_layer_entry_insert(&es->compositor->cursor_layer.surface_list,
+					  es);
 		weston_surface_update_transform(es);
 	}
 }
@@ -118,6 +118,13 @@ struct libevdev {
 	size_t queue_nsync; /**< number of sync events */
 
 	struct timeval last_event_time;
+
+	int (*read_events)(void *data, struct input_event *ev, int count);
+	void *read_data;
+
+	size_t frame_len; /**< events handed out by libevdev_next_frame() */
+	size_t frame_scanned; /**< events of a partial frame already scanned */
+	struct libevdev_read_stats stats;
 };
 
 
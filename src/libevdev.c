@@ -41,12 +41,37 @@ static int sync_mt_state(struct libevdev *dev, int create_events);
 static int
 init_event_queue(struct libevdev *dev)
 {
-	/* FIXME: count the number of axes, keys, etc. to get a better idea at how many events per
-	   EV_SYN we could possibly get. Then multiply that by the actual buffer size we care about */
+	/* Room for QUEUE_FRAMES of the largest frames the device can send:
+	   the SYN_REPORT, a scan code, a couple of keys or buttons, every
+	   relative and absolute axis, and every multitouch axis plus the
+	   ABS_MT_SLOT for each slot. A keyboard gets the minimum, a 10
+	   finger touchscreen about 20 times that. */
+
+	const int QUEUE_FRAMES = 16;
+	const int QUEUE_MIN = 64;
+	const int QUEUE_MAX = 4096;
+	int per_frame = 4, mt_codes = 0;
+	int i, size;
+
+	for (i = 0; i <= REL_MAX; i++)
+		if (libevdev_has_event_code(dev, EV_REL, i))
+			per_frame++;
+
+	for (i = 0; i <= ABS_MAX; i++) {
+		if (!libevdev_has_event_code(dev, EV_ABS, i))
+			continue;
+		if (i >= ABS_MT_MIN && i <= ABS_MT_MAX)
+			mt_codes++;
+		else
+			per_frame++;
+	}
 
-	const int QUEUE_SIZE = 256;
+	if (dev->num_slots > 0)
+		per_frame += min(dev->num_slots, LIBE_MAX_SLOTS) * mt_codes;
 
-	return queue_alloc(dev, QUEUE_SIZE);
+	size = max(QUEUE_MIN, min(QUEUE_MAX, per_frame * QUEUE_FRAMES));
+
+	return queue_alloc(dev, size);
 }
 
 static void
@@ -129,6 +154,16 @@ void libevdev_external_key_values_deactivate(struct libevdev *dev)
 				   dev->key_values_bit_id, dev->key_values_id);
 }
 
+void libevdev_set_read_func(struct libevdev *dev,
+			    int (*read_events)(void *data,
+					       struct input_event *ev,
+					       int count),
+			    void *data)
+{
+	dev->read_events = read_events;
+	dev->read_data = data;
+}
+
 void
 libevdev_free(struct libevdev *dev)
 {
@@ -606,6 +641,18 @@ read_more_events(struct libevdev *dev)
 		return 0;
 
 	next = queue_next_element(dev);
+	if (dev->read_events) {
+		len = dev->read_events(dev->read_data, next, free_elem);
+		if (len < 0)
+			return len;
+		if (len > 0) {
+			dev->stats.reads++;
+			dev->stats.events += len;
+		}
+		queue_set_num_elements(dev, queue_num_elements(dev) + len);
+		return 0;
+	}
+
 	len = read(dev->fd, next, free_elem * sizeof(struct input_event));
 	if (len < 0) {
 		return -errno;
@@ -613,12 +660,117 @@ read_more_events(struct libevdev *dev)
 		return -EINVAL;
 	else if (len > 0) {
 		int nev = len/sizeof(struct input_event);
+		dev->stats.reads++;
+		dev->stats.events += nev;
 		queue_set_num_elements(dev, queue_num_elements(dev) + nev);
 	}
 
 	return 0;
 }
 
+/* Drops the frame handed out by the last libevdev_next_frame() from the
+   queue. Without one, the queue holds the start of a frame that was
+   already scanned, and the state updated with, so leave frame_scanned
+   alone to not apply those events twice. */
+static void
+release_frame(struct libevdev *dev)
+{
+	if (dev->frame_len == 0)
+		return;
+
+	queue_shift_multiple(dev, dev->frame_len, NULL);
+	dev->frame_len = 0;
+	dev->frame_scanned = 0;
+}
+
+/* Drops the events queued after a SYN_DROPPED, after updating the state
+   with them, as libevdev_next_event() does in normal mode. */
+static void
+drop_sync(struct libevdev *dev)
+{
+	struct input_event e;
+
+	while (queue_shift(dev, &e) == 0)
+		update_state(dev, &e);
+
+	dev->queue_nsync = 0;
+	dev->sync_state = SYNC_NONE;
+}
+
+int libevdev_next_frame(struct libevdev *dev, struct input_event **events)
+{
+	struct input_event *queue;
+	size_t i, n, count;
+	int rc;
+
+	if (dev->fd < 0)
+		return -ENODEV;
+
+	release_frame(dev);
+
+	if (dev->sync_state != SYNC_NONE)
+		drop_sync(dev);
+
+	queue = dev->queue;
+	*events = queue;
+
+	for (;;) {
+		/* Events of disabled codes are compacted out as the queue is
+		   scanned, the frame so far is queue[0] to queue[count - 1]. */
+		n = queue_num_elements(dev);
+		count = dev->frame_scanned;
+		for (i = count; i < n; i++) {
+			if (queue[i].type == EV_SYN &&
+			    queue[i].code == SYN_DROPPED)
+				break;
+
+			update_state(dev, &queue[i]);
+			if (libevdev_has_event_code(dev, queue[i].type,
+						    queue[i].code))
+				queue[count++] = queue[i];
+
+			if (queue[i].type == EV_SYN &&
+			    queue[i].code == SYN_REPORT) {
+				dev->frame_len = i + 1;
+				dev->stats.frames++;
+				return count;
+			}
+		}
+
+		if (i < n) {
+			/* Hand out the events before the SYN_DROPPED first.
+			   The next call drops the events after it. */
+			if (i > 0) {
+				dev->frame_len = i;
+				return count;
+			}
+
+			queue_shift(dev, NULL);
+			dev->sync_state = SYNC_NEEDED;
+			dev->stats.syn_dropped++;
+			return 0;
+		}
+
+		/* No SYN_REPORT yet. If the queue is full, that's all of the
+		   frame there is room for. */
+		if (queue_num_free_elements(dev) == 0) {
+			dev->frame_len = n;
+			return count;
+		}
+
+		/* Otherwise read the rest, appended to the compacted part,
+		   which isn't scanned again. */
+		queue_set_num_elements(dev, count);
+		dev->frame_scanned = count;
+
+		rc = read_more_events(dev);
+		if (rc < 0 && rc != -EAGAIN)
+			return rc;
+		if (queue_num_elements(dev) == count)
+			return -EAGAIN;
+	}
+}
+
 int libevdev_next_event(struct libevdev *dev, unsigned int flags, struct input_event *ev)
 {
 	int rc = 0;
@@ -629,6 +781,8 @@ int libevdev_next_event(struct libevdev *dev, unsigned int flags, struct input_e
 	if (!(flags & (LIBEVDEV_READ_NORMAL|LIBEVDEV_READ_SYNC|LIBEVDEV_FORCE_SYNC)))
 		return -EINVAL;
 
+	release_frame(dev);
+
 	if (flags & LIBEVDEV_READ_SYNC) {
 		if (dev->sync_state == SYNC_NEEDED) {
 			rc = sync_state(dev);
@@ -689,6 +843,7 @@ int libevdev_next_event(struct libevdev *dev, unsigned int flags, struct input_e
 	rc = 0;
 	if (ev->type == EV_SYN && ev->code == SYN_DROPPED) {
 		dev->sync_state = SYNC_NEEDED;
+		dev->stats.syn_dropped++;
 		rc = 1;
 	}
 
@@ -703,6 +858,13 @@ out:
 	return rc;
 }
 
+void
+libevdev_get_read_stats(const struct libevdev *dev,
+			struct libevdev_read_stats *stats)
+{
+	*stats = dev->stats;
+}
+
 int libevdev_has_event_pending(struct libevdev *dev)
 {
 	struct pollfd fds = { dev->fd, POLLIN, 0 };
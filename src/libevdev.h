@@ -425,6 +425,26 @@ int libevdev_external_key_values_activate(
 
 void libevdev_external_key_values_deactivate(struct libevdev *dev);
 
+/**
+ * @ingroup init
+ *
+ * Read events through the given function instead of from the fd, for
+ * when another thread reads the fd. The function stores up to count
+ * events in ev and returns how many, or a negative errno, -EAGAIN if
+ * none are available. The fd is still used for ioctls, like when
+ * syncing the device state after a SYN_DROPPED.
+ *
+ * @param dev The evdev device
+ * @param read_events The function to read events with, or NULL to read
+ * from the fd again
+ * @param data Passed to read_events
+ */
+void libevdev_set_read_func(struct libevdev *dev,
+			    int (*read_events)(void *data,
+					       struct input_event *ev,
+					       int count),
+			    void *data);
+
 /**
  * @ingroup init
  *
@@ -574,6 +594,53 @@ int libevdev_get_fd(const struct libevdev* dev);
  */
 int libevdev_next_event(struct libevdev *dev, unsigned int flags, struct input_event *ev);
 
+/**
+ * @ingroup events
+ *
+ * Get the next frame of events from the device, up to and including the
+ * SYN_REPORT, in normal mode. The events are stored in the internal queue
+ * and stay valid until the next call to libevdev_next_frame() or
+ * libevdev_next_event(). The fd is only read when no complete frame is
+ * queued, so one read can serve many frames.
+ *
+ * Events of disabled codes are left out of the frame, and the state of
+ * the device is updated as with libevdev_next_event(). If the queue fills
+ * up before a SYN_REPORT, what is queued is returned as a frame.
+ *
+ * If a SYN_DROPPED is read from the device, the events before it are
+ * returned first, then this function returns 0 and the next call drops
+ * the events queued after it, as libevdev_next_event() does in normal
+ * mode.
+ *
+ * @param dev The evdev device, already initialized with libevdev_set_fd()
+ * @param events Set to the first event of the frame
+ * @return The number of events in the frame, 0 if there are none this
+ * time but more may be available, or a negative errno.
+ * @retval -EAGAIN No complete frame is currently available on the device
+ */
+int libevdev_next_frame(struct libevdev *dev, struct input_event **events);
+
+/**
+ * @ingroup events
+ *
+ * Counters of how the device was read.
+ */
+struct libevdev_read_stats {
+	unsigned int reads; /**< reads that returned events */
+	unsigned int events; /**< events read */
+	unsigned int frames; /**< frames returned by libevdev_next_frame() */
+	unsigned int syn_dropped; /**< SYN_DROPPED events read */
+};
+
+/**
+ * @ingroup events
+ *
+ * @param dev The evdev device
+ * @param stats Set to the read counters of the device
+ */
+void libevdev_get_read_stats(const struct libevdev *dev,
+			     struct libevdev_read_stats *stats);
+
 /**
  * @ingroup events
  *
@@ -25,6 +25,9 @@
 
 #include <errno.h>
 #include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include "pixman-renderer.h"
 
@@ -32,21 +35,75 @@
 
 struct pixman_output_state {
 	void *shadow_buffer;
-	pixman_image_t *shadow_image;
+	pixman_image_t *shadow_image;	/* NULL when rendering directly */
 	pixman_image_t *hw_buffer;
 };
 
 struct pixman_surface_state {
 	pixman_image_t *image;
 	struct weston_buffer_reference buffer_ref;
+	int solid;
+	pixman_color_t color;
+};
+
+/* One composite onto the output. The surfaces of a frame are recorded
+ * as a list of these first, and then replayed onto the whole target at
+ * once, or band by band on the tile threads. */
+struct pixman_draw_op {
+	pixman_image_t *image;
+	int solid;
+	pixman_color_t color;
+	pixman_transform_t transform;
+	pixman_filter_t filter;
+	pixman_op_t op;
+	pixman_region32_t region;	/* in output coordinates */
+};
+
+/* Worker threads for compositing a frame in horizontal bands. The
+ * thread calling tile_pool_run() works on the bands too. */
+struct pixman_tile_pool {
+	pthread_mutex_t mutex;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	pthread_t *threads;
+	int nthreads;
+	int quit;
+	uint32_t generation;
+
+	void (*func)(void *data, int tile);
+	void *data;
+	int ntiles;
+	int next_tile;
+	int tiles_done;
+};
+
+struct pixman_tile_frame {
+	struct pixman_renderer *pr;
+	struct pixman_output_state *po;
+	pixman_region32_t *copy;	/* in output coordinates */
+	int width;
+	int y1, y2;
+	int band_height;
 };
 
 struct pixman_renderer {
 	struct weston_renderer base;
 	int repaint_debug;
 	pixman_image_t *debug_color;
+	struct wl_array ops;
+	int threads;
+	struct pixman_tile_pool *pool;
 };
 
+static const pixman_color_t debug_red = {
+	0x3fff, 0x0000, 0x0000, 0x3fff
+};
+
+/* Bands are at least this many rows high. */
+#define TILE_MIN_HEIGHT 16
+/* Bands per thread, so that threads finishing early can help out. */
+#define TILES_PER_THREAD 4
+
 static inline struct pixman_output_state *
 get_output_state(struct weston_output *output)
 {
@@ -65,6 +122,13 @@ get_renderer(struct weston_compositor *ec)
 	return (struct pixman_renderer *)ec->renderer;
 }
 
+/* The image the surfaces are composited onto. */
+static inline pixman_image_t *
+get_target(struct pixman_output_state *po)
+{
+	return po->shadow_image ? po->shadow_image : po->hw_buffer;
+}
+
 static int
 pixman_renderer_read_pixels(struct weston_output *output,
 			       pixman_format_code_t format, void *pixels,
@@ -222,6 +286,8 @@ region_global_to_output(struct weston_output *output, pixman_region32_t *region)
 
 #define D2F(v) pixman_double_to_fixed((double)v)
 
+/* Records the composite of 'region' of the surface, and the debug
+ * overlay on top of it, as draw ops in pr->ops. */
 static void
 repaint_region(struct weston_surface *es, struct weston_output *output,
 	       pixman_region32_t *region, pixman_region32_t *surf_region,
@@ -230,7 +296,7 @@ repaint_region(struct weston_surface *es, struct weston_output *output,
 	struct pixman_renderer *pr =
 		(struct pixman_renderer *) output->compositor->renderer;
 	struct pixman_surface_state *ps = get_surface_state(es);
-	struct pixman_output_state *po = get_output_state(output);
+	struct pixman_draw_op *op;
 	pixman_region32_t final_region;
 	float surface_x, surface_y;
 	pixman_transform_t transform;
@@ -263,9 +329,6 @@ repaint_region(struct weston_surface *es, struct weston_output *output,
 	/* Convert from global to output coord */
 	region_global_to_output(output, &final_region);
 
-	/* And clip to it */
-	pixman_image_set_clip_region32 (po->shadow_image, &final_region);
-
 	/* Set up the source transformation based on the surface
 	   position, the output position/transform/scale and the client
 	   specified buffer transform/scale */
@@ -383,37 +446,41 @@ repaint_region(struct weston_surface *es, struct weston_output *output,
 			       pixman_double_to_fixed ((double)es->buffer_scale),
 			       pixman_double_to_fixed ((double)es->buffer_scale));
 
-	pixman_image_set_transform(ps->image, &transform);
+	op = wl_array_add(&pr->ops, sizeof *op);
+	if (!op) {
+		pixman_region32_fini(&final_region);
+		return;
+	}
+
+	op->image = ps->image;
+	op->solid = ps->solid;
+	op->color = ps->color;
+	op->transform = transform;
+	op->op = pixman_op;
 
 	if (es->transform.enabled || output->scale != es->buffer_scale)
-		pixman_image_set_filter(ps->image, PIXMAN_FILTER_BILINEAR, NULL, 0);
+		op->filter = PIXMAN_FILTER_BILINEAR;
 	else
-		pixman_image_set_filter(ps->image, PIXMAN_FILTER_NEAREST, NULL, 0);
+		op->filter = PIXMAN_FILTER_NEAREST;
 
-	pixman_image_composite32(pixman_op,
-				 ps->image, /* src */
-				 NULL /* mask */,
-				 po->shadow_image, /* dest */
-				 0, 0, /* src_x, src_y */
-				 0, 0, /* mask_x, mask_y */
-				 0, 0, /* dest_x, dest_y */
-				 pixman_image_get_width (po->shadow_image), /* width */
-				 pixman_image_get_height (po->shadow_image) /* height */);
+	/* The op takes over final_region. */
+	op->region = final_region;
 
-	if (pr->repaint_debug)
-		pixman_image_composite32(PIXMAN_OP_OVER,
-					 pr->debug_color, /* src */
-					 NULL /* mask */,
-					 po->shadow_image, /* dest */
-					 0, 0, /* src_x, src_y */
-					 0, 0, /* mask_x, mask_y */
-					 0, 0, /* dest_x, dest_y */
-					 pixman_image_get_width (po->shadow_image), /* width */
-					 pixman_image_get_height (po->shadow_image) /* height */);
+	if (!pr->repaint_debug)
+		return;
 
-	pixman_image_set_clip_region32 (po->shadow_image, NULL);
+	op = wl_array_add(&pr->ops, sizeof *op);
+	if (!op)
+		return;
 
-	pixman_region32_fini(&final_region);
+	op->image = pr->debug_color;
+	op->solid = 1;
+	op->color = debug_red;
+	pixman_transform_init_identity(&op->transform);
+	op->filter = PIXMAN_FILTER_NEAREST;
+	op->op = PIXMAN_OP_OVER;
+	pixman_region32_init(&op->region);
+	pixman_region32_copy(&op->region, &final_region);
 }
 
 static void
@@ -470,12 +537,48 @@ out:
 static void
 repaint_surfaces(struct weston_output *output, pixman_region32_t *damage)
 {
-	struct weston_compositor *compositor = output->compositor;
-	struct weston_surface *surface;
+	struct weston_surface **surfaces = output->draw_list.data;
+	int i;
+
+	/* The unoccluded primary plane surfaces, bottom to top. */
+	for (i = output->draw_list.size / sizeof *surfaces; i-- > 0; )
+		draw_surface(surfaces[i], output, damage);
+}
+
+static void
+clear_ops(struct pixman_renderer *pr)
+{
+	struct pixman_draw_op *op;
+
+	wl_array_for_each(op, &pr->ops)
+		pixman_region32_fini(&op->region);
+	pr->ops.size = 0;
+}
+
+/* Replays the draw ops onto the target in one go. */
+static void
+draw_ops(struct pixman_renderer *pr, struct pixman_output_state *po)
+{
+	pixman_image_t *target = get_target(po);
+	struct pixman_draw_op *op;
 
-	wl_list_for_each_reverse(surface, &compositor->surface_list, link)
-		if (surface->plane == &compositor->primary_plane)
-			draw_surface(surface, output, damage);
+	wl_array_for_each(op, &pr->ops) {
+		pixman_image_set_clip_region32 (target, &op->region);
+		pixman_image_set_transform(op->image, &op->transform);
+		pixman_image_set_filter(op->image, op->filter, NULL, 0);
+
+		pixman_image_composite32(op->op,
+					 op->image, /* src */
+					 NULL /* mask */,
+					 target, /* dest */
+					 0, 0, /* src_x, src_y */
+					 0, 0, /* mask_x, mask_y */
+					 0, 0, /* dest_x, dest_y */
+					 pixman_image_get_width (target), /* width */
+					 pixman_image_get_height (target) /* height */);
+
+		pixman_image_set_clip_region32 (target, NULL);
+	}
 }
 
 static void
@@ -502,19 +605,302 @@ copy_to_hw_buffer(struct weston_output *output, pixman_region32_t *region)
 				 pixman_image_get_height (po->hw_buffer) /* height */);
 
 	pixman_image_set_clip_region32 (po->hw_buffer, NULL);
+
+	pixman_region32_fini(&output_region);
+}
+
+/* pixman images carry their clip, transform and filter, so the tile
+ * threads can't share them. Each band gets its own images on top of
+ * the same pixels. */
+static pixman_image_t *
+image_wrap(pixman_image_t *image)
+{
+	return pixman_image_create_bits(pixman_image_get_format(image),
+					pixman_image_get_width(image),
+					pixman_image_get_height(image),
+					pixman_image_get_data(image),
+					pixman_image_get_stride(image));
+}
+
+static pixman_image_t *
+draw_op_source(struct pixman_draw_op *op)
+{
+	pixman_image_t *image;
+
+	if (op->solid)
+		image = pixman_image_create_solid_fill(&op->color);
+	else
+		image = image_wrap(op->image);
+	if (!image)
+		return NULL;
+
+	pixman_image_set_transform(image, &op->transform);
+	pixman_image_set_filter(image, op->filter, NULL, 0);
+
+	return image;
+}
+
+/* Composites the draw ops and, with a shadow, copies the result to the
+ * hardware buffer, clipped to one band. Each pixel comes out the same
+ * as with draw_ops() and copy_to_hw_buffer(), only the clip is smaller. */
+static void
+draw_tile(void *data, int tile)
+{
+	struct pixman_tile_frame *frame = data;
+	struct pixman_output_state *po = frame->po;
+	struct pixman_draw_op *op;
+	pixman_image_t *target, *hw = NULL, *src;
+	pixman_region32_t band, region;
+	int y1, y2;
+
+	y1 = frame->y1 + tile * frame->band_height;
+	y2 = MIN(y1 + frame->band_height, frame->y2);
+
+	target = image_wrap(get_target(po));
+	if (!target)
+		goto out;
+	if (po->shadow_image) {
+		hw = image_wrap(po->hw_buffer);
+		if (!hw)
+			goto out;
+	}
+
+	pixman_region32_init_rect(&band, 0, y1, frame->width, y2 - y1);
+	pixman_region32_init(&region);
+
+	wl_array_for_each(op, &frame->pr->ops) {
+		pixman_region32_intersect(&region, &op->region, &band);
+		if (!pixman_region32_not_empty(&region))
+			continue;
+
+		src = draw_op_source(op);
+		if (!src)
+			continue;
+
+		pixman_image_set_clip_region32 (target, &region);
+		pixman_image_composite32(op->op,
+					 src, /* src */
+					 NULL /* mask */,
+					 target, /* dest */
+					 0, 0, /* src_x, src_y */
+					 0, 0, /* mask_x, mask_y */
+					 0, 0, /* dest_x, dest_y */
+					 pixman_image_get_width (target), /* width */
+					 pixman_image_get_height (target) /* height */);
+		pixman_image_unref(src);
+	}
+
+	pixman_image_set_clip_region32 (target, NULL);
+
+	pixman_region32_intersect(&region, frame->copy, &band);
+	if (hw && pixman_region32_not_empty(&region)) {
+		pixman_image_set_clip_region32 (hw, &region);
+		pixman_image_composite32(PIXMAN_OP_SRC,
+					 target, /* src */
+					 NULL /* mask */,
+					 hw, /* dest */
+					 0, 0, /* src_x, src_y */
+					 0, 0, /* mask_x, mask_y */
+					 0, 0, /* dest_x, dest_y */
+					 pixman_image_get_width (hw), /* width */
+					 pixman_image_get_height (hw) /* height */);
+	}
+
+	pixman_region32_fini(&region);
+	pixman_region32_fini(&band);
+
+out:
+	if (target)
+		pixman_image_unref(target);
+	if (hw)
+		pixman_image_unref(hw);
+}
+
+/* Called with the pool mutex held. */
+static void
+tile_pool_work(struct pixman_tile_pool *pool)
+{
+	void (*func)(void *data, int tile);
+	void *data;
+	int tile;
+
+	while (pool->next_tile < pool->ntiles) {
+		tile = pool->next_tile++;
+		func = pool->func;
+		data = pool->data;
+
+		pthread_mutex_unlock(&pool->mutex);
+		func(data, tile);
+		pthread_mutex_lock(&pool->mutex);
+
+		if (++pool->tiles_done == pool->ntiles)
+			pthread_cond_signal(&pool->done);
+	}
+}
+
+static void *
+tile_pool_thread(void *data)
+{
+	struct pixman_tile_pool *pool = data;
+	uint32_t generation = 0;
+
+	pthread_mutex_lock(&pool->mutex);
+	for (;;) {
+		while (!pool->quit && pool->generation == generation)
+			pthread_cond_wait(&pool->start, &pool->mutex);
+		if (pool->quit)
+			break;
+
+		generation = pool->generation;
+		tile_pool_work(pool);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
+/* Runs func(data, tile) for each tile in [0, ntiles) on the pool and
+ * the calling thread, and returns once all of them are done. */
+static void
+tile_pool_run(struct pixman_tile_pool *pool,
+	      void (*func)(void *data, int tile), void *data, int ntiles)
+{
+	pthread_mutex_lock(&pool->mutex);
+
+	pool->func = func;
+	pool->data = data;
+	pool->ntiles = ntiles;
+	pool->next_tile = 0;
+	pool->tiles_done = 0;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->start);
+
+	tile_pool_work(pool);
+	while (pool->tiles_done < pool->ntiles)
+		pthread_cond_wait(&pool->done, &pool->mutex);
+
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+static void
+tile_pool_destroy(struct pixman_tile_pool *pool)
+{
+	int i;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->quit = 1;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (i = 0; i < pool->nthreads; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->start);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool->threads);
+	free(pool);
+}
+
+static struct pixman_tile_pool *
+tile_pool_create(int nthreads)
+{
+	struct pixman_tile_pool *pool;
+	sigset_t mask, old_mask;
+
+	pool = calloc(1, sizeof *pool);
+	if (!pool)
+		return NULL;
+
+	pool->threads = calloc(nthreads, sizeof *pool->threads);
+	if (!pool->threads) {
+		free(pool);
+		return NULL;
+	}
+
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->start, NULL);
+	pthread_cond_init(&pool->done, NULL);
+
+	/* Leave all signals to the main thread. */
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, &old_mask);
+
+	for (pool->nthreads = 0; pool->nthreads < nthreads; pool->nthreads++)
+		if (pthread_create(&pool->threads[pool->nthreads], NULL,
+				   tile_pool_thread, pool) != 0)
+			break;
+
+	pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+
+	if (pool->nthreads < nthreads) {
+		tile_pool_destroy(pool);
+		return NULL;
+	}
+
+	return pool;
+}
+
+/* Splits the rows covered by the damage into bands and has the tile
+ * pool composite and copy them out in parallel. */
+static void
+draw_tiles(struct weston_output *output, pixman_region32_t *damage)
+{
+	struct pixman_renderer *pr = get_renderer(output->compositor);
+	struct pixman_tile_frame frame;
+	pixman_region32_t copy;
+	pixman_box32_t *extents;
+	int ntiles;
+
+	pixman_region32_init(&copy);
+	pixman_region32_copy(&copy, damage);
+	region_global_to_output(output, &copy);
+
+	extents = pixman_region32_extents(&copy);
+	if (!pixman_region32_not_empty(&copy))
+		goto out;
+
+	frame.pr = pr;
+	frame.po = get_output_state(output);
+	frame.copy = &copy;
+	frame.width = pixman_image_get_width(get_target(frame.po));
+	frame.y1 = extents->y1;
+	frame.y2 = extents->y2;
+
+	ntiles = MIN(pr->threads * TILES_PER_THREAD,
+		     (frame.y2 - frame.y1 + TILE_MIN_HEIGHT - 1) /
+		     TILE_MIN_HEIGHT);
+	frame.band_height = (frame.y2 - frame.y1 + ntiles - 1) / ntiles;
+	ntiles = (frame.y2 - frame.y1 + frame.band_height - 1) /
+		 frame.band_height;
+
+	tile_pool_run(pr->pool, draw_tile, &frame, ntiles);
+
+out:
+	pixman_region32_fini(&copy);
 }
 
 static void
 pixman_renderer_repaint_output(struct weston_output *output,
 			     pixman_region32_t *output_damage)
 {
+	struct pixman_renderer *pr = get_renderer(output->compositor);
 	struct pixman_output_state *po = get_output_state(output);
 
 	if (!po->hw_buffer)
 		return;
 
 	repaint_surfaces(output, output_damage);
-	copy_to_hw_buffer(output, output_damage);
+
+	if (pr->pool) {
+		draw_tiles(output, output_damage);
+	} else {
+		draw_ops(pr, po);
+		if (po->shadow_image)
+			copy_to_hw_buffer(output, output_damage);
+	}
+
+	clear_ops(pr);
 
 	pixman_region32_copy(&output->previous_damage, output_damage);
 	wl_signal_emit(&output->frame_signal, output);
@@ -541,6 +927,7 @@ pixman_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 		pixman_image_unref(ps->image);
 		ps->image = NULL;
 	}
+	ps->solid = 0;
 
 	if (!buffer)
 		return;
@@ -612,6 +999,8 @@ pixman_renderer_surface_set_color(struct weston_surface *es,
 	}
 
 	ps->image = pixman_image_create_solid_fill(&color);
+	ps->solid = 1;
+	ps->color = color;
 }
 
 static void
@@ -630,6 +1019,13 @@ pixman_renderer_destroy_surface(struct weston_surface *surface)
 static void
 pixman_renderer_destroy(struct weston_compositor *ec)
 {
+	struct pixman_renderer *pr = get_renderer(ec);
+
+	if (pr->pool)
+		tile_pool_destroy(pr->pool);
+	clear_ops(pr);
+	wl_array_release(&pr->ops);
+
 	free(ec->renderer);
 	ec->renderer = NULL;
 }
@@ -644,11 +1040,7 @@ debug_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
 	pr->repaint_debug ^= 1;
 
 	if (pr->repaint_debug) {
-		pixman_color_t red = {
-			0x3fff, 0x0000, 0x0000, 0x3fff
-		};
-
-		pr->debug_color = pixman_image_create_solid_fill(&red);
+		pr->debug_color = pixman_image_create_solid_fill(&debug_red);
 	} else {
 		pixman_image_unref(pr->debug_color);
 		weston_compositor_damage_all(ec);
@@ -659,6 +1051,8 @@ WL_EXPORT int
 pixman_renderer_init(struct weston_compositor *ec)
 {
 	struct pixman_renderer *renderer;
+	struct weston_config_section *section;
+	int threads;
 
 	renderer = malloc(sizeof *renderer);
 	if (renderer == NULL)
@@ -666,6 +1060,11 @@ pixman_renderer_init(struct weston_compositor *ec)
 
 	renderer->repaint_debug = 0;
 	renderer->debug_color = NULL;
+	wl_array_init(&renderer->ops);
+
+	renderer->threads = 1;
+	renderer->pool = NULL;
+
 	renderer->base.read_pixels = pixman_renderer_read_pixels;
 	renderer->base.repaint_output = pixman_renderer_repaint_output;
 	renderer->base.flush_damage = pixman_renderer_flush_damage;
@@ -683,9 +1082,49 @@ pixman_renderer_init(struct weston_compositor *ec)
 
 	wl_display_add_shm_format(ec->wl_display, WL_SHM_FORMAT_RGB565);
 
+	section = weston_config_get_section(ec->config,
+					    "renderer", NULL, NULL);
+	weston_config_section_get_int(section, "pixman-threads",
+				      &threads, 1);
+	pixman_renderer_set_threads(ec, threads);
+
 	return 0;
 }
 
+/* Composites on 'threads' threads from the next repaint on, one per
+ * CPU if it is 0 or less. Returns the number of threads used, which is
+ * 1 if the tile threads could not be started. */
+WL_EXPORT int
+pixman_renderer_set_threads(struct weston_compositor *ec, int threads)
+{
+	struct pixman_renderer *pr = get_renderer(ec);
+
+	if (threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads <= 0)
+		threads = 1;
+
+	if (pr->pool) {
+		tile_pool_destroy(pr->pool);
+		pr->pool = NULL;
+	}
+
+	if (threads > 1) {
+		pr->pool = tile_pool_create(threads - 1);
+		if (!pr->pool) {
+			weston_log("pixman renderer: failed to start "
+				   "tile threads, compositing on one\n");
+			threads = 1;
+		}
+	}
+
+	pr->threads = threads;
+	weston_log("pixman renderer: compositing with %d thread%s\n",
+		   pr->threads, pr->threads > 1 ? "s" : "");
+
+	return pr->threads;
+}
+
 WL_EXPORT void
 pixman_renderer_output_set_buffer(struct weston_output *output, pixman_image_t *buffer)
 {
@@ -702,7 +1141,7 @@ pixman_renderer_output_set_buffer(struct weston_output *output, pixman_image_t *
 }
 
 WL_EXPORT int
-pixman_renderer_output_create(struct weston_output *output)
+pixman_renderer_output_create(struct weston_output *output, uint32_t flags)
 {
 	struct pixman_output_state *po = calloc(1, sizeof *po);
 	int w, h;
@@ -710,6 +1149,13 @@ pixman_renderer_output_create(struct weston_output *output)
 	if (!po)
 		return -1;
 
+	/* Without a shadow, surfaces are composited straight into the
+	 * hardware buffer. */
+	if (!(flags & PIXMAN_RENDERER_OUTPUT_USE_SHADOW)) {
+		output->renderer_state = po;
+		return 0;
+	}
+
 	/* set shadow image transformation */
 	w = output->current->width;
 	h = output->current->height;
@@ -741,7 +1187,10 @@ pixman_renderer_output_destroy(struct weston_output *output)
 {
 	struct pixman_output_state *po = get_output_state(output);
 
-	pixman_image_unref(po->shadow_image);
+	if (po->shadow_image) {
+		pixman_image_unref(po->shadow_image);
+		free(po->shadow_buffer);
+	}
 
 	if (po->hw_buffer)
 		pixman_image_unref(po->hw_buffer);
@@ -28,7 +28,19 @@ int
 pixman_renderer_init(struct weston_compositor *ec);
 
 int
-pixman_renderer_output_create(struct weston_output *output);
+pixman_renderer_set_threads(struct weston_compositor *ec, int threads);
+
+enum pixman_renderer_output_flags {
+	/* Composite into a shadow image and copy the damage to the
+	 * hardware buffer afterwards. Use this when the hardware buffer
+	 * is slow to read from, such as uncached mappings. Without it,
+	 * the hardware buffer must keep its contents outside the damage
+	 * passed to repaint_output() from one frame to the next. */
+	PIXMAN_RENDERER_OUTPUT_USE_SHADOW = (1 << 0),
+};
+
+int
+pixman_renderer_output_create(struct weston_output *output, uint32_t flags);
 
 void
 pixman_renderer_output_set_buffer(struct weston_output *output, pixman_image_t *buffer);
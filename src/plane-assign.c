@@ -0,0 +1,286 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "plane-assign.h"
+
+/* Surfaces are given top to bottom. A surface can only go on a plane
+ * if every surface above it that it overlaps is on a plane stacked
+ * higher, otherwise that surface would end up below it. The cost of
+ * an assignment is the pixels per second the renderer has to compose
+ * on the primary plane, commit rate times damage of each surface left
+ * there; between equal costs the one leaving the least area on the
+ * primary plane wins.
+ *
+ * The best assignment is found with a depth first search that tries
+ * the planes before the primary plane, so the first assignment it
+ * finds is the first fit one, and cuts off any branch that already
+ * costs more than the best so far. As a last resort, the search is
+ * capped at PLANE_ASSIGN_MAX_NODES steps. */
+
+#define PLANE_ASSIGN_MAX_NODES 4096
+
+struct cost {
+	double weight;
+	double area;
+};
+
+struct search {
+	struct plane_assign *pa;
+	struct plane_assign_surface *surfaces;
+	int count;
+
+	int plane[PLANE_ASSIGN_MAX_SURFACES];
+	int best[PLANE_ASSIGN_MAX_SURFACES];
+	struct cost best_cost;
+	int found;
+};
+
+static int
+box_overlap(const pixman_box32_t *a, const pixman_box32_t *b)
+{
+	return a->x1 < b->x2 && b->x1 < a->x2 &&
+	       a->y1 < b->y2 && b->y1 < a->y2;
+}
+
+static void
+cost_add(struct cost *cost, const struct plane_assign_surface *surface)
+{
+	const pixman_box32_t *box = &surface->box;
+
+	cost->weight += (double) surface->commit_rate * surface->damage_area;
+	cost->area += (double) (box->x2 - box->x1) * (box->y2 - box->y1);
+}
+
+static int
+cost_less(const struct cost *a, const struct cost *b)
+{
+	return a->weight < b->weight ||
+		(a->weight == b->weight && a->area < b->area);
+}
+
+void
+plane_assign_init(struct plane_assign *pa)
+{
+	memset(pa, 0, sizeof *pa);
+}
+
+/* Returns the index of the plane, the bit for it in
+ * plane_assign_surface::planes. */
+int
+plane_assign_add_plane(struct plane_assign *pa,
+		       enum plane_assign_type type, int zpos)
+{
+	if (pa->plane_count == PLANE_ASSIGN_MAX_PLANES)
+		return -1;
+
+	pa->planes[pa->plane_count].type = type;
+	pa->planes[pa->plane_count].zpos = zpos;
+
+	return pa->plane_count++;
+}
+
+static int
+can_lift(struct search *s, int i, int p)
+{
+	const pixman_box32_t *box = &s->surfaces[i].box;
+	int j, zpos = s->pa->planes[p].zpos;
+
+	for (j = 0; j < i; j++) {
+		if (!box_overlap(box, &s->surfaces[j].box))
+			continue;
+		if (s->plane[j] < 0 || s->pa->planes[s->plane[j]].zpos <= zpos)
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Planes of the same type and stacking are interchangeable, only try
+ * the first free one. */
+static int
+is_duplicate(struct search *s, uint32_t mask, int p)
+{
+	const struct plane_assign_plane *plane = &s->pa->planes[p];
+	int q;
+
+	for (q = 0; q < p; q++)
+		if ((mask & (1u << q)) &&
+		    s->pa->planes[q].type == plane->type &&
+		    s->pa->planes[q].zpos == plane->zpos)
+			return 1;
+
+	return 0;
+}
+
+static void
+search_leaf(struct search *s, int i, const struct cost *cost)
+{
+	/* Anything left is hidden under a scanout surface. */
+	for (; i < s->count; i++)
+		s->plane[i] = -1;
+
+	if (s->found && !cost_less(cost, &s->best_cost))
+		return;
+
+	memcpy(s->best, s->plane, s->count * sizeof s->best[0]);
+	s->best_cost = *cost;
+	s->found = 1;
+}
+
+static void
+search(struct search *s, int i, uint32_t used, struct cost cost)
+{
+	struct plane_assign_surface *surface;
+	struct cost primary;
+	uint32_t mask;
+	int p;
+
+	if (s->found && !cost_less(&cost, &s->best_cost))
+		return;
+
+	if (i == s->count) {
+		search_leaf(s, i, &cost);
+		return;
+	}
+
+	if (s->found && s->pa->nodes >= PLANE_ASSIGN_MAX_NODES)
+		return;
+	s->pa->nodes++;
+
+	surface = &s->surfaces[i];
+	mask = surface->planes & ~used;
+
+	for (p = 0; p < s->pa->plane_count; p++) {
+		if (!(mask & (1u << p)) || is_duplicate(s, mask, p) ||
+		    !can_lift(s, i, p))
+			continue;
+
+		s->plane[i] = p;
+		if (s->pa->planes[p].type == PLANE_ASSIGN_SCANOUT)
+			search_leaf(s, i + 1, &cost);
+		else
+			search(s, i + 1, used | (1u << p), cost);
+	}
+
+	s->plane[i] = -1;
+	primary = cost;
+	cost_add(&primary, surface);
+	search(s, i + 1, used, primary);
+}
+
+static int
+search_init(struct search *s, struct plane_assign *pa,
+	    struct plane_assign_surface *surfaces, int count)
+{
+	int i;
+
+	s->pa = pa;
+	s->surfaces = surfaces;
+	s->found = 0;
+	pa->nodes = 0;
+
+	/* Only the ones at the top get a chance to go on a plane. */
+	for (i = PLANE_ASSIGN_MAX_SURFACES; i < count; i++)
+		surfaces[i].plane = -1;
+	if (count > PLANE_ASSIGN_MAX_SURFACES)
+		count = PLANE_ASSIGN_MAX_SURFACES;
+	s->count = count;
+
+	return count;
+}
+
+/* Assigns the surfaces, given top to bottom, to planes and returns the
+ * cost of the primary plane, see above. */
+double
+plane_assign_run(struct plane_assign *pa,
+		 struct plane_assign_surface *surfaces, int count)
+{
+	struct search s;
+	struct cost cost = { 0.0, 0.0 };
+	int i;
+
+	count = search_init(&s, pa, surfaces, count);
+	search(&s, 0, 0, cost);
+
+	for (i = 0; i < count; i++)
+		surfaces[i].plane = s.best[i];
+
+	return plane_assign_cost(pa, surfaces, count);
+}
+
+/* The old heuristic: top to bottom, each surface goes on the first
+ * plane that can take it. For comparison. */
+double
+plane_assign_first_fit(struct plane_assign *pa,
+		       struct plane_assign_surface *surfaces, int count)
+{
+	struct search s;
+	uint32_t used = 0;
+	int i, p;
+
+	count = search_init(&s, pa, surfaces, count);
+
+	for (i = 0; i < count; i++) {
+		s.plane[i] = -1;
+		for (p = 0; p < pa->plane_count; p++) {
+			if ((surfaces[i].planes & ~used & (1u << p)) &&
+			    can_lift(&s, i, p)) {
+				s.plane[i] = p;
+				used |= 1u << p;
+				break;
+			}
+		}
+		pa->nodes++;
+
+		if (s.plane[i] >= 0 &&
+		    pa->planes[s.plane[i]].type == PLANE_ASSIGN_SCANOUT) {
+			while (++i < count)
+				s.plane[i] = -1;
+		}
+	}
+
+	for (i = 0; i < count; i++)
+		surfaces[i].plane = s.plane[i];
+
+	return plane_assign_cost(pa, surfaces, count);
+}
+
+/* The pixels per second composed on the primary plane. */
+double
+plane_assign_cost(struct plane_assign *pa,
+		  struct plane_assign_surface *surfaces, int count)
+{
+	struct cost cost = { 0.0, 0.0 };
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (surfaces[i].plane >= 0 &&
+		    pa->planes[surfaces[i].plane].type == PLANE_ASSIGN_SCANOUT)
+			break;
+		if (surfaces[i].plane < 0)
+			cost_add(&cost, &surfaces[i]);
+	}
+
+	return cost.weight;
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _WESTON_PLANE_ASSIGN_H
+#define _WESTON_PLANE_ASSIGN_H
+
+#include <stdint.h>
+#include <pixman.h>
+
+/* A software model of the planes of an output, used to pick which
+ * surfaces go on hardware planes. The backend says which planes each
+ * surface could go on, and the model finds the assignment that leaves
+ * the least for the renderer to compose on the primary plane, going by
+ * how often and how much of each surface changes. */
+
+#define PLANE_ASSIGN_MAX_PLANES		16
+#define PLANE_ASSIGN_MAX_SURFACES	64
+
+enum plane_assign_type {
+	PLANE_ASSIGN_OVERLAY,
+	PLANE_ASSIGN_CURSOR,
+	/* Shows the surface instead of the primary plane, and hides
+	 * everything below it. */
+	PLANE_ASSIGN_SCANOUT
+};
+
+struct plane_assign_plane {
+	enum plane_assign_type type;
+	int zpos;	/* above the primary plane when > 0 */
+};
+
+struct plane_assign_surface {
+	pixman_box32_t box;	/* in global coordinates */
+	uint32_t planes;	/* mask of the planes it can go on */
+	float commit_rate;	/* commits per second */
+	float damage_area;	/* damaged pixels per commit */
+	int plane;		/* result, index of the plane or -1 */
+};
+
+struct plane_assign {
+	struct plane_assign_plane planes[PLANE_ASSIGN_MAX_PLANES];
+	int plane_count;
+
+	/* Search steps taken by the last plane_assign_run(). */
+	uint32_t nodes;
+};
+
+void
+plane_assign_init(struct plane_assign *pa);
+
+int
+plane_assign_add_plane(struct plane_assign *pa,
+		       enum plane_assign_type type, int zpos);
+
+double
+plane_assign_run(struct plane_assign *pa,
+		 struct plane_assign_surface *surfaces, int count);
+
+double
+plane_assign_first_fit(struct plane_assign *pa,
+		       struct plane_assign_surface *surfaces, int count);
+
+double
+plane_assign_cost(struct plane_assign *pa,
+		  struct plane_assign_surface *surfaces, int count);
+
+#endif
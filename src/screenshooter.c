@@ -25,15 +25,17 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
 #include <linux/input.h>
 #include <fcntl.h>
 #include <unistd.h>
-#include <sys/uio.h>
 
 #include "compositor.h"
 #include "screenshooter-server-protocol.h"
 
-#include "../wcap/wcap-decode.h"
+#include "../wcap/wcap-codec.h"
 
 struct screenshooter {
 	struct weston_compositor *ec;
@@ -49,25 +51,22 @@ struct screenshooter_frame_listener {
 	struct wl_resource *resource;
 };
 
-static void
-copy_bgra_yflip(uint8_t *dst, uint8_t *src, int height, int stride)
-{
-	uint8_t *end;
-
-	end = dst + height * stride;
-	while (dst < end) {
-		memcpy(dst, src, stride);
-		dst += stride;
-		src -= stride;
-	}
-}
-
-static void
-copy_bgra(uint8_t *dst, uint8_t *src, int height, int stride)
-{
-	/* TODO: optimize this out */
-	memcpy(dst, src, height * stride);
-}
+/* Tracks the damage of an output since the last damage shot of it, for
+ * as long as the owner keeps it or the output exists. */
+struct weston_screenshooter_damage {
+	struct wl_list link;
+	struct weston_output *output;
+	const struct weston_screenshooter_damage_interface *interface;
+	void *data;
+	struct wl_listener damage_listener;
+	struct wl_listener frame_listener;	/* only while a shot is pending */
+	struct wl_listener output_destroy_listener;
+	pixman_region32_t damage;
+	struct weston_buffer *buffer;		/* pending shot */
+	struct wl_listener buffer_destroy_listener;
+	struct weston_buffer *last;		/* holds the last shot */
+	struct wl_listener last_destroy_listener;
+};
 
 static void
 copy_row_swap_RB(void *vdst, void *vsrc, int bytes)
@@ -87,28 +86,80 @@ copy_row_swap_RB(void *vdst, void *vsrc, int bytes)
 }
 
 static void
-copy_rgba_yflip(uint8_t *dst, uint8_t *src, int height, int stride)
+copy_row(void *dst, void *src, int bytes, int swap)
+{
+	if (swap)
+		copy_row_swap_RB(dst, src, bytes);
+	else
+		memcpy(dst, src, bytes);
+}
+
+/* Copies 'height' rows of 'bytes' each, flipping and swizzling them on
+ * the way as needed. A negative 'src_stride' flips the rows, with
+ * 'src' pointing at the last one. */
+static void
+copy_rows(uint8_t *dst, int dst_stride, uint8_t *src, int src_stride,
+	  int bytes, int height, int swap)
 {
 	uint8_t *end;
 
-	end = dst + height * stride;
+	end = dst + height * dst_stride;
 	while (dst < end) {
-		copy_row_swap_RB(dst, src, stride);
-		dst += stride;
-		src -= stride;
+		copy_row(dst, src, bytes, swap);
+		dst += dst_stride;
+		src += src_stride;
 	}
 }
 
-static void
-copy_rgba(uint8_t *dst, uint8_t *src, int height, int stride)
+/* Fixes up rows read back straight into the client buffer in place,
+ * swapping the top and bottom ones and swizzling in the same pass. */
+static int
+fixup_rows(uint8_t *d, int stride, int bytes, int height,
+	   int yflip, int swap)
 {
-	uint8_t *end;
+	uint8_t *top, *bottom, *row;
 
-	end = dst + height * stride;
-	while (dst < end) {
-		copy_row_swap_RB(dst, src, stride);
-		dst += stride;
-		src += stride;
+	if (!yflip) {
+		if (swap)
+			copy_rows(d, stride, d, stride, bytes, height, 1);
+		return 0;
+	}
+
+	row = malloc(bytes);
+	if (row == NULL)
+		return -1;
+
+	top = d;
+	bottom = d + (height - 1) * stride;
+	while (top < bottom) {
+		copy_row(row, top, bytes, swap);
+		copy_row(top, bottom, bytes, swap);
+		memcpy(bottom, row, bytes);
+		top += stride;
+		bottom -= stride;
+	}
+	if (top == bottom && swap)
+		copy_row_swap_RB(top, top, bytes);
+
+	free(row);
+
+	return 0;
+}
+
+static int
+read_format_needs_swap(pixman_format_code_t format, int *swap)
+{
+	switch (format) {
+	case PIXMAN_a8r8g8b8:
+	case PIXMAN_x8r8g8b8:
+		*swap = 0;
+		return 0;
+	case PIXMAN_x8b8g8r8:
+	case PIXMAN_a8b8g8r8:
+		*swap = 1;
+		return 0;
+	default:
+		return -1;
 	}
 }
 
@@ -120,54 +171,95 @@ screenshooter_frame_notify(struct wl_listener *listener, void *data)
 			     struct screenshooter_frame_listener, listener);
 	struct weston_output *output = data;
 	struct weston_compositor *compositor = output->compositor;
-	int32_t stride;
-	uint8_t *pixels, *d, *s;
+	int32_t stride, width, height, bytes;
+	int yflip, swap, ret = 0;
+	uint8_t *pixels, *d;
 
 	output->disable_planes--;
 	wl_list_remove(&listener->link);
-	stride = l->buffer->width * (PIXMAN_FORMAT_BPP(compositor->read_format) / 8);
-	pixels = malloc(stride * l->buffer->height);
 
-	if (pixels == NULL) {
-		wl_resource_post_no_memory(l->resource);
-		free(l);
-		return;
-	}
-
-	compositor->renderer->read_pixels(output,
-			     compositor->read_format, pixels,
-			     0, 0, output->current->width,
-			     output->current->height);
+	if (read_format_needs_swap(compositor->read_format, &swap) < 0)
+		goto out;
 
+	yflip = !!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
+	width = output->current->width;
+	height = output->current->height;
+	bytes = width * (PIXMAN_FORMAT_BPP(compositor->read_format) / 8);
 	stride = wl_shm_buffer_get_stride(l->buffer->shm_buffer);
-
 	d = wl_shm_buffer_get_data(l->buffer->shm_buffer);
-	s = pixels + stride * (l->buffer->height - 1);
 
-	switch (compositor->read_format) {
-	case PIXMAN_a8r8g8b8:
-	case PIXMAN_x8r8g8b8:
-		if (compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP)
-			copy_bgra_yflip(d, s, output->current->height, stride);
-		else
-			copy_bgra(d, pixels, output->current->height, stride);
-		break;
-	case PIXMAN_x8b8g8r8:
-	case PIXMAN_a8b8g8r8:
-		if (compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP)
-			copy_rgba_yflip(d, s, output->current->height, stride);
+	/* Read back straight into the client buffer if its rows are laid
+	 * out like read_pixels writes them, otherwise go through a copy
+	 * that flips and swizzles in the same pass. */
+	if (stride == bytes) {
+		compositor->renderer->read_pixels(output,
+				     compositor->read_format, d,
+				     0, 0, width, height);
+		ret = fixup_rows(d, stride, bytes, height, yflip, swap);
+	} else {
+		pixels = malloc(bytes * height);
+		if (pixels == NULL) {
+			ret = -1;
+			goto out;
+		}
+
+		compositor->renderer->read_pixels(output,
+				     compositor->read_format, pixels,
+				     0, 0, width, height);
+		if (yflip)
+			copy_rows(d, stride, pixels + bytes * (height - 1),
+				  -bytes, bytes, height, swap);
 		else
-			copy_rgba(d, pixels, output->current->height, stride);
-		break;
-	default:
-		break;
+			copy_rows(d, stride, pixels, bytes,
+				  bytes, height, swap);
+		free(pixels);
 	}
 
-	screenshooter_send_done(l->resource);
-	free(pixels);
+out:
+	if (ret < 0)
+		wl_resource_post_no_memory(l->resource);
+	else
+		screenshooter_send_done(l->resource);
 	free(l);
 }
 
+/* Screenshots go into shm buffers at least as big as the output. */
+static int
+screenshooter_check_buffer(struct weston_output *output,
+			   struct weston_buffer *buffer)
+{
+	if (!wl_shm_buffer_get(buffer->resource))
+		return -1;
+
+	buffer->shm_buffer = wl_shm_buffer_get(buffer->resource);
+	buffer->width = wl_shm_buffer_get_width(buffer->shm_buffer);
+	buffer->height = wl_shm_buffer_get_height(buffer->shm_buffer);
+
+	if (buffer->width < output->current->width ||
+	    buffer->height < output->current->height)
+		return -1;
+
+	return 0;
+}
+
+static struct weston_buffer *
+screenshooter_get_buffer(struct weston_output *output,
+			 struct wl_resource *resource,
+			 struct wl_resource *buffer_resource)
+{
+	struct weston_buffer *buffer =
+		weston_buffer_from_resource(buffer_resource);
+
+	if (buffer == NULL) {
+		wl_resource_post_no_memory(resource);
+		return NULL;
+	}
+	if (screenshooter_check_buffer(output, buffer) < 0)
+		return NULL;
+
+	return buffer;
+}
+
 static void
 screenshooter_shoot(struct wl_client *client,
 		    struct wl_resource *resource,
@@ -177,22 +269,10 @@ screenshooter_shoot(struct wl_client *client,
 	struct weston_output *output =
 		wl_resource_get_user_data(output_resource);
 	struct screenshooter_frame_listener *l;
-	struct weston_buffer *buffer =
-		weston_buffer_from_resource(buffer_resource);
-
-	if (buffer == NULL) {
-		wl_resource_post_no_memory(resource);
-		return;
-	}
-	if (!wl_shm_buffer_get(buffer->resource))
-		return;
-	
-	buffer->shm_buffer = wl_shm_buffer_get(buffer->resource);
-	buffer->width = wl_shm_buffer_get_width(buffer->shm_buffer);
-	buffer->height = wl_shm_buffer_get_height(buffer->shm_buffer);
+	struct weston_buffer *buffer;
 
-	if (buffer->width < output->current->width ||
-	    buffer->height < output->current->height)
+	buffer = screenshooter_get_buffer(output, resource, buffer_resource);
+	if (buffer == NULL)
 		return;
 
 	l = malloc(sizeof *l);
@@ -210,28 +290,394 @@ screenshooter_shoot(struct wl_client *client,
 	weston_output_schedule_repaint(output);
 }
 
+static void
+transform_rect(struct weston_output *output, pixman_box32_t *r)
+{
+	pixman_box32_t s = *r;
+
+	switch (output->transform) {
+	case WL_OUTPUT_TRANSFORM_FLIPPED:
+	case WL_OUTPUT_TRANSFORM_FLIPPED_90:
+	case WL_OUTPUT_TRANSFORM_FLIPPED_180:
+	case WL_OUTPUT_TRANSFORM_FLIPPED_270:
+		s.x1 = output->width - r->x2;
+		s.x2 = output->width - r->x1;
+		break;
+	default:
+		break;
+	}
+
+	switch (output->transform) {
+        case WL_OUTPUT_TRANSFORM_NORMAL:
+        case WL_OUTPUT_TRANSFORM_FLIPPED:
+		r->x1 = s.x1;
+		r->x2 = s.x2;
+                break;
+        case WL_OUTPUT_TRANSFORM_90:
+        case WL_OUTPUT_TRANSFORM_FLIPPED_90:
+		r->x1 = output->current->width - s.y2;
+		r->y1 = s.x1;
+		r->x2 = output->current->width - s.y1;
+		r->y2 = s.x2;
+                break;
+        case WL_OUTPUT_TRANSFORM_180:
+        case WL_OUTPUT_TRANSFORM_FLIPPED_180:
+		r->x1 = output->current->width - s.x2;
+		r->y1 = output->current->height - s.y2;
+		r->x2 = output->current->width - s.x1;
+		r->y2 = output->current->height - s.y1;
+                break;
+        case WL_OUTPUT_TRANSFORM_270:
+        case WL_OUTPUT_TRANSFORM_FLIPPED_270:
+		r->x1 = s.y1; 
+		r->y1 = output->current->height - s.x2;
+		r->x2 = s.y2; 
+		r->y2 = output->current->height - s.x1;
+                break;
+        default:
+                break;
+        }
+
+	r->x1 *= output->scale;
+	r->y1 *= output->scale;
+	r->x2 *= output->scale;
+	r->y2 *= output->scale;
+}
+
+/* Reads the damage since the last shot back into 'buffer', which
+ * still holds the rest from then, and tells the owner which parts
+ * changed. */
+static int
+screenshooter_damage_read(struct weston_screenshooter_damage *sd,
+			  struct weston_buffer *buffer,
+			  pixman_region32_t *damage)
+{
+	struct weston_output *output = sd->output;
+	struct weston_compositor *compositor = output->compositor;
+	pixman_box32_t *rects, r;
+	int32_t stride, width, height, bytes;
+	int i, n, yflip, swap, y_orig, size = 0;
+	uint8_t *pixels = NULL, *d;
+
+	if (read_format_needs_swap(compositor->read_format, &swap) < 0)
+		return 0;
+
+	yflip = !!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
+	stride = wl_shm_buffer_get_stride(buffer->shm_buffer);
+	d = wl_shm_buffer_get_data(buffer->shm_buffer);
+
+	pixman_region32_translate(damage, -output->x, -output->y);
+	rects = pixman_region32_rectangles(damage, &n);
+	for (i = 0; i < n; i++) {
+		r = rects[i];
+		transform_rect(output, &r);
+		width = r.x2 - r.x1;
+		height = r.y2 - r.y1;
+		bytes = width * 4;
+
+		if (bytes * height > size) {
+			size = bytes * height;
+			free(pixels);
+			pixels = malloc(size);
+			if (pixels == NULL)
+				return -1;
+		}
+
+		if (yflip)
+			y_orig = output->current->height - r.y2;
+		else
+			y_orig = r.y1;
+
+		compositor->renderer->read_pixels(output,
+				     compositor->read_format, pixels,
+				     r.x1, y_orig, width, height);
+
+		if (yflip)
+			copy_rows(d + r.y1 * stride + r.x1 * 4, stride,
+				  pixels + bytes * (height - 1), -bytes,
+				  bytes, height, swap);
+		else
+			copy_rows(d + r.y1 * stride + r.x1 * 4, stride,
+				  pixels, bytes, bytes, height, swap);
+
+		sd->interface->damage(sd->data, r.x1, r.y1, width, height);
+	}
+
+	free(pixels);
+
+	return 0;
+}
+
+static void
+screenshooter_damage_set_last(struct weston_screenshooter_damage *sd,
+			      struct weston_buffer *buffer)
+{
+	if (sd->last)
+		wl_list_remove(&sd->last_destroy_listener.link);
+	sd->last = buffer;
+	if (buffer)
+		wl_signal_add(&buffer->destroy_signal,
+			      &sd->last_destroy_listener);
+}
+
+/* Drops the pending shot, if any. */
+static void
+screenshooter_damage_end(struct weston_screenshooter_damage *sd)
+{
+	if (sd->buffer == NULL)
+		return;
+
+	wl_list_remove(&sd->frame_listener.link);
+	wl_list_remove(&sd->buffer_destroy_listener.link);
+	sd->output->disable_planes--;
+	sd->buffer = NULL;
+}
+
+static void
+screenshooter_damage_notify(struct wl_listener *listener, void *data)
+{
+	struct weston_screenshooter_damage *sd =
+		container_of(listener, struct weston_screenshooter_damage,
+			     damage_listener);
+	pixman_region32_t *damage = data;
+
+	pixman_region32_union(&sd->damage, &sd->damage, damage);
+}
+
+static void
+screenshooter_damage_frame_notify(struct wl_listener *listener, void *data)
+{
+	struct weston_screenshooter_damage *sd =
+		container_of(listener, struct weston_screenshooter_damage,
+			     frame_listener);
+	struct weston_output *output = data;
+	struct weston_buffer *buffer = sd->buffer;
+	pixman_region32_t damage;
+	int ret;
+
+	/* Any other buffer than the one the last shot went into gets all
+	 * of the output. */
+	pixman_region32_init(&damage);
+	if (buffer == sd->last)
+		pixman_region32_intersect(&damage, &sd->damage,
+					  &output->region);
+	else
+		pixman_region32_copy(&damage, &output->region);
+
+	ret = screenshooter_damage_read(sd, buffer, &damage);
+	pixman_region32_fini(&damage);
+	screenshooter_damage_end(sd);
+
+	if (ret < 0) {
+		screenshooter_damage_set_last(sd, NULL);
+		sd->interface->done(sd->data, ret);
+		return;
+	}
+
+	pixman_region32_clear(&sd->damage);
+	screenshooter_damage_set_last(sd, buffer);
+	sd->interface->done(sd->data, 0);
+}
+
+static void
+screenshooter_damage_buffer_destroy(struct wl_listener *listener, void *data)
+{
+	struct weston_screenshooter_damage *sd =
+		container_of(listener, struct weston_screenshooter_damage,
+			     buffer_destroy_listener);
+
+	screenshooter_damage_end(sd);
+}
+
+static void
+screenshooter_damage_last_destroy(struct wl_listener *listener, void *data)
+{
+	struct weston_screenshooter_damage *sd =
+		container_of(listener, struct weston_screenshooter_damage,
+			     last_destroy_listener);
+
+	sd->last = NULL;
+}
+
+static void
+screenshooter_damage_output_destroy(struct wl_listener *listener, void *data)
+{
+	struct weston_screenshooter_damage *sd =
+		container_of(listener, struct weston_screenshooter_damage,
+			     output_destroy_listener);
+
+	weston_screenshooter_damage_destroy(sd);
+}
+
+/* Starts tracking the damage of 'output' for damage shots. The tracker
+ * is freed along with the output, if not destroyed before. */
+WL_EXPORT struct weston_screenshooter_damage *
+weston_screenshooter_damage_create(struct weston_output *output,
+				   const struct weston_screenshooter_damage_interface *interface,
+				   void *data)
+{
+	struct weston_screenshooter_damage *sd;
+
+	sd = zalloc(sizeof *sd);
+	if (sd == NULL)
+		return NULL;
+
+	sd->output = output;
+	sd->interface = interface;
+	sd->data = data;
+	wl_list_init(&sd->link);
+	pixman_region32_init(&sd->damage);
+	sd->damage_listener.notify = screenshooter_damage_notify;
+	wl_signal_add(&output->damage_signal, &sd->damage_listener);
+	sd->frame_listener.notify = screenshooter_damage_frame_notify;
+	sd->buffer_destroy_listener.notify =
+		screenshooter_damage_buffer_destroy;
+	sd->last_destroy_listener.notify = screenshooter_damage_last_destroy;
+	sd->output_destroy_listener.notify =
+		screenshooter_damage_output_destroy;
+	wl_signal_add(&output->destroy_signal, &sd->output_destroy_listener);
+
+	return sd;
+}
+
+/* On the next frame, reads the damage since the last shot into
+ * 'buffer', or all of the output if 'buffer' is not the one the last
+ * shot went into. Returns -1 if 'buffer' is not an shm buffer at least
+ * as big as the output. */
+WL_EXPORT int
+weston_screenshooter_damage_shoot(struct weston_screenshooter_damage *sd,
+				  struct weston_buffer *buffer)
+{
+	if (screenshooter_check_buffer(sd->output, buffer) < 0)
+		return -1;
+
+	if (sd->buffer == NULL) {
+		sd->output->disable_planes++;
+		wl_signal_add(&sd->output->frame_signal, &sd->frame_listener);
+	} else {
+		wl_list_remove(&sd->buffer_destroy_listener.link);
+	}
+	sd->buffer = buffer;
+	wl_signal_add(&buffer->destroy_signal, &sd->buffer_destroy_listener);
+	weston_output_schedule_repaint(sd->output);
+
+	return 0;
+}
+
+WL_EXPORT void
+weston_screenshooter_damage_destroy(struct weston_screenshooter_damage *sd)
+{
+	screenshooter_damage_end(sd);
+	screenshooter_damage_set_last(sd, NULL);
+	wl_list_remove(&sd->damage_listener.link);
+	wl_list_remove(&sd->output_destroy_listener.link);
+	wl_list_remove(&sd->link);
+	pixman_region32_fini(&sd->damage);
+	free(sd);
+}
+
+static void
+screenshooter_resource_damage(void *data, int32_t x, int32_t y,
+			      int32_t width, int32_t height)
+{
+	screenshooter_send_damage(data, x, y, width, height);
+}
+
+static void
+screenshooter_resource_done(void *data, int status)
+{
+	if (status < 0)
+		wl_resource_post_no_memory(data);
+	else
+		screenshooter_send_done(data);
+}
+
+static const struct weston_screenshooter_damage_interface
+screenshooter_resource_interface = {
+	screenshooter_resource_damage,
+	screenshooter_resource_done
+};
+
+static void
+screenshooter_shoot_damage(struct wl_client *client,
+			   struct wl_resource *resource,
+			   struct wl_resource *output_resource,
+			   struct wl_resource *buffer_resource)
+{
+	struct weston_output *output =
+		wl_resource_get_user_data(output_resource);
+	struct wl_list *list = wl_resource_get_user_data(resource);
+	struct weston_screenshooter_damage *sd;
+	struct weston_buffer *buffer;
+
+	buffer = weston_buffer_from_resource(buffer_resource);
+	if (buffer == NULL) {
+		wl_resource_post_no_memory(resource);
+		return;
+	}
+
+	wl_list_for_each(sd, list, link)
+		if (sd->output == output)
+			break;
+
+	if (&sd->link == list) {
+		sd = weston_screenshooter_damage_create(output,
+							&screenshooter_resource_interface,
+							resource);
+		if (sd == NULL) {
+			wl_resource_post_no_memory(resource);
+			return;
+		}
+		wl_list_insert(list, &sd->link);
+	}
+
+	weston_screenshooter_damage_shoot(sd, buffer);
+}
+
 struct screenshooter_interface screenshooter_implementation = {
-	screenshooter_shoot
+	screenshooter_shoot,
+	screenshooter_shoot_damage
 };
 
+static void
+unbind_shooter(struct wl_resource *resource)
+{
+	struct wl_list *list = wl_resource_get_user_data(resource);
+	struct weston_screenshooter_damage *sd, *next;
+
+	wl_list_for_each_safe(sd, next, list, link)
+		weston_screenshooter_damage_destroy(sd);
+	free(list);
+}
+
 static void
 bind_shooter(struct wl_client *client,
 	     void *data, uint32_t version, uint32_t id)
 {
 	struct screenshooter *shooter = data;
 	struct wl_resource *resource;
+	struct wl_list *list;
 
-	resource = wl_resource_create(client,
-				      &screenshooter_interface, 1, id);
+	resource = wl_resource_create(client, &screenshooter_interface,
+				      MIN(version, 2), id);
 
 	if (client != shooter->client) {
 		wl_resource_post_error(resource, WL_DISPLAY_ERROR_INVALID_OBJECT,
 				       "screenshooter failed: permission denied");
 		wl_resource_destroy(resource);
+		return;
+	}
+
+	list = malloc(sizeof *list);
+	if (list == NULL) {
+		wl_client_post_no_memory(client);
+		wl_resource_destroy(resource);
+		return;
 	}
+	wl_list_init(list);
 
 	wl_resource_set_implementation(resource, &screenshooter_implementation,
-				       data, NULL);
+				       list, unbind_shooter);
 }
 
 static void
@@ -256,99 +702,196 @@ screenshooter_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
 					screenshooter_exe, screenshooter_sigchld);
 }
 
+/* Frames read back but not yet encoded. When all of them are taken,
+ * new frames are dropped rather than stalling the repaint loop. */
+#define RECORDER_FRAMES 4
+
+/* Encoded data is written out once this much has piled up, or when
+ * the encoder runs out of frames. */
+#define RECORDER_WRITE_SIZE (1024 * 1024)
+
+/* Keyframes go into version 2 recordings this often by default, in
+ * milliseconds, so that they can be seeked in. */
+#define RECORDER_KEYFRAME_INTERVAL 10000
+
+struct recorder_frame {
+	uint32_t msecs;
+	int keyframe;
+	struct wl_array rects;	/* pixman_box32_t, in buffer coordinates */
+	uint32_t *pixels;	/* the rects read back, one after the other */
+};
+
+/* The recorder reads back the damage of each frame into one of the
+ * frames[] on the compositor thread. A worker thread then diffs them
+ * against the previous contents in 'frame', run length encodes them
+ * and writes them out. */
 struct weston_recorder {
 	struct weston_output *output;
-	uint32_t *frame, *rect;
-	uint32_t *tmpbuf;
-	uint32_t total;
+	uint32_t *frame;
+	uint64_t total;
 	int fd;
 	struct wl_listener frame_listener;
 	int count;
+	int dropped;
+	int do_yflip;
+	int width, height;
+	pixman_region32_t missed;	/* damage of dropped frames */
+	int version;
+	uint32_t keyframe_interval;
+	uint32_t keyframe_msecs;
+	int need_keyframe;
+	struct wl_array index;		/* wcap_index_entry, v2 only */
+
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t queued_cond;
+	struct recorder_frame frames[RECORDER_FRAMES];
+	int head;	/* next frame to read back into */
+	int tail;	/* next frame to encode */
+	int queued;
+	int quit;
+	int error;
+	struct wl_array out;
 };
 
-static uint32_t *
-output_run(uint32_t *p, uint32_t delta, int run)
+static int
+recorder_flush(struct weston_recorder *recorder)
 {
-	int i;
-
-	while (run > 0) {
-		if (run <= 0xe0) {
-			*p++ = delta | ((run - 1) << 24);
-			break;
-		}
-
-		i = 24 - __builtin_clz(run);
-		*p++ = delta | ((i + 0xe0) << 24);
-		run -= 1 << (7 + i);
+	uint8_t *data = recorder->out.data;
+	size_t size = recorder->out.size;
+	ssize_t len;
+
+	while (size > 0) {
+		len = write(recorder->fd, data, size);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len < 0)
+			return -1;
+
+		recorder->total += len;
+		data += len;
+		size -= len;
 	}
 
-	return p;
+	recorder->out.size = 0;
+
+	return 0;
 }
 
-static uint32_t
-component_delta(uint32_t next, uint32_t prev)
+static int
+recorder_encode_frame(struct weston_recorder *recorder,
+		      struct recorder_frame *f)
 {
-	unsigned char dr, dg, db;
+	pixman_box32_t *r;
+	struct wcap_rectangle rect;
+	struct wcap_index_entry *entry;
+	uint64_t offset;
+	int i, n, width, height;
+	uint32_t *s, *p, *outbuf;
+	struct {
+		uint32_t msecs;
+		uint32_t nrects;
+	} *header;
+
+	n = f->rects.size / sizeof *r;
+
+	if (f->keyframe) {
+		entry = wl_array_add(&recorder->index, sizeof *entry);
+		if (!entry)
+			return -1;
+		entry->msecs = f->msecs;
+		entry->frame = recorder->count;
+		offset = recorder->total + recorder->out.size;
+		entry->offset_lo = offset;
+		entry->offset_hi = offset >> 32;
+
+		memset(recorder->frame, 0,
+		       recorder->width * recorder->height * 4);
+	}
+
+	header = wl_array_add(&recorder->out, sizeof *header);
+	if (!header)
+		return -1;
+	header->msecs = f->msecs;
+	header->nrects = n;
+	if (f->keyframe)
+		header->nrects |= WCAP_FRAME_KEY;
+
+	r = wl_array_add(&recorder->out, f->rects.size);
+	if (!r)
+		return -1;
+	memcpy(r, f->rects.data, f->rects.size);
 
-	dr = (next >> 16) - (prev >> 16);
-	dg = (next >>  8) - (prev >>  8);
-	db = (next >>  0) - (prev >>  0);
+	r = f->rects.data;
+	s = f->pixels;
 
-	return (dr << 16) | (dg << 8) | (db << 0);
+	for (i = 0; i < n; i++) {
+		width = r[i].x2 - r[i].x1;
+		height = r[i].y2 - r[i].y1;
+
+		/* A run is never longer than the pixels it covers. */
+		outbuf = wl_array_add(&recorder->out, width * height * 4);
+		if (!outbuf)
+			return -1;
+
+		rect.x1 = r[i].x1;
+		rect.y1 = r[i].y1;
+		rect.x2 = r[i].x2;
+		rect.y2 = r[i].y2;
+		p = wcap_encode_rect(outbuf, s, recorder->frame,
+				     recorder->width, &rect,
+				     recorder->do_yflip);
+		s += width * height;
+
+		recorder->out.size -= (outbuf + width * height - p) * 4;
+	}
+
+	return 0;
 }
 
-static void
-transform_rect(struct weston_output *output, pixman_box32_t *r)
+static void *
+recorder_thread(void *data)
 {
-	pixman_box32_t s = *r;
+	struct weston_recorder *recorder = data;
+	struct recorder_frame *f;
+	int ret;
+
+	pthread_mutex_lock(&recorder->mutex);
+	for (;;) {
+		while (!recorder->quit && recorder->queued == 0)
+			pthread_cond_wait(&recorder->queued_cond,
+					  &recorder->mutex);
+		if (recorder->queued == 0)
+			break;
 
-	switch (output->transform) {
-	case WL_OUTPUT_TRANSFORM_FLIPPED:
-	case WL_OUTPUT_TRANSFORM_FLIPPED_90:
-	case WL_OUTPUT_TRANSFORM_FLIPPED_180:
-	case WL_OUTPUT_TRANSFORM_FLIPPED_270:
-		s.x1 = output->width - r->x2;
-		s.x2 = output->width - r->x1;
-		break;
-	default:
-		break;
+		f = &recorder->frames[recorder->tail];
+		pthread_mutex_unlock(&recorder->mutex);
+
+		ret = recorder->error ? 0 : recorder_encode_frame(recorder, f);
+
+		pthread_mutex_lock(&recorder->mutex);
+		recorder->tail = (recorder->tail + 1) % RECORDER_FRAMES;
+		recorder->queued--;
+		if (ret < 0)
+			recorder->error = ENOMEM;
+		else if (!recorder->error)
+			recorder->count++;
+
+		/* Batch up the writes while frames keep coming. */
+		if (recorder->error ||
+		    (recorder->queued > 0 &&
+		     recorder->out.size < RECORDER_WRITE_SIZE))
+			continue;
+
+		pthread_mutex_unlock(&recorder->mutex);
+		ret = recorder_flush(recorder);
+		pthread_mutex_lock(&recorder->mutex);
+		if (ret < 0)
+			recorder->error = errno;
 	}
+	pthread_mutex_unlock(&recorder->mutex);
 
-	switch (output->transform) {
-        case WL_OUTPUT_TRANSFORM_NORMAL:
-        case WL_OUTPUT_TRANSFORM_FLIPPED:
-		r->x1 = s.x1;
-		r->x2 = s.x2;
-                break;
-        case WL_OUTPUT_TRANSFORM_90:
-        case WL_OUTPUT_TRANSFORM_FLIPPED_90:
-		r->x1 = output->current->width - s.y2;
-		r->y1 = s.x1;
-		r->x2 = output->current->width - s.y1;
-		r->y2 = s.x2;
-                break;
-        case WL_OUTPUT_TRANSFORM_180:
-        case WL_OUTPUT_TRANSFORM_FLIPPED_180:
-		r->x1 = output->current->width - s.x2;
-		r->y1 = output->current->height - s.y2;
-		r->x2 = output->current->width - s.x1;
-		r->y2 = output->current->height - s.y1;
-                break;
-        case WL_OUTPUT_TRANSFORM_270:
-        case WL_OUTPUT_TRANSFORM_FLIPPED_270:
-		r->x1 = s.y1; 
-		r->y1 = output->current->height - s.x2;
-		r->x2 = s.y2; 
-		r->y2 = output->current->height - s.x1;
-                break;
-        default:
-                break;
-        }
-
-	r->x1 *= output->scale;
-	r->y1 *= output->scale;
-	r->x2 *= output->scale;
-	r->y2 *= output->scale;
+	return NULL;
 }
 
 static void
@@ -358,100 +901,110 @@ weston_recorder_frame_notify(struct wl_listener *listener, void *data)
 		container_of(listener, struct weston_recorder, frame_listener);
 	struct weston_output *output = data;
 	struct weston_compositor *compositor = output->compositor;
-	uint32_t msecs = output->frame_time;
-	pixman_box32_t *r;
+	struct recorder_frame *f;
+	pixman_box32_t *r, *rects;
 	pixman_region32_t damage;
-	int i, j, k, n, width, height, run, stride;
-	uint32_t delta, prev, *d, *s, *p, next;
-	struct {
-		uint32_t msecs;
-		uint32_t nrects;
-	} header;
-	struct iovec v[2];
-	int do_yflip;
-	int y_orig;
-	uint32_t *outbuf;
+	int i, n, width, height, y_orig, full, keyframe;
+	uint32_t *pixels;
+
+	pixman_region32_union(&recorder->missed, &recorder->missed,
+			      &output->previous_damage);
+
+	/* If the encoder is behind, drop the frame. Its damage is read
+	 * back with the next one that makes it. */
+	pthread_mutex_lock(&recorder->mutex);
+	full = recorder->queued == RECORDER_FRAMES;
+	pthread_mutex_unlock(&recorder->mutex);
+	if (full) {
+		recorder->dropped++;
+		return;
+	}
 
-	do_yflip = !!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
-	if (do_yflip)
-		outbuf = recorder->rect;
-	else
-		outbuf = recorder->tmpbuf;
+	/* A keyframe reads back the whole output. If it is dropped, the
+	 * next frame tries again. */
+	keyframe = recorder->need_keyframe ||
+		(recorder->version >= 2 &&
+		 output->frame_time - recorder->keyframe_msecs >=
+		 recorder->keyframe_interval);
 
 	pixman_region32_init(&damage);
-	pixman_region32_intersect(&damage, &output->region,
-				  &output->previous_damage);
+	if (keyframe)
+		pixman_region32_copy(&damage, &output->region);
+	else
+		pixman_region32_intersect(&damage, &output->region,
+					  &recorder->missed);
+	pixman_region32_clear(&recorder->missed);
 
-	r = pixman_region32_rectangles(&damage, &n);
-	if (n == 0)
+	rects = pixman_region32_rectangles(&damage, &n);
+	if (n == 0) {
+		pixman_region32_fini(&damage);
 		return;
+	}
 
-	for (i = 0; i < n; i++)
-		transform_rect(output, &r[i]);
-
-	header.msecs = msecs;
-	header.nrects = n;
-	v[0].iov_base = &header;
-	v[0].iov_len = sizeof header;
-	v[1].iov_base = r;
-	v[1].iov_len = n * sizeof *r;
-	recorder->total += writev(recorder->fd, v, 2);
-	stride = output->current->width;
+	/* Only the compositor thread moves head, and the encoder doesn't
+	 * touch the frame until it is queued. */
+	f = &recorder->frames[recorder->head];
+	f->msecs = output->frame_time;
+	f->keyframe = keyframe;
+	f->rects.size = 0;
+	r = wl_array_add(&f->rects, n * sizeof *r);
+	if (!r) {
+		pixman_region32_union(&recorder->missed, &recorder->missed,
+				      &damage);
+		pixman_region32_fini(&damage);
+		recorder->dropped++;
+		return;
+	}
 
+	pixels = f->pixels;
 	for (i = 0; i < n; i++) {
+		r[i] = rects[i];
+		transform_rect(output, &r[i]);
+
 		width = r[i].x2 - r[i].x1;
 		height = r[i].y2 - r[i].y1;
 
-		if (do_yflip)
+		if (recorder->do_yflip)
 			y_orig = output->current->height - r[i].y2;
 		else
 			y_orig = r[i].y1;
 
 		compositor->renderer->read_pixels(output,
-				compositor->read_format, recorder->rect,
+				compositor->read_format, pixels,
 				r[i].x1, y_orig, width, height);
+		pixels += width * height;
+	}
 
-		s = recorder->rect;
-		p = outbuf;
-		run = prev = 0; /* quiet gcc */
-		for (j = 0; j < height; j++) {
-			if (do_yflip)
-				y_orig = r[i].y2 - j - 1;
-			else
-				y_orig = r[i].y1 + j;
-			d = recorder->frame + stride * y_orig + r[i].x1;
-
-			for (k = 0; k < width; k++) {
-				next = *s++;
-				delta = component_delta(next, *d);
-				*d++ = next;
-				if (run == 0 || delta == prev) {
-					run++;
-				} else {
-					p = output_run(p, prev, run);
-					run = 1;
-				}
-				prev = delta;
-			}
-		}
+	pixman_region32_fini(&damage);
 
-		p = output_run(p, prev, run);
+	if (keyframe) {
+		recorder->need_keyframe = 0;
+		recorder->keyframe_msecs = f->msecs;
+	}
 
-		recorder->total += write(recorder->fd,
-					 outbuf, (p - outbuf) * 4);
+	pthread_mutex_lock(&recorder->mutex);
+	recorder->head = (recorder->head + 1) % RECORDER_FRAMES;
+	recorder->queued++;
+	pthread_cond_signal(&recorder->queued_cond);
+	pthread_mutex_unlock(&recorder->mutex);
+}
 
-#if 0
-		fprintf(stderr,
-			"%dx%d at %d,%d rle from %d to %d bytes (%f) total %dM\n",
-			width, height, r[i].x1, r[i].y1,
-			width * height * 4, (int) (p - outbuf) * 4,
-			(float) (p - outbuf) / (width * height),
-			recorder->total / 1024 / 1024);
-#endif
-	}
+static void
+weston_recorder_free(struct weston_recorder *recorder)
+{
+	int i;
 
-	pixman_region32_fini(&damage);
-	recorder->count++;
+	for (i = 0; i < RECORDER_FRAMES; i++) {
+		wl_array_release(&recorder->frames[i].rects);
+		free(recorder->frames[i].pixels);
+	}
+	wl_array_release(&recorder->out);
+	wl_array_release(&recorder->index);
+	pixman_region32_fini(&recorder->missed);
+	pthread_cond_destroy(&recorder->queued_cond);
+	pthread_mutex_destroy(&recorder->mutex);
+	free(recorder->frame);
+	free(recorder);
 }
 
 static void
@@ -459,28 +1012,56 @@ weston_recorder_create(struct weston_output *output, const char *filename)
 {
 	struct weston_compositor *compositor = output->compositor;
 	struct weston_recorder *recorder;
-	int stride, size;
+	struct weston_config_section *section;
+	int i, size, interval;
 	struct { uint32_t magic, format, width, height; } header;
-	int do_yflip;
-
-	do_yflip = !!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
+	sigset_t mask, old_mask;
 
-	recorder = malloc(sizeof *recorder);
+	recorder = zalloc(sizeof *recorder);
+	if (recorder == NULL)
+		return;
 
-	stride = output->current->width;
-	size = stride * 4 * output->current->height;
-	recorder->frame = zalloc(size);
-	recorder->rect = malloc(size);
-	recorder->total = 0;
-	recorder->count = 0;
+	recorder->do_yflip =
+		!!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
+	recorder->width = output->current->width;
+	recorder->height = output->current->height;
 	recorder->output = output;
+	pixman_region32_init(&recorder->missed);
+	pthread_mutex_init(&recorder->mutex, NULL);
+	pthread_cond_init(&recorder->queued_cond, NULL);
+	wl_array_init(&recorder->out);
+	wl_array_init(&recorder->index);
+
+	section = weston_config_get_section(compositor->config,
+					    "recorder", NULL, NULL);
+	weston_config_section_get_int(section, "version",
+				      &recorder->version, 2);
+	weston_config_section_get_int(section, "keyframe-interval",
+				      &interval, RECORDER_KEYFRAME_INTERVAL);
+	if (recorder->version != 1)
+		recorder->version = 2;
+	if (interval <= 0)
+		interval = RECORDER_KEYFRAME_INTERVAL;
+	recorder->keyframe_interval = interval;
+	recorder->need_keyframe = recorder->version >= 2;
+
+	size = recorder->width * recorder->height * 4;
+	recorder->frame = zalloc(size);
+	if (!recorder->frame)
+		goto err_free;
+
+	/* The damage never covers more than the whole output. */
+	for (i = 0; i < RECORDER_FRAMES; i++) {
+		wl_array_init(&recorder->frames[i].rects);
+		recorder->frames[i].pixels = malloc(size);
+		if (!recorder->frames[i].pixels)
+			goto err_free;
+	}
 
-	if (do_yflip)
-		recorder->tmpbuf = NULL;
+	if (recorder->version >= 2)
+		header.magic = WCAP_HEADER_MAGIC_V2;
 	else
-		recorder->tmpbuf = malloc(size);
-
-	header.magic = WCAP_HEADER_MAGIC;
+		header.magic = WCAP_HEADER_MAGIC;
 
 	switch (compositor->read_format) {
 	case PIXMAN_x8r8g8b8:
@@ -492,8 +1073,7 @@ weston_recorder_create(struct weston_output *output, const char *filename)
 		break;
 	default:
 		weston_log("unknown recorder format\n");
-		free(recorder);
-		return;
+		goto err_free;
 	}
 
 	recorder->fd = open(filename,
@@ -501,30 +1081,92 @@ weston_recorder_create(struct weston_output *output, const char *filename)
 
 	if (recorder->fd < 0) {
 		weston_log("problem opening output file %s: %m\n", filename);
-		free(recorder);
-		return;
+		goto err_free;
 	}
 
 	header.width = output->current->width;
 	header.height = output->current->height;
 	recorder->total += write(recorder->fd, &header, sizeof header);
 
+	/* Leave all signals to the main thread. */
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, &old_mask);
+	i = pthread_create(&recorder->thread, NULL, recorder_thread, recorder);
+	pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+	if (i != 0) {
+		weston_log("failed to start recorder thread\n");
+		close(recorder->fd);
+		goto err_free;
+	}
+
 	recorder->frame_listener.notify = weston_recorder_frame_notify;
 	wl_signal_add(&output->frame_signal, &recorder->frame_listener);
 	output->disable_planes++;
 	weston_output_damage(output);
+
+	return;
+
+err_free:
+	weston_recorder_free(recorder);
+}
+
+/* Appends the keyframe index and the trailer pointing at it, which
+ * make a version 2 recording seekable. */
+static int
+recorder_write_index(struct weston_recorder *recorder)
+{
+	struct wcap_index_trailer *trailer;
+	uint64_t offset = recorder->total + recorder->out.size;
+	uint8_t *index;
+
+	index = wl_array_add(&recorder->out,
+			     recorder->index.size + sizeof *trailer);
+	if (!index) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	memcpy(index, recorder->index.data, recorder->index.size);
+	trailer = (void *) (index + recorder->index.size);
+	trailer->magic = WCAP_INDEX_MAGIC;
+	trailer->count = recorder->index.size / sizeof(struct wcap_index_entry);
+	trailer->offset_lo = offset;
+	trailer->offset_hi = offset >> 32;
+
+	return recorder_flush(recorder);
 }
 
+/* Stops listening for frames, and waits for the frames already read
+ * back to be encoded and written out. */
 static void
 weston_recorder_destroy(struct weston_recorder *recorder)
 {
 	wl_list_remove(&recorder->frame_listener.link);
+
+	pthread_mutex_lock(&recorder->mutex);
+	recorder->quit = 1;
+	pthread_cond_signal(&recorder->queued_cond);
+	pthread_mutex_unlock(&recorder->mutex);
+	pthread_join(recorder->thread, NULL);
+
+	if (!recorder->error && recorder->version >= 2 &&
+	    recorder_write_index(recorder) < 0)
+		recorder->error = errno;
+
+	if (recorder->error)
+		weston_log("recorder failed to write frames: %s\n",
+			   strerror(recorder->error));
+
+	weston_log("stopping recorder, total file size %dM, "
+		   "%d frames, %d dropped, %d keyframes\n",
+		   (int) (recorder->total / (1024 * 1024)), recorder->count,
+		   recorder->dropped,
+		   (int) (recorder->index.size /
+			  sizeof(struct wcap_index_entry)));
+
 	close(recorder->fd);
-	free(recorder->tmpbuf);
-	free(recorder->frame);
-	free(recorder->rect);
 	recorder->output->disable_planes--;
-	free(recorder);
+	weston_recorder_free(recorder);
 }
 
 static void
@@ -545,10 +1187,6 @@ recorder_binding(struct weston_seat *seat, uint32_t time, uint32_t key, void *da
 		recorder = container_of(listener, struct weston_recorder,
 					frame_listener);
 
-		weston_log(
-			"stopping recorder, total file size %dM, %d frames\n",
-			recorder->total / (1024 * 1024), recorder->count);
-
 		weston_recorder_destroy(recorder);
 	} else {
 		weston_log("starting recorder, file %s\n", filename);
@@ -579,7 +1217,7 @@ screenshooter_create(struct weston_compositor *ec)
 	shooter->client = NULL;
 
 	shooter->global = wl_global_create(ec->wl_display,
-					   &screenshooter_interface, 1,
+					   &screenshooter_interface, 2,
 					   shooter, bind_shooter);
 	weston_compositor_add_key_binding(ec, KEY_S, MODIFIER_SUPER,
 					  screenshooter_binding, shooter);
@@ -653,6 +653,7 @@ activate_workspace(struct desktop_shell *shell, unsigned int index)
 
 	ws = get_workspace(shell, index);
 	wl_list_insert(&shell->panel_layer.link, &ws->layer.link);
+	weston_compositor_surface_list_dirty(shell->compositor);
 
 	shell->workspaces.current = index;
 }
@@ -773,6 +774,7 @@ finish_workspace_change_animation(struct desktop_shell *shell,
 	shell->workspaces.anim_to = NULL;
 
 	wl_list_remove(&shell->workspaces.anim_from->layer.link);
+	weston_compositor_surface_list_dirty(shell->compositor);
 }
 
 static void
@@ -855,6 +857,7 @@ animate_workspace_change(struct desktop_shell *shell,
 		       &shell->workspaces.animation.link);
 
 	wl_list_insert(from->layer.link.prev, &to->layer.link);
+	weston_compositor_surface_list_dirty(shell->compositor);
 
 	workspace_translate_in(to, 0);
 
@@ -870,6 +873,7 @@ update_workspace(struct desktop_shell *shell, unsigned int index,
 	shell->workspaces.current = index;
 	wl_list_insert(&from->layer.link, &to->layer.link);
 	wl_list_remove(&from->layer.link);
+	weston_compositor_surface_list_dirty(shell->compositor);
 }
 
 static void
@@ -949,8 +953,8 @@ move_surface_to_workspace(struct desktop_shell *shell,
 	from = get_current_workspace(shell);
 	to = get_workspace(shell, workspace);
 
-	wl_list_remove(&surface->layer_link);
-	wl_list_insert(&to->layer.surface_list, &surface->layer_link);
+	weston_layer_entry_remove(surface);
+	weston_layer_entry_insert(&to->layer.surface_list, surface);
 
 	drop_focus_state(shell, from, surface);
 	wl_list_for_each(seat, &shell->compositor->seat_list, link) {
@@ -984,8 +988,8 @@ take_surface_to_workspace_by_seat(struct desktop_shell *shell,
 	from = get_current_workspace(shell);
 	to = get_workspace(shell, index);
 
-	wl_list_remove(&surface->layer_link);
-	wl_list_insert(&to->layer.surface_list, &surface->layer_link);
+	weston_layer_entry_remove(surface);
+	weston_layer_entry_insert(&to->layer.surface_list, surface);
 
 	replace_focus_state(shell, to, seat);
 	drop_focus_state(shell, from, surface);
@@ -994,6 +998,7 @@ take_surface_to_workspace_by_seat(struct desktop_shell *shell,
 	    shell->workspaces.anim_to == from) {
 		wl_list_remove(&to->layer.link);
 		wl_list_insert(from->layer.link.prev, &to->layer.link);
+		weston_compositor_surface_list_dirty(shell->compositor);
 
 		reverse_workspace_change_animation(shell, index, from, to);
 		broadcast_current_workspace_state(shell);
@@ -1664,8 +1669,8 @@ shell_unset_fullscreen(struct shell_surface *shsurf)
 	}
 
 	ws = get_current_workspace(shsurf->shell);
-	wl_list_remove(&shsurf->surface->layer_link);
-	wl_list_insert(&ws->layer.surface_list, &shsurf->surface->layer_link);
+	weston_layer_entry_remove(shsurf->surface);
+	weston_layer_entry_insert(&ws->layer.surface_list, shsurf->surface);
 }
 
 static void
@@ -1685,8 +1690,8 @@ shell_unset_maximized(struct shell_surface *shsurf)
 	}
 
 	ws = get_current_workspace(shsurf->shell);
-	wl_list_remove(&shsurf->surface->layer_link);
-	wl_list_insert(&ws->layer.surface_list, &shsurf->surface->layer_link);
+	weston_layer_entry_remove(shsurf->surface);
+	weston_layer_entry_insert(&ws->layer.surface_list, shsurf->surface);
 }
 
 static int
@@ -1901,9 +1906,9 @@ shell_configure_fullscreen(struct shell_surface *shsurf)
 					     output->width,
 					     output->height);
 
-	wl_list_remove(&shsurf->fullscreen.black_surface->layer_link);
-	wl_list_insert(&surface->layer_link,
-		       &shsurf->fullscreen.black_surface->layer_link);
+	weston_layer_entry_remove(shsurf->fullscreen.black_surface);
+	weston_layer_entry_insert(&surface->layer_link,
+				  shsurf->fullscreen.black_surface);
 	shsurf->fullscreen.black_surface->output = output;
 
 	surface_subsurfaces_boundingbox(surface, &surf_x, &surf_y,
@@ -1985,9 +1990,9 @@ shell_stack_fullscreen(struct shell_surface *shsurf)
 	struct weston_surface *surface = shsurf->surface;
 	struct desktop_shell *shell = shell_surface_get_shell(shsurf);
 
-	wl_list_remove(&surface->layer_link);
-	wl_list_insert(&shell->fullscreen_layer.surface_list,
-		       &surface->layer_link);
+	weston_layer_entry_remove(surface);
+	weston_layer_entry_insert(&shell->fullscreen_layer.surface_list,
+				  surface);
 	weston_surface_damage(surface);
 
 	if (!shsurf->fullscreen.black_surface)
@@ -1998,9 +2003,9 @@ shell_stack_fullscreen(struct shell_surface *shsurf)
 					     output->width,
 					     output->height);
 
-	wl_list_remove(&shsurf->fullscreen.black_surface->layer_link);
-	wl_list_insert(&surface->layer_link,
-		       &shsurf->fullscreen.black_surface->layer_link);
+	weston_layer_entry_remove(shsurf->fullscreen.black_surface);
+	weston_layer_entry_insert(&surface->layer_link,
+				  shsurf->fullscreen.black_surface);
 	weston_surface_damage(shsurf->fullscreen.black_surface);
 }
 
@@ -2535,7 +2540,7 @@ configure_static_surface(struct weston_surface *es, struct weston_layer *layer,
 	weston_surface_configure(es, es->output->x, es->output->y, width, height);
 
 	if (wl_list_empty(&es->layer_link)) {
-		wl_list_insert(&layer->surface_list, &es->layer_link);
+		weston_layer_entry_insert(&layer->surface_list, es);
 		weston_compositor_schedule_repaint(es->compositor);
 	}
 }
@@ -2621,8 +2626,8 @@ lock_surface_configure(struct weston_surface *surface, int32_t sx, int32_t sy, i
 	center_on_output(surface, get_default_output(shell->compositor));
 
 	if (!weston_surface_is_mapped(surface)) {
-		wl_list_insert(&shell->lock_layer.surface_list,
-			       &surface->layer_link);
+		weston_layer_entry_insert(&shell->lock_layer.surface_list,
+					  surface);
 		weston_surface_update_transform(surface);
 		shell_fade(shell, FADE_IN);
 	}
@@ -2682,6 +2687,7 @@ resume_desktop(struct desktop_shell *shell)
 	} else {
 		wl_list_insert(&shell->panel_layer.link, &ws->layer.link);
 	}
+	weston_compositor_surface_list_dirty(shell->compositor);
 
 	restore_focus_state(shell, get_current_workspace(shell));
 
@@ -3158,6 +3164,7 @@ lock(struct desktop_shell *shell)
 	wl_list_remove(&ws->layer.link);
 	wl_list_insert(&shell->compositor->cursor_layer.link,
 		       &shell->lock_layer.link);
+	weston_compositor_surface_list_dirty(shell->compositor);
 
 	launch_screensaver(shell);
 
@@ -3217,8 +3224,8 @@ shell_fade_create_surface(struct desktop_shell *shell)
 
 	weston_surface_configure(surface, 0, 0, 8192, 8192);
 	weston_surface_set_color(surface, 0.0, 0.0, 0.0, 1.0);
-	wl_list_insert(&compositor->fade_layer.surface_list,
-		       &surface->layer_link);
+	weston_layer_entry_insert(&compositor->fade_layer.surface_list,
+				  surface);
 	pixman_region32_init(&surface->input);
 
 	return surface;
@@ -3357,17 +3364,19 @@ show_input_panels(struct wl_listener *listener, void *data)
 
 	shell->showing_input_panels = true;
 
-	if (!shell->locked)
+	if (!shell->locked) {
 		wl_list_insert(&shell->panel_layer.link,
 			       &shell->input_panel_layer.link);
+		weston_compositor_surface_list_dirty(shell->compositor);
+	}
 
 	wl_list_for_each_safe(surface, next,
 			      &shell->input_panel.surfaces, link) {
 		ws = surface->surface;
 		if (!ws->buffer_ref.buffer)
 			continue;
-		wl_list_insert(&shell->input_panel_layer.surface_list,
-			       &ws->layer_link);
+		weston_layer_entry_insert(&shell->input_panel_layer.surface_list,
+					  ws);
 		weston_surface_geometry_dirty(ws);
 		weston_surface_update_transform(ws);
 		weston_surface_damage(ws);
@@ -3388,8 +3397,10 @@ hide_input_panels(struct wl_listener *listener, void *data)
 
 	shell->showing_input_panels = false;
 
-	if (!shell->locked)
+	if (!shell->locked) {
 		wl_list_remove(&shell->input_panel_layer.link);
+		weston_compositor_surface_list_dirty(shell->compositor);
+	}
 
 	wl_list_for_each_safe(surface, next,
 			      &shell->input_panel_layer.surface_list, layer_link)
@@ -3533,7 +3544,7 @@ map(struct desktop_shell *shell, struct weston_surface *surface,
 	case SHELL_SURFACE_POPUP:
 	case SHELL_SURFACE_TRANSIENT:
 		parent = shsurf->parent;
-		wl_list_insert(parent->layer_link.prev, &surface->layer_link);
+		weston_layer_entry_insert(parent->layer_link.prev, surface);
 		break;
 	case SHELL_SURFACE_FULLSCREEN:
 	case SHELL_SURFACE_NONE:
@@ -3541,7 +3552,7 @@ map(struct desktop_shell *shell, struct weston_surface *surface,
 	case SHELL_SURFACE_XWAYLAND:
 	default:
 		ws = get_current_workspace(shell);
-		wl_list_insert(&ws->layer.surface_list, &surface->layer_link);
+		weston_layer_entry_insert(&ws->layer.surface_list, surface);
 		break;
 	}
 
@@ -3777,8 +3788,8 @@ screensaver_configure(struct weston_surface *surface, int32_t sx, int32_t sy, in
 	center_on_output(surface, surface->output);
 
 	if (wl_list_empty(&surface->layer_link)) {
-		wl_list_insert(shell->lock_layer.surface_list.prev,
-			       &surface->layer_link);
+		weston_layer_entry_insert(shell->lock_layer.surface_list.prev,
+					  surface);
 		weston_surface_update_transform(surface);
 		wl_event_source_timer_update(shell->screensaver.timer,
 					     shell->screensaver.duration);
@@ -3869,8 +3880,8 @@ input_panel_configure(struct weston_surface *surface, int32_t sx, int32_t sy, in
 				 width, height);
 
 	if (show_surface) {
-		wl_list_insert(&shell->input_panel_layer.surface_list,
-			       &surface->layer_link);
+		weston_layer_entry_insert(&shell->input_panel_layer.surface_list,
+					  surface);
 		weston_surface_update_transform(surface);
 		weston_surface_damage(surface);
 		weston_slide_run(surface, surface->geometry.height, 0, NULL, NULL);
@@ -136,15 +136,15 @@ tablet_shell_surface_configure(struct weston_surface *surface,
 	weston_surface_configure(surface, 0, 0, width, height);
 
 	if (surface == shell->lockscreen_surface) {
-			wl_list_insert(&shell->lockscreen_layer.surface_list,
-					&surface->layer_link);
+			weston_layer_entry_insert(&shell->lockscreen_layer.surface_list,
+						  surface);
 	} else if (surface == shell->switcher_surface) {
 		/* */
 	} else if (surface == shell->home_surface) {
 		if (shell->state == STATE_STARTING) {
 	                /* homescreen always visible, at the bottom */
-			wl_list_insert(&shell->homescreen_layer.surface_list,
-					&surface->layer_link);
+			weston_layer_entry_insert(&shell->homescreen_layer.surface_list,
+					  surface);
 
 			tablet_shell_set_state(shell, STATE_LOCKED);
 			shell->previous_state = STATE_HOME;
@@ -156,8 +156,8 @@ tablet_shell_surface_configure(struct weston_surface *surface,
 		tablet_shell_set_state(shell, STATE_TASK);
 		shell->current_client->surface = surface;
 		weston_zoom_run(surface, 0.3, 1.0, NULL, NULL);
-		wl_list_insert(&shell->application_layer.surface_list,
-			       &surface->layer_link);
+		weston_layer_entry_insert(&shell->application_layer.surface_list,
+					  surface);
 	}
 
 	weston_surface_update_transform(surface);
@@ -81,7 +81,8 @@ device_added(struct udev_device *udev_device, struct udev_input *input)
 		return 0;
 	}
 
-	device = libevdev_device_create(&seat->base, devnode, fd);
+	device = libevdev_device_create(&seat->base, devnode, fd,
+					input->thread);
 	if (device == EVDEV_UNHANDLED_DEVICE) {
 		close(fd);
 		weston_log("not using input device '%s'.\n", devnode);
@@ -312,15 +313,30 @@ int
 udev_input_init(struct udev_input *input, struct weston_compositor *c, struct udev *udev,
 		const char *seat_id)
 {
+	struct weston_config_section *section;
+	int use_thread;
+
 	memset(input, 0, sizeof *input);
 	input->seat_id = strdup(seat_id);
 	input->compositor = c;
+
+	section = weston_config_get_section(c->config, "core", NULL, NULL);
+	weston_config_section_get_bool(section, "input-thread",
+				       &use_thread, 0);
+	if (use_thread) {
+		input->thread = input_thread_create(c->input_loop);
+		if (input->thread)
+			weston_log("reading input devices on a thread\n");
+	}
+
 	if (udev_input_enable(input, udev) < 0)
 		goto err;
 
 	return 0;
 
  err:
+	if (input->thread)
+		input_thread_destroy(input->thread);
 	free(input->seat_id);
 	return -1;
 }
@@ -332,6 +348,8 @@ udev_input_destroy(struct udev_input *input)
 	udev_input_disable(input);
 	wl_list_for_each_safe(seat, next, &input->compositor->seat_list, base.link)
 		udev_seat_destroy(seat);
+	if (input->thread)
+		input_thread_destroy(input->thread);
 	free(input->seat_id);
 }
 
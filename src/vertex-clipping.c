@@ -0,0 +1,602 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#include "vertex-clipping.h"
+
+float
+float_difference(float a, float b)
+{
+	/* http://www.altdevblogaday.com/2012/02/22/comparing-floating-point-numbers-2012-edition/ */
+	static const float max_diff = 4.0f * FLT_MIN;
+	static const float max_rel_diff = 4.0e-5;
+	float diff = a - b;
+	float adiff = fabsf(diff);
+
+	if (adiff <= max_diff)
+		return 0.0f;
+
+	a = fabsf(a);
+	b = fabsf(b);
+	if (adiff <= (a > b ? a : b) * max_rel_diff)
+		return 0.0f;
+
+	return diff;
+}
+
+/* A line segment (p1x, p1y)-(p2x, p2y) intersects the line x = x_arg.
+ * Compute the y coordinate of the intersection.
+ */
+static float
+clip_intersect_y(float p1x, float p1y, float p2x, float p2y,
+		 float x_arg)
+{
+	float a;
+	float diff = float_difference(p1x, p2x);
+
+	/* Practically vertical line segment, yet the end points have already
+	 * been determined to be on different sides of the line. Therefore
+	 * the line segment is part of the line and intersects everywhere.
+	 * Return the end point, so we use the whole line segment.
+	 */
+	if (diff == 0.0f)
+		return p2y;
+
+	a = (x_arg - p2x) / diff;
+	return p2y + (p1y - p2y) * a;
+}
+
+/* A line segment (p1x, p1y)-(p2x, p2y) intersects the line y = y_arg.
+ * Compute the x coordinate of the intersection.
+ */
+static float
+clip_intersect_x(float p1x, float p1y, float p2x, float p2y,
+		 float y_arg)
+{
+	float a;
+	float diff = float_difference(p1y, p2y);
+
+	/* Practically horizontal line segment, yet the end points have already
+	 * been determined to be on different sides of the line. Therefore
+	 * the line segment is part of the line and intersects everywhere.
+	 * Return the end point, so we use the whole line segment.
+	 */
+	if (diff == 0.0f)
+		return p2x;
+
+	a = (y_arg - p2y) / diff;
+	return p2x + (p1x - p2x) * a;
+}
+
+enum path_transition {
+	PATH_TRANSITION_OUT_TO_OUT = 0,
+	PATH_TRANSITION_OUT_TO_IN = 1,
+	PATH_TRANSITION_IN_TO_OUT = 2,
+	PATH_TRANSITION_IN_TO_IN = 3,
+};
+
+static void
+clip_append_vertex(struct clip_context *ctx, float x, float y)
+{
+	*ctx->vertices.x++ = x;
+	*ctx->vertices.y++ = y;
+}
+
+static enum path_transition
+path_transition_left_edge(struct clip_context *ctx, float x, float y)
+{
+	return ((ctx->prev.x >= ctx->clip.x1) << 1) | (x >= ctx->clip.x1);
+}
+
+static enum path_transition
+path_transition_right_edge(struct clip_context *ctx, float x, float y)
+{
+	return ((ctx->prev.x < ctx->clip.x2) << 1) | (x < ctx->clip.x2);
+}
+
+static enum path_transition
+path_transition_top_edge(struct clip_context *ctx, float x, float y)
+{
+	return ((ctx->prev.y >= ctx->clip.y1) << 1) | (y >= ctx->clip.y1);
+}
+
+static enum path_transition
+path_transition_bottom_edge(struct clip_context *ctx, float x, float y)
+{
+	return ((ctx->prev.y < ctx->clip.y2) << 1) | (y < ctx->clip.y2);
+}
+
+static void
+clip_polygon_leftright(struct clip_context *ctx,
+		       enum path_transition transition,
+		       float x, float y, float clip_x)
+{
+	float yi;
+
+	switch (transition) {
+	case PATH_TRANSITION_IN_TO_IN:
+		clip_append_vertex(ctx, x, y);
+		break;
+	case PATH_TRANSITION_IN_TO_OUT:
+		yi = clip_intersect_y(ctx->prev.x, ctx->prev.y, x, y, clip_x);
+		clip_append_vertex(ctx, clip_x, yi);
+		break;
+	case PATH_TRANSITION_OUT_TO_IN:
+		yi = clip_intersect_y(ctx->prev.x, ctx->prev.y, x, y, clip_x);
+		clip_append_vertex(ctx, clip_x, yi);
+		clip_append_vertex(ctx, x, y);
+		break;
+	case PATH_TRANSITION_OUT_TO_OUT:
+		/* nothing */
+		break;
+	default:
+		assert(0 && "bad enum path_transition");
+	}
+
+	ctx->prev.x = x;
+	ctx->prev.y = y;
+}
+
+static void
+clip_polygon_topbottom(struct clip_context *ctx,
+		       enum path_transition transition,
+		       float x, float y, float clip_y)
+{
+	float xi;
+
+	switch (transition) {
+	case PATH_TRANSITION_IN_TO_IN:
+		clip_append_vertex(ctx, x, y);
+		break;
+	case PATH_TRANSITION_IN_TO_OUT:
+		xi = clip_intersect_x(ctx->prev.x, ctx->prev.y, x, y, clip_y);
+		clip_append_vertex(ctx, xi, clip_y);
+		break;
+	case PATH_TRANSITION_OUT_TO_IN:
+		xi = clip_intersect_x(ctx->prev.x, ctx->prev.y, x, y, clip_y);
+		clip_append_vertex(ctx, xi, clip_y);
+		clip_append_vertex(ctx, x, y);
+		break;
+	case PATH_TRANSITION_OUT_TO_OUT:
+		/* nothing */
+		break;
+	default:
+		assert(0 && "bad enum path_transition");
+	}
+
+	ctx->prev.x = x;
+	ctx->prev.y = y;
+}
+
+static void
+clip_context_prepare(struct clip_context *ctx, const struct polygon8 *src,
+		      float *dst_x, float *dst_y)
+{
+	ctx->prev.x = src->x[src->n - 1];
+	ctx->prev.y = src->y[src->n - 1];
+	ctx->vertices.x = dst_x;
+	ctx->vertices.y = dst_y;
+}
+
+static int
+clip_polygon_left(struct clip_context *ctx, const struct polygon8 *src,
+		  float *dst_x, float *dst_y)
+{
+	enum path_transition trans;
+	int i;
+
+	clip_context_prepare(ctx, src, dst_x, dst_y);
+	for (i = 0; i < src->n; i++) {
+		trans = path_transition_left_edge(ctx, src->x[i], src->y[i]);
+		clip_polygon_leftright(ctx, trans, src->x[i], src->y[i],
+				       ctx->clip.x1);
+	}
+	return ctx->vertices.x - dst_x;
+}
+
+static int
+clip_polygon_right(struct clip_context *ctx, const struct polygon8 *src,
+		   float *dst_x, float *dst_y)
+{
+	enum path_transition trans;
+	int i;
+
+	clip_context_prepare(ctx, src, dst_x, dst_y);
+	for (i = 0; i < src->n; i++) {
+		trans = path_transition_right_edge(ctx, src->x[i], src->y[i]);
+		clip_polygon_leftright(ctx, trans, src->x[i], src->y[i],
+				       ctx->clip.x2);
+	}
+	return ctx->vertices.x - dst_x;
+}
+
+static int
+clip_polygon_top(struct clip_context *ctx, const struct polygon8 *src,
+		 float *dst_x, float *dst_y)
+{
+	enum path_transition trans;
+	int i;
+
+	clip_context_prepare(ctx, src, dst_x, dst_y);
+	for (i = 0; i < src->n; i++) {
+		trans = path_transition_top_edge(ctx, src->x[i], src->y[i]);
+		clip_polygon_topbottom(ctx, trans, src->x[i], src->y[i],
+				       ctx->clip.y1);
+	}
+	return ctx->vertices.x - dst_x;
+}
+
+static int
+clip_polygon_bottom(struct clip_context *ctx, const struct polygon8 *src,
+		    float *dst_x, float *dst_y)
+{
+	enum path_transition trans;
+	int i;
+
+	clip_context_prepare(ctx, src, dst_x, dst_y);
+	for (i = 0; i < src->n; i++) {
+		trans = path_transition_bottom_edge(ctx, src->x[i], src->y[i]);
+		clip_polygon_topbottom(ctx, trans, src->x[i], src->y[i],
+				       ctx->clip.y2);
+	}
+	return ctx->vertices.x - dst_x;
+}
+
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#define min(a, b) (((a) > (b)) ? (b) : (a))
+#define clip(x, a, b)  min(max(x, a), b)
+
+/* Simple case, the bounding box edges of 'surf' are parallel to the
+ * surface edges, there will be only four edges. We just need to clip
+ * the surface vertices to the clip rect bounds.
+ */
+int
+clip_simple(struct clip_context *ctx,
+	    const struct polygon8 *surf,
+	    float *ex,
+	    float *ey)
+{
+	int i;
+
+	for (i = 0; i < surf->n; i++) {
+		ex[i] = clip(surf->x[i], ctx->clip.x1, ctx->clip.x2);
+		ey[i] = clip(surf->y[i], ctx->clip.y1, ctx->clip.y2);
+	}
+	return surf->n;
+}
+
+/* Copy the vertices of 'src' to 'ex' and 'ey', dropping the ones that
+ * practically coincide with the previous one. Returns the number of
+ * vertices left, or 0 if they no longer make a polygon.
+ */
+static int
+clip_dedup(const struct polygon8 *src, float *ex, float *ey)
+{
+	int i, n;
+
+	if (src->n == 0)
+		return 0;
+
+	ex[0] = src->x[0];
+	ey[0] = src->y[0];
+	n = 1;
+	for (i = 1; i < src->n; i++) {
+		if (float_difference(ex[n - 1], src->x[i]) == 0.0f &&
+		    float_difference(ey[n - 1], src->y[i]) == 0.0f)
+			continue;
+		ex[n] = src->x[i];
+		ey[n] = src->y[i];
+		n++;
+	}
+	if (float_difference(ex[n - 1], src->x[0]) == 0.0f &&
+	    float_difference(ey[n - 1], src->y[0]) == 0.0f)
+		n--;
+
+	if (n < 3)
+		return 0;
+
+	return n;
+}
+
+/* Transformed case: use a general polygon clipping algorithm to
+ * clip the surface rectangle with each side of the clip rect.
+ * The algorithm is Sutherland-Hodgman, as explained in
+ * http://www.codeguru.com/cpp/misc/misc/graphics/article.php/c8965/Polygon-Clipping.htm
+ * but without looking at any of that code.
+ *
+ * 'surf' is used as scratch space and is clobbered.
+ */
+int
+clip_transformed(struct clip_context *ctx,
+		 struct polygon8 *surf,
+		 float *ex,
+		 float *ey)
+{
+	struct polygon8 polygon;
+
+	/* Once a stage clips everything away, the next one would start
+	 * from a vertex before the first. */
+	polygon.n = clip_polygon_left(ctx, surf, polygon.x, polygon.y);
+	if (polygon.n == 0)
+		return 0;
+	surf->n = clip_polygon_right(ctx, &polygon, surf->x, surf->y);
+	if (surf->n == 0)
+		return 0;
+	polygon.n = clip_polygon_top(ctx, surf, polygon.x, polygon.y);
+	if (polygon.n == 0)
+		return 0;
+	surf->n = clip_polygon_bottom(ctx, &polygon, surf->x, surf->y);
+
+	/* Get rid of duplicate vertices */
+	return clip_dedup(surf, ex, ey);
+}
+
+struct quad_bounds {
+	float x1, y1;
+	float x2, y2;
+};
+
+static void
+quad_bounds(const struct polygon8 *quad, struct quad_bounds *b)
+{
+	int i;
+
+	b->x1 = b->x2 = quad->x[0];
+	b->y1 = b->y2 = quad->y[0];
+
+	for (i = 1; i < quad->n; i++) {
+		b->x1 = min(b->x1, quad->x[i]);
+		b->x2 = max(b->x2, quad->x[i]);
+		b->y1 = min(b->y1, quad->y[i]);
+		b->y2 = max(b->y2, quad->y[i]);
+	}
+}
+
+static void
+clip_transformed_rect(const struct polygon8 *quad, const pixman_box32_t *rect,
+		      struct polygon8 *out)
+{
+	struct clip_context ctx;
+	struct polygon8 surf;
+
+	ctx.clip.x1 = rect->x1;
+	ctx.clip.y1 = rect->y1;
+	ctx.clip.x2 = rect->x2;
+	ctx.clip.y2 = rect->y2;
+
+	surf = *quad;
+	out->n = clip_transformed(&ctx, &surf, out->x, out->y);
+}
+
+static void
+clip_quad_rect(const struct polygon8 *quad, int transformed,
+	       const struct quad_bounds *b, const pixman_box32_t *rect,
+	       struct polygon8 *out)
+{
+	struct clip_context ctx;
+
+	ctx.clip.x1 = rect->x1;
+	ctx.clip.y1 = rect->y1;
+	ctx.clip.x2 = rect->x2;
+	ctx.clip.y2 = rect->y2;
+
+	/* First, simple bounding box check to discard early transformed
+	 * surface rects that do not intersect with the clip region:
+	 */
+	if ((b->x1 >= ctx.clip.x2) || (b->x2 <= ctx.clip.x1) ||
+	    (b->y1 >= ctx.clip.y2) || (b->y2 <= ctx.clip.y1)) {
+		out->n = 0;
+		return;
+	}
+
+	if (transformed)
+		clip_transformed_rect(quad, rect, out);
+	else
+		out->n = clip_simple(&ctx, quad, out->x, out->y);
+}
+
+/*
+ * Compute the boundary vertices of the intersection of each of the
+ * global coordinate aligned rectangles 'rects', and an arbitrary
+ * quadrilateral 'quad', usually a surface rectangle transformed into
+ * global coordinates. Set 'transformed' if the edges of 'quad' may not
+ * be parallel to the axes.
+ *
+ * The vertices for rects[i] are written to out[i], in clockwise winding
+ * order. Each out[i] gets either zero vertices, or 3-8 vertices with
+ * non-zero polygon area.
+ *
+ * This is the reference implementation, without vector instructions.
+ */
+void
+clip_quad_rects_scalar(const struct polygon8 *quad, int transformed,
+		       const pixman_box32_t *rects, int count,
+		       struct polygon8 *out)
+{
+	struct quad_bounds b;
+	int i;
+
+	assert(quad->n == 4);
+
+	quad_bounds(quad, &b);
+	for (i = 0; i < count; i++)
+		clip_quad_rect(quad, transformed, &b, &rects[i], &out[i]);
+}
+
+/* The vector versions of clip_quad_rects_scalar() below keep the four
+ * vertices of the quad in one register each for x and y, and load a
+ * whole rect as x1, y1, x2, y2 into another, so the bounding box check
+ * and the simple case take a handful of instructions per rect. In the
+ * transformed case, a quad that lies entirely inside the rect comes out
+ * of all four Sutherland-Hodgman stages unchanged, so that is tested
+ * for with the same comparisons the stages use and the stages are
+ * skipped. Only quads that cross an edge of the rect still run the
+ * scalar clipper.
+ *
+ * They must give bit for bit the same results as the scalar code, so
+ * the min() and max() above are done with the same operand order, which
+ * matters for signed zeros.
+ */
+
+#if defined(__SSE2__)
+
+void
+clip_quad_rects(const struct polygon8 *quad, int transformed,
+		const pixman_box32_t *rects, int count,
+		struct polygon8 *out)
+{
+	struct quad_bounds b;
+	__m128 qx, qy, bounds, r, v, in;
+	int i;
+
+	assert(quad->n == 4);
+
+	quad_bounds(quad, &b);
+	bounds = _mm_setr_ps(b.x2, b.y2, b.x1, b.y1);
+	qx = _mm_loadu_ps(quad->x);
+	qy = _mm_loadu_ps(quad->y);
+
+	for (i = 0; i < count; i++) {
+		/* x1, y1, x2, y2 */
+		r = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *) &rects[i]));
+
+		/* b.x2 <= x1 || b.y2 <= y1 || b.x1 >= x2 || b.y1 >= y2 */
+		if ((_mm_movemask_ps(_mm_cmple_ps(bounds, r)) & 0x3) ||
+		    (_mm_movemask_ps(_mm_cmpge_ps(bounds, r)) & 0xc)) {
+			out[i].n = 0;
+			continue;
+		}
+
+		if (transformed) {
+			/* x >= x1 && x < x2 && y >= y1 && y < y2 */
+			in = _mm_and_ps(
+				_mm_and_ps(_mm_cmpge_ps(qx, _mm_shuffle_ps(r, r, 0x00)),
+					   _mm_cmplt_ps(qx, _mm_shuffle_ps(r, r, 0xaa))),
+				_mm_and_ps(_mm_cmpge_ps(qy, _mm_shuffle_ps(r, r, 0x55)),
+					   _mm_cmplt_ps(qy, _mm_shuffle_ps(r, r, 0xff))));
+			if (_mm_movemask_ps(in) == 0xf)
+				out[i].n = clip_dedup(quad, out[i].x, out[i].y);
+			else
+				clip_transformed_rect(quad, &rects[i], &out[i]);
+			continue;
+		}
+
+		/* min(v, c2) is c2 < v ? c2 : v, max(v, c1) is v > c1 ? v : c1 */
+		v = _mm_max_ps(qx, _mm_shuffle_ps(r, r, 0x00));
+		_mm_storeu_ps(out[i].x, _mm_min_ps(_mm_shuffle_ps(r, r, 0xaa), v));
+		v = _mm_max_ps(qy, _mm_shuffle_ps(r, r, 0x55));
+		_mm_storeu_ps(out[i].y, _mm_min_ps(_mm_shuffle_ps(r, r, 0xff), v));
+		out[i].n = quad->n;
+	}
+}
+
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+static inline float32x4_t
+vmax(float32x4_t a, float32x4_t b)
+{
+	return vbslq_f32(vcgtq_f32(a, b), a, b);
+}
+
+static inline float32x4_t
+vmin(float32x4_t a, float32x4_t b)
+{
+	return vbslq_f32(vcgtq_f32(a, b), b, a);
+}
+
+void
+clip_quad_rects(const struct polygon8 *quad, int transformed,
+		const pixman_box32_t *rects, int count,
+		struct polygon8 *out)
+{
+	static const uint32_t lo[4] = { ~0u, ~0u, 0, 0 };
+	struct quad_bounds b;
+	float32x4_t qx, qy, bounds, r, v;
+	uint32x4_t reject, in;
+	uint32x2_t any;
+	int i;
+
+	assert(quad->n == 4);
+
+	quad_bounds(quad, &b);
+	bounds = vcombine_f32(vset_lane_f32(b.y2, vdup_n_f32(b.x2), 1),
+			      vset_lane_f32(b.y1, vdup_n_f32(b.x1), 1));
+	qx = vld1q_f32(quad->x);
+	qy = vld1q_f32(quad->y);
+
+	for (i = 0; i < count; i++) {
+		/* x1, y1, x2, y2 */
+		r = vcvtq_f32_s32(vld1q_s32((const int32_t *) &rects[i]));
+
+		/* b.x2 <= x1 || b.y2 <= y1 || b.x1 >= x2 || b.y1 >= y2 */
+		reject = vbslq_u32(vld1q_u32(lo), vcleq_f32(bounds, r),
+				   vcgeq_f32(bounds, r));
+		any = vorr_u32(vget_low_u32(reject), vget_high_u32(reject));
+		if (vget_lane_u32(any, 0) | vget_lane_u32(any, 1)) {
+			out[i].n = 0;
+			continue;
+		}
+
+		if (transformed) {
+			/* x >= x1 && x < x2 && y >= y1 && y < y2 */
+			in = vandq_u32(
+				vandq_u32(vcgeq_f32(qx, vdupq_n_f32(vgetq_lane_f32(r, 0))),
+					  vcltq_f32(qx, vdupq_n_f32(vgetq_lane_f32(r, 2)))),
+				vandq_u32(vcgeq_f32(qy, vdupq_n_f32(vgetq_lane_f32(r, 1))),
+					  vcltq_f32(qy, vdupq_n_f32(vgetq_lane_f32(r, 3)))));
+			any = vand_u32(vget_low_u32(in), vget_high_u32(in));
+			if (vget_lane_u32(any, 0) & vget_lane_u32(any, 1))
+				out[i].n = clip_dedup(quad, out[i].x, out[i].y);
+			else
+				clip_transformed_rect(quad, &rects[i], &out[i]);
+			continue;
+		}
+
+		v = vmax(qx, vdupq_n_f32(vgetq_lane_f32(r, 0)));
+		vst1q_f32(out[i].x, vmin(v, vdupq_n_f32(vgetq_lane_f32(r, 2))));
+		v = vmax(qy, vdupq_n_f32(vgetq_lane_f32(r, 1)));
+		vst1q_f32(out[i].y, vmin(v, vdupq_n_f32(vgetq_lane_f32(r, 3))));
+		out[i].n = quad->n;
+	}
+}
+
+#else
+
+void
+clip_quad_rects(const struct polygon8 *quad, int transformed,
+		const pixman_box32_t *rects, int count,
+		struct polygon8 *out)
+{
+	clip_quad_rects_scalar(quad, transformed, rects, count, out);
+}
+
+#endif
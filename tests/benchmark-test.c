@@ -0,0 +1,86 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+
+#include "../src/compositor.h"
+
+/* Runs on the headless backend in benchmark mode, see weston-tests-env.
+ * The backend drives the workload and ends the compositor by itself;
+ * this only checks that it got to repaint along the way and that
+ * nothing it left behind trips up the shutdown. */
+
+struct benchmark_test {
+	struct weston_compositor *compositor;
+	struct wl_listener frame_listener;
+	struct wl_listener destroy_listener;
+	int frames;
+};
+
+static void
+frame_notify(struct wl_listener *listener, void *data)
+{
+	struct benchmark_test *t =
+		container_of(listener, struct benchmark_test, frame_listener);
+
+	t->frames++;
+}
+
+static void
+output_destroyed(struct wl_listener *listener, void *data)
+{
+	struct benchmark_test *t =
+		container_of(listener, struct benchmark_test,
+			     destroy_listener);
+
+	/* The benchmark is torn down before the outputs, its layer and
+	 * surfaces are gone from a surface list due for a rebuild. */
+	assert(t->frames > 1);
+	assert(t->compositor->surface_list_dirty);
+
+	fprintf(stderr, "benchmark: %d frames repainted\n", t->frames);
+
+	wl_list_remove(&t->frame_listener.link);
+	free(t);
+}
+
+WL_EXPORT int
+module_init(struct weston_compositor *compositor, int *argc, char *argv[])
+{
+	struct weston_output *output;
+	struct benchmark_test *t;
+
+	t = calloc(1, sizeof *t);
+	assert(t);
+	t->compositor = compositor;
+
+	output = container_of(compositor->output_list.next,
+			      struct weston_output, link);
+	t->frame_listener.notify = frame_notify;
+	wl_signal_add(&output->frame_signal, &t->frame_listener);
+	t->destroy_listener.notify = output_destroyed;
+	wl_signal_add(&output->destroy_signal, &t->destroy_listener);
+
+	return 0;
+}
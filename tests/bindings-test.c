@@ -0,0 +1,245 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <time.h>
+#include <linux/input.h>
+
+#include "../src/compositor.h"
+
+/* Several handlers bound to the same combination must all run, in the
+ * order they were added, and only those; axis bindings stop at the
+ * first. Then times button binding dispatch with a thousand button
+ * bindings added, against a quarter of that. */
+
+#define BINDINGS 1000
+#define DISPATCHES 200000
+
+static int calls[8];
+static int call_count;
+
+static void
+record(void *data)
+{
+	assert(call_count < 8);
+	calls[call_count++] = (intptr_t) data;
+}
+
+static void
+key_handler(struct weston_seat *seat, uint32_t time, uint32_t key,
+	    void *data)
+{
+	record(data);
+}
+
+static void
+button_handler(struct weston_seat *seat, uint32_t time, uint32_t button,
+	       void *data)
+{
+	record(data);
+}
+
+static void
+axis_handler(struct weston_seat *seat, uint32_t time, uint32_t axis,
+	     wl_fixed_t value, void *data)
+{
+	record(data);
+}
+
+static void
+count_handler(struct weston_seat *seat, uint32_t time, uint32_t button,
+	      void *data)
+{
+	(*(int *) data)++;
+}
+
+static void
+check_calls(int count, const int *expected)
+{
+	int i;
+
+	assert(call_count == count);
+	for (i = 0; i < count; i++)
+		assert(calls[i] == expected[i]);
+	call_count = 0;
+}
+
+static void
+run_key(struct weston_compositor *compositor, struct weston_seat *seat,
+	uint32_t key)
+{
+	struct weston_keyboard_grab *grab;
+
+	weston_compositor_run_key_binding(compositor, seat, 0, key,
+					  WL_KEYBOARD_KEY_STATE_PRESSED);
+
+	/* Release the key to end the grab that swallows it. */
+	grab = seat->keyboard->grab;
+	if (grab != &seat->keyboard->default_grab)
+		grab->interface->key(grab, 0, key,
+				     WL_KEYBOARD_KEY_STATE_RELEASED);
+}
+
+static double
+time_dispatch(struct weston_compositor *compositor, struct weston_seat *seat)
+{
+	struct timespec start, end;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < DISPATCHES; i++) {
+		seat->modifier_state = i & (MODIFIER_CTRL | MODIFIER_ALT);
+		weston_compositor_run_button_binding(compositor, seat, 0,
+						     BTN_MISC + i % 64,
+						     WL_POINTER_BUTTON_STATE_PRESSED);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return ((end.tv_sec - start.tv_sec) * 1e9 +
+		(end.tv_nsec - start.tv_nsec)) / DISPATCHES;
+}
+
+static void
+bindings(void *data)
+{
+	struct weston_compositor *compositor = data;
+	struct weston_binding *b[BINDINGS], *extra;
+	struct weston_seat seat;
+	double few, many;
+	int i, count = 0;
+
+	weston_seat_init(&seat, compositor, "bindings");
+	assert(weston_seat_init_keyboard(&seat, NULL) == 0);
+
+	/* Same combinations, interleaved with others that must not run. */
+	b[0] = weston_compositor_add_key_binding(compositor, KEY_A,
+						 MODIFIER_SUPER,
+						 key_handler, (void *) 1);
+	b[1] = weston_compositor_add_key_binding(compositor, KEY_A, 0,
+						 key_handler, (void *) 2);
+	b[2] = weston_compositor_add_key_binding(compositor, KEY_A,
+						 MODIFIER_SUPER,
+						 key_handler, (void *) 3);
+	b[3] = weston_compositor_add_button_binding(compositor, KEY_A,
+						    MODIFIER_SUPER,
+						    button_handler, (void *) 4);
+	b[4] = weston_compositor_add_key_binding(compositor, KEY_A,
+						 MODIFIER_SUPER,
+						 key_handler, (void *) 5);
+	b[5] = weston_compositor_add_button_binding(compositor, BTN_LEFT,
+						    MODIFIER_SUPER,
+						    button_handler, (void *) 6);
+	b[6] = weston_compositor_add_button_binding(compositor, BTN_LEFT,
+						    MODIFIER_SUPER,
+						    button_handler, (void *) 7);
+	b[7] = weston_compositor_add_axis_binding(compositor, 0,
+						  MODIFIER_SUPER,
+						  axis_handler, (void *) 8);
+	b[8] = weston_compositor_add_axis_binding(compositor, 0,
+						  MODIFIER_SUPER,
+						  axis_handler, (void *) 9);
+
+	seat.modifier_state = MODIFIER_SUPER;
+	run_key(compositor, &seat, KEY_A);
+	check_calls(3, (int []) { 1, 3, 5 });
+
+	weston_compositor_run_button_binding(compositor, &seat, 0, BTN_LEFT,
+					     WL_POINTER_BUTTON_STATE_PRESSED);
+	check_calls(2, (int []) { 6, 7 });
+	weston_compositor_run_button_binding(compositor, &seat, 0, BTN_LEFT,
+					     WL_POINTER_BUTTON_STATE_RELEASED);
+	check_calls(0, NULL);
+
+	assert(weston_compositor_run_axis_binding(compositor, &seat, 0, 0,
+						  wl_fixed_from_int(1)));
+	check_calls(1, (int []) { 8 });
+	assert(!weston_compositor_run_axis_binding(compositor, &seat, 0, 1,
+						   wl_fixed_from_int(1)));
+
+	seat.modifier_state = 0;
+	run_key(compositor, &seat, KEY_A);
+	check_calls(1, (int []) { 2 });
+
+	/* Destroyed bindings no longer run, bindings added later run
+	 * after the earlier ones. */
+	weston_binding_destroy(b[2]);
+	extra = weston_compositor_add_key_binding(compositor, KEY_A,
+						  MODIFIER_SUPER,
+						  key_handler, (void *) 10);
+	weston_binding_destroy(b[7]);
+	seat.modifier_state = MODIFIER_SUPER;
+	run_key(compositor, &seat, KEY_A);
+	check_calls(3, (int []) { 1, 5, 10 });
+	assert(weston_compositor_run_axis_binding(compositor, &seat, 0, 0,
+						  wl_fixed_from_int(1)));
+	check_calls(1, (int []) { 9 });
+
+	weston_binding_destroy(extra);
+	for (i = 0; i < 9; i++)
+		if (i != 2 && i != 7)
+			weston_binding_destroy(b[i]);
+
+	/* Micro-benchmark: 64 buttons times 4 modifier combinations are
+	 * bound once each and dispatched to, then the rest of the
+	 * thousand go to other buttons, which a walk of the whole button
+	 * binding list would have to skip. */
+	for (i = 0; i < 256; i++)
+		b[i] = weston_compositor_add_button_binding(compositor,
+							    BTN_MISC + i / 4,
+							    i % 4,
+							    count_handler,
+							    &count);
+	few = time_dispatch(compositor, &seat);
+
+	for (; i < BINDINGS; i++)
+		b[i] = weston_compositor_add_button_binding(compositor,
+							    BTN_MISC + 64 +
+							    i % 128, i % 16,
+							    count_handler,
+							    NULL);
+	many = time_dispatch(compositor, &seat);
+	assert(count == 2 * DISPATCHES);
+
+	fprintf(stderr, "button binding dispatch: %.0f ns with 256 bindings, "
+		"%.0f ns with %d\n", few, many, BINDINGS);
+
+	for (i = 0; i < BINDINGS; i++)
+		weston_binding_destroy(b[i]);
+
+	weston_seat_release(&seat);
+
+	wl_display_terminate(compositor->wl_display);
+}
+
+WL_EXPORT int
+module_init(struct weston_compositor *compositor, int *argc, char *argv[])
+{
+	struct wl_event_loop *loop;
+
+	loop = wl_display_get_event_loop(compositor->wl_display);
+
+	wl_event_loop_add_idle(loop, bindings, compositor);
+
+	return 0;
+}
@@ -0,0 +1,137 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+
+#include "../src/compositor.h"
+
+/* Each repaint of an output fills in the next entry of its timing
+ * ring, which is marked presented by the following finish_frame, and
+ * surfaces drawn with a pending commit get it counted in their latency
+ * histogram then. */
+
+static uint32_t
+histogram_count(struct weston_surface *surface)
+{
+	uint32_t count = 0;
+	int i;
+
+	for (i = 0; i < WESTON_LATENCY_BUCKETS; i++)
+		count += surface->latency_histogram[i];
+
+	return count;
+}
+
+static void
+repaint(struct weston_output *output)
+{
+	output->repaint_needed = 1;
+	weston_output_finish_frame(output, 0);
+}
+
+static void
+frame_timing(void *data)
+{
+	struct weston_compositor *compositor = data;
+	struct weston_output *output;
+	struct weston_frame_timing *timing;
+	struct weston_surface *surface;
+	struct weston_layer layer;
+	uint32_t seq;
+	int i;
+
+	assert(weston_latency_bucket(0) == 0);
+	assert(weston_latency_bucket(999) == 0);
+	assert(weston_latency_bucket(1000) == 1);
+	assert(weston_latency_bucket(5000) == 3);
+	assert(weston_latency_bucket(63999) == 6);
+	assert(weston_latency_bucket(1000000) == WESTON_LATENCY_BUCKETS - 1);
+
+	output = container_of(compositor->output_list.next,
+			      struct weston_output, link);
+
+	weston_layer_init(&layer, &compositor->layer_list);
+	surface = weston_surface_create(compositor);
+	assert(surface);
+	weston_surface_configure(surface, 10, 10, 100, 100);
+	weston_layer_entry_insert(&layer.surface_list, surface);
+
+	/* Wrap around the ring at least once. */
+	seq = output->timing_seq;
+	for (i = 0; i < WESTON_FRAME_TIMINGS + 2; i++) {
+		weston_surface_damage(surface);
+		repaint(output);
+		assert(output->timing_seq == seq + i + 1);
+
+		timing = &output->timings[(seq + i) % WESTON_FRAME_TIMINGS];
+		assert(timing->seq == seq + i);
+		assert(timing->start != 0);
+		assert(timing->presented == 0);
+	}
+
+	surface->commit_time = weston_compositor_get_monotonic_time();
+	weston_surface_damage(surface);
+	repaint(output);
+	assert(surface->commit_time == 0);
+	assert(surface->drawn_commit_time != 0);
+	assert(output->presenting.size == sizeof surface);
+	assert(histogram_count(surface) == 0);
+
+	/* The previous frame is now presented. */
+	weston_output_finish_frame(output, 0);
+	timing = &output->timings[(output->timing_seq - 1) %
+				  WESTON_FRAME_TIMINGS];
+	assert(timing->presented != 0);
+	assert(histogram_count(surface) == 1);
+	assert(output->presenting.size == 0);
+
+	/* Nothing committed since, so nothing more is counted. */
+	weston_surface_damage(surface);
+	repaint(output);
+	weston_output_finish_frame(output, 0);
+	assert(histogram_count(surface) == 1);
+
+	/* A surface destroyed before its frame is presented is dropped. */
+	surface->commit_time = weston_compositor_get_monotonic_time();
+	weston_surface_damage(surface);
+	repaint(output);
+	weston_surface_destroy(surface);
+	weston_output_finish_frame(output, 0);
+
+	wl_list_remove(&layer.link);
+
+	wl_display_terminate(compositor->wl_display);
+}
+
+WL_EXPORT int
+module_init(struct weston_compositor *compositor, int *argc, char *argv[])
+{
+	struct wl_event_loop *loop;
+
+	loop = wl_display_get_event_loop(compositor->wl_display);
+
+	wl_event_loop_add_idle(loop, frame_timing, compositor);
+
+	return 0;
+}
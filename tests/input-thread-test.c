@@ -0,0 +1,249 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "compositor.h"
+#include "input-thread.h"
+
+/* Feeds numbered events through a pipe standing in for a device fd,
+ * and checks that they come out of the input thread's queue in order
+ * across the queue wrapping around, that a full queue stops the thread
+ * reading with the rest left in the fd, and that reading or flushing
+ * the queue gets the thread going again. */
+
+#define CHUNK 100
+
+struct queue_test {
+	struct wl_event_loop *loop;
+	struct input_thread *thread;
+	struct input_thread_source *source;
+	int fds[2];
+	int32_t sent, received;
+	int dispatches;
+	int drain;
+};
+
+static void
+send_events(struct queue_test *t, int count)
+{
+	struct input_event *ev;
+	ssize_t len;
+	int i;
+
+	ev = calloc(count, sizeof *ev);
+	assert(ev);
+	for (i = 0; i < count; i++) {
+		ev[i].type = EV_REL;
+		ev[i].code = REL_X;
+		ev[i].value = t->sent++;
+	}
+
+	len = write(t->fds[1], ev, count * sizeof *ev);
+	assert(len == (ssize_t) (count * sizeof *ev));
+	free(ev);
+}
+
+/* Reads what is queued in odd sized chunks, and checks the order. */
+static int
+receive_events(struct queue_test *t)
+{
+	struct input_event ev[CHUNK];
+	int i, n, total = 0;
+
+	while ((n = input_thread_source_read(t->source, ev, CHUNK - 3)) > 0) {
+		for (i = 0; i < n; i++)
+			assert(ev[i].value == t->received++);
+		total += n;
+	}
+	assert(n == -EAGAIN);
+
+	return total;
+}
+
+static int
+dispatch(int fd, uint32_t mask, void *data)
+{
+	struct queue_test *t = data;
+
+	assert(fd == t->fds[0]);
+	t->dispatches++;
+	if (t->drain)
+		receive_events(t);
+
+	return 1;
+}
+
+static uint32_t
+queued(struct queue_test *t)
+{
+	return __atomic_load_n(&t->source->head, __ATOMIC_ACQUIRE) -
+		__atomic_load_n(&t->source->tail, __ATOMIC_ACQUIRE);
+}
+
+static int
+pending_in_fd(struct queue_test *t)
+{
+	int bytes;
+
+	assert(ioctl(t->fds[0], FIONREAD, &bytes) == 0);
+
+	return bytes / sizeof (struct input_event);
+}
+
+/* Waits up to five seconds for the thread to have queued 'count'
+ * events and to be done reading. */
+static void
+wait_queued(struct queue_test *t, uint32_t count, int stalled)
+{
+	int i;
+
+	for (i = 0; i < 5000; i++) {
+		if (queued(t) == count &&
+		    __atomic_load_n(&t->source->stalled,
+				    __ATOMIC_SEQ_CST) == stalled)
+			return;
+		usleep(1000);
+	}
+
+	fprintf(stderr, "%u events queued, expected %u\n", queued(t), count);
+	assert(0);
+}
+
+static void
+test_wraparound(struct queue_test *t)
+{
+	int i;
+
+	/* Batches that don't divide the queue size, read from the
+	 * main loop as they come, go round the queue a few times. */
+	t->drain = 1;
+	for (i = 0; i < 10; i++) {
+		send_events(t, 700);
+		while (t->received < t->sent)
+			assert(wl_event_loop_dispatch(t->loop, 5000) == 0);
+	}
+	assert(t->source->head > 5 * INPUT_THREAD_QUEUE_SIZE);
+	assert(t->source->head == t->source->tail);
+	assert(t->source->stalls == 0);
+	assert(t->dispatches > 0);
+}
+
+static void
+test_full(struct queue_test *t)
+{
+	uint32_t stalls = t->source->stalls;
+	int n;
+
+	/* With nothing read, the queue fills and the rest stays in the
+	 * fd, for the kernel to deal with. */
+	t->drain = 0;
+	send_events(t, INPUT_THREAD_QUEUE_SIZE + 500);
+	wait_queued(t, INPUT_THREAD_QUEUE_SIZE, 1);
+	assert(t->source->stalls == stalls + 1);
+	assert(t->source->max_queued == INPUT_THREAD_QUEUE_SIZE);
+	assert(pending_in_fd(t) == 500);
+
+	/* Dispatching without reading doesn't restart the thread. */
+	assert(wl_event_loop_dispatch(t->loop, 0) == 0);
+	usleep(20000);
+	assert(queued(t) == INPUT_THREAD_QUEUE_SIZE);
+	assert(pending_in_fd(t) == 500);
+
+	/* Reading does, the thread queues the rest while it goes. */
+	n = receive_events(t);
+	assert(n >= INPUT_THREAD_QUEUE_SIZE);
+	wait_queued(t, INPUT_THREAD_QUEUE_SIZE + 500 - n, 0);
+	assert(pending_in_fd(t) == 0);
+	assert(receive_events(t) == INPUT_THREAD_QUEUE_SIZE + 500 - n);
+	assert(t->received == t->sent);
+}
+
+static void
+test_flush(struct queue_test *t)
+{
+	uint32_t stalls = t->source->stalls;
+
+	/* Flushing a full queue drops what is in it, and the thread
+	 * picks up what was left in the fd. */
+	t->drain = 0;
+	send_events(t, INPUT_THREAD_QUEUE_SIZE + 300);
+	wait_queued(t, INPUT_THREAD_QUEUE_SIZE, 1);
+	assert(t->source->stalls == stalls + 1);
+
+	input_thread_source_flush(t->source);
+	t->received += INPUT_THREAD_QUEUE_SIZE;
+	wait_queued(t, 300, 0);
+	assert(receive_events(t) == 300);
+	assert(t->received == t->sent);
+
+	/* Nothing left to replay. */
+	input_thread_source_flush(t->source);
+	assert(queued(t) == 0);
+	send_events(t, 10);
+	wait_queued(t, 10, 0);
+	assert(receive_events(t) == 10);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct queue_test t;
+
+	memset(&t, 0, sizeof t);
+	weston_log_file_open(NULL);
+
+	t.loop = wl_event_loop_create();
+	assert(t.loop);
+	t.thread = input_thread_create(t.loop);
+	assert(t.thread);
+
+	/* Room for more than a queue full of events in the pipe. */
+	assert(pipe2(t.fds, O_CLOEXEC | O_NONBLOCK) == 0);
+	assert(fcntl(t.fds[1], F_GETPIPE_SZ) >=
+	       (int) ((INPUT_THREAD_QUEUE_SIZE + 500) *
+		      sizeof (struct input_event)));
+	t.source = input_thread_add_fd(t.thread, t.fds[0], "pipe",
+				       dispatch, &t);
+	assert(t.source);
+
+	test_wraparound(&t);
+	test_full(&t);
+	test_flush(&t);
+
+	input_thread_source_remove(t.source);
+	input_thread_destroy(t.thread);
+	close(t.fds[0]);
+	close(t.fds[1]);
+	wl_event_loop_destroy(t.loop);
+
+	return 0;
+}
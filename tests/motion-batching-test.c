@@ -0,0 +1,178 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <linux/input.h>
+
+#include "../src/compositor.h"
+
+/* Runs on the headless backend, see weston-tests-env. Motion on a seat
+ * of our own is batched per frame and by rate, and a grab records what
+ * reaches it: batched motion must come in once, at the last position,
+ * and always before the button that followed it. */
+
+struct event {
+	enum { MOTION, BUTTON } type;
+	wl_fixed_t x, y;
+	uint32_t time;
+};
+
+static struct event events[16];
+static int event_count;
+
+static void
+record(struct weston_pointer *pointer, int type, uint32_t time)
+{
+	assert(event_count < 16);
+	events[event_count].type = type;
+	events[event_count].x = pointer->x;
+	events[event_count].y = pointer->y;
+	events[event_count].time = time;
+	event_count++;
+}
+
+static void
+grab_focus(struct weston_pointer_grab *grab)
+{
+}
+
+static void
+grab_motion(struct weston_pointer_grab *grab, uint32_t time)
+{
+	record(grab->pointer, MOTION, time);
+}
+
+static void
+grab_button(struct weston_pointer_grab *grab,
+	    uint32_t time, uint32_t button, uint32_t state)
+{
+	record(grab->pointer, BUTTON, time);
+}
+
+static const struct weston_pointer_grab_interface grab_interface = {
+	grab_focus,
+	grab_motion,
+	grab_button
+};
+
+static void
+repaint(struct weston_compositor *compositor)
+{
+	struct weston_output *output;
+
+	output = container_of(compositor->output_list.next,
+			      struct weston_output, link);
+	output->repaint_needed = 1;
+	weston_output_finish_frame(output, 0);
+}
+
+static void
+motion_batching(void *data)
+{
+	struct weston_compositor *compositor = data;
+	struct weston_pointer_grab grab;
+	struct weston_pointer *pointer;
+	struct weston_seat seat;
+	int i;
+
+	weston_seat_init(&seat, compositor, "motion-batching");
+	weston_seat_init_pointer(&seat);
+	pointer = seat.pointer;
+	notify_motion_absolute(&seat, 0, wl_fixed_from_int(100),
+			       wl_fixed_from_int(100));
+
+	grab.interface = &grab_interface;
+	weston_pointer_start_grab(pointer, &grab);
+
+	/* Per frame: the pointer moves right away, the grab only hears
+	 * about it on the next repaint. */
+	compositor->motion_batching = WESTON_MOTION_BATCHING_FRAME;
+	for (i = 1; i <= 4; i++)
+		notify_motion(&seat, i, wl_fixed_from_int(10), 0);
+	assert(pointer->x == wl_fixed_from_int(140));
+	assert(event_count == 0);
+
+	repaint(compositor);
+	assert(event_count == 1);
+	assert(events[0].type == MOTION && events[0].time == 4);
+	assert(events[0].x == wl_fixed_from_int(140));
+
+	/* A button delivers the motion before it first. */
+	notify_motion(&seat, 5, 0, wl_fixed_from_int(10));
+	notify_motion(&seat, 6, 0, wl_fixed_from_int(10));
+	notify_button(&seat, 7, BTN_LEFT, WL_POINTER_BUTTON_STATE_PRESSED);
+	notify_button(&seat, 8, BTN_LEFT, WL_POINTER_BUTTON_STATE_RELEASED);
+	assert(event_count == 4);
+	assert(events[1].type == MOTION && events[1].time == 6);
+	assert(events[1].y == wl_fixed_from_int(120));
+	assert(events[2].type == BUTTON && events[3].type == BUTTON);
+
+	repaint(compositor);
+	assert(event_count == 4);
+
+	/* By rate: the first motion after a quiet second goes through,
+	 * the rest wait for the timer or the next button. */
+	compositor->motion_batching = WESTON_MOTION_BATCHING_RATE;
+	compositor->motion_rate = 1;
+	pointer->motion_flush_time = weston_compositor_get_time() - 2000;
+	notify_motion(&seat, 9, wl_fixed_from_int(10), 0);
+	notify_motion(&seat, 10, wl_fixed_from_int(10), 0);
+	notify_motion(&seat, 11, wl_fixed_from_int(10), 0);
+	assert(event_count == 5);
+	assert(events[4].type == MOTION && events[4].time == 9);
+	assert(pointer->motion_pending);
+
+	notify_button(&seat, 12, BTN_LEFT, WL_POINTER_BUTTON_STATE_PRESSED);
+	notify_button(&seat, 13, BTN_LEFT, WL_POINTER_BUTTON_STATE_RELEASED);
+	assert(event_count == 8);
+	assert(events[5].type == MOTION && events[5].time == 11);
+	assert(events[5].x == wl_fixed_from_int(170));
+
+	assert(pointer->motion_events == 10);
+	assert(pointer->motion_deliveries == 5);
+
+	/* Without batching every motion goes through. */
+	compositor->motion_batching = WESTON_MOTION_BATCHING_NONE;
+	notify_motion(&seat, 14, wl_fixed_from_int(-10), 0);
+	notify_motion(&seat, 15, wl_fixed_from_int(-10), 0);
+	assert(event_count == 10);
+	assert(pointer->motion_deliveries == 7);
+
+	weston_pointer_end_grab(pointer);
+	weston_seat_release(&seat);
+
+	wl_display_terminate(compositor->wl_display);
+}
+
+WL_EXPORT int
+module_init(struct weston_compositor *compositor, int *argc, char *argv[])
+{
+	struct wl_event_loop *loop;
+
+	loop = wl_display_get_event_loop(compositor->wl_display);
+
+	wl_event_loop_add_idle(loop, motion_batching, compositor);
+
+	return 0;
+}
@@ -0,0 +1,222 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+
+#include "../src/compositor.h"
+
+/* Runs on the headless backend with two outputs side by side, see
+ * weston-tests-env. A surface straddling both outputs is damaged, and
+ * each output must be handed exactly its share of the damage, with the
+ * damage pass only run once for both. */
+
+struct damage_output {
+	struct weston_output *output;
+	void (*repaint)(struct weston_output *output,
+			pixman_region32_t *damage);
+	pixman_region32_t damage;
+};
+
+static struct damage_output outputs[2];
+
+static void
+damage_output_repaint(struct weston_output *output, pixman_region32_t *damage)
+{
+	struct damage_output *o;
+
+	o = output == outputs[0].output ? &outputs[0] : &outputs[1];
+	assert(o->output == output);
+
+	pixman_region32_copy(&o->damage, damage);
+	o->repaint(output, damage);
+}
+
+static void
+repaint(struct damage_output *o)
+{
+	pixman_region32_fini(&o->damage);
+	pixman_region32_init(&o->damage);
+	o->output->repaint_needed = 1;
+	weston_output_finish_frame(o->output, 0);
+}
+
+static void
+assert_damage(struct damage_output *o, pixman_region32_t *expected)
+{
+	pixman_region32_t region;
+
+	pixman_region32_init(&region);
+	pixman_region32_intersect(&region, expected, &o->output->region);
+	assert(pixman_region32_equal(&region, &o->damage));
+	pixman_region32_fini(&region);
+}
+
+static int
+draws(struct damage_output *o, struct weston_surface *surface)
+{
+	struct weston_surface **es;
+
+	wl_array_for_each(es, &o->output->draw_list)
+		if (*es == surface)
+			return 1;
+
+	return 0;
+}
+
+static struct weston_surface *
+create_surface(struct weston_compositor *compositor, struct weston_layer *layer,
+	       int x, int y, int width, int height)
+{
+	struct weston_surface *surface;
+
+	surface = weston_surface_create(compositor);
+	assert(surface);
+	weston_surface_configure(surface, x, y, width, height);
+	pixman_region32_fini(&surface->opaque);
+	pixman_region32_init_rect(&surface->opaque, 0, 0, width, height);
+	weston_layer_entry_insert(&layer->surface_list, surface);
+
+	return surface;
+}
+
+static void
+output_damage(void *data)
+{
+	struct weston_compositor *compositor = data;
+	struct weston_output *output;
+	struct weston_layer layer;
+	struct weston_surface *below, *hidden, *above;
+	pixman_region32_t expected;
+	uint32_t passes, skipped, rendered, rebuilds;
+	int i = 0;
+
+	wl_list_for_each(output, &compositor->output_list, link) {
+		assert(i < 2);
+		outputs[i].output = output;
+		outputs[i].repaint = output->repaint;
+		pixman_region32_init(&outputs[i].damage);
+		output->repaint = damage_output_repaint;
+		i++;
+	}
+	assert(i == 2);
+
+	weston_layer_init(&layer, &compositor->layer_list);
+
+	/* 'below' straddles the two outputs; 'above' is opaque, stacked
+	 * on top and covers the middle of it, also on both outputs.
+	 * 'hidden' is entirely behind 'above'. */
+	below = create_surface(compositor, &layer, 824, 100, 400, 300);
+	hidden = create_surface(compositor, &layer, 974, 225, 100, 50);
+	above = create_surface(compositor, &layer, 924, 200, 200, 100);
+
+	/* Flush the initial output damage and the damage from mapping. */
+	repaint(&outputs[0]);
+	repaint(&outputs[1]);
+	assert(!pixman_region32_not_empty(&compositor->primary_plane.damage));
+
+	/* Nothing is restacked from here on, so damage alone must not
+	 * rebuild the surface list. */
+	rebuilds = compositor->surface_list_rebuilds;
+
+	pixman_region32_init_rect(&expected, 824, 100, 400, 300);
+	pixman_region32_subtract(&expected, &expected,
+				 &above->transform.boundingbox);
+
+	weston_surface_damage(below);
+	passes = compositor->damage_passes;
+	repaint(&outputs[0]);
+	repaint(&outputs[1]);
+	assert(compositor->damage_passes == passes + 1);
+	assert_damage(&outputs[0], &expected);
+	assert_damage(&outputs[1], &expected);
+	assert(pixman_region32_equal(&below->clip,
+				     &above->transform.boundingbox));
+
+	/* Only the occluded surface is culled, on both outputs. */
+	for (i = 0; i < 2; i++) {
+		assert(outputs[i].output->surfaces_culled == 1);
+		assert(draws(&outputs[i], below));
+		assert(draws(&outputs[i], above));
+		assert(!draws(&outputs[i], hidden));
+	}
+
+	/* New damage between the two repaints must not be lost. */
+	pixman_region32_fini(&expected);
+	pixman_region32_init_rect(&expected, 924, 200, 200, 100);
+
+	weston_surface_damage(above);
+	passes = compositor->damage_passes;
+	repaint(&outputs[1]);
+	assert(compositor->damage_passes == passes + 1);
+	assert_damage(&outputs[1], &expected);
+
+	weston_surface_damage(below);
+	repaint(&outputs[0]);
+	assert(compositor->damage_passes == passes + 2);
+	pixman_region32_union_rect(&expected, &expected, 824, 100, 400, 300);
+	pixman_region32_subtract(&expected, &expected,
+				 &outputs[1].output->region);
+	assert_damage(&outputs[0], &expected);
+
+	/* Output 1 hasn't seen the last damage pass yet, after that both
+	 * are clean and repaints are skipped until something changes. */
+	repaint(&outputs[1]);
+	for (i = 0; i < 2; i++) {
+		skipped = outputs[i].output->frames_skipped;
+		rendered = outputs[i].output->frames_rendered;
+		repaint(&outputs[i]);
+		assert(outputs[i].output->frames_skipped == skipped + 1);
+		assert(outputs[i].output->frames_rendered == rendered);
+		assert(!outputs[i].output->repaint_scheduled);
+	}
+
+	rendered = outputs[0].output->frames_rendered;
+	weston_surface_damage(hidden);
+	repaint(&outputs[0]);
+	assert(outputs[0].output->frames_rendered == rendered + 1);
+	assert(compositor->surface_list_rebuilds == rebuilds);
+
+	pixman_region32_fini(&expected);
+	for (i = 0; i < 2; i++)
+		pixman_region32_fini(&outputs[i].damage);
+
+	weston_surface_destroy(above);
+	weston_surface_destroy(hidden);
+	weston_surface_destroy(below);
+	wl_list_remove(&layer.link);
+
+	wl_display_terminate(compositor->wl_display);
+}
+
+WL_EXPORT int
+module_init(struct weston_compositor *compositor, int *argc, char *argv[])
+{
+	struct wl_event_loop *loop;
+
+	loop = wl_display_get_event_loop(compositor->wl_display);
+
+	wl_event_loop_add_idle(loop, output_damage, compositor);
+
+	return 0;
+}
@@ -0,0 +1,217 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <math.h>
+
+#include "../src/compositor.h"
+
+/* Runs on the headless backend, see weston-tests-env. Picks through
+ * the compositor pick grid must find the same surface at the same
+ * surface coordinates as walking surface_list, with surfaces moved,
+ * transformed, unmapped and destroyed in between. */
+
+#define SURFACES 48
+#define POINTS 20000
+
+struct pick_surface {
+	struct weston_surface *surface;
+	struct weston_transform transform;
+	int transformed;
+};
+
+static struct pick_surface surfaces[SURFACES];
+
+static struct weston_surface *
+pick_linear(struct weston_compositor *compositor, wl_fixed_t x, wl_fixed_t y,
+	    wl_fixed_t *sx, wl_fixed_t *sy)
+{
+	struct weston_surface *surface;
+
+	wl_list_for_each(surface, &compositor->surface_list, link) {
+		weston_surface_from_global_fixed(surface, x, y, sx, sy);
+		if (pixman_region32_contains_point(&surface->input,
+						   wl_fixed_to_int(*sx),
+						   wl_fixed_to_int(*sy),
+						   NULL))
+			return surface;
+	}
+
+	return NULL;
+}
+
+static void
+check_picks(struct weston_compositor *compositor)
+{
+	struct weston_surface *expected, *picked;
+	wl_fixed_t x, y, sx, sy, esx, esy;
+	uint32_t candidates;
+	int i;
+
+	candidates = compositor->pick.candidates;
+
+	for (i = 0; i < POINTS; i++) {
+		x = wl_fixed_from_int(rand() % 2400 - 200) + rand() % 256;
+		y = wl_fixed_from_int(rand() % 1600 - 200) + rand() % 256;
+
+		expected = pick_linear(compositor, x, y, &esx, &esy);
+		picked = weston_compositor_pick_surface(compositor, x, y,
+							&sx, &sy);
+		assert(picked == expected);
+		if (picked)
+			assert(sx == esx && sy == esy);
+	}
+
+	fprintf(stderr, "%.1f candidates per pick\n",
+		(float) (compositor->pick.candidates - candidates) / POINTS);
+}
+
+static void
+repaint(struct weston_compositor *compositor)
+{
+	struct weston_output *output;
+
+	output = container_of(compositor->output_list.next,
+			      struct weston_output, link);
+	output->repaint_needed = 1;
+	weston_output_finish_frame(output, 0);
+}
+
+static void
+place_surface(struct pick_surface *s)
+{
+	struct weston_surface *surface = s->surface;
+	int32_t w = 1 + rand() % 400, h = 1 + rand() % 300;
+	float angle;
+
+	weston_surface_configure(surface, rand() % 2200 - 100,
+				 rand() % 1400 - 100, w, h);
+
+	pixman_region32_fini(&surface->input);
+	if (rand() % 4 == 0)
+		pixman_region32_init_rect(&surface->input,
+					  w / 4, h / 4, w / 2 + 1, h / 2 + 1);
+	else
+		pixman_region32_init_rect(&surface->input, 0, 0, w, h);
+
+	if (s->transformed) {
+		wl_list_remove(&s->transform.link);
+		s->transformed = 0;
+	}
+
+	if (rand() % 3 == 0) {
+		angle = rand() % 360 * M_PI / 180;
+		weston_matrix_init(&s->transform.matrix);
+		weston_matrix_translate(&s->transform.matrix,
+					-w / 2.0f, -h / 2.0f, 0);
+		weston_matrix_rotate_xy(&s->transform.matrix,
+					cosf(angle), sinf(angle));
+		weston_matrix_scale(&s->transform.matrix,
+				    0.5f + rand() % 4, 0.5f + rand() % 4, 1);
+		weston_matrix_translate(&s->transform.matrix,
+					w / 2.0f, h / 2.0f, 0);
+		wl_list_insert(surface->geometry.transformation_list.prev,
+			       &s->transform.link);
+		s->transformed = 1;
+	}
+
+	weston_surface_geometry_dirty(surface);
+}
+
+static void
+pick(void *data)
+{
+	struct weston_compositor *compositor = data;
+	struct weston_surface *background;
+	struct weston_layer layer;
+	int i;
+
+	srand(0);
+
+	weston_layer_init(&layer, &compositor->layer_list);
+
+	/* Keeps the default infinite input region, and so is never in
+	 * the grid, but only picked where nothing else is. */
+	background = weston_surface_create(compositor);
+	assert(background);
+	weston_surface_configure(background, 0, 0, 100, 100);
+
+	for (i = 0; i < SURFACES; i++) {
+		surfaces[i].surface = weston_surface_create(compositor);
+		assert(surfaces[i].surface);
+		place_surface(&surfaces[i]);
+		weston_layer_entry_insert(&layer.surface_list,
+					  surfaces[i].surface);
+	}
+	weston_layer_entry_insert(layer.surface_list.prev, background);
+
+	repaint(compositor);
+	check_picks(compositor);
+
+	/* Moved surfaces aren't picked where they were until the next
+	 * repaint, but where they are now, as before. */
+	for (i = 0; i < SURFACES; i += 3)
+		place_surface(&surfaces[i]);
+	check_picks(compositor);
+
+	repaint(compositor);
+	check_picks(compositor);
+
+	for (i = 1; i < SURFACES; i += 4)
+		weston_surface_unmap(surfaces[i].surface);
+	for (i = 2; i < SURFACES; i += 4) {
+		if (surfaces[i].transformed)
+			wl_list_remove(&surfaces[i].transform.link);
+		weston_surface_destroy(surfaces[i].surface);
+		surfaces[i].surface = NULL;
+	}
+	check_picks(compositor);
+
+	repaint(compositor);
+	check_picks(compositor);
+
+	for (i = 0; i < SURFACES; i++) {
+		if (!surfaces[i].surface)
+			continue;
+		if (surfaces[i].transformed)
+			wl_list_remove(&surfaces[i].transform.link);
+		weston_surface_destroy(surfaces[i].surface);
+	}
+	weston_surface_destroy(background);
+	wl_list_remove(&layer.link);
+
+	wl_display_terminate(compositor->wl_display);
+}
+
+WL_EXPORT int
+module_init(struct weston_compositor *compositor, int *argc, char *argv[])
+{
+	struct wl_event_loop *loop;
+
+	loop = wl_display_get_event_loop(compositor->wl_display);
+
+	wl_event_loop_add_idle(loop, pick, compositor);
+
+	return 0;
+}
@@ -0,0 +1,280 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "../src/compositor.h"
+#include "../src/pixman-renderer.h"
+
+/* Runs on the headless backend with the pixman renderer, see
+ * weston-tests-env. The same scene of translucent, rotated and scaled
+ * shm surfaces is rendered on one thread and on the tile threads, with
+ * full and with partial damage, and the pixels must come out the same. */
+
+#define TILE_THREADS 4
+
+struct tiles_test {
+	struct weston_compositor *compositor;
+	struct weston_output *output;
+	struct wl_client *client;
+	uint32_t next_id;
+	struct weston_layer layer;
+	struct weston_transform transforms[2];
+	int width, height;
+};
+
+static struct weston_surface *
+create_solid(struct tiles_test *t, int x, int y, int width, int height,
+	     uint32_t color)
+{
+	struct weston_surface *surface;
+	float alpha = (color >> 24) / 255.0f;
+
+	surface = weston_surface_create(t->compositor);
+	assert(surface);
+	weston_surface_set_color(surface, ((color >> 16) & 0xff) / 255.0f,
+				 ((color >> 8) & 0xff) / 255.0f,
+				 (color & 0xff) / 255.0f, alpha);
+	weston_surface_configure(surface, x, y, width, height);
+	if (alpha == 1.0f) {
+		pixman_region32_fini(&surface->opaque);
+		pixman_region32_init_rect(&surface->opaque,
+					  0, 0, width, height);
+	}
+	weston_layer_entry_insert(&t->layer.surface_list, surface);
+
+	return surface;
+}
+
+/* A surface with an ARGB shm buffer holding a gradient with a grid on
+ * it, so filtering across band edges shows up in the pixels. */
+static struct weston_surface *
+create_image(struct tiles_test *t, int x, int y, int width, int height)
+{
+	struct weston_surface *surface;
+	struct wl_shm_buffer *shm;
+	struct weston_buffer *buffer;
+	uint32_t *data, a;
+	int i, j;
+
+	surface = weston_surface_create(t->compositor);
+	assert(surface);
+
+	shm = wl_shm_buffer_create(t->client, t->next_id, width, height,
+				   width * 4, WL_SHM_FORMAT_ARGB8888);
+	assert(shm);
+	data = wl_shm_buffer_get_data(shm);
+	for (i = 0; i < height; i++) {
+		for (j = 0; j < width; j++) {
+			a = (i % 16 == 0 || j % 16 == 0) ?
+				0xff : 0x40 + (i + j) % 0xc0;
+			/* premultiplied */
+			data[i * width + j] = a << 24 |
+				(a * j / width) << 16 |
+				(a * i / height) << 8 |
+				a * ((i ^ j) & 0xff) / 0xff;
+		}
+	}
+
+	buffer = weston_buffer_from_resource(wl_client_get_object(t->client,
+								  t->next_id));
+	assert(buffer);
+	t->next_id++;
+	weston_buffer_reference(&surface->buffer_ref, buffer);
+	t->compositor->renderer->attach(surface, buffer);
+
+	weston_surface_configure(surface, x, y, width, height);
+	weston_layer_entry_insert(&t->layer.surface_list, surface);
+
+	return surface;
+}
+
+static void
+transform_surface(struct weston_surface *surface,
+		  struct weston_transform *transform,
+		  float angle, float scale)
+{
+	struct weston_matrix *matrix = &transform->matrix;
+	float cx = surface->geometry.width / 2.0f;
+	float cy = surface->geometry.height / 2.0f;
+
+	weston_matrix_init(matrix);
+	weston_matrix_translate(matrix, -cx, -cy, 0.0f);
+	weston_matrix_rotate_xy(matrix, cosf(angle), sinf(angle));
+	weston_matrix_scale(matrix, scale, scale, 1.0f);
+	weston_matrix_translate(matrix, cx, cy, 0.0f);
+
+	wl_list_insert(surface->geometry.transformation_list.prev,
+		       &transform->link);
+	weston_surface_geometry_dirty(surface);
+}
+
+static void
+repaint(struct tiles_test *t)
+{
+	t->output->repaint_needed = 1;
+	weston_output_finish_frame(t->output, 0);
+}
+
+static uint32_t *
+read_output(struct tiles_test *t)
+{
+	uint32_t *pixels;
+
+	pixels = malloc(t->width * t->height * 4);
+	assert(pixels);
+	assert(t->compositor->renderer->read_pixels(t->output,
+						     PIXMAN_a8r8g8b8, pixels,
+						     0, 0, t->width,
+						     t->height) == 0);
+
+	return pixels;
+}
+
+static int
+compare(struct tiles_test *t, const uint32_t *a, const uint32_t *b)
+{
+	int i;
+
+	for (i = 0; i < t->width * t->height; i++) {
+		if (a[i] == b[i])
+			continue;
+
+		/* read_pixels() flips the rows. */
+		fprintf(stderr, "pixel %d,%d differs: %08x on one thread, "
+			"%08x on %d\n", i % t->width,
+			t->height - 1 - i / t->width, a[i], b[i],
+			TILE_THREADS);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Overwrite the whole output with one color, so that pixels a later
+ * repaint fails to touch don't keep the right values by accident. */
+static void
+scribble(struct tiles_test *t)
+{
+	struct weston_surface *cover;
+	uint32_t *pixels;
+
+	cover = create_solid(t, 0, 0, t->width, t->height, 0xffff00ff);
+	repaint(t);
+	pixels = read_output(t);
+	assert(pixels[0] == 0xffff00ff);
+	free(pixels);
+	weston_surface_destroy(cover);
+}
+
+/* Renders the whole output from scratch on one thread. */
+static uint32_t *
+render_reference(struct tiles_test *t)
+{
+	assert(pixman_renderer_set_threads(t->compositor, 1) == 1);
+	scribble(t);
+	weston_compositor_damage_all(t->compositor);
+	repaint(t);
+
+	return read_output(t);
+}
+
+static void
+pixman_tiles(void *data)
+{
+	struct tiles_test t = { data };
+	struct weston_surface *rotated, *scaled, *glass, *surface, *next;
+	uint32_t *reference, *tiled;
+	int fds[2];
+
+	t.output = container_of(t.compositor->output_list.next,
+				struct weston_output, link);
+	t.width = t.output->current->width;
+	t.height = t.output->current->height;
+
+	/* A client to own the shm buffers, nobody talks to it. */
+	assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == 0);
+	t.client = wl_client_create(t.compositor->wl_display, fds[0]);
+	assert(t.client);
+	/* Object 1 is the client's wl_display. */
+	t.next_id = 2;
+
+	weston_layer_init(&t.layer, &t.compositor->layer_list);
+
+	/* Each new surface goes on top. */
+	create_solid(&t, 0, 0, t.width, t.height, 0xff102030);
+	rotated = create_image(&t, 300, 150, 256, 256);
+	scaled = create_image(&t, 600, 120, 101, 77);
+	create_image(&t, 37, 300, 333, 211);
+	glass = create_solid(&t, 150, 50, 500, 400, 0x80204080);
+	transform_surface(rotated, &t.transforms[0], 0.5f, 1.0f);
+	transform_surface(scaled, &t.transforms[1], -0.2f, 2.7f);
+
+	/* Full damage. */
+	reference = render_reference(&t);
+	assert(pixman_renderer_set_threads(t.compositor,
+					   TILE_THREADS) == TILE_THREADS);
+	scribble(&t);
+	weston_compositor_damage_all(t.compositor);
+	repaint(&t);
+	tiled = read_output(&t);
+	assert(compare(&t, reference, tiled) == 0);
+	free(tiled);
+	free(reference);
+
+	/* Partial damage, over the bands of the frame before. */
+	weston_surface_set_color(glass, 0.5f, 0.25f, 0.0f, 0.75f);
+	weston_surface_damage(glass);
+	repaint(&t);
+	tiled = read_output(&t);
+	reference = render_reference(&t);
+	assert(compare(&t, reference, tiled) == 0);
+	free(tiled);
+	free(reference);
+
+	/* All of them are mapped, so this takes them out of the layer. */
+	wl_list_for_each_safe(surface, next, &t.layer.surface_list, layer_link)
+		weston_surface_destroy(surface);
+	wl_list_remove(&t.layer.link);
+	wl_client_destroy(t.client);
+	close(fds[1]);
+
+	wl_display_terminate(t.compositor->wl_display);
+}
+
+WL_EXPORT int
+module_init(struct weston_compositor *compositor, int *argc, char *argv[])
+{
+	struct wl_event_loop *loop;
+
+	loop = wl_display_get_event_loop(compositor->wl_display);
+
+	wl_event_loop_add_idle(loop, pixman_tiles, compositor);
+
+	return 0;
+}
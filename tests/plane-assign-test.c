@@ -0,0 +1,275 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "plane-assign.h"
+
+/* Checks on random scenes that plane_assign_run() gives a valid
+ * assignment that costs no more than any other, by trying all of them,
+ * and never more than first fit. With --benchmark, also times both on
+ * a larger scene. */
+
+#define WIDTH 1024
+#define HEIGHT 768
+
+static struct timespec begin_time;
+
+static void
+reset_timer(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &begin_time);
+}
+
+static double
+read_timer(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (double)(t.tv_sec - begin_time.tv_sec) +
+	       1e-9 * (t.tv_nsec - begin_time.tv_nsec);
+}
+
+/* Like the drm backend: a cursor plane on top, two overlays and the
+ * scanout plane. */
+static void
+make_planes(struct plane_assign *pa)
+{
+	plane_assign_init(pa);
+	plane_assign_add_plane(pa, PLANE_ASSIGN_CURSOR, 2);
+	plane_assign_add_plane(pa, PLANE_ASSIGN_SCANOUT, 0);
+	plane_assign_add_plane(pa, PLANE_ASSIGN_OVERLAY, 1);
+	plane_assign_add_plane(pa, PLANE_ASSIGN_OVERLAY, 1);
+}
+
+/* With 'windows', a desktop instead: a cursor, windows and a
+ * fullscreen background at the bottom. */
+static void
+make_surfaces(struct plane_assign_surface *surfaces, int count, int windows)
+{
+	struct plane_assign_surface *s;
+	int i, w, h, kind;
+
+	for (i = 0; i < count; i++) {
+		s = &surfaces[i];
+		kind = random() % 4;
+		if (windows)
+			kind = i == 0 ? 0 : i == count - 1 ? 1 : 2;
+		switch (kind) {
+		case 0:
+			/* A cursor, on top. */
+			w = h = 32;
+			s->planes = 1 << 0;
+			break;
+		case 1:
+			/* Fullscreen, could be scanned out. */
+			w = WIDTH;
+			h = HEIGHT;
+			s->planes = (1 << 1) | (1 << 2) | (1 << 3);
+			break;
+		default:
+			w = 64 + random() % 512;
+			h = 64 + random() % 512;
+			s->planes = random() % 2 ? (1 << 2) | (1 << 3) : 0;
+			break;
+		}
+
+		s->box.x1 = w == WIDTH ? 0 : random() % (WIDTH - w);
+		s->box.y1 = h == HEIGHT ? 0 : random() % (HEIGHT - h);
+		s->box.x2 = s->box.x1 + w;
+		s->box.y2 = s->box.y1 + h;
+
+		/* Mostly idle, some animating. */
+		s->commit_rate = random() % 3 ? 0.0f : 1 + random() % 60;
+		s->damage_area = (float) w * h / (1 + random() % 4);
+		s->plane = -2;
+	}
+}
+
+static int
+overlap(const pixman_box32_t *a, const pixman_box32_t *b)
+{
+	return a->x1 < b->x2 && b->x1 < a->x2 &&
+	       a->y1 < b->y2 && b->y1 < a->y2;
+}
+
+static int
+valid(struct plane_assign *pa, struct plane_assign_surface *s, int count)
+{
+	uint32_t used = 0;
+	int i, j, p;
+
+	for (i = 0; i < count; i++) {
+		p = s[i].plane;
+		if (p < 0)
+			continue;
+
+		if (p >= pa->plane_count || !(s[i].planes & (1 << p)) ||
+		    (used & (1 << p)))
+			return 0;
+		used |= 1 << p;
+
+		for (j = 0; j < i; j++)
+			if (overlap(&s[i].box, &s[j].box) &&
+			    (s[j].plane < 0 ||
+			     pa->planes[s[j].plane].zpos <=
+			     pa->planes[p].zpos))
+				return 0;
+
+		if (pa->planes[p].type == PLANE_ASSIGN_SCANOUT)
+			for (j = i + 1; j < count; j++)
+				if (s[j].plane >= 0)
+					return 0;
+	}
+
+	return 1;
+}
+
+/* Tries every assignment and returns the lowest cost. */
+static double
+brute_force(struct plane_assign *pa, struct plane_assign_surface *s,
+	    int count)
+{
+	double cost, best = -1.0;
+	int i, n, total = 1;
+
+	for (i = 0; i < count; i++)
+		total *= pa->plane_count + 1;
+
+	for (n = 0; n < total; n++) {
+		int k = n;
+
+		for (i = 0; i < count; i++) {
+			s[i].plane = k % (pa->plane_count + 1) - 1;
+			k /= pa->plane_count + 1;
+		}
+
+		if (!valid(pa, s, count))
+			continue;
+
+		cost = plane_assign_cost(pa, s, count);
+		if (best < 0.0 || cost < best)
+			best = cost;
+	}
+
+	return best;
+}
+
+static int
+test_optimal(void)
+{
+	struct plane_assign pa;
+	struct plane_assign_surface s[6], copy[6];
+	double cost, first_fit, best;
+	int i, count, better = 0, failed = 0;
+
+	make_planes(&pa);
+
+	for (i = 0; i < 2000; i++) {
+		count = 1 + random() % 6;
+		make_surfaces(s, count, 0);
+
+		memcpy(copy, s, sizeof s);
+		cost = plane_assign_run(&pa, s, count);
+		if (!valid(&pa, s, count)) {
+			printf("scene %d: invalid assignment\n", i);
+			failed++;
+			continue;
+		}
+
+		first_fit = plane_assign_first_fit(&pa, copy, count);
+		if (!valid(&pa, copy, count) || first_fit < cost - 1e-6) {
+			printf("scene %d: first fit %f beats %f\n",
+			       i, first_fit, cost);
+			failed++;
+		} else if (first_fit > cost) {
+			better++;
+		}
+
+		best = brute_force(&pa, copy, count);
+		if (fabs(best - cost) > 1e-6 * (1.0 + best)) {
+			printf("scene %d: cost %f, best possible %f\n",
+			       i, cost, best);
+			failed++;
+		}
+	}
+
+	printf("%d of 2000 scenes composed less than with first fit\n",
+	       better);
+
+	return failed;
+}
+
+static void
+benchmark(void)
+{
+	double (*assign[2])(struct plane_assign *,
+			    struct plane_assign_surface *, int) = {
+		plane_assign_first_fit, plane_assign_run
+	};
+	static const char *names[2] = { "first fit", "search" };
+	struct plane_assign pa;
+	struct plane_assign_surface s[32];
+	unsigned long count, nodes;
+	double t, cost = 0.0;
+	int j;
+
+	make_planes(&pa);
+	make_surfaces(s, 32, 1);
+
+	for (j = 0; j < 2; j++) {
+		printf("\nRunning 3 s test on %s assignment...\n", names[j]);
+
+		count = 0;
+		nodes = 0;
+		reset_timer();
+		while ((t = read_timer()) < 3.0) {
+			cost = assign[j](&pa, s, 32);
+			nodes += pa.nodes;
+			count++;
+		}
+
+		printf("%lu runs of 32 surfaces in %f seconds, "
+		       "avg. %.1f us/run, %lu steps/run, cost %.0f.\n",
+		       count, t, 1e6 * t / count, nodes / count, cost);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int failed;
+
+	srandom(0);
+
+	failed = test_optimal();
+	printf("%d scenes assigned wrong\n", failed);
+
+	if (argc > 1 && strcmp(argv[1], "--benchmark") == 0)
+		benchmark();
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "../src/compositor.h"
+
+/* The repaint after a frame is due repaint_window ms before the next
+ * vblank, counted in microseconds from the frame's presentation, not
+ * from when the backend got around to reporting it. */
+
+static void
+repaint_delay(void *data)
+{
+	struct weston_compositor *compositor = data;
+	struct weston_mode mode;
+	struct weston_output output;
+	int32_t repaint_window = compositor->repaint_window;
+	uint64_t now;
+
+	memset(&mode, 0, sizeof mode);
+	mode.refresh = 60000;	/* 16666 us */
+	memset(&output, 0, sizeof output);
+	output.compositor = compositor;
+	output.current = &mode;
+
+	/* No window, repaint right away. */
+	compositor->repaint_window = 0;
+	now = 10000500;
+	assert(weston_output_repaint_delay(&output, 9998, now) <= 0);
+
+	/* Presented in the ms that started 2.5 ms ago. */
+	compositor->repaint_window = 7;
+	assert(weston_output_repaint_delay(&output, 9998, now) ==
+	       16666 - 2500 - 7000);
+
+	/* Reported late, the deadline doesn't move. */
+	now += 3250;
+	assert(weston_output_repaint_delay(&output, 9998, now) ==
+	       16666 - 5750 - 7000);
+
+	/* Past the deadline already. */
+	now += 5000;
+	assert(weston_output_repaint_delay(&output, 9998, now) < 0);
+
+	/* The millisecond clock wraps at 32 bits. */
+	now = ((1ULL << 32) + 3) * 1000 + 200;
+	assert(weston_output_repaint_delay(&output, 0xffffffff, now) ==
+	       16666 - 4200 - 7000);
+
+	/* A frame time on another clock counts as presented now. */
+	assert(weston_output_repaint_delay(&output, 12345678, now) ==
+	       16666 - 7000);
+	assert(weston_output_repaint_delay(&output, 5, now) == 16666 - 7000);
+
+	/* No mode refresh rate to go by. */
+	mode.refresh = 0;
+	assert(weston_output_repaint_delay(&output, 9998, 10000500) <= 0);
+
+	compositor->repaint_window = repaint_window;
+
+	wl_display_terminate(compositor->wl_display);
+}
+
+WL_EXPORT int
+module_init(struct weston_compositor *compositor, int *argc, char *argv[])
+{
+	struct wl_event_loop *loop;
+
+	loop = wl_display_get_event_loop(compositor->wl_display);
+
+	wl_event_loop_add_idle(loop, repaint_delay, compositor);
+
+	return 0;
+}
@@ -0,0 +1,247 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "../src/compositor.h"
+
+/* Runs on the headless backend with the pixman renderer, see
+ * weston-tests-env. Damage shots alternate between two buffers, and
+ * each buffer must end up holding the whole output, not only the
+ * damage since the shot that went into the other one. Between shots,
+ * tracking the damage must not keep the output repainting. */
+
+struct shot_test {
+	struct weston_compositor *compositor;
+	struct weston_output *output;
+	struct wl_client *client;
+	uint32_t next_id;
+	int width, height;
+	int done, damage_rects;
+	int32_t damage_area;
+};
+
+static void
+shot_damage(void *data, int32_t x, int32_t y, int32_t width, int32_t height)
+{
+	struct shot_test *t = data;
+
+	t->damage_rects++;
+	t->damage_area += width * height;
+}
+
+static void
+shot_done(void *data, int status)
+{
+	struct shot_test *t = data;
+
+	assert(status == 0);
+	t->done++;
+}
+
+static const struct weston_screenshooter_damage_interface shot_interface = {
+	shot_damage,
+	shot_done
+};
+
+static struct weston_surface *
+create_solid(struct shot_test *t, struct weston_layer *layer,
+	     int x, int y, int width, int height, float red)
+{
+	struct weston_surface *surface;
+
+	surface = weston_surface_create(t->compositor);
+	assert(surface);
+	weston_surface_set_color(surface, red, 0.5f, 0.25f, 1.0f);
+	weston_surface_configure(surface, x, y, width, height);
+	pixman_region32_fini(&surface->opaque);
+	pixman_region32_init_rect(&surface->opaque, 0, 0, width, height);
+	weston_layer_entry_insert(&layer->surface_list, surface);
+
+	return surface;
+}
+
+static struct weston_buffer *
+create_buffer(struct shot_test *t)
+{
+	struct wl_shm_buffer *shm;
+	struct weston_buffer *buffer;
+
+	shm = wl_shm_buffer_create(t->client, t->next_id, t->width, t->height,
+				   t->width * 4, WL_SHM_FORMAT_XRGB8888);
+	assert(shm);
+	buffer = weston_buffer_from_resource(wl_client_get_object(t->client,
+								  t->next_id));
+	assert(buffer);
+	t->next_id++;
+
+	return buffer;
+}
+
+/* Fills the buffer with a color the output never shows. */
+static void
+clobber(struct weston_buffer *buffer)
+{
+	struct wl_shm_buffer *shm = wl_shm_buffer_get(buffer->resource);
+
+	memset(wl_shm_buffer_get_data(shm), 0xa5,
+	       wl_shm_buffer_get_stride(shm) * wl_shm_buffer_get_height(shm));
+}
+
+static void
+repaint(struct shot_test *t)
+{
+	t->output->repaint_needed = 1;
+	weston_output_finish_frame(t->output, 0);
+}
+
+/* Shoots into 'buffer' on a repaint and checks that it holds what is on
+ * the output. Returns the damaged area reported for the shot. */
+static int32_t
+shoot(struct shot_test *t, struct weston_screenshooter_damage *sd,
+      struct weston_buffer *buffer)
+{
+	struct wl_shm_buffer *shm = wl_shm_buffer_get(buffer->resource);
+	uint32_t *pixels, *data;
+	int x, y, done = t->done;
+
+	t->damage_rects = 0;
+	t->damage_area = 0;
+	assert(weston_screenshooter_damage_shoot(sd, buffer) == 0);
+	repaint(t);
+	assert(t->done == done + 1);
+
+	pixels = malloc(t->width * t->height * 4);
+	assert(pixels);
+	assert(t->compositor->renderer->read_pixels(t->output,
+						     PIXMAN_a8r8g8b8, pixels,
+						     0, 0, t->width,
+						     t->height) == 0);
+
+	/* read_pixels() flips the rows, the screenshot doesn't. The
+	 * output has no alpha channel to compare. */
+	data = wl_shm_buffer_get_data(shm);
+	for (y = 0; y < t->height; y++)
+		for (x = 0; x < t->width; x++)
+			assert(((data[y * t->width + x] ^
+				 pixels[(t->height - 1 - y) * t->width + x]) &
+				0x00ffffff) == 0);
+	free(pixels);
+
+	return t->damage_area;
+}
+
+static void
+screenshooter_damage(void *data)
+{
+	struct shot_test t = { data };
+	struct weston_screenshooter_damage *sd;
+	struct weston_buffer *a, *b;
+	struct weston_surface *square, *surface, *next;
+	struct weston_layer layer;
+	int32_t full;
+	uint32_t skipped;
+	int fds[2];
+
+	t.output = container_of(t.compositor->output_list.next,
+				struct weston_output, link);
+	t.width = t.output->current->width;
+	t.height = t.output->current->height;
+	full = t.width * t.height;
+
+	/* A client to own the shm buffers, nobody talks to it. */
+	assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == 0);
+	t.client = wl_client_create(t.compositor->wl_display, fds[0]);
+	assert(t.client);
+	/* Object 1 is the client's wl_display. */
+	t.next_id = 2;
+
+	weston_layer_init(&layer, &t.compositor->layer_list);
+	create_solid(&t, &layer, 0, 0, t.width, t.height, 0.0f);
+	square = create_solid(&t, &layer, 100, 100, 64, 64, 1.0f);
+
+	sd = weston_screenshooter_damage_create(t.output, &shot_interface, &t);
+	assert(sd);
+	a = create_buffer(&t);
+	b = create_buffer(&t);
+	clobber(a);
+	clobber(b);
+
+	/* The first shot of each buffer gets all of the output, even
+	 * with only the square moved since the shot into the other. */
+	assert(shoot(&t, sd, a) == full);
+	weston_surface_set_position(square, 200, 100);
+	assert(shoot(&t, sd, b) == full);
+
+	/* 'a' missed the shot into 'b', so it gets everything again. */
+	weston_surface_set_position(square, 300, 100);
+	assert(shoot(&t, sd, a) == full);
+
+	/* Back to back into the same buffer, only the damage. */
+	weston_surface_set_position(square, 400, 100);
+	assert(shoot(&t, sd, a) < full);
+	assert(t.damage_rects > 0);
+
+	/* With no shot pending, nothing changed, the repaint is
+	 * skipped. */
+	skipped = t.output->frames_skipped;
+	repaint(&t);
+	assert(t.output->frames_skipped == skipped + 1);
+
+	/* Damage from frames without a shot still counts, and a
+	 * destroyed buffer is not taken for the last one. */
+	weston_surface_set_position(square, 500, 100);
+	repaint(&t);
+	assert(shoot(&t, sd, a) < full);
+	wl_resource_destroy(a->resource);
+	a = create_buffer(&t);
+	clobber(a);
+	assert(shoot(&t, sd, a) == full);
+
+	weston_screenshooter_damage_destroy(sd);
+
+	/* All of them are mapped, so this takes them out of the layer. */
+	wl_list_for_each_safe(surface, next, &layer.surface_list, layer_link)
+		weston_surface_destroy(surface);
+	wl_list_remove(&layer.link);
+	wl_client_destroy(t.client);
+	close(fds[1]);
+
+	wl_display_terminate(t.compositor->wl_display);
+}
+
+WL_EXPORT int
+module_init(struct weston_compositor *compositor, int *argc, char *argv[])
+{
+	struct wl_event_loop *loop;
+
+	loop = wl_display_get_event_loop(compositor->wl_display);
+
+	wl_event_loop_add_idle(loop, screenshooter_damage, compositor);
+
+	return 0;
+}
@@ -0,0 +1,548 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <assert.h>
+#include <float.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "vertex-clipping.h"
+
+/* Checks that clip_quad_rects() and clip_quad_rects_scalar() give the
+ * same vertices as the clipper gl-renderer.c had before, copied below,
+ * for both axis aligned and rotated quads. With --benchmark, also times
+ * the vector and scalar paths. */
+
+#define NRECTS 64
+
+static float
+ref_float_difference(float a, float b)
+{
+	/* http://www.altdevblogaday.com/2012/02/22/comparing-floating-point-numbers-2012-edition/ */
+	static const float max_diff = 4.0f * FLT_MIN;
+	static const float max_rel_diff = 4.0e-5;
+	float diff = a - b;
+	float adiff = fabsf(diff);
+
+	if (adiff <= max_diff)
+		return 0.0f;
+
+	a = fabsf(a);
+	b = fabsf(b);
+	if (adiff <= (a > b ? a : b) * max_rel_diff)
+		return 0.0f;
+
+	return diff;
+}
+
+/* A line segment (p1x, p1y)-(p2x, p2y) intersects the line x = x_arg.
+ * Compute the y coordinate of the intersection.
+ */
+static float
+ref_clip_intersect_y(float p1x, float p1y, float p2x, float p2y,
+		     float x_arg)
+{
+	float a;
+	float diff = ref_float_difference(p1x, p2x);
+
+	/* Practically vertical line segment, yet the end points have already
+	 * been determined to be on different sides of the line. Therefore
+	 * the line segment is part of the line and intersects everywhere.
+	 * Return the end point, so we use the whole line segment.
+	 */
+	if (diff == 0.0f)
+		return p2y;
+
+	a = (x_arg - p2x) / diff;
+	return p2y + (p1y - p2y) * a;
+}
+
+/* A line segment (p1x, p1y)-(p2x, p2y) intersects the line y = y_arg.
+ * Compute the x coordinate of the intersection.
+ */
+static float
+ref_clip_intersect_x(float p1x, float p1y, float p2x, float p2y,
+		     float y_arg)
+{
+	float a;
+	float diff = ref_float_difference(p1y, p2y);
+
+	/* Practically horizontal line segment, yet the end points have already
+	 * been determined to be on different sides of the line. Therefore
+	 * the line segment is part of the line and intersects everywhere.
+	 * Return the end point, so we use the whole line segment.
+	 */
+	if (diff == 0.0f)
+		return p2x;
+
+	a = (y_arg - p2y) / diff;
+	return p2x + (p1x - p2x) * a;
+}
+
+enum ref_path_transition {
+	REF_PATH_TRANSITION_OUT_TO_OUT = 0,
+	REF_PATH_TRANSITION_OUT_TO_IN = 1,
+	REF_PATH_TRANSITION_IN_TO_OUT = 2,
+	REF_PATH_TRANSITION_IN_TO_IN = 3,
+};
+
+static void
+ref_clip_append_vertex(struct clip_context *ctx, float x, float y)
+{
+	*ctx->vertices.x++ = x;
+	*ctx->vertices.y++ = y;
+}
+
+static enum ref_path_transition
+ref_path_transition_left_edge(struct clip_context *ctx, float x, float y)
+{
+	return ((ctx->prev.x >= ctx->clip.x1) << 1) | (x >= ctx->clip.x1);
+}
+
+static enum ref_path_transition
+ref_path_transition_right_edge(struct clip_context *ctx, float x, float y)
+{
+	return ((ctx->prev.x < ctx->clip.x2) << 1) | (x < ctx->clip.x2);
+}
+
+static enum ref_path_transition
+ref_path_transition_top_edge(struct clip_context *ctx, float x, float y)
+{
+	return ((ctx->prev.y >= ctx->clip.y1) << 1) | (y >= ctx->clip.y1);
+}
+
+static enum ref_path_transition
+ref_path_transition_bottom_edge(struct clip_context *ctx, float x, float y)
+{
+	return ((ctx->prev.y < ctx->clip.y2) << 1) | (y < ctx->clip.y2);
+}
+
+static void
+ref_clip_polygon_leftright(struct clip_context *ctx,
+			   enum ref_path_transition transition,
+			   float x, float y, float clip_x)
+{
+	float yi;
+
+	switch (transition) {
+	case REF_PATH_TRANSITION_IN_TO_IN:
+		ref_clip_append_vertex(ctx, x, y);
+		break;
+	case REF_PATH_TRANSITION_IN_TO_OUT:
+		yi = ref_clip_intersect_y(ctx->prev.x, ctx->prev.y, x, y, clip_x);
+		ref_clip_append_vertex(ctx, clip_x, yi);
+		break;
+	case REF_PATH_TRANSITION_OUT_TO_IN:
+		yi = ref_clip_intersect_y(ctx->prev.x, ctx->prev.y, x, y, clip_x);
+		ref_clip_append_vertex(ctx, clip_x, yi);
+		ref_clip_append_vertex(ctx, x, y);
+		break;
+	case REF_PATH_TRANSITION_OUT_TO_OUT:
+		/* nothing */
+		break;
+	default:
+		assert(0 && "bad enum ref_path_transition");
+	}
+
+	ctx->prev.x = x;
+	ctx->prev.y = y;
+}
+
+static void
+ref_clip_polygon_topbottom(struct clip_context *ctx,
+			   enum ref_path_transition transition,
+			   float x, float y, float clip_y)
+{
+	float xi;
+
+	switch (transition) {
+	case REF_PATH_TRANSITION_IN_TO_IN:
+		ref_clip_append_vertex(ctx, x, y);
+		break;
+	case REF_PATH_TRANSITION_IN_TO_OUT:
+		xi = ref_clip_intersect_x(ctx->prev.x, ctx->prev.y, x, y, clip_y);
+		ref_clip_append_vertex(ctx, xi, clip_y);
+		break;
+	case REF_PATH_TRANSITION_OUT_TO_IN:
+		xi = ref_clip_intersect_x(ctx->prev.x, ctx->prev.y, x, y, clip_y);
+		ref_clip_append_vertex(ctx, xi, clip_y);
+		ref_clip_append_vertex(ctx, x, y);
+		break;
+	case REF_PATH_TRANSITION_OUT_TO_OUT:
+		/* nothing */
+		break;
+	default:
+		assert(0 && "bad enum ref_path_transition");
+	}
+
+	ctx->prev.x = x;
+	ctx->prev.y = y;
+}
+
+static void
+ref_clip_context_prepare(struct clip_context *ctx, const struct polygon8 *src,
+			 float *dst_x, float *dst_y)
+{
+	ctx->prev.x = src->x[src->n - 1];
+	ctx->prev.y = src->y[src->n - 1];
+	ctx->vertices.x = dst_x;
+	ctx->vertices.y = dst_y;
+}
+
+static int
+ref_clip_polygon_left(struct clip_context *ctx, const struct polygon8 *src,
+		      float *dst_x, float *dst_y)
+{
+	enum ref_path_transition trans;
+	int i;
+
+	ref_clip_context_prepare(ctx, src, dst_x, dst_y);
+	for (i = 0; i < src->n; i++) {
+		trans = ref_path_transition_left_edge(ctx, src->x[i], src->y[i]);
+		ref_clip_polygon_leftright(ctx, trans, src->x[i], src->y[i],
+					   ctx->clip.x1);
+	}
+	return ctx->vertices.x - dst_x;
+}
+
+static int
+ref_clip_polygon_right(struct clip_context *ctx, const struct polygon8 *src,
+		       float *dst_x, float *dst_y)
+{
+	enum ref_path_transition trans;
+	int i;
+
+	ref_clip_context_prepare(ctx, src, dst_x, dst_y);
+	for (i = 0; i < src->n; i++) {
+		trans = ref_path_transition_right_edge(ctx, src->x[i], src->y[i]);
+		ref_clip_polygon_leftright(ctx, trans, src->x[i], src->y[i],
+					   ctx->clip.x2);
+	}
+	return ctx->vertices.x - dst_x;
+}
+
+static int
+ref_clip_polygon_top(struct clip_context *ctx, const struct polygon8 *src,
+		     float *dst_x, float *dst_y)
+{
+	enum ref_path_transition trans;
+	int i;
+
+	ref_clip_context_prepare(ctx, src, dst_x, dst_y);
+	for (i = 0; i < src->n; i++) {
+		trans = ref_path_transition_top_edge(ctx, src->x[i], src->y[i]);
+		ref_clip_polygon_topbottom(ctx, trans, src->x[i], src->y[i],
+					   ctx->clip.y1);
+	}
+	return ctx->vertices.x - dst_x;
+}
+
+static int
+ref_clip_polygon_bottom(struct clip_context *ctx, const struct polygon8 *src,
+			float *dst_x, float *dst_y)
+{
+	enum ref_path_transition trans;
+	int i;
+
+	ref_clip_context_prepare(ctx, src, dst_x, dst_y);
+	for (i = 0; i < src->n; i++) {
+		trans = ref_path_transition_bottom_edge(ctx, src->x[i], src->y[i]);
+		ref_clip_polygon_topbottom(ctx, trans, src->x[i], src->y[i],
+					   ctx->clip.y2);
+	}
+	return ctx->vertices.x - dst_x;
+}
+
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#define min(a, b) (((a) > (b)) ? (b) : (a))
+#define clip(x, a, b)  min(max(x, a), b)
+
+/* calculate_edges() as it was in gl-renderer.c before the clipper moved
+ * to vertex-clipping.c, taking the quad already in global coordinates.
+ */
+static int
+ref_calculate_edges(const struct polygon8 *quad, int transformed,
+		    const pixman_box32_t *rect, float *ex, float *ey)
+{
+	struct polygon8 polygon;
+	struct clip_context ctx;
+	int i, n;
+	float min_x, max_x, min_y, max_y;
+	struct polygon8 surf = *quad;
+
+	ctx.clip.x1 = rect->x1;
+	ctx.clip.y1 = rect->y1;
+	ctx.clip.x2 = rect->x2;
+	ctx.clip.y2 = rect->y2;
+
+	/* find bounding box: */
+	min_x = max_x = surf.x[0];
+	min_y = max_y = surf.y[0];
+
+	for (i = 1; i < surf.n; i++) {
+		min_x = min(min_x, surf.x[i]);
+		max_x = max(max_x, surf.x[i]);
+		min_y = min(min_y, surf.y[i]);
+		max_y = max(max_y, surf.y[i]);
+	}
+
+	/* First, simple bounding box check to discard early transformed
+	 * surface rects that do not intersect with the clip region:
+	 */
+	if ((min_x >= ctx.clip.x2) || (max_x <= ctx.clip.x1) ||
+	    (min_y >= ctx.clip.y2) || (max_y <= ctx.clip.y1))
+		return 0;
+
+	/* Simple case, bounding box edges are parallel to surface edges,
+	 * there will be only four edges.  We just need to clip the surface
+	 * vertices to the clip rect bounds:
+	 */
+	if (!transformed) {
+		for (i = 0; i < surf.n; i++) {
+			ex[i] = clip(surf.x[i], ctx.clip.x1, ctx.clip.x2);
+			ey[i] = clip(surf.y[i], ctx.clip.y1, ctx.clip.y2);
+		}
+		return surf.n;
+	}
+
+	/* Transformed case: use a general polygon clipping algorithm to
+	 * clip the surface rectangle with each side of 'rect'.
+	 * The algorithm is Sutherland-Hodgman, as explained in
+	 * http://www.codeguru.com/cpp/misc/misc/graphics/article.php/c8965/Polygon-Clipping.htm
+	 * but without looking at any of that code.
+	 */
+	polygon.n = ref_clip_polygon_left(&ctx, &surf, polygon.x, polygon.y);
+	surf.n = ref_clip_polygon_right(&ctx, &polygon, surf.x, surf.y);
+	polygon.n = ref_clip_polygon_top(&ctx, &surf, polygon.x, polygon.y);
+	surf.n = ref_clip_polygon_bottom(&ctx, &polygon, surf.x, surf.y);
+
+	/* Get rid of duplicate vertices */
+	ex[0] = surf.x[0];
+	ey[0] = surf.y[0];
+	n = 1;
+	for (i = 1; i < surf.n; i++) {
+		if (ref_float_difference(ex[n - 1], surf.x[i]) == 0.0f &&
+		    ref_float_difference(ey[n - 1], surf.y[i]) == 0.0f)
+			continue;
+		ex[n] = surf.x[i];
+		ey[n] = surf.y[i];
+		n++;
+	}
+	if (ref_float_difference(ex[n - 1], surf.x[0]) == 0.0f &&
+	    ref_float_difference(ey[n - 1], surf.y[0]) == 0.0f)
+		n--;
+
+	if (n < 3)
+		return 0;
+
+	return n;
+}
+
+static void
+reference(const struct polygon8 *quad, int transformed,
+	  const pixman_box32_t *rects, int count, struct polygon8 *out)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		out[i].n = ref_calculate_edges(quad, transformed, &rects[i],
+					       out[i].x, out[i].y);
+}
+
+static struct timespec begin_time;
+
+static void
+reset_timer(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &begin_time);
+}
+
+static double
+read_timer(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (double)(t.tv_sec - begin_time.tv_sec) +
+	       1e-9 * (t.tv_nsec - begin_time.tv_nsec);
+}
+
+/* A grid of rects like a damage region on a 1024x768 output, with
+ * random gaps, so some of them miss the quad, and one rect around half
+ * of the output that sometimes holds all of the quad. */
+static int
+make_rects(pixman_box32_t *rects)
+{
+	int i, n = 0;
+
+	rects[n].x1 = random() % 512 - 256;
+	rects[n].y1 = random() % 384 - 192;
+	rects[n].x2 = rects[n].x1 + 768;
+	rects[n].y2 = rects[n].y1 + 576;
+	n++;
+
+	for (i = 1; i < NRECTS; i++) {
+		if (random() % 4 == 0)
+			continue;
+
+		rects[n].x1 = (i % 8) * 128 + random() % 32;
+		rects[n].y1 = (i / 8) * 96 + random() % 32;
+		rects[n].x2 = rects[n].x1 + 32 + random() % 64;
+		rects[n].y2 = rects[n].y1 + 32 + random() % 48;
+		n++;
+	}
+
+	return n;
+}
+
+static void
+make_quad(struct polygon8 *quad, int transformed)
+{
+	float x = random() % 1024 - 128, y = random() % 768 - 96;
+	float w = 64 + random() % 512, h = 64 + random() % 384;
+	float a, s, c, dx, dy;
+	int i;
+
+	quad->x[0] = x;
+	quad->x[1] = x + w;
+	quad->x[2] = x + w;
+	quad->x[3] = x;
+	quad->y[0] = y;
+	quad->y[1] = y;
+	quad->y[2] = y + h;
+	quad->y[3] = y + h;
+	quad->n = 4;
+
+	if (!transformed)
+		return;
+
+	/* rotate around the center */
+	a = (random() % 3600) * M_PI / 1800.0;
+	s = sinf(a);
+	c = cosf(a);
+	for (i = 0; i < 4; i++) {
+		dx = quad->x[i] - (x + w / 2);
+		dy = quad->y[i] - (y + h / 2);
+		quad->x[i] = x + w / 2 + dx * c - dy * s;
+		quad->y[i] = y + h / 2 + dx * s + dy * c;
+	}
+}
+
+static int
+compare(const struct polygon8 *quad, const pixman_box32_t *rects, int count,
+	const struct polygon8 *a, const struct polygon8 *b)
+{
+	int i, k;
+
+	for (i = 0; i < count; i++) {
+		if (a[i].n == b[i].n &&
+		    memcmp(a[i].x, b[i].x, a[i].n * sizeof a[i].x[0]) == 0 &&
+		    memcmp(a[i].y, b[i].y, a[i].n * sizeof a[i].y[0]) == 0)
+			continue;
+
+		printf("mismatch: rect (%d,%d)-(%d,%d), quad",
+		       rects[i].x1, rects[i].y1, rects[i].x2, rects[i].y2);
+		for (k = 0; k < quad->n; k++)
+			printf(" (%f,%f)", quad->x[k], quad->y[k]);
+		printf("\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+test_identical(int transformed)
+{
+	pixman_box32_t rects[NRECTS];
+	struct polygon8 quad, a[NRECTS], b[NRECTS], ref[NRECTS];
+	int i, n, failed = 0;
+
+	for (i = 0; i < 10000; i++) {
+		n = make_rects(rects);
+		make_quad(&quad, transformed);
+
+		reference(&quad, transformed, rects, n, ref);
+		clip_quad_rects(&quad, transformed, rects, n, a);
+		clip_quad_rects_scalar(&quad, transformed, rects, n, b);
+		if (compare(&quad, rects, n, a, ref) < 0 ||
+		    compare(&quad, rects, n, b, ref) < 0)
+			failed++;
+	}
+
+	return failed;
+}
+
+static void
+benchmark(int transformed)
+{
+	void (*clip[2])(const struct polygon8 *, int,
+			const pixman_box32_t *, int, struct polygon8 *) = {
+		clip_quad_rects_scalar, clip_quad_rects
+	};
+	static const char *names[2] = { "scalar", "vector" };
+	pixman_box32_t rects[NRECTS];
+	struct polygon8 quads[16], out[NRECTS];
+	unsigned long count;
+	double t;
+	int i, j, n;
+
+	n = make_rects(rects);
+	for (i = 0; i < 16; i++)
+		make_quad(&quads[i], transformed);
+
+	for (j = 0; j < 2; j++) {
+		printf("\nRunning 3 s test on %s %s clipping...\n",
+		       names[j], transformed ? "transformed" : "simple");
+
+		count = 0;
+		reset_timer();
+		while ((t = read_timer()) < 3.0) {
+			for (i = 0; i < 16; i++)
+				clip[j](&quads[i], transformed, rects, n, out);
+			count += 16;
+		}
+
+		printf("%lu quads of %d rects in %f seconds, "
+		       "avg. %.1f ns/rect.\n", count, n, t, 1e9 * t / count / n);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int failed;
+
+	srandom(0);
+
+	failed = test_identical(0) + test_identical(1);
+	printf("%d mismatches against the reference clipper\n", failed);
+
+	if (argc > 1 && strcmp(argv[1], "--benchmark") == 0) {
+		benchmark(0);
+		benchmark(1);
+	}
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
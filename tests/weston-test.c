@@ -80,8 +80,8 @@ test_surface_configure(struct weston_surface *surface, int32_t sx, int32_t sy, i
 	struct weston_test *test = test_surface->test;
 
 	if (wl_list_empty(&surface->layer_link))
-		wl_list_insert(&test->layer.surface_list,
-			       &surface->layer_link);
+		weston_layer_entry_insert(&test->layer.surface_list,
+					  surface);
 
 	weston_surface_configure(surface, test_surface->x, test_surface->y,
 				 width, height);
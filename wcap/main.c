@@ -30,18 +30,19 @@
 #include <unistd.h>
 #include <string.h>
 #include <fcntl.h>
-#include <assert.h>
+#include <pthread.h>
 
 #include <cairo.h>
 
 #include "wcap-decode.h"
+#include "wcap-yuv.h"
 
 static void
-write_png(struct wcap_decoder *decoder, const char *filename)
+write_png(struct wcap_decoder *decoder, uint32_t *frame, const char *filename)
 {
 	cairo_surface_t *surface;
 
-	surface = cairo_image_surface_create_for_data((unsigned char *) decoder->frame,
+	surface = cairo_image_surface_create_for_data((unsigned char *) frame,
 						      CAIRO_FORMAT_ARGB32,
 						      decoder->width,
 						      decoder->height,
@@ -50,142 +51,214 @@ write_png(struct wcap_decoder *decoder, const char *filename)
 	cairo_surface_destroy(surface);
 }
 
-static inline int
-rgb_to_yuv(uint32_t format, uint32_t p, int *u, int *v)
+/* Decoding has to happen in order, but the frames that come out of it
+ * can be converted and written as png independently. The main thread
+ * decodes and hands copies of the frames to a pool of workers through
+ * a ring of jobs, and writes out the converted yuv4mpeg2 frames in
+ * order as they complete. */
+
+enum job_state {
+	JOB_FREE,
+	JOB_QUEUED,
+	JOB_DONE
+};
+
+struct job {
+	enum job_state state;
+	int png;		/* frame number to write as png, or -1 */
+	uint32_t *frame;
+	unsigned char *yuv;
+};
+
+struct pipeline {
+	struct wcap_decoder *decoder;
+	int yuv4mpeg2;
+	int yuv_size;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_t *threads;
+	int nthreads;
+	struct job *jobs;
+	int njobs;
+	int submitted;		/* jobs handed out by the main thread */
+	int taken;		/* jobs taken by the workers */
+	int written;		/* jobs written out by the main thread */
+	int quit;
+};
+
+static void
+run_job(struct pipeline *pipeline, struct job *job)
 {
-	int r, g, b, y;
-
-	switch (format) {
-	case WCAP_FORMAT_XRGB8888:
-		r = (p >> 16) & 0xff;
-		g = (p >> 8) & 0xff;
-		b = (p >> 0) & 0xff;
-		break;
-	case WCAP_FORMAT_XBGR8888:
-		r = (p >> 0) & 0xff;
-		g = (p >> 8) & 0xff;
-		b = (p >> 16) & 0xff;
-		break;
-	default:
-		assert(0);
+	struct wcap_decoder *decoder = pipeline->decoder;
+	char filename[200];
+
+	if (job->png >= 0) {
+		snprintf(filename, sizeof filename,
+			 "wcap-frame-%d.png", job->png);
+		write_png(decoder, job->frame, filename);
+		fprintf(stderr, "wrote %s\n", filename);
 	}
 
-	y = (19595 * r + 38469 * g + 7472 * b) >> 16;
-	if (y > 255)
-		y = 255;
+	if (pipeline->yuv4mpeg2 == 444)
+		wcap_convert_to_yuv444(job->frame, decoder->width,
+				       decoder->height, decoder->format,
+				       job->yuv);
+	else if (pipeline->yuv4mpeg2)
+		wcap_convert_to_yv12(job->frame, decoder->width,
+				     decoder->height, decoder->format,
+				     job->yuv);
+}
+
+static void *
+worker_thread(void *data)
+{
+	struct pipeline *pipeline = data;
+	struct job *job;
+
+	pthread_mutex_lock(&pipeline->mutex);
+	for (;;) {
+		while (!pipeline->quit &&
+		       pipeline->taken == pipeline->submitted)
+			pthread_cond_wait(&pipeline->cond, &pipeline->mutex);
+		if (pipeline->taken == pipeline->submitted)
+			break;
+
+		job = &pipeline->jobs[pipeline->taken % pipeline->njobs];
+		pipeline->taken++;
+		pthread_mutex_unlock(&pipeline->mutex);
+
+		run_job(pipeline, job);
 
-	*u += 46727 * (r - y);
-	*v += 36962 * (b - y);
+		pthread_mutex_lock(&pipeline->mutex);
+		job->state = JOB_DONE;
+		pthread_cond_broadcast(&pipeline->cond);
+	}
+	pthread_mutex_unlock(&pipeline->mutex);
 
-	return y;
+	return NULL;
 }
 
-static inline
-int clamp_uv(int u)
+static int
+pipeline_init(struct pipeline *pipeline, struct wcap_decoder *decoder,
+	      int yuv4mpeg2, int nthreads)
 {
-	int clamp = (u >> 18) + 128;
+	int i, frame_size;
 
-	if (clamp < 0)
-		return 0;
-	else if (clamp > 255)
-		return 255;
+	memset(pipeline, 0, sizeof *pipeline);
+	pipeline->decoder = decoder;
+	pipeline->yuv4mpeg2 = yuv4mpeg2;
+	if (yuv4mpeg2 == 444)
+		pipeline->yuv_size = decoder->width * decoder->height * 3;
 	else
-		return clamp;
+		pipeline->yuv_size = decoder->width * decoder->height * 3 / 2;
+	pthread_mutex_init(&pipeline->mutex, NULL);
+	pthread_cond_init(&pipeline->cond, NULL);
+
+	/* The main thread converts frames itself if there are no
+	 * workers. Otherwise, two jobs per worker keep them busy while
+	 * the main thread decodes or waits to write. */
+	pipeline->nthreads = nthreads > 1 ? nthreads : 0;
+	pipeline->njobs = pipeline->nthreads > 0 ? 2 * pipeline->nthreads : 1;
+
+	frame_size = decoder->width * decoder->height * 4;
+	pipeline->jobs = calloc(pipeline->njobs, sizeof *pipeline->jobs);
+	if (pipeline->jobs == NULL)
+		return -1;
+	for (i = 0; i < pipeline->njobs; i++) {
+		pipeline->jobs[i].frame = malloc(frame_size);
+		pipeline->jobs[i].yuv = malloc(pipeline->yuv_size);
+		if (!pipeline->jobs[i].frame || !pipeline->jobs[i].yuv)
+			return -1;
+	}
+
+	pipeline->threads = calloc(pipeline->nthreads + 1,
+				   sizeof *pipeline->threads);
+	if (pipeline->threads == NULL)
+		return -1;
+	for (i = 0; i < pipeline->nthreads; i++)
+		if (pthread_create(&pipeline->threads[i], NULL,
+				   worker_thread, pipeline) != 0)
+			break;
+	pipeline->nthreads = i;
+
+	return 0;
 }
 
+/* Waits for the oldest job to complete and writes it out. */
 static void
-convert_to_yv12(struct wcap_decoder *decoder, unsigned char *out)
+pipeline_write(struct pipeline *pipeline)
 {
-	unsigned char *y1, *y2, *u, *v;
-	uint32_t *p1, *p2, *end;
-	int i, u_accum, v_accum, stride0, stride1;
-	uint32_t format = decoder->format;
-
-	stride0 = decoder->width;
-	stride1 = decoder->width / 2;
-	for (i = 0; i < decoder->height; i += 2) {
-		y1 = out + stride0 * i;
-		y2 = y1 + stride0;
-		v = out + stride0 * decoder->height + stride1 * i / 2;
-		u = v + stride1 * decoder->height / 2;
-		p1 = decoder->frame + decoder->width * i;
-		p2 = p1 + decoder->width;
-		end = p1 + decoder->width;
-
-		while (p1 < end) {
-			u_accum = 0;
-			v_accum = 0;
-			y1[0] = rgb_to_yuv(format, p1[0], &u_accum, &v_accum);
-			y1[1] = rgb_to_yuv(format, p1[1], &u_accum, &v_accum);
-			y2[0] = rgb_to_yuv(format, p2[0], &u_accum, &v_accum);
-			y2[1] = rgb_to_yuv(format, p2[1], &u_accum, &v_accum);
-			u[0] = clamp_uv(u_accum);
-			v[0] = clamp_uv(v_accum);
-
-			y1 += 2;
-			p1 += 2;
-			y2 += 2;
-			p2 += 2;
-			u++;
-			v++;
-		}
+	struct job *job = &pipeline->jobs[pipeline->written % pipeline->njobs];
+
+	pthread_mutex_lock(&pipeline->mutex);
+	while (job->state != JOB_DONE)
+		pthread_cond_wait(&pipeline->cond, &pipeline->mutex);
+	pthread_mutex_unlock(&pipeline->mutex);
+
+	if (pipeline->yuv4mpeg2) {
+		printf("FRAME\n");
+		fwrite(job->yuv, 1, pipeline->yuv_size, stdout);
 	}
+
+	job->state = JOB_FREE;
+	pipeline->written++;
 }
 
 static void
-convert_to_yuv444(struct wcap_decoder *decoder, unsigned char *out)
+pipeline_submit(struct pipeline *pipeline, int png)
 {
-
-	unsigned char *yp, *up, *vp;
-	uint32_t *rp, *end;
-	int u, v;
-	int i, stride, psize;
-	uint32_t format = decoder->format;
-
-	stride = decoder->width;
-	psize = stride * decoder->height;
-	for (i = 0; i < decoder->height; i++) {
-		yp = out + stride * i;
-		up = yp + (psize * 2);
-		vp = yp + (psize * 1);
-		rp = decoder->frame + decoder->width * i;
-		end = rp + decoder->width;	
-		while (rp < end) {
-			u = 0;
-			v = 0;
-			yp[0] = rgb_to_yuv(format, rp[0], &u, &v);
-			up[0] = clamp_uv(u/.3);
-			vp[0] = clamp_uv(v/.3);
-			up++;
-			vp++;
-			yp++;
-			rp++;
-		}
+	struct wcap_decoder *decoder = pipeline->decoder;
+	struct job *job;
+
+	while (pipeline->submitted - pipeline->written >= pipeline->njobs)
+		pipeline_write(pipeline);
+
+	job = &pipeline->jobs[pipeline->submitted % pipeline->njobs];
+	memcpy(job->frame, decoder->frame,
+	       decoder->width * decoder->height * 4);
+	job->png = png;
+
+	if (pipeline->nthreads == 0) {
+		run_job(pipeline, job);
+		job->state = JOB_DONE;
+		pipeline->submitted++;
+		return;
 	}
+
+	pthread_mutex_lock(&pipeline->mutex);
+	job->state = JOB_QUEUED;
+	pipeline->submitted++;
+	pthread_cond_broadcast(&pipeline->cond);
+	pthread_mutex_unlock(&pipeline->mutex);
 }
 
 static void
-output_yuv_frame(struct wcap_decoder *decoder, int depth)
+pipeline_finish(struct pipeline *pipeline)
 {
-	static unsigned char *out;
-	int size;
+	int i;
 
-	if (depth == 444) {
-		size = decoder->width * decoder->height * 3;
-	} else {
-		size = decoder->width * decoder->height * 3 / 2;
-	}
-	if (out == NULL)
-		out = malloc(size);
+	while (pipeline->written < pipeline->submitted)
+		pipeline_write(pipeline);
 
-	if (depth == 444) {
-		convert_to_yuv444(decoder, out);
-	} else {
-		convert_to_yv12(decoder, out);
-	}
+	pthread_mutex_lock(&pipeline->mutex);
+	pipeline->quit = 1;
+	pthread_cond_broadcast(&pipeline->cond);
+	pthread_mutex_unlock(&pipeline->mutex);
+
+	for (i = 0; i < pipeline->nthreads; i++)
+		pthread_join(pipeline->threads[i], NULL);
 
-	printf("FRAME\n");
-	fwrite(out, 1, size, stdout);
+	if (pipeline->jobs) {
+		for (i = 0; i < pipeline->njobs; i++) {
+			free(pipeline->jobs[i].frame);
+			free(pipeline->jobs[i].yuv);
+		}
+	}
+	free(pipeline->jobs);
+	free(pipeline->threads);
+	pthread_cond_destroy(&pipeline->cond);
+	pthread_mutex_destroy(&pipeline->mutex);
 }
 
 static void
@@ -193,14 +266,19 @@ usage(int exit_code)
 {
 	fprintf(stderr, "usage: wcap-decode "
 		"[--help] [--yuv4mpeg2] [--frame=<frame>] [--all] \n"
-		"\t[--rate=<num:denom>] <wcap file>\n\n"
+		"\t[--rate=<num:denom>] [--start=<msecs>] [--threads=<n>]\n"
+		"\t<wcap file>\n\n"
 		"\t--help\t\t\tthis help text\n"
 		"\t--yuv4mpeg2\t\tdump wcap file to stdout in yuv4mpeg2 format\n"
 		"\t--yuv4mpeg2-444\t\tdump wcap file to stdout in yuv4mpeg2 444 format\n"
 		"\t--frame=<frame>\t\twrite out the given frame number as png\n"
 		"\t--all\t\t\twrite all frames as pngs\n"
 		"\t--rate=<num:denom>\treplay frame rate for yuv4mpeg2,\n"
-		"\t\t\t\tspecified as an integer fraction\n\n");
+		"\t\t\t\tspecified as an integer fraction\n"
+		"\t--start=<msecs>\t\tstart this far into the recording,\n"
+		"\t\t\t\tframes are counted from there\n"
+		"\t--threads=<n>\t\tconvert and write frames on n threads,\n"
+		"\t\t\t\tdefaults to one per CPU\n\n");
 
 	exit(exit_code);
 }
@@ -208,11 +286,11 @@ usage(int exit_code)
 int main(int argc, char *argv[])
 {
 	struct wcap_decoder *decoder;
+	struct pipeline pipeline;
 	int i, j, output_frame = -1, yuv4mpeg2 = 0, all = 0, has_frame;
-	int num = 30, denom = 1;
-	char filename[200];
+	int num = 30, denom = 1, start = -1, threads = 0;
 	char *mode;
-	uint32_t msecs, frame_time, *frame, frame_size;
+	uint32_t msecs, frame_time;
 
 	for (i = 1, j = 1; i < argc; i++) {
 		if (strcmp(argv[i], "--yuv4mpeg2-444") == 0) {
@@ -229,6 +307,10 @@ int main(int argc, char *argv[])
 			;
 		} else if (sscanf(argv[i], "--rate=%d:%d", &num, &denom) == 2) {
 			;
+		} else if (sscanf(argv[i], "--start=%d", &start) == 1) {
+			;
+		} else if (sscanf(argv[i], "--threads=%d", &threads) == 1) {
+			;
 		} else if (strcmp(argv[i], "--") == 0) {
 			break;
 		} else if (argv[i][0] == '-') {
@@ -248,6 +330,9 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
+	if (threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+
 	decoder = wcap_decoder_create(argv[1]);
 
 	if (yuv4mpeg2 && isatty(1)) {
@@ -270,29 +355,33 @@ int main(int argc, char *argv[])
 		fflush(stdout);
 	}
 
+	if (pipeline_init(&pipeline, decoder, yuv4mpeg2, threads) < 0) {
+		fprintf(stderr, "failed to allocate frames\n");
+		exit(EXIT_FAILURE);
+	}
+
 	i = 0;
-	has_frame = wcap_decoder_get_frame(decoder);
-	msecs = decoder->msecs;
+	if (start >= 0) {
+		msecs = decoder->start_msecs + start;
+		has_frame = wcap_decoder_seek(decoder, msecs);
+	} else {
+		has_frame = wcap_decoder_get_frame(decoder);
+		msecs = decoder->msecs;
+	}
 	frame_time = 1000 * denom / num;
-	frame_size = decoder->width * decoder->height * 4;
-	frame = malloc(frame_size);
 	while (has_frame) {
-		if (decoder->msecs >= msecs)
-			memcpy(frame, decoder->frame, frame_size);
-		if (all || i == output_frame) {
-			snprintf(filename, sizeof filename,
-				 "wcap-frame-%d.png", i);
-			write_png(decoder, filename);
-			fprintf(stderr, "wrote %s\n", filename);
-		}
-		if (yuv4mpeg2)
-			output_yuv_frame(decoder, yuv4mpeg2);
+		if (all || i == output_frame)
+			pipeline_submit(&pipeline, i);
+		else if (yuv4mpeg2)
+			pipeline_submit(&pipeline, -1);
 		i++;
 		msecs += frame_time;
 		while (decoder->msecs < msecs && has_frame)
 			has_frame = wcap_decoder_get_frame(decoder);
 	}
 
+	pipeline_finish(&pipeline);
+
 	fprintf(stderr, "wcap file: size %dx%d, %d frames\n",
 		decoder->width, decoder->height, i);
 
@@ -0,0 +1,246 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "wcap-decode.h"
+#include "wcap-codec.h"
+#include "wcap-yuv.h"
+
+/* Replays a recording through the vector and the scalar codec and
+ * reports the throughput of each, in MB of frame pixels per second.
+ * The recording itself is the reference: decoding both ways must give
+ * the same frames, and encoding the decoded frames again, both ways,
+ * must give back the runs in the file byte for byte. Each decoded
+ * frame is also converted to yv12 both ways, which must agree. */
+
+struct codec {
+	const char *name;
+	uint32_t *(*encode)(uint32_t *out, const uint32_t *pixels,
+			    uint32_t *frame, int stride,
+			    const struct wcap_rectangle *rect, int yflip);
+	const uint32_t *(*decode)(uint32_t *frame, int stride,
+				  const struct wcap_rectangle *rect,
+				  const uint32_t *p, int *decoded);
+	void (*yv12)(const uint32_t *frame, int width, int height,
+		     uint32_t format, unsigned char *out);
+	uint32_t *frame;	/* decoder state */
+	uint32_t *previous;	/* encoder state */
+	unsigned char *yuv;
+	double decode_time, encode_time, yv12_time;
+	int mismatches;
+};
+
+static double
+now(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/* Copies 'rect' out of 'frame' the way the recorder reads it back,
+ * bottom row first. */
+static void
+read_rect(uint32_t *pixels, const uint32_t *frame, int stride,
+	  const struct wcap_rectangle *rect)
+{
+	int width = rect->x2 - rect->x1;
+	int y;
+
+	for (y = rect->y2 - 1; y >= rect->y1; y--) {
+		memcpy(pixels, frame + y * stride + rect->x1, width * 4);
+		pixels += width;
+	}
+}
+
+static int
+replay_frame(struct codec *codec, struct wcap_decoder *decoder,
+	     const struct wcap_frame_header *header,
+	     uint32_t *pixels, uint32_t *out)
+{
+	const struct wcap_rectangle *rects;
+	const uint32_t *p, *q;
+	uint32_t *end, nrects = header->nrects;
+	size_t size = decoder->width * decoder->height * 4;
+	double t;
+	int i, n, count;
+
+	/* Keyframes are coded against a blank frame. */
+	if (decoder->version >= 2 && (nrects & WCAP_FRAME_KEY)) {
+		nrects &= ~WCAP_FRAME_KEY;
+		memset(codec->frame, 0, size);
+		memset(codec->previous, 0, size);
+	}
+
+	rects = (const void *) (header + 1);
+	p = (const uint32_t *) (rects + nrects);
+	for (i = 0; i < (int) nrects; i++) {
+		count = (rects[i].x2 - rects[i].x1) *
+			(rects[i].y2 - rects[i].y1);
+
+		t = now();
+		q = codec->decode(codec->frame, decoder->width,
+				  &rects[i], p, &n);
+		codec->decode_time += now() - t;
+
+		if (n != count) {
+			fprintf(stderr, "frame %d: rle encoding longer than "
+				"expected (%d expected %d)\n",
+				decoder->count, n, count);
+			return -1;
+		}
+
+		read_rect(pixels, codec->frame, decoder->width, &rects[i]);
+		t = now();
+		end = codec->encode(out, pixels, codec->previous,
+				    decoder->width, &rects[i], 1);
+		codec->encode_time += now() - t;
+
+		if (end - out != q - p ||
+		    memcmp(out, p, (q - p) * sizeof *p) != 0)
+			codec->mismatches++;
+
+		p = q;
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct wcap_decoder *decoder;
+	const struct wcap_frame_header *header;
+	const struct wcap_rectangle *rects;
+	struct codec codecs[] = {
+		{ "vector", wcap_encode_rect, wcap_decode_rect,
+		  wcap_convert_to_yv12 },
+		{ "scalar", wcap_encode_rect_scalar, wcap_decode_rect_scalar,
+		  wcap_convert_to_yv12_scalar },
+	};
+	uint32_t *pixels, *out, nrects;
+	double mb = 0, frame_mb = 0, t;
+	size_t size, yuv_size;
+	int i, j, k, rounds = 10, status = 0;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s WCAP_FILE [ROUNDS]\n", argv[0]);
+		return 1;
+	}
+	if (argc > 2)
+		rounds = atoi(argv[2]);
+
+	decoder = wcap_decoder_create(argv[1]);
+	if (decoder == NULL) {
+		fprintf(stderr, "failed to open %s\n", argv[1]);
+		return 1;
+	}
+
+	size = decoder->width * decoder->height * sizeof *pixels;
+	yuv_size = decoder->width * decoder->height * 3 / 2;
+	pixels = malloc(size);
+	out = malloc(size);
+	for (i = 0; i < 2; i++) {
+		codecs[i].frame = malloc(size);
+		codecs[i].previous = malloc(size);
+		codecs[i].yuv = malloc(yuv_size);
+	}
+
+	for (k = 0; k < rounds; k++) {
+		for (i = 0; i < 2; i++) {
+			memset(codecs[i].frame, 0, size);
+			memset(codecs[i].previous, 0, size);
+		}
+
+		decoder->p = (struct wcap_header *) decoder->map + 1;
+		decoder->count = 0;
+		while (decoder->p != decoder->end) {
+			header = decoder->p;
+			rects = (const void *) (header + 1);
+			nrects = header->nrects;
+			if (decoder->version >= 2)
+				nrects &= ~WCAP_FRAME_KEY;
+			for (j = 0; j < (int) nrects; j++)
+				mb += (rects[j].x2 - rects[j].x1) *
+					(rects[j].y2 - rects[j].y1) *
+					4 / (1024.0 * 1024.0);
+
+			for (i = 0; i < 2; i++) {
+				if (replay_frame(&codecs[i], decoder, header,
+						 pixels, out) < 0)
+					return 1;
+
+				t = now();
+				codecs[i].yv12(codecs[i].frame,
+					       decoder->width, decoder->height,
+					       decoder->format, codecs[i].yuv);
+				codecs[i].yv12_time += now() - t;
+			}
+			frame_mb += size / (1024.0 * 1024.0);
+
+			if (memcmp(codecs[0].frame, codecs[1].frame, size)) {
+				fprintf(stderr, "frame %d: vector and scalar "
+					"decoders differ\n", decoder->count);
+				status = 1;
+			} else if (memcmp(codecs[0].yuv, codecs[1].yuv,
+					  yuv_size)) {
+				fprintf(stderr, "frame %d: vector and scalar "
+					"yv12 conversions differ\n",
+					decoder->count);
+				status = 1;
+			}
+
+			/* Skip to the next frame by decoding it once more. */
+			wcap_decoder_get_frame(decoder);
+		}
+	}
+
+	printf("%d frames of %dx%d, %.1f MB of pixels per round\n",
+	       decoder->count, decoder->width, decoder->height,
+	       mb / rounds);
+	for (i = 0; i < 2; i++) {
+		printf("%s: decode %.1f MB/s, encode %.1f MB/s, "
+		       "yv12 %.1f MB/s, %d rects encoded differently\n",
+		       codecs[i].name,
+		       mb / codecs[i].decode_time, mb / codecs[i].encode_time,
+		       frame_mb / codecs[i].yv12_time, codecs[i].mismatches);
+		if (codecs[i].mismatches)
+			status = 1;
+	}
+
+	for (i = 0; i < 2; i++) {
+		free(codecs[i].frame);
+		free(codecs[i].previous);
+		free(codecs[i].yuv);
+	}
+	free(pixels);
+	free(out);
+	wcap_decoder_destroy(decoder);
+
+	return status;
+}
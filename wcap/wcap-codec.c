@@ -0,0 +1,356 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#include "wcap-codec.h"
+
+/* A wcap rectangle is a list of runs, each a 24 bit per component
+ * delta against the previous frame in the low bits and a length in the
+ * top byte. Lengths up to 0xe0 are stored as length - 1, longer runs
+ * as 0xe0 + n for 1 << (n + 7) pixels, split up as needed. */
+
+static uint32_t *
+output_run(uint32_t *p, uint32_t delta, int run)
+{
+	int i;
+
+	while (run > 0) {
+		if (run <= 0xe0) {
+			*p++ = delta | ((run - 1) << 24);
+			break;
+		}
+
+		i = 24 - __builtin_clz(run);
+		*p++ = delta | ((i + 0xe0) << 24);
+		run -= 1 << (7 + i);
+	}
+
+	return p;
+}
+
+static uint32_t
+component_delta(uint32_t next, uint32_t prev)
+{
+	unsigned char dr, dg, db;
+
+	dr = (next >> 16) - (prev >> 16);
+	dg = (next >>  8) - (prev >>  8);
+	db = (next >>  0) - (prev >>  0);
+
+	return (dr << 16) | (dg << 8) | (db << 0);
+}
+
+static uint32_t
+component_add(uint32_t prev, uint32_t delta)
+{
+	unsigned char r, g, b;
+
+	r = (prev >> 16) + (delta >> 16);
+	g = (prev >>  8) + (delta >>  8);
+	b = (prev >>  0) + (delta >>  0);
+
+	return 0xff000000 | (r << 16) | (g << 8) | b;
+}
+
+struct encoder {
+	uint32_t *p;
+	uint32_t prev;
+	int run;
+};
+
+static inline void
+encode_pixel(struct encoder *e, uint32_t delta)
+{
+	if (e->run == 0 || delta == e->prev) {
+		e->run++;
+	} else {
+		e->p = output_run(e->p, e->prev, e->run);
+		e->run = 1;
+	}
+	e->prev = delta;
+}
+
+static void
+encode_span_scalar(struct encoder *e, const uint32_t *s, uint32_t *d, int n)
+{
+	uint32_t next;
+	int k;
+
+	for (k = 0; k < n; k++) {
+		next = s[k];
+		encode_pixel(e, component_delta(next, d[k]));
+		d[k] = next;
+	}
+}
+
+static void
+decode_span_scalar(uint32_t *d, uint32_t delta, int n)
+{
+	int k;
+
+	for (k = 0; k < n; k++)
+		d[k] = component_add(d[k], delta);
+}
+
+/* The vector versions take four pixels at a time. Bytewise wrapping
+ * subtraction and addition with the alpha byte masked off gives the
+ * same deltas as the per component code. While four deltas all extend
+ * the current run, the encoder only bumps its length, which is the
+ * common case of unchanged or evenly changed areas. */
+
+#if defined(__SSE2__)
+
+static void
+encode_span(struct encoder *e, const uint32_t *s, uint32_t *d, int n)
+{
+	const __m128i rgb = _mm_set1_epi32(0x00ffffff);
+	__m128i next, delta;
+	uint32_t deltas[4];
+	int k, l;
+
+	for (k = 0; k + 4 <= n; k += 4) {
+		next = _mm_loadu_si128((const __m128i *) &s[k]);
+		delta = _mm_sub_epi8(next,
+				     _mm_loadu_si128((const __m128i *) &d[k]));
+		delta = _mm_and_si128(delta, rgb);
+		_mm_storeu_si128((__m128i *) &d[k], next);
+
+		if (e->run > 0 &&
+		    _mm_movemask_epi8(_mm_cmpeq_epi32(delta,
+			    _mm_set1_epi32(e->prev))) == 0xffff) {
+			e->run += 4;
+			continue;
+		}
+
+		_mm_storeu_si128((__m128i *) deltas, delta);
+		for (l = 0; l < 4; l++)
+			encode_pixel(e, deltas[l]);
+	}
+
+	encode_span_scalar(e, s + k, d + k, n - k);
+}
+
+static void
+decode_span(uint32_t *d, uint32_t delta, int n)
+{
+	const __m128i alpha = _mm_set1_epi32(0xff000000);
+	__m128i v;
+	int k;
+
+	if (n < 4) {
+		decode_span_scalar(d, delta, n);
+		return;
+	}
+
+	v = _mm_set1_epi32(delta);
+	for (k = 0; k + 4 <= n; k += 4)
+		_mm_storeu_si128((__m128i *) &d[k],
+			_mm_or_si128(_mm_add_epi8(
+				_mm_loadu_si128((const __m128i *) &d[k]), v),
+				alpha));
+
+	decode_span_scalar(d + k, delta, n - k);
+}
+
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+static void
+encode_span(struct encoder *e, const uint32_t *s, uint32_t *d, int n)
+{
+	const uint32x4_t rgb = vdupq_n_u32(0x00ffffff);
+	uint32x4_t next, delta, eq;
+	uint32x2_t all;
+	uint32_t deltas[4];
+	int k, l;
+
+	for (k = 0; k + 4 <= n; k += 4) {
+		next = vld1q_u32(&s[k]);
+		delta = vreinterpretq_u32_u8(
+			vsubq_u8(vreinterpretq_u8_u32(next),
+				 vreinterpretq_u8_u32(vld1q_u32(&d[k]))));
+		delta = vandq_u32(delta, rgb);
+		vst1q_u32(&d[k], next);
+
+		if (e->run > 0) {
+			eq = vceqq_u32(delta, vdupq_n_u32(e->prev));
+			all = vand_u32(vget_low_u32(eq), vget_high_u32(eq));
+			if (vget_lane_u32(all, 0) & vget_lane_u32(all, 1)) {
+				e->run += 4;
+				continue;
+			}
+		}
+
+		vst1q_u32(deltas, delta);
+		for (l = 0; l < 4; l++)
+			encode_pixel(e, deltas[l]);
+	}
+
+	encode_span_scalar(e, s + k, d + k, n - k);
+}
+
+static void
+decode_span(uint32_t *d, uint32_t delta, int n)
+{
+	const uint32x4_t alpha = vdupq_n_u32(0xff000000);
+	uint8x16_t v;
+	int k;
+
+	if (n < 4) {
+		decode_span_scalar(d, delta, n);
+		return;
+	}
+
+	v = vreinterpretq_u8_u32(vdupq_n_u32(delta));
+	for (k = 0; k + 4 <= n; k += 4)
+		vst1q_u32(&d[k],
+			  vorrq_u32(vreinterpretq_u32_u8(
+				vaddq_u8(vreinterpretq_u8_u32(vld1q_u32(&d[k])),
+					 v)),
+				    alpha));
+
+	decode_span_scalar(d + k, delta, n - k);
+}
+
+#else
+
+#define encode_span encode_span_scalar
+#define decode_span decode_span_scalar
+
+#endif
+
+typedef void (*encode_span_func_t)(struct encoder *e, const uint32_t *s,
+				   uint32_t *d, int n);
+typedef void (*decode_span_func_t)(uint32_t *d, uint32_t delta, int n);
+
+static inline uint32_t *
+encode_rect(uint32_t *out, const uint32_t *pixels, uint32_t *frame,
+	    int stride, const struct wcap_rectangle *rect, int yflip,
+	    encode_span_func_t span)
+{
+	struct encoder e = { out, 0, 0 };
+	int width = rect->x2 - rect->x1;
+	int height = rect->y2 - rect->y1;
+	int j, y;
+
+	for (j = 0; j < height; j++) {
+		y = yflip ? rect->y2 - j - 1 : rect->y1 + j;
+		span(&e, pixels + j * width,
+		     frame + stride * y + rect->x1, width);
+	}
+
+	return output_run(e.p, e.prev, e.run);
+}
+
+/* Encodes 'rect' into 'out' and returns the end of the runs. 'pixels'
+ * holds the new contents of the rectangle, bottom row first if 'yflip'
+ * is set, and 'frame' the previous contents of the whole frame. It is
+ * updated with the new contents. 'out' needs room for as many runs as
+ * the rectangle has pixels. */
+uint32_t *
+wcap_encode_rect(uint32_t *out, const uint32_t *pixels,
+		 uint32_t *frame, int stride,
+		 const struct wcap_rectangle *rect, int yflip)
+{
+	return encode_rect(out, pixels, frame, stride, rect, yflip,
+			   encode_span);
+}
+
+uint32_t *
+wcap_encode_rect_scalar(uint32_t *out, const uint32_t *pixels,
+			uint32_t *frame, int stride,
+			const struct wcap_rectangle *rect, int yflip)
+{
+	return encode_rect(out, pixels, frame, stride, rect, yflip,
+			   encode_span_scalar);
+}
+
+static inline const uint32_t *
+decode_rect(uint32_t *frame, int stride, const struct wcap_rectangle *rect,
+	    const uint32_t *p, int *decoded, decode_span_func_t span)
+{
+	uint32_t v, delta, *d;
+	int width = rect->x2 - rect->x1;
+	int count = width * (rect->y2 - rect->y1);
+	int i, j, l, m, x;
+
+	d = frame + (rect->y2 - 1) * stride;
+	x = rect->x1;
+	i = 0;
+	while (i < count) {
+		v = *p++;
+		l = v >> 24;
+		if (l < 0xe0)
+			j = l + 1;
+		else
+			j = 1 << (l - 0xe0 + 7);
+		delta = v & 0xffffff;
+
+		/* Runs are split at the end of each row, and anything
+		 * past the end of the rectangle is dropped. */
+		l = j > count - i ? count - i : j;
+		i += j;
+		while (l > 0) {
+			m = rect->x2 - x;
+			if (m > l)
+				m = l;
+			span(d + x, delta, m);
+			x += m;
+			l -= m;
+			if (x == rect->x2) {
+				x = rect->x1;
+				d -= stride;
+			}
+		}
+	}
+
+	if (decoded)
+		*decoded = i;
+
+	return p;
+}
+
+/* Applies the runs at 'p' to 'rect' of 'frame', bottom row first, and
+ * returns the end of them. The number of pixels the runs covered is
+ * returned in 'decoded', which should match the area of 'rect'. */
+const uint32_t *
+wcap_decode_rect(uint32_t *frame, int stride,
+		 const struct wcap_rectangle *rect, const uint32_t *p,
+		 int *decoded)
+{
+	return decode_rect(frame, stride, rect, p, decoded, decode_span);
+}
+
+const uint32_t *
+wcap_decode_rect_scalar(uint32_t *frame, int stride,
+			const struct wcap_rectangle *rect, const uint32_t *p,
+			int *decoded)
+{
+	return decode_rect(frame, stride, rect, p, decoded,
+			   decode_span_scalar);
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _WCAP_CODEC_
+#define _WCAP_CODEC_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "wcap-decode.h"
+
+/* Delta and run length coding of one rectangle of a wcap frame, shared
+ * by the recorder in weston and the decoder. The plain versions use
+ * SSE2 or NEON where available, the _scalar ones are the reference. */
+
+uint32_t *
+wcap_encode_rect(uint32_t *out, const uint32_t *pixels,
+		 uint32_t *frame, int stride,
+		 const struct wcap_rectangle *rect, int yflip);
+
+uint32_t *
+wcap_encode_rect_scalar(uint32_t *out, const uint32_t *pixels,
+			uint32_t *frame, int stride,
+			const struct wcap_rectangle *rect, int yflip);
+
+const uint32_t *
+wcap_decode_rect(uint32_t *frame, int stride,
+		 const struct wcap_rectangle *rect, const uint32_t *p,
+		 int *decoded);
+
+const uint32_t *
+wcap_decode_rect_scalar(uint32_t *frame, int stride,
+			const struct wcap_rectangle *rect, const uint32_t *p,
+			int *decoded);
+
+#endif
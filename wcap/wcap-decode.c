@@ -34,50 +34,21 @@
 #include <cairo.h>
 
 #include "wcap-decode.h"
+#include "wcap-codec.h"
 
 static void
 wcap_decoder_decode_rectangle(struct wcap_decoder *decoder,
 			      struct wcap_rectangle *rect)
 {
-	uint32_t v, *p = decoder->p, *d;
 	int width = rect->x2 - rect->x1, height = rect->y2 - rect->y1;
-	int x, i, j, k, l, count = width * height;
-	unsigned char r, g, b, dr, dg, db;
-
-	d = decoder->frame + (rect->y2 - 1) * decoder->width;
-	x = rect->x1;
-	i = 0;
-	while (i < count) {
-		v = *p++;
-		l = v >> 24;
-		if (l < 0xe0) {
-			j = l + 1;
-		} else {
-			j = 1 << (l - 0xe0 + 7);
-		}
+	int count = width * height, i;
 
-		dr = (v >> 16);
-		dg = (v >>  8);
-		db = (v >>  0);
-		for (k = 0; k < j; k++) {
-			r = (d[x] >> 16) + dr;
-			g = (d[x] >>  8) + dg;
-			b = (d[x] >>  0) + db;
-			d[x] = 0xff000000 | (r << 16) | (g << 8) | b;
-			x++;
-			if (x == rect->x2) {
-				x = rect->x1;
-				d -= decoder->width;
-			}
-		}
-		i += j;
-	}
+	decoder->p = (void *) wcap_decode_rect(decoder->frame, decoder->width,
+					       rect, decoder->p, &i);
 
 	if (i != count)
 		printf("rle encoding longer than expected (%d expected %d)\n",
 		       i, count);
-
-	decoder->p = p;
 }
 
 int
@@ -85,7 +56,7 @@ wcap_decoder_get_frame(struct wcap_decoder *decoder)
 {
 	struct wcap_rectangle *rects;
 	struct wcap_frame_header *header;
-	uint32_t i;
+	uint32_t i, nrects;
 
 	if (decoder->p == decoder->end)
 		return 0;
@@ -94,19 +65,93 @@ wcap_decoder_get_frame(struct wcap_decoder *decoder)
 	decoder->msecs = header->msecs;
 	decoder->count++;
 
+	nrects = header->nrects;
+	if (decoder->version >= 2 && (nrects & WCAP_FRAME_KEY)) {
+		nrects &= ~WCAP_FRAME_KEY;
+		memset(decoder->frame, 0,
+		       decoder->width * decoder->height * 4);
+	}
+
 	rects = (void *) (header + 1);
-	decoder->p = (uint32_t *) (rects + header->nrects);
-	for (i = 0; i < header->nrects; i++)
+	decoder->p = (uint32_t *) (rects + nrects);
+	for (i = 0; i < nrects; i++)
 		wcap_decoder_decode_rectangle(decoder, &rects[i]);
 
 	return 1;
 }
 
+static void
+wcap_decoder_rewind(struct wcap_decoder *decoder,
+		    const struct wcap_index_entry *entry)
+{
+	struct wcap_header *header = decoder->map;
+
+	if (entry) {
+		decoder->p = (char *) decoder->map + WCAP_OFFSET(entry);
+		decoder->count = entry->frame;
+	} else {
+		decoder->p = header + 1;
+		decoder->count = 0;
+		memset(decoder->frame, 0,
+		       decoder->width * decoder->height * 4);
+	}
+}
+
+/* Decodes up to the last frame at or before 'msecs', or the first frame
+ * if they are all later. With an index, decoding starts from the
+ * closest keyframe before that, otherwise from the current frame if it
+ * is not past 'msecs' yet, or else the start of the file. Returns 0 if
+ * there are no frames. */
+int
+wcap_decoder_seek(struct wcap_decoder *decoder, uint32_t msecs)
+{
+	const struct wcap_index_entry *entry = NULL;
+	struct wcap_frame_header *next;
+	uint32_t lo, hi, mid;
+
+	if (decoder->index_count > 0) {
+		/* Find the last keyframe at or before msecs. */
+		lo = 0;
+		hi = decoder->index_count;
+		while (hi - lo > 1) {
+			mid = lo + (hi - lo) / 2;
+			if (decoder->index[mid].msecs <= msecs)
+				lo = mid;
+			else
+				hi = mid;
+		}
+		entry = &decoder->index[lo];
+
+		/* No need to go back if we're already past it. */
+		if (decoder->count > entry->frame && decoder->msecs <= msecs)
+			entry = NULL;
+		else
+			wcap_decoder_rewind(decoder, entry);
+	} else if (decoder->count == 0 || decoder->msecs > msecs) {
+		wcap_decoder_rewind(decoder, NULL);
+	}
+
+	if (decoder->count == 0 || entry)
+		if (!wcap_decoder_get_frame(decoder))
+			return 0;
+
+	while (decoder->p != decoder->end) {
+		next = decoder->p;
+		if (next->msecs > msecs)
+			break;
+		wcap_decoder_get_frame(decoder);
+	}
+
+	return 1;
+}
+
 struct wcap_decoder *
 wcap_decoder_create(const char *filename)
 {
 	struct wcap_decoder *decoder;
 	struct wcap_header *header;
+	struct wcap_index_trailer *trailer;
+	uint64_t offset;
 	int frame_size;
 	struct stat buf;
 
@@ -126,12 +171,39 @@ wcap_decoder_create(const char *filename)
 			    PROT_READ, MAP_PRIVATE, decoder->fd, 0);
 		
 	header = decoder->map;
+	decoder->version = header->magic == WCAP_HEADER_MAGIC_V2 ? 2 : 1;
 	decoder->format = header->format;
 	decoder->count = 0;
+	decoder->msecs = 0;
 	decoder->width = header->width;
 	decoder->height = header->height;
 	decoder->p = header + 1;
 	decoder->end = decoder->map + decoder->size;
+	decoder->index = NULL;
+	decoder->index_count = 0;
+
+	/* A recording that was cut short has no index, but the frames
+	 * up to that point can still be played back in order. */
+	if (decoder->version >= 2 &&
+	    decoder->size >= sizeof *header + sizeof *trailer) {
+		trailer = (void *) ((char *) decoder->end - sizeof *trailer);
+		offset = WCAP_OFFSET(trailer);
+		if (trailer->magic == WCAP_INDEX_MAGIC &&
+		    offset >= sizeof *header &&
+		    offset + trailer->count * sizeof *decoder->index +
+		    sizeof *trailer == decoder->size) {
+			decoder->index = (void *)
+				((char *) decoder->map + offset);
+			decoder->index_count = trailer->count;
+			decoder->end = (void *) decoder->index;
+		}
+	}
+
+	if (decoder->p != decoder->end)
+		decoder->start_msecs =
+			((struct wcap_frame_header *) decoder->p)->msecs;
+	else
+		decoder->start_msecs = 0;
 
 	frame_size = header->width * header->height * 4;
 	decoder->frame = malloc(frame_size);
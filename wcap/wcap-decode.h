@@ -24,6 +24,8 @@
 #define _WCAP_DECODE_
 
 #define WCAP_HEADER_MAGIC	0x57434150
+#define WCAP_HEADER_MAGIC_V2	0x57434132
+#define WCAP_INDEX_MAGIC	0x57494458
 
 #define WCAP_FORMAT_XRGB8888	0x34325258
 #define WCAP_FORMAT_XBGR8888	0x34324258
@@ -41,22 +43,48 @@ struct wcap_frame_header {
 	uint32_t nrects;
 };
 
+/* In version 2 files, keyframes set this bit in nrects. They cover
+ * the whole frame and are encoded against a frame of all zeroes. */
+#define WCAP_FRAME_KEY		0x80000000
+
 struct wcap_rectangle {
 	int32_t x1, y1, x2, y2;
 };
 
+/* Version 2 files end in an index of their keyframes, followed by a
+ * trailer giving its offset in the file. Like everything else in the
+ * file, these are 32 bit words, so 64 bit offsets are split in two. */
+struct wcap_index_entry {
+	uint32_t msecs;
+	uint32_t frame;
+	uint32_t offset_lo, offset_hi;
+};
+
+struct wcap_index_trailer {
+	uint32_t magic;
+	uint32_t count;
+	uint32_t offset_lo, offset_hi;
+};
+
+#define WCAP_OFFSET(s) ((uint64_t) (s)->offset_hi << 32 | (s)->offset_lo)
+
 struct wcap_decoder {
 	int fd;
 	size_t size;
 	void *map, *p, *end;
 	uint32_t *frame;
+	uint32_t version;
 	uint32_t format;
+	const struct wcap_index_entry *index;
+	uint32_t index_count;
+	uint32_t start_msecs;
 	uint32_t msecs;
 	uint32_t count;
 	int width, height;
 };
 
 int wcap_decoder_get_frame(struct wcap_decoder *decoder);
+int wcap_decoder_seek(struct wcap_decoder *decoder, uint32_t msecs);
 struct wcap_decoder *wcap_decoder_create(const char *filename);
 void wcap_decoder_destroy(struct wcap_decoder *decoder);
 
@@ -0,0 +1,366 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#include "wcap-decode.h"
+#include "wcap-yuv.h"
+
+static inline int
+rgb_to_yuv(uint32_t format, uint32_t p, int *u, int *v)
+{
+	int r, g, b, y;
+
+	switch (format) {
+	case WCAP_FORMAT_XRGB8888:
+		r = (p >> 16) & 0xff;
+		g = (p >> 8) & 0xff;
+		b = (p >> 0) & 0xff;
+		break;
+	case WCAP_FORMAT_XBGR8888:
+		r = (p >> 0) & 0xff;
+		g = (p >> 8) & 0xff;
+		b = (p >> 16) & 0xff;
+		break;
+	default:
+		assert(0);
+	}
+
+	y = (19595 * r + 38469 * g + 7472 * b) >> 16;
+	if (y > 255)
+		y = 255;
+
+	*u += 46727 * (r - y);
+	*v += 36962 * (b - y);
+
+	return y;
+}
+
+static inline
+int clamp_uv(int u)
+{
+	int clamp = (u >> 18) + 128;
+
+	if (clamp < 0)
+		return 0;
+	else if (clamp > 255)
+		return 255;
+	else
+		return clamp;
+}
+
+/* Converts 'n' pixels of two rows, each 2x2 block sharing one u and v
+ * sample. */
+static void
+yv12_span_scalar(const uint32_t *p1, const uint32_t *p2,
+		 unsigned char *y1, unsigned char *y2,
+		 unsigned char *u, unsigned char *v, int n, uint32_t format)
+{
+	int k, u_accum, v_accum;
+
+	for (k = 0; k < n; k += 2) {
+		u_accum = 0;
+		v_accum = 0;
+		y1[k] = rgb_to_yuv(format, p1[k], &u_accum, &v_accum);
+		y1[k + 1] = rgb_to_yuv(format, p1[k + 1], &u_accum, &v_accum);
+		y2[k] = rgb_to_yuv(format, p2[k], &u_accum, &v_accum);
+		y2[k + 1] = rgb_to_yuv(format, p2[k + 1], &u_accum, &v_accum);
+		u[k / 2] = clamp_uv(u_accum);
+		v[k / 2] = clamp_uv(v_accum);
+	}
+}
+
+/* The vector versions convert 8x2 pixels at a time. All intermediate
+ * values of rgb_to_yuv() fit in 24 bits, so with SSE2 they can be
+ * computed exactly in single precision floats; only the chroma sums of
+ * a block need 32 bit integers. NEON has the integer multiplies. */
+
+#if defined(__SSE2__)
+
+static inline __m128i
+rgb_to_yuv4(__m128i p, uint32_t format, __m128i *u, __m128i *v)
+{
+	const __m128i mask = _mm_set1_epi32(0xff);
+	__m128 r, g, b, y;
+	__m128i lo, hi, yi;
+
+	lo = _mm_and_si128(p, mask);
+	hi = _mm_and_si128(_mm_srli_epi32(p, 16), mask);
+	g = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(p, 8), mask));
+	if (format == WCAP_FORMAT_XRGB8888) {
+		r = _mm_cvtepi32_ps(hi);
+		b = _mm_cvtepi32_ps(lo);
+	} else {
+		r = _mm_cvtepi32_ps(lo);
+		b = _mm_cvtepi32_ps(hi);
+	}
+
+	y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r, _mm_set1_ps(19595.0f)),
+				  _mm_mul_ps(g, _mm_set1_ps(38469.0f))),
+		       _mm_mul_ps(b, _mm_set1_ps(7472.0f)));
+	yi = _mm_cvttps_epi32(_mm_mul_ps(y, _mm_set1_ps(1.0f / 65536.0f)));
+	y = _mm_cvtepi32_ps(yi);
+
+	*u = _mm_cvttps_epi32(_mm_mul_ps(_mm_sub_ps(r, y),
+					 _mm_set1_ps(46727.0f)));
+	*v = _mm_cvttps_epi32(_mm_mul_ps(_mm_sub_ps(b, y),
+					 _mm_set1_ps(36962.0f)));
+
+	return yi;
+}
+
+/* Adds up neighbouring pairs of a and b: a0 + a1, a2 + a3, b0 + b1,
+ * b2 + b3. */
+static inline __m128i
+pair_sum(__m128i a, __m128i b)
+{
+	__m128 fa = _mm_castsi128_ps(a), fb = _mm_castsi128_ps(b);
+
+	return _mm_add_epi32(
+		_mm_castps_si128(_mm_shuffle_ps(fa, fb, _MM_SHUFFLE(2, 0, 2, 0))),
+		_mm_castps_si128(_mm_shuffle_ps(fa, fb, _MM_SHUFFLE(3, 1, 3, 1))));
+}
+
+static inline void
+store_y8(unsigned char *y, __m128i a, __m128i b)
+{
+	a = _mm_packs_epi32(a, b);
+	_mm_storel_epi64((__m128i *) y, _mm_packus_epi16(a, a));
+}
+
+static inline void
+store_uv4(unsigned char *out, __m128i sum)
+{
+	uint32_t uv;
+
+	sum = _mm_add_epi32(_mm_srai_epi32(sum, 18), _mm_set1_epi32(128));
+	sum = _mm_packs_epi32(sum, sum);
+	uv = _mm_cvtsi128_si32(_mm_packus_epi16(sum, sum));
+	memcpy(out, &uv, sizeof uv);
+}
+
+static void
+yv12_span(const uint32_t *p1, const uint32_t *p2,
+	  unsigned char *y1, unsigned char *y2,
+	  unsigned char *u, unsigned char *v, int n, uint32_t format)
+{
+	__m128i ya, yb, ua, ub, va, vb, us, vs;
+	int k;
+
+	for (k = 0; k + 8 <= n; k += 8) {
+		ya = rgb_to_yuv4(_mm_loadu_si128((const __m128i *) &p1[k]),
+				 format, &ua, &va);
+		yb = rgb_to_yuv4(_mm_loadu_si128((const __m128i *) &p1[k + 4]),
+				 format, &ub, &vb);
+		store_y8(y1 + k, ya, yb);
+		us = pair_sum(ua, ub);
+		vs = pair_sum(va, vb);
+
+		ya = rgb_to_yuv4(_mm_loadu_si128((const __m128i *) &p2[k]),
+				 format, &ua, &va);
+		yb = rgb_to_yuv4(_mm_loadu_si128((const __m128i *) &p2[k + 4]),
+				 format, &ub, &vb);
+		store_y8(y2 + k, ya, yb);
+		us = _mm_add_epi32(us, pair_sum(ua, ub));
+		vs = _mm_add_epi32(vs, pair_sum(va, vb));
+
+		store_uv4(u + k / 2, us);
+		store_uv4(v + k / 2, vs);
+	}
+
+	yv12_span_scalar(p1 + k, p2 + k, y1 + k, y2 + k,
+			 u + k / 2, v + k / 2, n - k, format);
+}
+
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+static inline uint32x4_t
+rgb_to_yuv4(uint32x4_t p, uint32_t format, int32x4_t *u, int32x4_t *v)
+{
+	const uint32x4_t mask = vdupq_n_u32(0xff);
+	uint32x4_t r, g, b, y, lo, hi;
+
+	lo = vandq_u32(p, mask);
+	hi = vandq_u32(vshrq_n_u32(p, 16), mask);
+	g = vandq_u32(vshrq_n_u32(p, 8), mask);
+	if (format == WCAP_FORMAT_XRGB8888) {
+		r = hi;
+		b = lo;
+	} else {
+		r = lo;
+		b = hi;
+	}
+
+	y = vmulq_n_u32(r, 19595);
+	y = vmlaq_n_u32(y, g, 38469);
+	y = vmlaq_n_u32(y, b, 7472);
+	y = vshrq_n_u32(y, 16);
+
+	*u = vmulq_n_s32(vsubq_s32(vreinterpretq_s32_u32(r),
+				   vreinterpretq_s32_u32(y)), 46727);
+	*v = vmulq_n_s32(vsubq_s32(vreinterpretq_s32_u32(b),
+				   vreinterpretq_s32_u32(y)), 36962);
+
+	return y;
+}
+
+static inline int32x4_t
+pair_sum(int32x4_t a, int32x4_t b)
+{
+	return vcombine_s32(vpadd_s32(vget_low_s32(a), vget_high_s32(a)),
+			    vpadd_s32(vget_low_s32(b), vget_high_s32(b)));
+}
+
+static inline void
+store_y8(unsigned char *y, uint32x4_t a, uint32x4_t b)
+{
+	vst1_u8(y, vmovn_u16(vcombine_u16(vmovn_u32(a), vmovn_u32(b))));
+}
+
+static inline void
+store_uv4(unsigned char *out, int32x4_t sum)
+{
+	int16x4_t s;
+	uint8x8_t uv;
+
+	sum = vaddq_s32(vshrq_n_s32(sum, 18), vdupq_n_s32(128));
+	s = vqmovn_s32(sum);
+	uv = vqmovun_s16(vcombine_s16(s, s));
+	vst1_lane_u32((uint32_t *) out, vreinterpret_u32_u8(uv), 0);
+}
+
+static void
+yv12_span(const uint32_t *p1, const uint32_t *p2,
+	  unsigned char *y1, unsigned char *y2,
+	  unsigned char *u, unsigned char *v, int n, uint32_t format)
+{
+	uint32x4_t ya, yb;
+	int32x4_t ua, ub, va, vb, us, vs;
+	int k;
+
+	for (k = 0; k + 8 <= n; k += 8) {
+		ya = rgb_to_yuv4(vld1q_u32(&p1[k]), format, &ua, &va);
+		yb = rgb_to_yuv4(vld1q_u32(&p1[k + 4]), format, &ub, &vb);
+		store_y8(y1 + k, ya, yb);
+		us = pair_sum(ua, ub);
+		vs = pair_sum(va, vb);
+
+		ya = rgb_to_yuv4(vld1q_u32(&p2[k]), format, &ua, &va);
+		yb = rgb_to_yuv4(vld1q_u32(&p2[k + 4]), format, &ub, &vb);
+		store_y8(y2 + k, ya, yb);
+		us = vaddq_s32(us, pair_sum(ua, ub));
+		vs = vaddq_s32(vs, pair_sum(va, vb));
+
+		store_uv4(u + k / 2, us);
+		store_uv4(v + k / 2, vs);
+	}
+
+	yv12_span_scalar(p1 + k, p2 + k, y1 + k, y2 + k,
+			 u + k / 2, v + k / 2, n - k, format);
+}
+
+#else
+
+#define yv12_span yv12_span_scalar
+
+#endif
+
+typedef void (*yv12_span_func_t)(const uint32_t *p1, const uint32_t *p2,
+				 unsigned char *y1, unsigned char *y2,
+				 unsigned char *u, unsigned char *v,
+				 int n, uint32_t format);
+
+static inline void
+convert_to_yv12(const uint32_t *frame, int width, int height,
+		uint32_t format, unsigned char *out, yv12_span_func_t span)
+{
+	unsigned char *y1, *u, *v;
+	const uint32_t *p1;
+	int i, stride0, stride1;
+
+	stride0 = width;
+	stride1 = width / 2;
+	for (i = 0; i < height; i += 2) {
+		y1 = out + stride0 * i;
+		v = out + stride0 * height + stride1 * i / 2;
+		u = v + stride1 * height / 2;
+		p1 = frame + width * i;
+
+		span(p1, p1 + width, y1, y1 + stride0, u, v, width, format);
+	}
+}
+
+void
+wcap_convert_to_yv12(const uint32_t *frame, int width, int height,
+		     uint32_t format, unsigned char *out)
+{
+	if (format == WCAP_FORMAT_XRGB8888 || format == WCAP_FORMAT_XBGR8888)
+		convert_to_yv12(frame, width, height, format, out, yv12_span);
+	else
+		wcap_convert_to_yv12_scalar(frame, width, height, format, out);
+}
+
+void
+wcap_convert_to_yv12_scalar(const uint32_t *frame, int width, int height,
+			    uint32_t format, unsigned char *out)
+{
+	convert_to_yv12(frame, width, height, format, out, yv12_span_scalar);
+}
+
+void
+wcap_convert_to_yuv444(const uint32_t *frame, int width, int height,
+		       uint32_t format, unsigned char *out)
+{
+	unsigned char *yp, *up, *vp;
+	const uint32_t *rp, *end;
+	int u, v;
+	int i, stride, psize;
+
+	stride = width;
+	psize = stride * height;
+	for (i = 0; i < height; i++) {
+		yp = out + stride * i;
+		up = yp + (psize * 2);
+		vp = yp + (psize * 1);
+		rp = frame + width * i;
+		end = rp + width;
+		while (rp < end) {
+			u = 0;
+			v = 0;
+			yp[0] = rgb_to_yuv(format, rp[0], &u, &v);
+			up[0] = clamp_uv(u/.3);
+			vp[0] = clamp_uv(v/.3);
+			up++;
+			vp++;
+			yp++;
+			rp++;
+		}
+	}
+}